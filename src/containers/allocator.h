@@ -19,7 +19,7 @@ namespace octet {
   class allocator {
     // singleton state, a bit like an old-world global variable
     struct state_t {
-      int num_bytes;
+      volatile int num_bytes;
     };
 
     static state_t &state() {
@@ -27,23 +27,33 @@ namespace octet {
       return instance;
     }
 
+    // worker threads allocate too, so the count is updated atomically.
+    // (this comes before threads.h, so we can't use octet::atomic)
+    static int add_bytes(int delta) {
+      #ifdef WIN32
+        return (int)_InterlockedExchangeAdd((volatile long*)&state().num_bytes, delta) + delta;
+      #else
+        return __sync_add_and_fetch(&state().num_bytes, delta);
+      #endif
+    }
+
   public:
     // todo: implement this from scratch using a pool allocator
     static void *malloc(size_t size) {
-      state().num_bytes += size;
+      add_bytes((int)size);
       void *res = ::malloc(size);
       //printf("malloc %p[%d] -> %d\n", res, size, state().num_bytes);
       return res;
     }
 
     static void free(void *ptr, size_t size) {
-      state().num_bytes -= size;
+      add_bytes(-(int)size);
       //printf("free %p[%d] -> %d\n", ptr, size, state().num_bytes);
       return ::free(ptr);
     }
 
     static void *realloc(void *ptr, size_t old_size, size_t size) {
-      state().num_bytes += size - old_size;
+      add_bytes((int)( size - old_size ));
       void *res = ::realloc(ptr, size);
       //printf("realloc %p[%d] -> %p[%d] %d\n", ptr, old_size, res, size, state().num_bytes);
       return res;
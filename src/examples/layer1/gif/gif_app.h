@@ -13,6 +13,7 @@
 //   Shaders
 //   Basic Matrices
 //   Texture loaded from GIF file
+//   Playing a GIF animation
 //
 
 namespace octet {
@@ -31,10 +32,86 @@ namespace octet {
     // handle for the texture
     GLuint texture_handle_;
 
+    // the gif file stays in memory while we play it
+    dynarray<uint8_t> gif_file;
+    gif_decoder gif;
+
+    // the frame on the texture and when to show the next one (in 1/100ths of a second)
+    unsigned cur_frame;
+    int next_frame_time;
+
+    // times we have played the whole animation
+    unsigned num_loops;
+    dynarray<uint8_t> frame_pixels;
+
+    // the app runs at 60 frames a second, gifs count in 100ths.
+    int get_time() {
+      return get_frame_number() * 100 / 60;
+    }
+
+    // make a texture for the animation with the first frame on it.
+    void init_animation(const char *url) {
+      app_utils::get_url(gif_file, url);
+      cur_frame = 0;
+      next_frame_time = 0;
+      num_loops = 0;
+      if (gif_file.size() == 0 || !gif.open(&gif_file[0], &gif_file[0] + gif_file.size())) {
+        return;
+      }
+      gif.get_frame(frame_pixels, 0);
+
+      glGenTextures(1, &texture_handle_);
+      glBindTexture(GL_TEXTURE_2D, texture_handle_);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, gif.get_width(), gif.get_height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, &frame_pixels[0]);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glBindTexture(GL_TEXTURE_2D, 0);
+
+      next_frame_time = get_time() + gif.get_delay(0);
+    }
+
+    // move on to the next frame when it is time, skipping frames if we are late.
+    // stop on the last frame after gif.get_loop_count() plays (0 plays forever).
+    void update_animation() {
+      unsigned num_frames = gif.get_num_frames();
+      if (num_frames <= 1) return;
+
+      int time = get_time();
+      unsigned frame = cur_frame;
+      for (unsigned i = 0; i != num_frames && time >= next_frame_time; ++i) {
+        if (frame + 1 != num_frames) {
+          frame++;
+        } else {
+          unsigned loop_count = gif.get_loop_count();
+          if (loop_count != 0 && num_loops + 1 >= loop_count) break;
+          num_loops++;
+          frame = 0;
+        }
+        // browsers treat very short delays as 1/10th of a second
+        unsigned delay = gif.get_delay(frame);
+        next_frame_time += delay < 2 ? 10 : delay;
+      }
+      if (time >= next_frame_time) {
+        next_frame_time = time;
+      }
+
+      if (frame != cur_frame && gif.get_frame(frame_pixels, frame)) {
+        cur_frame = frame;
+        glBindTexture(GL_TEXTURE_2D, texture_handle_);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, gif.get_width(), gif.get_height(), GL_RGBA, GL_UNSIGNED_BYTE, &frame_pixels[0]);
+      }
+    }
+
   public:
 
     // this is called when we construct the class
     gif_app(int argc, char **argv) : app(argc, argv) {
+      texture_handle_ = 0;
+      cur_frame = 0;
+      next_frame_time = 0;
+      num_loops = 0;
     }
 
     // this is called once OpenGL is initialized
@@ -47,8 +124,8 @@ namespace octet {
       cameraToWorld.loadIdentity();
       cameraToWorld.translate(0, 0, 3);
 
-      // use helper function to generate an OpenGL texture
-      texture_handle_ = resources::get_texture_handle(GL_RGBA, "assets/stars.gif");
+      // decode the gif ourselves so that we can play animated gifs
+      init_animation("assets/stars.gif");
     }
 
     // this is called to draw the world
@@ -76,6 +153,7 @@ namespace octet {
 
       // set up opengl to draw textured triangles using sampler 0 (GL_TEXTURE0)
       glActiveTexture(GL_TEXTURE0);
+      update_animation();
       glBindTexture(GL_TEXTURE_2D, texture_handle_);
       texture_shader_.render(modelToProjection, 0);
 
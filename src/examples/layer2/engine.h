@@ -55,6 +55,10 @@ namespace octet {
         dict.visit(r);
         fclose(file);
         app_scene = dict.get_active_scene();
+      } else if (file && scene_cache::get().load(dict, filename)) {
+        // compiled on an earlier run
+        fclose(file);
+        app_scene = dict.get_active_scene();
       } else {
         if (file) fclose(file);
         collada_builder builder;
@@ -71,24 +75,48 @@ namespace octet {
         app_scene->create_default_camera_and_lights();
 
         dict.set_active_scene(app_scene);
+
+        // save the scene before we add anything that only lives for this run.
+        scene_cache::get().store(dict, filename);
       }
 
       app_scene->play_all_anims(dict);
 
+      // levels of detail for each mesh, built on worker threads.
+      dynarray<simplifier*> simplifiers;
       for (unsigned i = 0; i != app_scene->get_num_mesh_instances(); ++i) {
         mesh_instance *mi = app_scene->get_mesh_instance(i);
         //mi->set_mesh(new wireframe(new displacement_map(mi->get_mesh())));
         //mi->set_mesh(new smooth(mi->get_mesh()));
         //mi->set_mesh(mi->get_mesh());
-        mi->set_mesh(new indexer(mi->get_mesh()));
+        simplifier *s = new simplifier(new cache_optimizer(new indexer(mi->get_mesh())), false);
+        mi->set_mesh(s);
+        simplifiers.push_back(s);
+      }
+      if (simplifiers.size()) {
+        simplifier::update_all(&simplifiers[0], simplifiers.size());
       }
 
+      // smaller vertices and indices.
+      unsigned bytes_before = 0, bytes_after = 0;
+      for (int i = 0; i != app_scene->get_num_mesh_instances(); ++i) {
+        mesh_instance *mi = app_scene->get_mesh_instance(i);
+        quantizer *q = new quantizer(mi->get_mesh());
+        mi->set_mesh(q);
+        bytes_before += q->get_bytes_before();
+        bytes_after += q->get_bytes_after();
+      }
+      OCTET_LOG_INFO("quantizer: scene %d bytes -> %d bytes, %d saved\n", bytes_before, bytes_after, bytes_before - bytes_after);
+
       if (app_scene->get_num_camera_instances() != 0) {
         camera_instance *cam = app_scene->get_camera_instance(0);
         scene_node *node = cam->get_node();
         mat4t cameraToWorld = node->get_nodeToParent();
         ball.init(this, cameraToWorld.w().length(), 360.0f);
       }
+
+      image_cache::get().log_stats();
+      scene_cache::get().log_stats();
     }
   public:
     // this is called when we construct the class
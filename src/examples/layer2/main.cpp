@@ -19,6 +19,21 @@
 int main(int argc, char **argv) {
   //octet::unit_test_ray();
 
+  // convert textures to KTX offline, eg. layer2 --ktx duck.gif duck.ktx
+  // --ktx-dxt makes DXT1 or DXT5 files.
+  bool ktx_dxt = argc >= 2 && !strcmp(argv[1], "--ktx-dxt");
+  if (argc >= 4 && (ktx_dxt || !strcmp(argv[1], "--ktx"))) {
+    octet::app_utils::prefix("");
+    octet::image_cache::get().set_enabled(false);
+    if (ktx_dxt) octet::image::set_compression(octet::image::compress_high_quality);
+    for (int i = 2; i + 1 < argc; i += 2) {
+      octet::ref<octet::image> img;
+      img = new octet::image(argv[i]);
+      printf("%s -> %s: %s\n", argv[i], argv[i+1], img->save_ktx(argv[i+1]) ? "ok" : "failed");
+    }
+    return 0;
+  }
+
   octet::app_utils::prefix("../../");
   octet::app::init_all(argc, argv);
   octet::engine app(argc, argv);
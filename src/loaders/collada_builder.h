@@ -6,7 +6,14 @@
 //
 // load a COLLADA file.
 //
-// This class uses "tiny xml" a handy little XML reader
+// The file is mapped and read with xml_tokenizer into a flat table of elements.
+// Names, attributes and short text are copied into one string pool. The big
+// arrays (<float_array>, <p>, <vcount> and <v>) are parsed straight from the file
+// into typed pools, so we never hold the text of the file in memory.
+//
+// Each mesh of each geometry and controller is built on a worker thread (see
+// build_meshes) and then added to the resources in document order, so you get
+// the same resources whatever the number of threads.
 //
 // Do not read this until you have a good understanding of C++ coding, it will melt your mind.
 // It is, however, one of the smallest COLLADA readers in the Universe of its kind.
@@ -22,49 +29,246 @@ namespace octet {
   public:
 
   private:
-    TiXmlDocument doc;
+    enum { no_text = ~0u };
+
+    // one XML element. links are indices into elements, 0 for none.
+    struct element {
+      unsigned name;          // offset in strings
+      unsigned first_attr;    // index in attrs
+      unsigned num_attrs;
+      unsigned text;          // offset in strings or no_text
+      unsigned first_child;
+      unsigned last_child;
+      unsigned next_sibling;
+      const char *payload;    // text of number arrays in the file (while loading)
+      unsigned payload_size;
+      unsigned values;        // offset in floats or ints
+      unsigned num_values;
+      void *user_data;        // scene_node of a <node>
+    };
+
+    struct attribute {
+      unsigned name;
+      unsigned value;
+    };
+
     string doc_path;
-    dictionary<TiXmlElement *, allocator> ids;
+
+    // element 0 is the document, its child is <COLLADA>
+    dynarray<element> elements;
+    dynarray<attribute> attrs;
+    dynarray<char> strings;
+    dynarray<float> floats;
+    dynarray<int> ints;
+
+    // element index of every id
+    dictionary<unsigned> ids;
+
     dynarray<float> temp_floats;
 
-    // find all the ids in an xml file
-    void find_ids(TiXmlElement *parent) {
-      for (TiXmlElement *elem = parent->FirstChildElement(); elem; elem = elem->NextSiblingElement()) {
-        const char *attrib = elem->Attribute("id");
-        if (attrib) {
-          //printf("%s %s\n", elem->Value(), attrib);
-          ids[attrib] = elem;
+    element *get_element(unsigned index) {
+      return index ? &elements[index] : NULL;
+    }
+
+    // the <COLLADA> element
+    element *root() {
+      return elements.size() ? get_element(elements[0].first_child) : NULL;
+    }
+
+    // numbers in these elements are parsed straight into floats and ints
+    static bool is_float_array(const char *name) {
+      return !strcmp(name, "float_array");
+    }
+
+    static bool is_int_array(const char *name) {
+      return !strcmp(name, "p") || !strcmp(name, "vcount") || !strcmp(name, "v");
+    }
+
+    unsigned add_string(const char *src, unsigned size, bool decode) {
+      unsigned offset = strings.size();
+      if (decode) {
+        xml_tokenizer::decode(strings, src, size, false, true);
+      } else {
+        strings.resize(offset + size + 1);
+        memcpy(&strings[offset], src, size);
+        strings[offset + size] = 0;
+      }
+      return offset;
+    }
+
+    // read the whole file into the element table
+    bool parse(const char *src, const char *src_max) {
+      elements.reset();
+      attrs.reset();
+      strings.reset();
+      floats.reset();
+      ints.reset();
+      ids.reset();
+
+      elements.resize(1);
+      memset(&elements[0], 0, sizeof(element));
+      elements[0].text = no_text;
+
+      dynarray<unsigned> stack;
+      stack.reserve(64);
+      stack.push_back(0);
+
+      xml_tokenizer tok;
+      tok.init(src, src_max);
+      for (;;) {
+        xml_tokenizer::token_t token = tok.next();
+        if (token == xml_tokenizer::token_eof) {
+          break;
+        } else if (token == xml_tokenizer::token_error) {
+          printf("warning: %s at line %d\n", tok.get_error(), tok.get_line());
+          return false;
+        } else if (token == xml_tokenizer::token_start) {
+          unsigned index = elements.size();
+          elements.resize(index + 1);
+          element &e = elements[index];
+          memset(&e, 0, sizeof(e));
+          e.text = no_text;
+
+          unsigned size;
+          const char *name = tok.get_name(size);
+          e.name = add_string(name, size, false);
+          e.first_attr = attrs.size();
+          e.num_attrs = tok.get_num_attributes();
+          for (unsigned i = 0; i != e.num_attrs; ++i) {
+            const xml_tokenizer::attribute &a = tok.get_attribute(i);
+            attribute attr;
+            attr.name = add_string(a.name, a.name_size, false);
+            attr.value = add_string(a.value, a.value_size, true);
+            attrs.push_back(attr);
+            if (!strcmp(&strings[attr.name], "id")) {
+              ids[&strings[attr.value]] = index;
+            }
+          }
+
+          element &parent = elements[stack.back()];
+          if (parent.last_child) {
+            elements[parent.last_child].next_sibling = index;
+          } else {
+            parent.first_child = index;
+          }
+          parent.last_child = index;
+          stack.push_back(index);
+        } else if (token == xml_tokenizer::token_end) {
+          stack.pop_back();
+        } else if (token == xml_tokenizer::token_text) {
+          // like TinyXML, only the first piece of text counts
+          element &e = elements[stack.back()];
+          if (e.text != no_text || e.payload || e.first_child) continue;
+
+          unsigned size;
+          const char *text = tok.get_text(size);
+          const char *name = &strings[e.name];
+          if (is_float_array(name) || is_int_array(name)) {
+            e.payload = text;
+            e.payload_size = size;
+          } else {
+            e.text = strings.size();
+            xml_tokenizer::decode(strings, text, size, !tok.is_cdata(), !tok.is_cdata());
+          }
+        }
+      }
+
+      // float_array has a count attribute, so the float pool is only allocated once.
+      // <p> and friends don't, and counting them costs more than growing the pool.
+      unsigned total_floats = 0;
+      for (unsigned i = 1; i != elements.size(); ++i) {
+        element &e = elements[i];
+        if (!e.payload) continue;
+        e.num_values = 0;
+        if (is_float_array(&strings[e.name])) {
+          const char *count = attr(&e, "count");
+          e.num_values = count ? (unsigned)atoi(count) : 0;
+          total_floats += e.num_values;
         }
-        find_ids(elem);
       }
+      // a bad count attribute could ask for anything. every number needs at least two bytes.
+      unsigned limit = (unsigned)( ( src_max - src ) / 2 );
+      if (total_floats <= limit && total_floats > floats.capacity()) floats.reserve(total_floats);
+
+      // convert the number arrays
+      for (unsigned i = 1; i != elements.size(); ++i) {
+        element &e = elements[i];
+        if (!e.payload) continue;
+        if (is_float_array(&strings[e.name])) {
+          e.values = floats.size();
+          atofv(floats, e.payload, e.payload + e.payload_size, e.num_values);
+          e.num_values = floats.size() - e.values;
+        } else {
+          e.values = ints.size();
+          atoiv(ints, e.payload, e.payload + e.payload_size, e.num_values);
+          e.num_values = ints.size() - e.values;
+        }
+        e.payload = 0;
+      }
+      return true;
     }
 
-    TiXmlElement *find_id(const char *source) {
+    element *find_id(const char *source) {
       if (source) {
         if (source[0] == '#') source++;
-        return ids[source];
+        int index = ids.get_index(source);
+        return index >= 0 ? get_element(ids.get_value(index)) : NULL;
       }
       return 0;
     }
 
-    TiXmlElement *child(TiXmlElement *parent, const char *value) {
-      return parent ? parent->FirstChildElement(value) : NULL;
+    // first child element, with a name if you give one
+    element *child(element *parent, const char *value = NULL) {
+      element *e = parent ? get_element(parent->first_child) : NULL;
+      while (e && value && strcmp(&strings[e->name], value)) {
+        e = get_element(e->next_sibling);
+      }
+      return e;
+    }
+
+    // next sibling element, with a name if you give one
+    element *sibling(element *e, const char *value = NULL) {
+      e = e ? get_element(e->next_sibling) : NULL;
+      while (e && value && strcmp(&strings[e->name], value)) {
+        e = get_element(e->next_sibling);
+      }
+      return e;
+    }
+
+    const char *attr(element *parent, const char *value) {
+      if (!parent) return NULL;
+      for (unsigned i = 0; i != parent->num_attrs; ++i) {
+        const attribute &a = attrs[parent->first_attr + i];
+        if (!strcmp(&strings[a.name], value)) return &strings[a.value];
+      }
+      return NULL;
+    }
+
+    const char *text(element *parent) {
+      return parent && parent->text != no_text ? &strings[parent->text] : NULL;
     }
 
-    TiXmlElement *sibling(TiXmlElement *element, const char *value) {
-      return element ? element->NextSiblingElement(value) : NULL;
+    const char *value(element *parent) {
+      return parent ? &strings[parent->name] : NULL;
     }
 
-    const char *attr(TiXmlElement *parent, const char *value) {
-      return parent ? parent->Attribute(value) : NULL;
+    // the numbers in a <float_array>
+    const float *get_floats(element *array, unsigned &size) {
+      size = array && is_float_array(&strings[array->name]) ? array->num_values : 0;
+      return size ? &floats[array->values] : NULL;
     }
 
-    const char *text(TiXmlElement *parent) {
-      return parent ? parent->GetText() : NULL;
+    void get_floats(dynarray<float> &values, element *array) {
+      unsigned size;
+      const float *src = get_floats(array, size);
+      values.resize(size);
+      if (size) memcpy(&values[0], src, size * sizeof(float));
     }
 
-    const char *value(TiXmlElement *parent) {
-      return parent ? parent->Value() : NULL;
+    // the numbers in a <p>, <vcount> or <v>
+    const int *get_ints(element *array, unsigned &size) {
+      size = array && is_int_array(&strings[array->name]) ? array->num_values : 0;
+      return size ? &ints[array->values] : NULL;
     }
 
     int semantic_to_attr(const char *semantic, const char *set) {
@@ -95,50 +299,31 @@ namespace octet {
       return 8;
     }
 
+    // add the floats in a string like "1.2 3.4 43.12" to an array.
+    // *src_max must not be part of a number (a zero or the '<' of the next tag).
+    // count is the number of floats we expect, if we know it.
+    static void atofv(dynarray<float> &values, const char *src, const char *src_max, unsigned count = 0) {
+      number_parser::parse_floats(values, src, src_max, count);
+    }
+
     // convert a string like "1.2 3.4 43.12" into an array of float values
-    void atofv(dynarray<float> &values, const char *src) {  
+    static void atofv(dynarray<float> &values, const char *src) {
       values.resize(0);
       if (!src) return;
+      atofv(values, src, src + strlen(src));
+    }
 
-      while (*src > 0 && *src <= ' ') ++src;
-      while(*src != 0) {
-        double whole = 0, msign = 1;
-        if (*src == '-') { msign = -1; src++; }
-        if( !(*src >= '0' && *src <= '9') && *src != '.' ) break;
-        while (*src >= '0' && *src <= '9') whole = whole * 10 + (*src++ - '0');
-        if (*src == '.') {
-          src++;
-          double frac = 0, v = 1;
-          while (*src >= '0' && *src <= '9') { frac = frac * 10 + (*src++ - '0'); v *= 10; }
-          whole += frac / v;
-        }
-        if (*src == 'e' || *src == 'E') {
-          int esign = 1;
-          src++;
-          if (*src == '-') { esign = -1; src++; }
-          else if (*src == '+') src++;
-          int exp = 0;
-          while (*src >= '0' && *src <= '9') { exp = exp * 10 + (*src++ - '0'); }
-          whole = whole * pow(10.0, exp * esign);
-        }
-        values.push_back((float)(whole * msign));
-        while (*src > 0 && *src <= ' ') ++src;
-      }
+    // add the integers in a string like "1 3 9 12 34" to an array.
+    // *src_max must not be part of a number (a zero or the '<' of the next tag).
+    static void atoiv(dynarray<int> &values, const char *src, const char *src_max, unsigned count = 0) {
+      number_parser::parse_ints(values, src, src_max, count);
     }
 
     // convert an ascii sequence of integers like "1 3 9 12 34" to an array of integers
-    void atoiv(dynarray<int> &values, const char *src) {  
+    static void atoiv(dynarray<int> &values, const char *src) {
       values.resize(0);
       if (!src) return;
-
-      while (*src > 0 && *src <= ' ') ++src;
-      while(*src != 0) {
-        int whole = 0, msign = 1;
-        if (*src == '-') { msign = -1; src++; }
-        while (*src >= '0' && *src <= '9') whole = whole * 10 + (*src++ - '0');
-        values.push_back(whole * msign);
-        while (*src > 0 && *src <= ' ') ++src;
-      }
+      atoiv(values, src, src + strlen(src));
     }
 
     // convert an ascii sequence of integers like "fred bert harry" into an array of strings
@@ -165,23 +350,33 @@ namespace octet {
     // structure used when building a skin
     struct skin_state {
       // collada-style skin state
-      dynarray<int> vcount;              // from skin vcount
+      const int *vcount;                 // from skin vcount
+      unsigned num_vcount;
       dynarray<float> raw_weights;       // from WEIGHT semantic - one per vertex
       dynarray<int> raw_indices;         // from JOINT semantic - one per vertex - must match INV_BIND_MATRIX
       dynarray<float> inv_bind_matrices; // from INV_BIND_MATRIX semantic
       dynarray<float> bind_shape_matrix; // from BIND_SHAPE_MATRIX element
       string joints;                     // from JOINT semantic - sids of affected nodes
 
+      // reported after the worker threads are done
+      dynarray<const char *> warnings;
+
       // OpenGL-style skin state
       enum { max_indices = 4 };
       dynarray<float> gl_weights;
       dynarray<int> gl_indices;
+
+      skin_state() {
+        vcount = 0;
+        num_vcount = 0;
+      }
     };
 
     // a structure to keep track of the complex COLLADA <input> tags
     struct parse_input_state {
       mesh *s;
-      dynarray<int> p;
+      const int *p;                      // from <p> or <v>
+      unsigned p_size;
       dynarray<float> vertices;
       dynarray<unsigned> indices;
       unsigned attr_offset;
@@ -192,74 +387,119 @@ namespace octet {
       unsigned vertex_input_offset;
       int pass;
       skin_state *skinst;
+
+      // reported after the worker threads are done, in document order
+      dynarray<const char *> warnings;
+    };
+
+    // one trilist or polylist to build. the vertices are built on worker threads and
+    // the mesh is added to the resources afterwards, in document order.
+    struct mesh_task {
+      enum result_t { no_p, bad_stride, ok };
+
+      mesh *msh;
+      const char *id;
+      element *mesh_child;
+      skin_state *skinst;
+      parse_input_state state;
+      unsigned num_vertices;
+      unsigned num_indices;
+      result_t result;
+
+      mesh_task(mesh *msh_, const char *id_, element *mesh_child_, skin_state *skinst_) {
+        msh = msh_;
+        id = id_;
+        mesh_child = mesh_child_;
+        skinst = skinst_;
+        num_vertices = num_indices = 0;
+        result = no_p;
+      }
     };
 
+    // the skin of a controller, built on a worker thread before its meshes.
+    struct skin_task {
+      element *controller;
+      element *vertex_weights;
+      skin_state *skinst;
+    };
+
+    // below this many indices in all the meshes, threads cost more than they save.
+    enum { min_thread_indices = 16384 };
+
+    // threads to use for building meshes. 0 is one per cpu.
+    unsigned num_threads;
+
+    // work queued by add_geometry and add_controllers for build_meshes
+    dynarray<mesh_task*> mesh_tasks;
+    dynarray<skin_task> skin_tasks;
+    dynarray<skin_state*> skin_states;
+
     // parse and <input> tag
-    void parse_input(parse_input_state &state, TiXmlElement *input) {
-      const char *source = input->Attribute("source");
-      const char *semantic = input->Attribute("semantic");
-      const char *set = input->Attribute("set");
+    void parse_input(parse_input_state &state, element *input) {
+      const char *source = attr(input, "source");
+      const char *semantic = attr(input, "semantic");
+      const char *set = attr(input, "set");
 
       if (!source || !semantic) {
-        printf("warning: bad input\n");
+        state.warnings.push_back("bad input");
         return;
       }
 
-      TiXmlElement *source_elem = source ? find_id(source) : 0;
+      element *source_elem = source ? find_id(source) : 0;
       if (!source_elem) {
-        printf("warning: source not found\n");
+        state.warnings.push_back("source not found");
         return;
       }
 
-      TiXmlElement *input2 = child(source_elem, "input");
+      element *input2 = child(source_elem, "input");
       if (input2) {
         // recursive <input> tag:; includes other inputs
-        for (;input2 != 0; input2 = input2->NextSiblingElement("input")) {
+        for (;input2 != 0; input2 = sibling(input2, "input")) {
           parse_input(state, input2);
         }
         return;
       }
 
-      if (strcmp(source_elem->Value(), "source")) {
-        printf("warning: source not found\n");
+      if (strcmp(value(source_elem), "source")) {
+        state.warnings.push_back("source not found");
         return;
       }
 
-      TiXmlElement *tc = child(source_elem, "technique_common");
+      element *tc = child(source_elem, "technique_common");
       if (!tc) {
-        printf("warning: no technique_common\n");
+        state.warnings.push_back("no technique_common");
         return;
       }
 
-      TiXmlElement *accessor = child(tc, "accessor");
+      element *accessor = child(tc, "accessor");
       if (!accessor) {
-        printf("warning: no accessor\n");
+        state.warnings.push_back("no accessor");
         return;
       }
 
-      const char *accessor_source = accessor->Attribute("source");
-      const char *accessor_offset = accessor->Attribute("offset");
-      const char *accessor_stride = accessor->Attribute("stride");
+      const char *accessor_source = attr(accessor, "source");
+      const char *accessor_offset = attr(accessor, "offset");
+      const char *accessor_stride = attr(accessor, "stride");
       int accessor_offset_int = accessor_offset ? atoi(accessor_offset) : 0;
       int accessor_stride_int = accessor_stride ? atoi(accessor_stride) : 0;
-      TiXmlElement *accessor_source_elem = accessor_source ? find_id(accessor_source) : 0;
+      element *accessor_source_elem = accessor_source ? find_id(accessor_source) : 0;
 
       if (!accessor_source_elem || accessor_stride_int == 0) {
-        printf("warning: bad or no accessor source\n");
+        state.warnings.push_back("bad or no accessor source");
         return;
       }
 
       unsigned size = 0;
       const char *param_type = 0;
       for (
-        TiXmlElement *param = child(accessor, "param");
+        element *param = child(accessor, "param");
         param != 0;
-        param = param->NextSiblingElement("param")
+        param = sibling(param, "param")
       ) {
-        const char *param_name = param->Attribute("name");
+        const char *param_name = attr(param, "name");
 
         if (param_name) {
-          param_type = param->Attribute("type");
+          param_type = attr(param, "type");
           size++;
         } else {
           accessor_offset_int++;
@@ -267,7 +507,7 @@ namespace octet {
       }
 
       if (!param_type) {
-        printf("warning: no param type\n");
+        state.warnings.push_back("no param type");
         return;
       }
 
@@ -279,12 +519,11 @@ namespace octet {
       } else if (!strcmp(param_type, "name")) {
         type = 3;
       } else {
-        printf("warning: unsupported type\n");
+        state.warnings.push_back("unsupported type");
         return;
       }
 
-      unsigned p_size = state.p.size();
-      unsigned num_vertices = p_size / state.input_stride;
+      unsigned num_vertices = state.p_size / state.input_stride;
 
       if (state.pass == 1) {
         // attribute metrics pass
@@ -292,10 +531,8 @@ namespace octet {
         state.s->add_attribute(attr, size, GL_FLOAT, state.attr_offset * 4);
         state.attr_offset += size;
       } else if (state.pass == 2) {
-        dynarray<float> accessor_floats;
-        if (!strcmp(accessor_source_elem->Value(), "float_array")) {
-          atofv(accessor_floats, accessor_source_elem->GetText());
-        }
+        unsigned num_floats;
+        const float *accessor_floats = get_floats(accessor_source_elem, num_floats);
 
         // attribute building pass
         for (unsigned i = 0; i != num_vertices; ++i) {
@@ -306,13 +543,13 @@ namespace octet {
             unsigned dest_idx = i * state.attr_stride + state.attr_offset + j;
             unsigned src_idx = accessor_offset_int + index * accessor_stride_int + j;
             if (dest_idx >= state.vertices.size()) {
-              printf("dest_idx >= state.vertices.size()\n");
+              state.warnings.push_back("dest_idx >= state.vertices.size()");
               return;
             }
 
             if (type == 1) {
-              if (src_idx >= accessor_floats.size()) {
-                printf("src_idx >= accessor_floats.size()\n");
+              if (src_idx >= num_floats) {
+                state.warnings.push_back("src_idx >= num_floats");
                 return;
               }
               state.vertices[dest_idx] = accessor_floats[src_idx];
@@ -332,41 +569,41 @@ namespace octet {
             state.skinst->raw_indices[i] = src_idx;
           }
         } else if (!strcmp(semantic, "WEIGHT")) {
-          dynarray<float> accessor_floats;
-          atofv(accessor_floats, accessor_source_elem->GetText());
+          unsigned num_floats;
+          const float *accessor_floats = get_floats(accessor_source_elem, num_floats);
           assert(state.skinst->raw_weights.size() >= num_vertices);
           for (unsigned i = 0; i != num_vertices; ++i) {
             unsigned index = state.p[i * state.input_stride + state.input_offset];
             unsigned src_idx = accessor_offset_int + index * accessor_stride_int;
-            state.skinst->raw_weights[i] = accessor_floats[src_idx];
+            state.skinst->raw_weights[i] = src_idx < num_floats ? accessor_floats[src_idx] : 0;
           }
         }
       }
     }
 
     // effects use "newparam" tags to store samplers and textures
-    TiXmlElement *find_param(TiXmlElement *profile_COMMON, const char *sid, const char *child_name) {
+    element *find_param(element *profile_COMMON, const char *sid, const char *child_name) {
       if (!sid) return NULL;
 
       for (
-        TiXmlElement *new_param = child(profile_COMMON, "newparam");
-        new_param; new_param = new_param->NextSiblingElement("newparam")
+        element *new_param = child(profile_COMMON, "newparam");
+        new_param; new_param = sibling(new_param, "newparam")
       ) {
-        const char *sid_param = new_param->Attribute("sid");
+        const char *sid_param = attr(new_param, "sid");
         if (sid_param && !strcmp(sid_param, sid)) {
-          return new_param->FirstChildElement(child_name);
+          return child(new_param, child_name);
         }
       }
       return NULL;
     }
 
     // get a texture or a solid colour
-    param *get_param(resources &dict, TiXmlElement *shader, TiXmlElement *profile_COMMON, const char *value, const vec4 &deflt) {
-      TiXmlElement *section = child(shader, value);
-      TiXmlElement *color = child(section, "color");
-      TiXmlElement *texture = child(section, "texture");
+    param *get_param(resources &dict, element *shader, element *profile_COMMON, const char *value, const vec4 &deflt) {
+      element *section = child(shader, value);
+      element *color = child(section, "color");
+      element *texture = child(section, "texture");
       if (color) {
-        atofv(temp_floats, color->GetText());
+        atofv(temp_floats, text(color));
         if (temp_floats.size() == 3) {
           temp_floats.push_back(1);
         }
@@ -384,15 +621,15 @@ namespace octet {
       } else if (texture) {
         // todo: handle multiple texcoords
         const char *texture_name = attr(texture, "texture");
-        TiXmlElement *sampler2D = find_param(profile_COMMON, texture_name, "sampler2D");
-        TiXmlElement *source = child(sampler2D, "source");
+        element *sampler2D = find_param(profile_COMMON, texture_name, "sampler2D");
+        element *source = child(sampler2D, "source");
         const char *surface_name = text(source);
-        TiXmlElement *surface = find_param(profile_COMMON, surface_name, "surface");
-        TiXmlElement *init_from = child(surface, "init_from");
+        element *surface = find_param(profile_COMMON, surface_name, "surface");
+        element *init_from = child(surface, "init_from");
         const char *image_name = text(init_from);
         image *img = dict.get_image(image_name);
         if (img) return new param(img);
-        /*TiXmlElement *image = find_id(image_name);
+        /*element *image = find_id(image_name);
         const char *url_attr = text(child(image, "init_from"));
         if (url_attr) {
           string new_path;
@@ -405,11 +642,11 @@ namespace octet {
     }
 
     // get a floating point number (or the default)
-    param *get_float(TiXmlElement *shader, const char *value, float deflt) {
-      TiXmlElement *section = child(shader, value);
-      TiXmlElement *float_ = child(section, "float");
+    param *get_float(element *shader, const char *value, float deflt) {
+      element *section = child(shader, value);
+      element *float_ = child(section, "float");
       if (float_) {
-        atofv(temp_floats, float_->GetText());
+        atofv(temp_floats, text(float_));
         if (temp_floats.size() >= 1) {
           return new param(vec4(temp_floats[0], 0, 0, 0));
         }
@@ -419,7 +656,7 @@ namespace octet {
 
     // add all the materials from the collada file to the resources collection
     void add_materials(resources &dict) {
-      TiXmlElement *lib_mat = child(doc.RootElement(), "library_materials");
+      element *lib_mat = child(root(), "library_materials");
 
       if (!dict.has_resource("default_material")) {
         material *defmat = new material();
@@ -429,16 +666,16 @@ namespace octet {
 
       if (!lib_mat) return;
 
-      for (TiXmlElement *mat_elem = lib_mat->FirstChildElement(); mat_elem != NULL; mat_elem = mat_elem->NextSiblingElement()) {
-        TiXmlElement *ieffect = child(mat_elem, "instance_effect");
+      for (element *mat_elem = child(lib_mat); mat_elem != NULL; mat_elem = sibling(mat_elem)) {
+        element *ieffect = child(mat_elem, "instance_effect");
         const char *url = attr(ieffect, "url");
-        TiXmlElement *effect = find_id(url);
-        TiXmlElement *profile_COMMON = child(effect, "profile_COMMON");
-        TiXmlElement *technique = child(profile_COMMON, "technique");
-        TiXmlElement *phong = child(technique, "phong");
-        TiXmlElement *blinn = child(technique, "blinn");
-        TiXmlElement *lambert = child(technique, "lambert");
-        TiXmlElement *shader = phong ? phong : blinn ? blinn : lambert;
+        element *effect = find_id(url);
+        element *profile_COMMON = child(effect, "profile_COMMON");
+        element *technique = child(profile_COMMON, "technique");
+        element *phong = child(technique, "phong");
+        element *blinn = child(technique, "blinn");
+        element *lambert = child(technique, "lambert");
+        element *shader = phong ? phong : blinn ? blinn : lambert;
         if (shader) {
           url += url[0] == '#';
           param *emission = get_param(dict, shader, profile_COMMON, "emission", vec4(0, 0, 0, 0));
@@ -461,14 +698,14 @@ namespace octet {
     }
 
     // add geometry and skins from the collada file to the resources collection
-    void add_mesh_instances(TiXmlElement *technique_common, const char *url, scene_node *node, skeleton *skel, resources &dict, scene &s) {
+    void add_mesh_instances(element *technique_common, const char *url, scene_node *node, skeleton *skel, resources &dict, scene &s) {
       if (!url) return;
 
-      TiXmlElement *instance = child(technique_common, "instance_material");
+      element *instance = child(technique_common, "instance_material");
       if (instance) {
-        for (; instance != NULL; instance = instance->NextSiblingElement("instance_material")) {
-          const char *symbol = instance->Attribute("symbol");
-          const char *target = instance->Attribute("target");
+        for (; instance != NULL; instance = sibling(instance, "instance_material")) {
+          const char *symbol = attr(instance, "symbol");
+          const char *target = attr(instance, "target");
           material *mat = dict.get_material(target);
           if (!mat) mat = dict.get_material("default_material");
           const char *mesh_url = url;
@@ -480,14 +717,14 @@ namespace octet {
             mesh_url = new_url.c_str();
           }
 
-          app_utils::log("add mesh instance %s\n", mesh_url);
+          OCTET_LOG_DEBUG("add mesh instance %s\n", mesh_url);
 
           mesh *msh = dict.get_mesh(mesh_url);
           if (msh) {
             mesh_instance *mi = new mesh_instance(node, msh, mat, skel);
             s.add_mesh_instance(mi);
           } else {
-            app_utils::log("warning: missing mesh %s\n", mesh_url);
+            OCTET_LOG_WARNING("warning: missing mesh %s\n", mesh_url);
           }
         }
       } else {
@@ -501,23 +738,23 @@ namespace octet {
     }
 
     // add an <instance_geometry> mesh instance
-    void add_instance_geometry(TiXmlElement *element, scene_node *node, resources &dict, scene &s) {
-      const char *url = element->Attribute("url");
+    void add_instance_geometry(element *instance, scene_node *node, resources &dict, scene &s) {
+      const char *url = attr(instance, "url");
       url += url[0] == '#';
-      TiXmlElement *bind_material = child(element, "bind_material");
-      TiXmlElement *technique_common = child(bind_material, "technique_common");
+      element *bind_material = child(instance, "bind_material");
+      element *technique_common = child(bind_material, "technique_common");
 
       add_mesh_instances(technique_common, url, node, 0, dict, s);
     }
 
     // add an <instance_controller> skin instance
-    void add_instance_controller(TiXmlElement *element, scene_node *node, resources &dict, scene &s) {
-      const char *controller_url = attr(element, "url");
-      TiXmlElement *bind_material = child(element, "bind_material");
-      TiXmlElement *technique_common = child(bind_material, "technique_common");
+    void add_instance_controller(element *instance, scene_node *node, resources &dict, scene &s) {
+      const char *controller_url = attr(instance, "url");
+      element *bind_material = child(instance, "bind_material");
+      element *technique_common = child(bind_material, "technique_common");
 
       int num_bones = 0;
-      for (TiXmlElement *skel_elem = child(element, "skeleton"); skel_elem; skel_elem = sibling(skel_elem, "skeleton")) {
+      for (element *skel_elem = child(instance, "skeleton"); skel_elem; skel_elem = sibling(skel_elem, "skeleton")) {
         num_bones++;
       }
 
@@ -526,12 +763,12 @@ namespace octet {
       //skin *skn = mesh->get_skin();
 
       skeleton *skel = new skeleton();
-      TiXmlElement *skel_elem = child(element, "skeleton");
+      element *skel_elem = child(instance, "skeleton");
       dictionary<int> skin_joints;
       while (skel_elem) {
         const char *skeleton_id = text(skel_elem);
-        TiXmlElement *node_elem = find_id(skeleton_id);
-        scene_node *node = (scene_node*)node_elem->GetUserData();
+        element *node_elem = find_id(skeleton_id);
+        scene_node *node = node_elem ? (scene_node*)node_elem->user_data : NULL;
         if (node) {
           dynarray<scene_node*> nodes;
           dynarray<int> parents;
@@ -544,36 +781,36 @@ namespace octet {
         skel_elem = sibling(skel_elem, "skeleton");
       }
 
-      //const char *url = skin->Attribute("source");
+      //const char *url = attr(skin, "source");
       add_mesh_instances(technique_common, controller_url, node, skel, dict, s);
     }
 
     // utility to get a float
-    float quick_float(TiXmlElement *parent, const char *name, float deflt=0) {
-      TiXmlElement *child = parent->FirstChildElement(name);
-      return child ? (float)atof(child->GetText()) : deflt;
+    float quick_float(element *parent, const char *name, float deflt=0) {
+      element *elem = child(parent, name);
+      return elem ? (float)atof(text(elem)) : deflt;
     }
 
     // utility to get a float
-    vec4 quick_vec(TiXmlElement *parent, const char *name) {
-      TiXmlElement *child = parent->FirstChildElement(name);
+    vec4 quick_vec(element *parent, const char *name) {
+      element *elem = child(parent, name);
       dynarray<float> v;
-      if (child) atofv(v, child->GetText());
+      if (elem) atofv(v, text(elem));
       unsigned s = v.size();
       return vec4(v[0], s > 1 ? v[1] : 0, s > 2 ? v[2] : 0, s > 3 ? v[3] : 1);
     }
 
     // add a camera to the scene
-    void add_instance_camera(TiXmlElement *elem, scene_node *node, resources &dict, scene &s) {
-      const char *url = elem->Attribute("url");
-      TiXmlElement *cam = find_id(url);
+    void add_instance_camera(element *elem, scene_node *node, resources &dict, scene &s) {
+      const char *url = attr(elem, "url");
+      element *cam = find_id(url);
       if (!cam) return;
 
-      TiXmlElement *optics = child(cam, "optics");
-      TiXmlElement *technique_common = child(optics, "technique_common");
-      TiXmlElement *perspective = child(technique_common, "perspective");
-      TiXmlElement *ortho = child(technique_common, "ortho");
-      TiXmlElement *params = perspective ? perspective : ortho;
+      element *optics = child(cam, "optics");
+      element *technique_common = child(optics, "technique_common");
+      element *perspective = child(technique_common, "perspective");
+      element *ortho = child(technique_common, "ortho");
+      element *params = perspective ? perspective : ortho;
       if (params) {
         float n = quick_float(params, "znear");
         float f = quick_float(params, "zfar");
@@ -594,21 +831,21 @@ namespace octet {
     }
 
     // add a light to the scene
-    void add_instance_light(TiXmlElement *elem, scene_node *node, resources &dict, scene &s) {
-      const char *url = elem->Attribute("url");
-      TiXmlElement *light = find_id(url);
+    void add_instance_light(element *elem, scene_node *node, resources &dict, scene &s) {
+      const char *url = attr(elem, "url");
+      element *light = find_id(url);
       if (!light) return;
 
       light_instance *il = new light_instance();
       il->set_node(node);
       s.add_light_instance(il);
       
-      TiXmlElement *technique_common = child(light, "technique_common");
-      TiXmlElement *ambient = child(technique_common, "ambient");
-      TiXmlElement *directional = child(technique_common, "directional");
-      TiXmlElement *spot = child(technique_common, "spot");
-      TiXmlElement *point = child(technique_common, "point");
-      TiXmlElement *params = ambient ? ambient : directional ? directional : spot ? spot : point;
+      element *technique_common = child(light, "technique_common");
+      element *ambient = child(technique_common, "ambient");
+      element *directional = child(technique_common, "directional");
+      element *spot = child(technique_common, "spot");
+      element *point = child(technique_common, "point");
+      element *params = ambient ? ambient : directional ? directional : spot ? spot : point;
 
       il->set_color(vec4(1, 1, 1, 1));
       if (params) {
@@ -627,57 +864,57 @@ namespace octet {
       }
     }
 
-    // add a geometry element to the list of mesh states
+    // queue the meshes of each geometry element for build_meshes
     void add_geometry(resources &dict) {
-      TiXmlElement *lib_geom = doc.RootElement()->FirstChildElement("library_geometries");
+      element *lib_geom = child(root(), "library_geometries");
       if (!lib_geom) return;
 
-      for (TiXmlElement *geometry = lib_geom->FirstChildElement(); geometry != NULL; geometry = geometry->NextSiblingElement()) {
-        TiXmlElement *mesh_elem = child(geometry, "mesh");
-        const char *id = geometry->Attribute("id");
+      for (element *geometry = child(lib_geom); geometry != NULL; geometry = sibling(geometry)) {
+        element *mesh_elem = child(geometry, "mesh");
+        const char *id = attr(geometry, "id");
 
-        for (TiXmlElement *mesh_child = mesh_elem ? mesh_elem->FirstChildElement() : 0;
+        for (element *mesh_child = mesh_elem ? child(mesh_elem) : 0;
           mesh_child != NULL;
-          mesh_child = mesh_child->NextSiblingElement()
+          mesh_child = sibling(mesh_child)
         ) {
-          if (is_mesh_component(mesh_child->Value())) {
-            mesh *msh = new mesh();
-            get_mesh_component(msh, id, mesh_child, NULL, dict);
+          if (is_mesh_component(value(mesh_child))) {
+            mesh_tasks.push_back(new mesh_task(new mesh(), id, mesh_child, NULL));
           }
         }
       }
     }
 
-    // add a geometry element to the list of mesh states
+    // make the skin of each controller and queue its meshes for build_meshes
     void add_controllers(resources &dict) {
-      TiXmlElement *lib_ctrl = doc.RootElement()->FirstChildElement("library_controllers");
+      element *lib_ctrl = child(root(), "library_controllers");
       if (!lib_ctrl) return;
 
-      for (TiXmlElement *controller = lib_ctrl->FirstChildElement(); controller != NULL; controller = controller->NextSiblingElement()) {
-        TiXmlElement *skin_elem = child(controller, "skin");
-        const char *controller_id = controller->Attribute("id");
-        TiXmlElement *geometry = find_id(attr(skin_elem, "source"));
-        TiXmlElement *bind_shape_matrix = child(skin_elem, "bind_shape_matrix");
-        TiXmlElement *joints_elem = child(skin_elem, "joints");
-        skin_state skinst;
+      for (element *controller = child(lib_ctrl); controller != NULL; controller = sibling(controller)) {
+        element *skin_elem = child(controller, "skin");
+        const char *controller_id = attr(controller, "id");
+        element *geometry = find_id(attr(skin_elem, "source"));
+        element *bind_shape_matrix = child(skin_elem, "bind_shape_matrix");
+        element *joints_elem = child(skin_elem, "joints");
+        skin_state *skinst = new skin_state();
+        skin_states.push_back(skinst);
 
         if (bind_shape_matrix) {
-          atofv(skinst.bind_shape_matrix, text(bind_shape_matrix));
+          atofv(skinst->bind_shape_matrix, text(bind_shape_matrix));
         }
 
         if (joints_elem) {
-          TiXmlElement *input = child(joints_elem, "input");
+          element *input = child(joints_elem, "input");
           while (input) {
             const char *semantic = attr(input, "semantic");
             const char *source_id = attr(input, "source");
             if (!strcmp(semantic, "JOINT")) {
-              TiXmlElement *name_array = child(find_id(source_id), "Name_array");
+              element *name_array = child(find_id(source_id), "Name_array");
               if (name_array) {
-                skinst.joints = text(name_array);
+                skinst->joints = text(name_array);
               }
             } else if (!strcmp(semantic, "INV_BIND_MATRIX")) {
-              TiXmlElement *float_array = child(find_id(source_id), "float_array");
-              atofv(skinst.inv_bind_matrices, text(float_array));
+              element *float_array = child(find_id(source_id), "float_array");
+              get_floats(skinst->inv_bind_matrices, float_array);
             }
             input = sibling(input, "input");
           }
@@ -685,8 +922,8 @@ namespace octet {
 
         mat4t modelToBind;
 
-        if (skinst.bind_shape_matrix.size() >= 16) {
-          modelToBind.init_transpose(&skinst.bind_shape_matrix[0]);
+        if (skinst->bind_shape_matrix.size() >= 16) {
+          modelToBind.init_transpose(&skinst->bind_shape_matrix[0]);
         } else {
           modelToBind.loadIdentity();
         }
@@ -694,39 +931,88 @@ namespace octet {
         skin *mesh_skin = new skin(modelToBind);
 
         dynarray<string> joints;
-        atonv(joints, skinst.joints);
+        atonv(joints, skinst->joints);
 
         for (unsigned i = 0; i != joints.size(); ++i) {
           mat4t bindToModel;
-          bindToModel.init_transpose(&skinst.inv_bind_matrices[i*16]);
+          bindToModel.init_transpose(&skinst->inv_bind_matrices[i*16]);
           mesh_skin->add_joint(bindToModel, app_utils::get_atom(joints[i]));
         }
 
-        TiXmlElement *vertex_weights = child(skin_elem, "vertex_weights");
+        element *vertex_weights = child(skin_elem, "vertex_weights");
         if (vertex_weights && geometry) {
-          get_skin(controller, vertex_weights, &skinst);
-          TiXmlElement *mesh_elem = child(geometry, "mesh");
-          //const char *id = geometry->Attribute("id");
+          skin_task task = { controller, vertex_weights, skinst };
+          skin_tasks.push_back(task);
+          element *mesh_elem = child(geometry, "mesh");
+          //const char *id = attr(geometry, "id");
 
-          for (TiXmlElement *mesh_child = mesh_elem ? mesh_elem->FirstChildElement() : 0;
+          for (element *mesh_child = mesh_elem ? child(mesh_elem) : 0;
             mesh_child != NULL;
-            mesh_child = mesh_child->NextSiblingElement()
+            mesh_child = sibling(mesh_child)
           ) {
-            if (is_mesh_component(mesh_child->Value())) {
-              mesh *msh = new mesh(mesh_skin);
-              get_mesh_component(msh, controller_id, mesh_child, &skinst, dict);
+            if (is_mesh_component(value(mesh_child))) {
+              mesh_tasks.push_back(new mesh_task(new mesh(mesh_skin), controller_id, mesh_child, skinst));
             }
           }
         }
       }
     }
 
+    // warnings from the worker threads, printed on the main thread so they come out in order.
+    static void print_warnings(const dynarray<const char *> &warnings) {
+      for (unsigned i = 0; i != warnings.size(); ++i) {
+        printf("warning: %s\n", warnings[i]);
+      }
+    }
+
+    static void build_skin_task(void *arg, unsigned index) {
+      collada_builder *b = (collada_builder*)arg;
+      skin_task &task = b->skin_tasks[index];
+      b->get_skin(task.controller, task.vertex_weights, task.skinst);
+    }
+
+    static void build_mesh_task(void *arg, unsigned index) {
+      collada_builder *b = (collada_builder*)arg;
+      b->build_mesh_component(*b->mesh_tasks[index]);
+    }
+
+    // build the skins and then the meshes queued by add_geometry and add_controllers on all the cpus.
+    // each task only writes to its own mesh and state, the rest of the builder is read only.
+    void build_meshes(resources &dict) {
+      unsigned num_indices = 0;
+      for (unsigned i = 0; i != mesh_tasks.size(); ++i) {
+        unsigned size = 0;
+        get_ints(child(mesh_tasks[i]->mesh_child, "p"), size);
+        num_indices += size;
+      }
+
+      unsigned threads = num_threads ? num_threads : thread::get_num_cpus();
+      if (num_indices < min_thread_indices) threads = 1;
+
+      parallel_for::run(skin_tasks.size(), build_skin_task, (void*)this, threads);
+      for (unsigned i = 0; i != skin_tasks.size(); ++i) {
+        print_warnings(skin_tasks[i].skinst->warnings);
+      }
+      parallel_for::run(mesh_tasks.size(), build_mesh_task, (void*)this, threads);
+
+      for (unsigned i = 0; i != mesh_tasks.size(); ++i) {
+        finish_mesh_component(*mesh_tasks[i], dict);
+        delete mesh_tasks[i];
+      }
+      for (unsigned i = 0; i != skin_states.size(); ++i) {
+        delete skin_states[i];
+      }
+      mesh_tasks.reset();
+      skin_tasks.reset();
+      skin_states.reset();
+    }
+
     // add <library_images> to the scene
     void add_images(resources &dict) {
-      TiXmlElement *lib_anim = doc.RootElement()->FirstChildElement("library_images");
+      element *lib_anim = child(root(), "library_images");
       if (!lib_anim) return;
 
-      for (TiXmlElement *elem = child(lib_anim, "image"); elem != NULL; elem = sibling(elem, "image")) {
+      for (element *elem = child(lib_anim, "image"); elem != NULL; elem = sibling(elem, "image")) {
         const char *url_attr = text(child(elem, "init_from"));
         if (url_attr) {
           string new_path;
@@ -740,15 +1026,15 @@ namespace octet {
     // add <library_animations> to the scene
     // collada animations range from sensible (array of matrices) to crazy (complex rotations and translations)
     void add_animations(resources &dict) {
-      TiXmlElement *lib_anim = doc.RootElement()->FirstChildElement("library_animations");
+      element *lib_anim = child(root(), "library_animations");
       if (!lib_anim) return;
 
-      for (TiXmlElement *anim_elem = child(lib_anim, "animation"); anim_elem != NULL; anim_elem = sibling(anim_elem, "animation")) {
+      for (element *anim_elem = child(lib_anim, "animation"); anim_elem != NULL; anim_elem = sibling(anim_elem, "animation")) {
         animation *anim = new animation();
         const char *id = attr(anim_elem, "id");
         dict.set_resource(id, anim);
-        app_utils::log("animation %s\n", id);
-        for (TiXmlElement *channel_elem = child(anim_elem, "channel"); channel_elem != NULL; channel_elem = sibling(channel_elem, "channel")) {
+        OCTET_LOG_DEBUG("animation %s\n", id);
+        for (element *channel_elem = child(anim_elem, "channel"); channel_elem != NULL; channel_elem = sibling(channel_elem, "channel")) {
           const char *target = attr(channel_elem, "target");
           string node_name = target;
           string sub_target_name;
@@ -769,25 +1055,25 @@ namespace octet {
           atom_t sub_target_sid = app_utils::get_atom(sub_target_name);
           atom_t component_sid = app_utils::get_atom(component_name);
           
-          app_utils::log("  channel target %s %s %s\n", node_name.c_str(), sub_target_name.c_str(), component_name.c_str());
-          TiXmlElement *sampler_elem = find_id(attr(channel_elem, "source"));
+          OCTET_LOG_DEBUG("  channel target %s %s %s\n", node_name.c_str(), sub_target_name.c_str(), component_name.c_str());
+          element *sampler_elem = find_id(attr(channel_elem, "source"));
           if (sampler_elem) {
             dynarray<float> times;
             dynarray<float> values;
             //dynarray<string> interpolation;
 
-            TiXmlElement *input = child(sampler_elem, "input");
+            element *input = child(sampler_elem, "input");
             while (input) {
               const char *semantic = attr(input, "semantic");
               const char *source_id = attr(input, "source");
               if (!strcmp(semantic, "INPUT")) {
-                TiXmlElement *float_array = child(find_id(source_id), "float_array");
-                atofv(times, text(float_array));
+                element *float_array = child(find_id(source_id), "float_array");
+                get_floats(times, float_array);
               } else if (!strcmp(semantic, "OUTPUT")) {
-                TiXmlElement *float_array = child(find_id(source_id), "float_array");
-                atofv(values, text(float_array));
+                element *float_array = child(find_id(source_id), "float_array");
+                get_floats(values, float_array);
               } else if (!strcmp(semantic, "INTERPOLATION")) {
-                /*TiXmlElement *name_array = child(find_id(source_id), "Name_array");
+                /*element *name_array = child(find_id(source_id), "Name_array");
                 if (name_array) {
                   atonv(interpolation, text(name_array));
                 }*/
@@ -803,9 +1089,9 @@ namespace octet {
     }
 
     // build the scene_node heirachy
-    void build_heirachy(dynarray<TiXmlElement *> &node_elems, dynarray<scene_node *> &nodes, TiXmlElement *scene_element, resources &dict, scene &s) {
+    void build_heirachy(dynarray<element *> &node_elems, dynarray<scene_node *> &nodes, element *scene_element, resources &dict, scene &s) {
       // create a stack to avoid recursion (a bad thing in games)
-      dynarray<TiXmlElement *> stack;
+      dynarray<element *> stack;
       dynarray<scene_node *> node_stack;
       stack.reserve(64);
       node_stack.reserve(64);
@@ -813,42 +1099,42 @@ namespace octet {
       node_stack.push_back(s.get_root_node());
       stack.push_back(scene_element);
       while (!stack.is_empty()) {
-        TiXmlElement *parent_elem = stack.back();
+        element *parent_elem = stack.back();
         scene_node *parent = node_stack.back();
         stack.pop_back();
         node_stack.pop_back();
-        TiXmlElement *node_elem = child(parent_elem, "node");
+        element *node_elem = child(parent_elem, "node");
         while (node_elem) {
           mat4t nodeToParent;
           nodeToParent.loadIdentity();
           const char *sid = attr(node_elem, "sid");
           const char *id = attr(node_elem, "id");
           scene_node *new_node = new scene_node(nodeToParent, app_utils::get_atom(sid));
-          app_utils::log("add scene_node id=%s sid=%s\n", id, sid);
+          OCTET_LOG_DEBUG("add scene_node id=%s sid=%s\n", id, sid);
           dict.set_resource(id, new_node);
           parent->add_child(new_node);
           stack.push_back(node_elem);
           node_stack.push_back(new_node);
           nodes.push_back(new_node);
           node_elems.push_back(node_elem);
-          node_elem->SetUserData(new_node);
+          node_elem->user_data = new_node;
           node_elem = sibling(node_elem, "node");
         }
       }
     }
 
     // add matrices and instances
-    void build_matrices(dynarray<TiXmlElement *> &node_elems, dynarray<scene_node *> &nodes, resources &dict, scene &s) {
+    void build_matrices(dynarray<element *> &node_elems, dynarray<scene_node *> &nodes, resources &dict, scene &s) {
       for (int ni = 0; ni != node_elems.size(); ++ni) {
-        TiXmlElement *node_elem = node_elems[ni];
+        element *node_elem = node_elems[ni];
         scene_node *node = nodes[ni];
         mat4t &matrix = node->access_nodeToParent();
         matrix.loadIdentity();
 
-        for (TiXmlElement *child = node_elem->FirstChildElement(); child != NULL; child = child->NextSiblingElement()) {
-          const char *value = child->Value();
-          if (!strcmp(value, "matrix")) {
-            atofv(temp_floats, child->GetText());
+        for (element *elem = child(node_elem); elem != NULL; elem = sibling(elem)) {
+          const char *name = value(elem);
+          if (!strcmp(name, "matrix")) {
+            atofv(temp_floats, text(elem));
             if (temp_floats.size() >= 16) {
               mat4t tmp(
                 vec4(temp_floats[0], temp_floats[4], temp_floats[8], temp_floats[12]),
@@ -858,18 +1144,18 @@ namespace octet {
               );
               matrix.multMatrix(tmp);
             }
-          } else if (!strcmp(value, "rotate")) {
-            atofv(temp_floats, child->GetText());
+          } else if (!strcmp(name, "rotate")) {
+            atofv(temp_floats, text(elem));
             if (temp_floats.size() >= 4) {
               matrix.rotate(temp_floats[3], temp_floats[0], temp_floats[1], temp_floats[2]);
             }
-          } else if (!strcmp(value, "scale")) {
-            atofv(temp_floats, child->GetText());
+          } else if (!strcmp(name, "scale")) {
+            atofv(temp_floats, text(elem));
             if (temp_floats.size() >= 3) {
               matrix.scale(temp_floats[0], temp_floats[1], temp_floats[2]);
             }
-          } else if (!strcmp(value, "translate")) {
-            atofv(temp_floats, child->GetText());
+          } else if (!strcmp(name, "translate")) {
+            atofv(temp_floats, text(elem));
             if (temp_floats.size() >= 3) {
               matrix.translate(temp_floats[0], temp_floats[1], temp_floats[2]);
             }
@@ -879,22 +1165,22 @@ namespace octet {
     }
 
     // add instances
-    void build_instances(dynarray<TiXmlElement *> &node_elems, dynarray<scene_node *> &nodes, resources &dict, scene &s) {
+    void build_instances(dynarray<element *> &node_elems, dynarray<scene_node *> &nodes, resources &dict, scene &s) {
       for (int ni = 0; ni != node_elems.size(); ++ni) {
-        TiXmlElement *node_elem = node_elems[ni];
+        element *node_elem = node_elems[ni];
         scene_node *node = nodes[ni];
 
-        for (TiXmlElement *child = node_elem->FirstChildElement(); child != NULL; child = child->NextSiblingElement()) {
-          const char *value = child->Value();
-          if (!strcmp(value, "instance_geometry")) {
-            add_instance_geometry(child, node, dict, s);
-          } else if (!strcmp(value, "instance_controller")) {
-            add_instance_controller(child, node, dict, s);
-          } else if (!strcmp(value, "instance_camera")) {
-            add_instance_camera(child, node, dict, s);
-          } else if (!strcmp(value, "instance_light")) {
-            add_instance_light(child, node, dict, s);
-          } else if (!strcmp(value, "instance_mesh")) {
+        for (element *elem = child(node_elem); elem != NULL; elem = sibling(elem)) {
+          const char *name = value(elem);
+          if (!strcmp(name, "instance_geometry")) {
+            add_instance_geometry(elem, node, dict, s);
+          } else if (!strcmp(name, "instance_controller")) {
+            add_instance_controller(elem, node, dict, s);
+          } else if (!strcmp(name, "instance_camera")) {
+            add_instance_camera(elem, node, dict, s);
+          } else if (!strcmp(name, "instance_light")) {
+            add_instance_light(elem, node, dict, s);
+          } else if (!strcmp(name, "instance_mesh")) {
             // we do not support instance_mesh yet as this requires a DAG
           }
         }
@@ -903,9 +1189,9 @@ namespace octet {
 
     // if we have a vcount element (polylist), we build polygons out of triangles
     // and hope they are convex!
-    unsigned convert_polygons_to_triangles(parse_input_state &state, dynarray<int> &vcount) {
+    unsigned convert_polygons_to_triangles(parse_input_state &state, const int *vcount, unsigned num_vcount) {
       unsigned num_indices = 0;
-      for (unsigned i = 0; i != vcount.size(); ++i) {
+      for (unsigned i = 0; i != num_vcount; ++i) {
         unsigned nv = vcount[i];
         num_indices += (nv - 2) * 3;
       }
@@ -913,7 +1199,7 @@ namespace octet {
 
       unsigned j = 0;
       unsigned z = 0;
-      for (unsigned i = 0; i != vcount.size(); ++i) {
+      for (unsigned i = 0; i != num_vcount; ++i) {
         unsigned nv = vcount[i];
         for (unsigned k = 0; k != nv - 2; ++k) {
           state.indices[j++] = z;
@@ -926,14 +1212,14 @@ namespace octet {
     }
 
     // find the maximum input offset and infer the input stride (this is not explicit in the spec)
-    int get_input_stride(TiXmlElement *mesh_child) {
+    int get_input_stride(element *mesh_child) {
       int input_stride = 1;
       int implicit_offset = 0;
-      for (TiXmlElement *input_elem = child(mesh_child, "input");
+      for (element *input_elem = child(mesh_child, "input");
         input_elem != NULL;
-        input_elem = input_elem->NextSiblingElement("input")
+        input_elem = sibling(input_elem, "input")
       ) {
-        const char *offset = input_elem->Attribute("offset");
+        const char *offset = attr(input_elem, "offset");
         int int_offset = offset ? atoi(offset) : implicit_offset++;
         if (int_offset+1 > input_stride) {
           input_stride = int_offset+1;
@@ -942,51 +1228,42 @@ namespace octet {
       return input_stride;
     }
 
-    // get triangles from a trilist or polylist
-    void get_mesh_component(mesh *mesh, const char *id, TiXmlElement *mesh_child, skin_state *skinst, resources &dict) {
-      TiXmlElement *pelem = child(mesh_child, "p");
+    // build the vertices and indices of a trilist or polylist.
+    // this runs on worker threads, so it must not use the resources, GL or the atom table.
+    void build_mesh_component(mesh_task &task) {
+      element *mesh_child = task.mesh_child;
+      element *pelem = child(mesh_child, "p");
 
       if (!pelem) {
-        printf("warning: no <p>\n");
+        task.result = mesh_task::no_p;
         return;
       }
 
-      // a geometry or controller is split up into its material groups
-      // with a name of "geometry+material"
-      // each requires a separate mesh instance to render
-      const char *symbol = attr(mesh_child, "material");
-      string new_url;
-      const char *mesh_url = id;
-      if (symbol) {
-        new_url.format("%s+%s", id, symbol);
-        mesh_url = new_url;
-      }
-      app_utils::log("created mesh %s\n", id);
-      dict.set_resource(mesh_url, mesh);
-
-      parse_input_state state;
+      mesh *mesh = task.msh;
+      skin_state *skinst = task.skinst;
+      parse_input_state &state = task.state;
       state.s = mesh;
-      atoiv(state.p, pelem->GetText());
+      state.p = get_ints(pelem, state.p_size);
       state.input_stride = get_input_stride(mesh_child);
       //unsigned implicit_offset = 0;
       state.slot = 0;
       state.attr_offset = 0;
       state.skinst = skinst;
 
-      unsigned p_size = state.p.size();
+      unsigned p_size = state.p_size;
       if (p_size % state.input_stride != 0) {
-        printf("warning: expected multiple of %d indices\n", state.input_stride);
+        task.result = mesh_task::bad_stride;
         return;
       }
 
       unsigned num_vertices = p_size / state.input_stride;
 
       // find the output size
-      for (TiXmlElement *input = child(mesh_child, "input");
+      for (element *input = child(mesh_child, "input");
         input != NULL;
-        input = input->NextSiblingElement("input")
+        input = sibling(input, "input")
       ) {
-        const char *offset = input->Attribute("offset");
+        const char *offset = attr(input, "offset");
         state.input_offset = offset ? atoi(offset) : 0;
         state.pass = 1;
         parse_input(state, input);
@@ -1016,11 +1293,11 @@ namespace octet {
       state.vertex_input_offset = 0;
 
       // build the attributes
-      for (TiXmlElement *input = child(mesh_child, "input");
+      for (element *input = child(mesh_child, "input");
         input != NULL;
-        input = input->NextSiblingElement("input")
+        input = sibling(input, "input")
       ) {
-        const char *offset = input->Attribute("offset");
+        const char *offset = attr(input, "offset");
         state.input_offset = offset ? atoi(offset) : 0;
         state.pass = 2;
         parse_input(state, input);
@@ -1032,12 +1309,11 @@ namespace octet {
       // skins need extra parameters for indices and weights
       // copy the processed blend vertices to the gl attributes using indices from the <p> array
       if (skinst) {
-        unsigned p_size = state.p.size();
-        unsigned num_vertices = p_size / state.input_stride;
+        unsigned num_vertices = state.p_size / state.input_stride;
         for (unsigned i = 0; i != num_vertices; ++i) {
           unsigned index = state.p[i * state.input_stride + state.vertex_input_offset];
           if (0) {
-            app_utils::log("i%d\n", index);
+            OCTET_LOG_DEBUG("i%d\n", index);
           }
           for (int j = 0; j != blendindices_stride; ++j) {
             state.vertices[state.attr_stride * i + blendindices_offset + j] = (float)state.skinst->gl_indices[index * blendindices_stride + j];
@@ -1048,16 +1324,16 @@ namespace octet {
         }
       }
 
-      TiXmlElement *vcount_elem = child(mesh_child, "vcount");
+      element *vcount_elem = child(mesh_child, "vcount");
 
       // build an initial index based on the mesh_child value
       // todo: optimise the mesh.
       unsigned num_indices = 0;
       if (vcount_elem) {
         // polygons
-        dynarray<int> vcount;
-        atoiv(vcount, vcount_elem->GetText());
-        num_indices = convert_polygons_to_triangles(state, vcount);
+        unsigned num_vcount;
+        const int *vcount = get_ints(vcount_elem, num_vcount);
+        num_indices = convert_polygons_to_triangles(state, vcount, num_vcount);
       } else {
         // just plain triangles
         state.indices.resize(num_vertices);
@@ -1067,9 +1343,6 @@ namespace octet {
         }
       }
       
-      unsigned isize = state.indices.size() * sizeof(state.indices[0]);
-      unsigned vsize = state.vertices.size() * sizeof(state.vertices[0]);
-      
       unsigned pos_slot = mesh->get_slot(attribute_pos);
       unsigned offset = mesh->get_offset(pos_slot);
       if (mesh->get_size(pos_slot) == 3 && num_vertices != 0) {
@@ -1095,35 +1368,81 @@ namespace octet {
         mesh->set_aabb(aabb((vmax + vmin) * 0.5f, (vmax - vmin) * 0.5f));
       }
 
+      task.num_vertices = num_vertices;
+      task.num_indices = num_indices;
+      task.result = mesh_task::ok;
+    }
+
+    // add a mesh built by build_mesh_component to the resources and copy it to GL.
+    // meshes are finished in document order, so the resources are the same however many threads we use.
+    void finish_mesh_component(mesh_task &task, resources &dict) {
+      print_warnings(task.state.warnings);
+      if (task.result == mesh_task::no_p) {
+        printf("warning: no <p>\n");
+        return;
+      }
+
+      // a geometry or controller is split up into its material groups
+      // with a name of "geometry+material"
+      // each requires a separate mesh instance to render
+      mesh *mesh = task.msh;
+      const char *id = task.id;
+      const char *symbol = attr(task.mesh_child, "material");
+      string new_url;
+      const char *mesh_url = id;
+      if (symbol) {
+        new_url.format("%s+%s", id, symbol);
+        mesh_url = new_url;
+      }
+      OCTET_LOG_DEBUG("created mesh %s\n", id);
+      dict.set_resource(mesh_url, mesh);
+
+      parse_input_state &state = task.state;
+      if (task.result == mesh_task::bad_stride) {
+        printf("warning: expected multiple of %d indices\n", state.input_stride);
+        return;
+      }
+
+      unsigned isize = state.indices.size() * sizeof(state.indices[0]);
+      unsigned vsize = state.vertices.size() * sizeof(state.vertices[0]);
+
       mesh->allocate(vsize, isize);
       mesh->assign(vsize, isize, (unsigned char*)&state.vertices[0], (unsigned char*)&state.indices[0]);
-      mesh->set_params(state.attr_stride * 4, num_indices, num_vertices, GL_TRIANGLES, GL_UNSIGNED_INT);
+      mesh->set_params(state.attr_stride * 4, task.num_indices, task.num_vertices, GL_TRIANGLES, GL_UNSIGNED_INT);
       if (0) {
-        FILE *file = app_utils::log("mesh skinst=%p\n", skinst);
+        OCTET_LOG_DEBUG("mesh skinst=%p\n", task.skinst);
+        FILE *file = logger::get().get_file();
         mesh->dump(file);
         fflush(file);
       }
     }
 
+    // get triangles from a trilist or polylist
+    void get_mesh_component(mesh *mesh, const char *id, element *mesh_child, skin_state *skinst, resources &dict) {
+      mesh_task task(mesh, id, mesh_child, skinst);
+      build_mesh_component(task);
+      finish_mesh_component(task, dict);
+    }
+
     // get blend weights and matrices from a skin
     // after this we are still not home yet as the weights need to be indexed by the POSITION of the skinned mesh.
-    void get_skin(TiXmlElement *geometry, TiXmlElement *mesh_child, skin_state *skin) {
-      TiXmlElement *pelem = child(mesh_child, "v");
+    void get_skin(element *geometry, element *mesh_child, skin_state *skin) {
+      element *pelem = child(mesh_child, "v");
 
       if (!pelem) {
-        printf("warning: no <v>\n");
+        skin->warnings.push_back("no <v>");
         return;
       }
 
-      TiXmlElement *vcount_elem = child(mesh_child, "vcount");
+      element *vcount_elem = child(mesh_child, "vcount");
       if (!vcount_elem) {
-        printf("warning: no vcount element in skin\n");
+        skin->warnings.push_back("no vcount element in skin");
       }
 
-      atoiv(skin->vcount, vcount_elem->GetText());
+      skin->vcount = get_ints(vcount_elem, skin->num_vcount);
 
       int num_vertices = 0;
-      int num_vcs = skin->vcount.size();
+      int num_vcs = skin->num_vcount;
       for (int i = 0; i != num_vcs; ++i) {
         num_vertices += skin->vcount[i];
       }
@@ -1133,7 +1452,7 @@ namespace octet {
 
       parse_input_state state;
       state.s = NULL;
-      atoiv(state.p, pelem->GetText());
+      state.p = get_ints(pelem, state.p_size);
       state.input_stride = get_input_stride(mesh_child);
       state.slot = 0;
       state.attr_offset = 0;
@@ -1141,15 +1460,18 @@ namespace octet {
       state.input_offset = 0;
 
       // build the raw skin paramerters
-      for (TiXmlElement *input = child(mesh_child, "input");
+      for (element *input = child(mesh_child, "input");
         input != NULL;
-        input = input->NextSiblingElement("input")
+        input = sibling(input, "input")
       ) {
-        const char *offset = input->Attribute("offset");
+        const char *offset = attr(input, "offset");
         state.input_offset = offset ? atoi(offset) : 0;
         state.pass = 3;
         parse_input(state, input);
       }
+      for (unsigned i = 0; i != state.warnings.size(); ++i) {
+        skin->warnings.push_back(state.warnings[i]);
+      }
 
       // convert raw params into gl params (max 4 weights)
       int start = 0;
@@ -1173,7 +1495,8 @@ namespace octet {
         start += vc;
       }
       if (0) {
-        FILE *f = app_utils::log("raw weights & indices\n");
+        OCTET_LOG_DEBUG("raw weights & indices\n");
+        FILE *f = logger::get().get_file();
         for (int i = 0; i != skin->raw_indices.size(); ++i) {
           fprintf(f, "ri %d %d\n", i, skin->raw_indices[i]);
         }
@@ -1199,12 +1522,12 @@ namespace octet {
 
     // add all the scenes from the collada file to the resources collection
     void add_scenes(resources  &dict) {
-      TiXmlElement *lib = doc.RootElement()->FirstChildElement("library_visual_scenes");
+      element *lib = child(root(), "library_visual_scenes");
 
       if (!lib) return;
 
-      for (TiXmlElement *elem = lib->FirstChildElement(); elem != NULL; elem = elem->NextSiblingElement()) {
-        dynarray<TiXmlElement *> node_elems;
+      for (element *elem = child(lib); elem != NULL; elem = sibling(elem)) {
+        dynarray<element *> node_elems;
         dynarray<scene_node *> nodes;
         scene *scn = new scene();
         dict.set_resource(attr(elem, "id"), scn);
@@ -1217,44 +1540,54 @@ namespace octet {
 
   public:
     collada_builder() {
+      num_threads = 0;
+    }
+
+    // threads to use for building meshes. 0 is one per cpu and 1 never starts threads.
+    void set_num_threads(unsigned value) {
+      num_threads = value;
     }
 
     // public function to load a collada file
     bool load_xml(const char *url) {
       doc_path = url;
       doc_path.truncate(doc_path.filename_pos());
-      doc.LoadFile(app_utils::get_path(url));
 
-      TiXmlElement *top = doc.RootElement();
-      if (!top || strcmp(top->Value(), "COLLADA")) {
-        printf("warning: not a collada file");
+      // the element table keeps everything we need, so the file can go after parsing.
+      mapped_file file;
+      if (!file.open(app_utils::get_path(url)) || !parse((const char*)file.data(), (const char*)file.data() + file.size())) {
+        elements.reset();
+      }
+
+      element *top = root();
+      if (!top || strcmp(value(top), "COLLADA")) {
+        printf("warning: not a collada file\n");
         return false;
       }
-      find_ids(top);
       return true;
     }
 
     // once loaded, use this to access the first component in the mesh
     void get_mesh(mesh &s, const char *id, resources &dict) {
-      TiXmlElement *geometry = find_id(id);
+      element *geometry = find_id(id);
       s.init();
 
-      if (!geometry || strcmp(geometry->Value(), "geometry")) {
+      if (!geometry || strcmp(value(geometry), "geometry")) {
         printf("warning: geometry %s not found\n", id);
         return;
       }
 
-      TiXmlElement *mesh = child(geometry, "mesh");
+      element *mesh = child(geometry, "mesh");
       if (!mesh) {
         printf("warning: geometry %s has no mesh\n", id);
         return;
       }
 
-      for (TiXmlElement *mesh_child = mesh->FirstChildElement();
+      for (element *mesh_child = child(mesh);
         mesh_child != NULL;
-        mesh_child = mesh_child->NextSiblingElement()
+        mesh_child = sibling(mesh_child)
       ) {
-        if (is_mesh_component(mesh_child->Value())) {
+        if (is_mesh_component(value(mesh_child))) {
           get_mesh_component(&s, id, mesh_child, NULL, dict);
           return;
         }
@@ -1263,9 +1596,9 @@ namespace octet {
 
     // get the url from the default visual scene
     const char *get_default_scene() {
-      TiXmlElement *scene = doc.RootElement()->FirstChildElement("scene");
-      TiXmlElement *ivs = child(scene, "instance_visual_scene");
-      return ivs ? ivs->Attribute("url") : 0;
+      element *scene = child(root(), "scene");
+      element *ivs = child(scene, "instance_visual_scene");
+      return ivs ? attr(ivs, "url") : 0;
     }
 
     // extract resources from the collada file into a collection.
@@ -1278,6 +1611,9 @@ namespace octet {
 
       add_controllers(dict);
 
+      // meshes are built on all the cpus, then added to the resources in order
+      build_meshes(dict);
+
       // scenes refer to all the above
       add_scenes(dict);
 
@@ -7,6 +7,11 @@
 //
 // DDS file decoder - direct draw surface
 //
+// DXT1, DXT3 and DXT5 files are normally passed to the GPU as they are.
+// With set_decompress(true), or for BC4 (ATI1) and BC5 (ATI2) files, we
+// decode all the mip levels to RGBA on the cpu a block at a time.
+// Rows of blocks are shared between the cpus (see parallel_for).
+//
 
 namespace octet {
   class dds_decoder {
@@ -97,69 +102,230 @@ namespace octet {
 
     // read four bytes as a little-endian value
     // this will work on the PS3 and other big-endian machines
-    int le4( uint8_t val[4] )
+    unsigned le4( uint8_t val[4] )
     {
-      return val[0] + val[1] * 0x100 + val[2] * 0x10000 + val[3] * 0x1000000;
+      return val[0] + val[1] * 0x100 + val[2] * 0x10000 + val[3] * 0x1000000u;
     }
 
-    // rrrrrggggggbbbbb
-    // rrrrrggggggbbbbb
-    // 0011223344556677
-    // 8899aabbccddeeff
-    void hack_dxt1(uint8_t *dest, const uint8_t *src, unsigned stride, bool always_use_four_colours) {
-      uint16_t color0 = src[0] + src[1] * 256;
-      uint16_t color1 = src[2] + src[3] * 256;
-      src += 4;
-
-      uint8_t r0 = ( ( ( color0 >> 11 ) & 0x1f ) * (0xffff / 0x1f)) >> 8;
-      uint8_t g0 = ( ( ( color0 >> 6 ) & 0x3f ) * (0xffff / 0x3f)) >> 8;
-      uint8_t b0 = ( ( ( color0 >> 0 ) & 0x1f ) * (0xffff / 0x1f)) >> 8;
-      uint8_t r1 = ( ( ( color1 >> 11 ) & 0x1f ) * (0xffff / 0x1f)) >> 8;
-      uint8_t g1 = ( ( ( color1 >> 6 ) & 0x3f ) * (0xffff / 0x3f)) >> 8;
-      uint8_t b1 = ( ( ( color1 >> 0 ) & 0x1f ) * (0xffff / 0x1f)) >> 8;
-
-      // if it were not for the patent, some other code would go here
-      dest[0] = ( r0 + r1 ) >> 1;
-      dest[1] = ( g0 + g1 ) >> 1;
-      dest[2] = ( b0 + b1 ) >> 1;
-      dest[3] = 0xff;
+    // each block row of each level is a job for parallel_for
+    struct block_row {
+      const uint8_t *src;
+      uint8_t *dest;      // the level's pixels
+      unsigned width;
+      unsigned height;
+      unsigned y;         // first pixel row in the file (top down)
+    };
+
+    struct decode_job {
+      unsigned fourcc;
+      block_row *rows;
+    };
+
+    unsigned num_threads;
+    bool decompress;
+    unsigned num_levels;
+
+    // below this many blocks, threads cost more than they save.
+    enum { min_thread_blocks = 1024 };
+
+    static unsigned make_fourcc(char a, char b, char c, char d) {
+      return (uint8_t)a | ( (uint8_t)b << 8 ) | ( (uint8_t)c << 16 ) | ( (uint8_t)d << 24 );
     }
 
-    // quantised alpha
-    void hack_dxt3(uint8_t *dest, const uint8_t *src, unsigned stride) {
-      dest[3] = ( src[0] + src[1] ) >> 1;
+    static unsigned get_block_size(unsigned fourcc) {
+      return fourcc == make_fourcc('D', 'X', 'T', '1') || fourcc == make_fourcc('A', 'T', 'I', '1') || fourcc == make_fourcc('B', 'C', '4', 'U') ? 8 : 16;
     }
 
-    // interpolated alpha
-    void hack_dxt5(uint8_t *dest, const uint8_t *src, unsigned stride) {
-      dest[3] = ( src[0] + src[1] ) >> 1;
+    static unsigned get_level_size(unsigned fourcc, unsigned width, unsigned height) {
+      return ( ( width + 3 ) / 4 ) * ( ( height + 3 ) / 4 ) * get_block_size(fourcc);
     }
 
+    // decode the colour part of a DXT block to 16 RGBA pixels.
     // see http://www.opengl.org/registry/specs/EXT/texture_compression_s3tc.txt
-    // a s3tc dirty hack.
-    void hack_s3(uint8_t *image, unsigned dxt, unsigned width, unsigned height, const uint8_t *src, const uint8_t *src_max) {
-      unsigned max_bytes = (width) * (height) * 8;
-      if (dxt != 1) max_bytes *= 2;
-      //if (src_max - src > max_bytes) return; // oops
-
-      for (unsigned y = 0; y != height; ++y) {
-        uint8_t *dest = (uint8_t *)( image + y * (width * 4) );
-        for (unsigned x = 0; x != width; ++x) {
-          if (dxt == 1) {
-            hack_dxt1(dest, src+8, width * 4, false);
-            src += 8;
-          } else if (dxt <= 3) {
-            hack_dxt1(dest, src+8, width * 4, true);
-            hack_dxt3(dest, src, width * 4);
-            src += 16;
-          } else {
-            hack_dxt1(dest, src+8, width * 4, true);
-            hack_dxt5(dest, src, width * 4);
-            src += 16;
+    //
+    // rrrrrggggggbbbbb colour 0
+    // rrrrrggggggbbbbb colour 1
+    // 2 bit indices, four to a byte, pixel 0 in the bottom bits
+    static OCTET_HOT void decode_color(uint8_t *pixels, const uint8_t *src, bool dxt1) {
+      unsigned c0 = src[0] + src[1] * 256;
+      unsigned c1 = src[2] + src[3] * 256;
+
+      // build the palette once for the block
+      uint8_t palette[4][4];
+      palette[0][0] = (uint8_t)( ( ( c0 >> 11 ) << 3 ) | ( c0 >> 13 ) );
+      palette[0][1] = (uint8_t)( ( ( ( c0 >> 5 ) & 0x3f ) << 2 ) | ( ( c0 >> 9 ) & 3 ) );
+      palette[0][2] = (uint8_t)( ( ( c0 & 0x1f ) << 3 ) | ( ( c0 >> 2 ) & 7 ) );
+      palette[1][0] = (uint8_t)( ( ( c1 >> 11 ) << 3 ) | ( c1 >> 13 ) );
+      palette[1][1] = (uint8_t)( ( ( ( c1 >> 5 ) & 0x3f ) << 2 ) | ( ( c1 >> 9 ) & 3 ) );
+      palette[1][2] = (uint8_t)( ( ( c1 & 0x1f ) << 3 ) | ( ( c1 >> 2 ) & 7 ) );
+      palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 0xff;
+
+      if (c0 > c1 || !dxt1) {
+        for (unsigned i = 0; i != 3; ++i) {
+          palette[2][i] = (uint8_t)( ( palette[0][i] * 2 + palette[1][i] ) / 3 );
+          palette[3][i] = (uint8_t)( ( palette[0][i] + palette[1][i] * 2 ) / 3 );
+        }
+      } else {
+        // three colours and transparent black
+        for (unsigned i = 0; i != 3; ++i) {
+          palette[2][i] = (uint8_t)( ( palette[0][i] + palette[1][i] ) / 2 );
+          palette[3][i] = 0;
+        }
+        palette[3][3] = 0;
+      }
+
+      unsigned indices = src[4] | ( src[5] << 8 ) | ( src[6] << 16 ) | ( (unsigned)src[7] << 24 );
+      for (unsigned i = 0; i != 16; ++i, indices >>= 2) {
+        memcpy(pixels + i * 4, palette[indices & 3], 4);
+      }
+    }
+
+    // explicit 4 bit alpha (DXT3)
+    static void decode_alpha4(uint8_t *pixels, const uint8_t *src) {
+      for (unsigned i = 0; i != 8; ++i) {
+        pixels[i*8+3] = (uint8_t)( ( src[i] & 0x0f ) * 0x11 );
+        pixels[i*8+7] = (uint8_t)( ( src[i] >> 4 ) * 0x11 );
+      }
+    }
+
+    // interpolated 8 bit values with 3 bit indices (DXT5 alpha, BC4 and BC5)
+    // into one channel of the pixels.
+    static OCTET_HOT void decode_alpha8(uint8_t *pixels, const uint8_t *src, unsigned channel) {
+      unsigned a0 = src[0];
+      unsigned a1 = src[1];
+      uint8_t palette[8];
+      palette[0] = (uint8_t)a0;
+      palette[1] = (uint8_t)a1;
+      if (a0 > a1) {
+        for (unsigned i = 1; i != 7; ++i) {
+          palette[i+1] = (uint8_t)( ( a0 * ( 7 - i ) + a1 * i ) / 7 );
+        }
+      } else {
+        for (unsigned i = 1; i != 5; ++i) {
+          palette[i+1] = (uint8_t)( ( a0 * ( 5 - i ) + a1 * i ) / 5 );
+        }
+        palette[6] = 0;
+        palette[7] = 0xff;
+      }
+
+      // two groups of eight 3 bit indices
+      for (unsigned half = 0; half != 2; ++half) {
+        const uint8_t *p = src + 2 + half * 3;
+        unsigned indices = p[0] | ( p[1] << 8 ) | ( p[2] << 16 );
+        uint8_t *dest = pixels + half * 32 + channel;
+        for (unsigned i = 0; i != 8; ++i, indices >>= 3) {
+          dest[i*4] = palette[indices & 7];
+        }
+      }
+    }
+
+    // decode one block of any format to 16 RGBA pixels
+    static void decode_block(uint8_t *pixels, const uint8_t *src, unsigned fourcc) {
+      switch (fourcc) {
+        case 0x31545844: { // DXT1
+          decode_color(pixels, src, true);
+        } break;
+        case 0x33545844: { // DXT3
+          decode_color(pixels, src + 8, false);
+          decode_alpha4(pixels, src);
+        } break;
+        case 0x35545844: { // DXT5
+          decode_color(pixels, src + 8, false);
+          decode_alpha8(pixels, src, 3);
+        } break;
+        case 0x31495441: case 0x55344342: { // ATI1, BC4U: grey
+          decode_alpha8(pixels, src, 0);
+          for (unsigned i = 0; i != 16; ++i) {
+            pixels[i*4+1] = pixels[i*4+2] = pixels[i*4];
+            pixels[i*4+3] = 0xff;
+          }
+        } break;
+        case 0x32495441: case 0x55354342: { // ATI2, BC5U: normal map x and y, make z
+          decode_alpha8(pixels, src, 0);
+          decode_alpha8(pixels, src + 8, 1);
+          for (unsigned i = 0; i != 16; ++i) {
+            float x = pixels[i*4+0] * ( 2.0f / 255 ) - 1;
+            float y = pixels[i*4+1] * ( 2.0f / 255 ) - 1;
+            float zz = 1 - x * x - y * y;
+            float z = zz > 0 ? sqrtf(zz) : 0;
+            pixels[i*4+2] = (uint8_t)( z * 127.5f + 127.5f );
+            pixels[i*4+3] = 0xff;
+          }
+        } break;
+      }
+    }
+
+    // decode a row of blocks. The rows of each level are flipped for OpenGL.
+    static void decode_row(void *arg, unsigned index) {
+      decode_job &job = *(decode_job*)arg;
+      const block_row &row = job.rows[index];
+      unsigned block_size = get_block_size(job.fourcc);
+      unsigned stride = row.width * 4;
+      unsigned rows = row.height - row.y < 4 ? row.height - row.y : 4;
+
+      const uint8_t *src = row.src;
+      uint8_t pixels[64];
+      for (unsigned x = 0; x < row.width; x += 4, src += block_size) {
+        decode_block(pixels, src, job.fourcc);
+
+        uint8_t *dest = row.dest + ( row.height - 1 - row.y ) * stride + x * 4;
+        if (x + 4 <= row.width) {
+          // whole rows of the block
+          for (unsigned j = 0; j != rows; ++j, dest -= stride) {
+            #if OCTET_SSE2
+              _mm_storeu_si128((__m128i*)dest, _mm_loadu_si128((const __m128i*)(pixels + j * 16)));
+            #else
+              memcpy(dest, pixels + j * 16, 16);
+            #endif
           }
-          dest += 4;
+        } else {
+          // the right edge of the level
+          for (unsigned j = 0; j != rows; ++j, dest -= stride) {
+            memcpy(dest, pixels + j * 16, ( row.width - x ) * 4);
+          }
+        }
+      }
+    }
+
+    static unsigned next_size(unsigned size) {
+      return size > 1 ? size >> 1 : 1;
+    }
+
+    // decompress all the levels to RGBA, one after the other.
+    void decode_levels(dynarray<uint8_t> &image, unsigned fourcc, unsigned width, unsigned height, unsigned levels, const uint8_t *src, const uint8_t *src_max) {
+      // find the levels that are in the file
+      unsigned num_pixels = 0;
+      unsigned num_blocks = 0;
+      unsigned src_size = 0;
+      num_levels = 0;
+      // each level is half the size of the one before, but never less than one.
+      for (unsigned w = width, h = height; num_levels != levels && w && h; w = next_size(w), h = next_size(h)) {
+        unsigned size = get_level_size(fourcc, w, h);
+        if (src + src_size + size > src_max) break;
+        src_size += size;
+        num_pixels += w * h;
+        num_blocks += size / get_block_size(fourcc);
+        num_levels++;
+        if (w == 1 && h == 1) break;
+      }
+      if (!num_levels) return;
+
+      image.resize(num_pixels * 4);
+      dynarray<block_row> rows;
+      uint8_t *dest = &image[0];
+      for (unsigned level = 0, w = width, h = height; level != num_levels; ++level, w = next_size(w), h = next_size(h)) {
+        for (unsigned y = 0; y < h; y += 4) {
+          block_row row = { src, dest, w, h, y };
+          rows.push_back(row);
+          src += get_level_size(fourcc, w, 4);
         }
+        dest += w * h * 4;
       }
+
+      decode_job job = { fourcc, &rows[0] };
+      unsigned threads = num_threads ? num_threads : thread::get_num_cpus();
+      if (num_blocks < min_thread_blocks) threads = 1;
+      parallel_for::run(rows.size(), decode_row, (void*)&job, threads);
     }
 
     static void swap(uint32_t &a, uint32_t &b) {
@@ -278,18 +444,60 @@ namespace octet {
       }
     }
   public:
+    dds_decoder() {
+      num_threads = 0;
+      decompress = false;
+      num_levels = 0;
+    }
+
+    // decode to RGBA instead of keeping the compressed blocks.
+    // For GPUs without S3TC and for tools. BC4 and BC5 files are always decoded.
+    void set_decompress(bool value) {
+      decompress = value;
+    }
+
+    // threads to use for big images. 0 is one per cpu and 1 never starts threads.
+    void set_num_threads(unsigned value) {
+      num_threads = value;
+    }
+
+    // the number of mip levels we decoded, or found in a compressed file
+    unsigned get_num_levels() const {
+      return num_levels;
+    }
+
     // get an opengl texture from a file in memory
     void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width, uint16_t &height, const uint8_t *src, const uint8_t *src_max) {
       // convert the data
       dds_header *header = (dds_header*)src;
 
-      if (le4(header->magic) != dds_magic) return;
+      num_levels = 0;
+      if (src_max - src < (int)sizeof(dds_header) || le4(header->magic) != dds_magic) return;
 
       unsigned pf_flags = le4(header->pf.flags);
 
       if (pf_flags & ddpf_fourcc) {
         uint8_t *fourcc = header->pf.fourcc;
-        if (fourcc[0] == 'D' && fourcc[1] == 'X' && fourcc[2] == 'T') {
+        unsigned code = le4(fourcc);
+        bool is_dxt = code == make_fourcc('D', 'X', 'T', '1') || code == make_fourcc('D', 'X', 'T', '3') || code == make_fourcc('D', 'X', 'T', '5');
+        bool is_bc45 =
+          code == make_fourcc('A', 'T', 'I', '1') || code == make_fourcc('B', 'C', '4', 'U') ||
+          code == make_fourcc('A', 'T', 'I', '2') || code == make_fourcc('B', 'C', '5', 'U')
+        ;
+
+        if (is_bc45 || ( is_dxt && decompress )) {
+          width = le4(header->width);
+          height = le4(header->height);
+          format = 0x1908; // GL_RGBA
+          unsigned levels = le4(header->flags) & ddsd_mipmapcount ? le4(header->mipmap_count) : 1;
+          decode_levels(image, code, width, height, levels ? levels : 1, src + 128, src_max);
+          if (!num_levels) {
+            width = height = 0;
+          }
+          return;
+        }
+
+        if (is_dxt) {
           width = le4(header->width);
           height = le4(header->height);
 
@@ -303,6 +511,16 @@ namespace octet {
           image.resize(size);
           memcpy(&image[0], src + 128, size);
 
+          // count the levels that are in the file
+          unsigned levels = le4(header->flags) & ddsd_mipmapcount ? le4(header->mipmap_count) : 1;
+          unsigned offset = 0;
+          for (unsigned w = width, h = height; num_levels != ( levels ? levels : 1 ) && w && h; w = next_size(w), h = next_size(h)) {
+            offset += get_level_size(code, w, h);
+            if (offset > size) break;
+            num_levels++;
+            if (w == 1 && h == 1) break;
+          }
+
           // dds textures are upside down, flip them!
           switch (format) {
             case COMPRESSED_RGB_S3TC_DXT1_EXT: flip_dxt1(image, width, height); break;
@@ -312,7 +530,7 @@ namespace octet {
           return;
         }
       }
-      printf("warning: DDS decoder only supports DXTn\n");
+      printf("warning: DDS decoder only supports DXTn, BC4 and BC5\n");
     }
   };
 }
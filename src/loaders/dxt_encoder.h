@@ -0,0 +1,593 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+//
+// DXT1 and DXT5 (BC1 and BC3) texture encoder
+//
+// See http://www.opengl.org/registry/specs/EXT/texture_compression_s3tc.txt
+//
+// Compressed textures take 1/8 (DXT1) or 1/4 (DXT5) of the video memory
+// of RGBA and upload that much faster.
+//
+// Each 4x4 block stores two 565 colours and a 2 bit index per pixel
+// choosing one of the two colours or one of two in between. We find the
+// colours like this:
+//   solid blocks use a table of the best pair of colours for each value.
+//   otherwise take the main axis of the colours (power method on the
+//   covariance) and use the two pixels at the ends of the axis.
+//   choose the indices by projecting the pixels onto the line between the colours.
+//   refine the colours with a least squares fit to the pixels for those indices.
+//
+// quality_high repeats the last two steps until the error stops falling.
+// DXT5 adds a block of 8 bit alpha values with 3 bit indices.
+//
+// Rows of blocks are shared between the cpus (see parallel_for).
+// The projections have SSE2 versions (see OCTET_SSE2) which give exactly
+// the same results as the C versions.
+//
+// example:
+//
+//   dxt_encoder enc;
+//   dynarray<uint8_t> dxt;
+//   enc.encode_mips(dxt, pixels, size, width, height, 4, true);  // DXT5 with all the mips
+//
+namespace octet {
+  class dxt_encoder {
+  public:
+    enum {
+      quality_fast = 0,
+      quality_high = 1,
+    };
+
+  private:
+    // below this many blocks, threads cost more than they save.
+    enum { min_thread_blocks = 1024 };
+
+    // passes of least squares refinement for quality_high
+    enum { max_refine_passes = 8 };
+
+    unsigned quality;
+    unsigned num_threads;
+
+    // the best pair of 5 or 6 bit end points for a block of one colour.
+    // [0] is colour 0 and [1] colour 1. We use index 2 (2/3 of colour 0 and 1/3 of colour 1)
+    uint8_t match5[256][2];
+    uint8_t match6[256][2];
+
+    // one row of blocks
+    struct row_job {
+      const uint8_t *src;
+      uint8_t *dest;
+      unsigned width;
+      unsigned height;
+      unsigned num_comps;
+      bool bc3;
+    };
+
+    struct job {
+      const dxt_encoder *enc;
+      row_job *rows;
+    };
+
+    static int expand5(int x) { return ( x << 3 ) | ( x >> 2 ); }
+    static int expand6(int x) { return ( x << 2 ) | ( x >> 4 ); }
+
+    // 2/3 of a and 1/3 of b
+    static int lerp13(int a, int b) { return ( a * 2 + b ) / 3; }
+
+    // a * b / 255 rounded
+    static int mul8bit(int a, int b) {
+      int t = a * b + 128;
+      return ( t + ( t >> 8 ) ) >> 8;
+    }
+
+    static unsigned to565(const uint8_t *c) {
+      return ( mul8bit(c[0], 31) << 11 ) | ( mul8bit(c[1], 63) << 5 ) | mul8bit(c[2], 31);
+    }
+
+    static int clamp(float x, int max_value) {
+      int i = (int)x;
+      return i < 0 ? 0 : i > max_value ? max_value : i;
+    }
+
+    // the four colours of a block, RGBA
+    static void get_palette(uint8_t *palette, unsigned c0, unsigned c1) {
+      palette[0] = (uint8_t)expand5(c0 >> 11);
+      palette[1] = (uint8_t)expand6(( c0 >> 5 ) & 0x3f);
+      palette[2] = (uint8_t)expand5(c0 & 0x1f);
+      palette[3] = 0xff;
+      palette[4] = (uint8_t)expand5(c1 >> 11);
+      palette[5] = (uint8_t)expand6(( c1 >> 5 ) & 0x3f);
+      palette[6] = (uint8_t)expand5(c1 & 0x1f);
+      palette[7] = 0xff;
+      for (unsigned i = 0; i != 3; ++i) {
+        palette[8 + i] = (uint8_t)lerp13(palette[i], palette[4 + i]);
+        palette[12 + i] = (uint8_t)lerp13(palette[4 + i], palette[i]);
+      }
+      palette[11] = palette[15] = 0xff;
+    }
+
+    // fill the single colour tables
+    void build_tables() {
+      for (int i = 0; i != 256; ++i) {
+        int best5 = 0x7fffffff, best6 = 0x7fffffff;
+        for (int a = 0; a != 64; ++a) {
+          for (int b = 0; b != 64; ++b) {
+            // the interpolated colour can be out by 3% on some hardware, so prefer close pairs.
+            if (a < 32 && b < 32) {
+              int ea = expand5(a), eb = expand5(b);
+              int err = abs(lerp13(ea, eb) - i) * 100 + abs(ea - eb) * 3;
+              if (err < best5) { best5 = err; match5[i][0] = (uint8_t)a; match5[i][1] = (uint8_t)b; }
+            }
+            int ea = expand6(a), eb = expand6(b);
+            int err = abs(lerp13(ea, eb) - i) * 100 + abs(ea - eb) * 3;
+            if (err < best6) { best6 = err; match6[i][0] = (uint8_t)a; match6[i][1] = (uint8_t)b; }
+          }
+        }
+      }
+    }
+
+    // copy a 4x4 block of pixels to RGBA, repeating the last row and column at the edges.
+    static void load_block(uint8_t *block, const uint8_t *src, unsigned x, unsigned width, unsigned height, unsigned num_comps) {
+      unsigned stride = width * num_comps;
+      if (num_comps == 4 && x + 4 <= width && height == 4) {
+        for (unsigned j = 0; j != 4; ++j) {
+          memcpy(block + j * 16, src + j * stride + x * 4, 16);
+        }
+        return;
+      }
+      for (unsigned j = 0; j != 4; ++j) {
+        const uint8_t *row = src + ( j < height ? j : height - 1 ) * stride;
+        for (unsigned i = 0; i != 4; ++i) {
+          unsigned xi = x + i < width ? x + i : width - 1;
+          const uint8_t *p = row + xi * num_comps;
+          uint8_t *d = block + ( j * 4 + i ) * 4;
+          d[0] = p[0];
+          d[1] = p[1];
+          d[2] = p[2];
+          d[3] = num_comps == 4 ? p[3] : 0xff;
+        }
+      }
+    }
+
+    // dot products of the 16 pixels with a direction. dir must fit in 16 bits.
+    static OCTET_HOT void get_dots(int *dots, const uint8_t *block, int dr, int dg, int db) {
+      #if OCTET_SSE2
+        __m128i zero = _mm_setzero_si128();
+        __m128i dir = _mm_setr_epi16((short)dr, (short)dg, (short)db, 0, (short)dr, (short)dg, (short)db, 0);
+        for (unsigned i = 0; i != 4; ++i) {
+          __m128i p = _mm_loadu_si128((const __m128i*)(block + i * 16));
+          // r*dr + g*dg and b*db for each pixel
+          __m128 lo = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpacklo_epi8(p, zero), dir));
+          __m128 hi = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpackhi_epi8(p, zero), dir));
+          __m128i even = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+          __m128i odd = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+          _mm_storeu_si128((__m128i*)(dots + i * 4), _mm_add_epi32(even, odd));
+        }
+      #else
+        for (unsigned i = 0; i != 16; ++i) {
+          const uint8_t *p = block + i * 4;
+          dots[i] = p[0] * dr + p[1] * dg + p[2] * db;
+        }
+      #endif
+    }
+
+    // spread 16 bits out to the even bits of a 32 bit word
+    static unsigned spread_bits(unsigned x) {
+      x = ( x | ( x << 8 ) ) & 0x00ff00ff;
+      x = ( x | ( x << 4 ) ) & 0x0f0f0f0f;
+      x = ( x | ( x << 2 ) ) & 0x33333333;
+      x = ( x | ( x << 1 ) ) & 0x55555555;
+      return x;
+    }
+
+    // choose the nearest colour for each pixel. The colours are on a line, so
+    // we project the pixels onto the line and compare with the mid points.
+    static OCTET_HOT unsigned match_colors(const uint8_t *block, const uint8_t *palette) {
+      int dr = palette[0] - palette[4];
+      int dg = palette[1] - palette[5];
+      int db = palette[2] - palette[6];
+
+      int stops[4];
+      for (unsigned i = 0; i != 4; ++i) {
+        stops[i] = palette[i*4+0] * dr + palette[i*4+1] * dg + palette[i*4+2] * db;
+      }
+
+      // along the line the colours go 1, 3, 2, 0.
+      // these are doubled so that we don't lose the bottom bit.
+      int c1_point = stops[1] + stops[3];
+      int half_point = stops[3] + stops[2];
+      int c2_point = stops[2] + stops[0];
+
+      int dots[16];
+      get_dots(dots, block, dr, dg, db);
+
+      #if OCTET_SSE2
+        // index = below half | (below c2 and not below c1) << 1
+        __m128i c1 = _mm_set1_epi32(c1_point);
+        __m128i half = _mm_set1_epi32(half_point);
+        __m128i c2 = _mm_set1_epi32(c2_point);
+        __m128i bit0[4], bit1[4];
+        for (unsigned i = 0; i != 4; ++i) {
+          __m128i dot = _mm_slli_epi32(_mm_loadu_si128((const __m128i*)(dots + i * 4)), 1);
+          bit0[i] = _mm_cmplt_epi32(dot, half);
+          bit1[i] = _mm_andnot_si128(_mm_cmplt_epi32(dot, c1), _mm_cmplt_epi32(dot, c2));
+        }
+        unsigned mask0 = _mm_movemask_epi8(_mm_packs_epi16(_mm_packs_epi32(bit0[0], bit0[1]), _mm_packs_epi32(bit0[2], bit0[3])));
+        unsigned mask1 = _mm_movemask_epi8(_mm_packs_epi16(_mm_packs_epi32(bit1[0], bit1[1]), _mm_packs_epi32(bit1[2], bit1[3])));
+        return spread_bits(mask0) | ( spread_bits(mask1) << 1 );
+      #else
+        unsigned mask = 0;
+        for (int i = 15; i >= 0; --i) {
+          int dot = dots[i] * 2;
+          mask <<= 2;
+          if (dot < half_point) {
+            mask |= dot < c1_point ? 1 : 3;
+          } else {
+            mask |= dot < c2_point ? 2 : 0;
+          }
+        }
+        return mask;
+      #endif
+    }
+
+    // sum of squared differences between the block and what the decoder will make of it
+    static unsigned get_error(const uint8_t *block, const uint8_t *palette, unsigned mask) {
+      unsigned error = 0;
+      for (unsigned i = 0; i != 16; ++i, mask >>= 2) {
+        const uint8_t *p = block + i * 4;
+        const uint8_t *c = palette + ( mask & 3 ) * 4;
+        int dr = p[0] - c[0], dg = p[1] - c[1], db = p[2] - c[2];
+        error += dr * dr + dg * dg + db * db;
+      }
+      return error;
+    }
+
+    // pick the end points from the main axis of the colours
+    static OCTET_HOT void choose_endpoints(const uint8_t *block, unsigned &c0, unsigned &c1) {
+      int sum[3] = { 0, 0, 0 };
+      int lo[3] = { 255, 255, 255 };
+      int hi[3] = { 0, 0, 0 };
+      for (unsigned i = 0; i != 16; ++i) {
+        for (unsigned c = 0; c != 3; ++c) {
+          int v = block[i*4+c];
+          sum[c] += v;
+          lo[c] = v < lo[c] ? v : lo[c];
+          hi[c] = v > hi[c] ? v : hi[c];
+        }
+      }
+
+      int mean[3] = { ( sum[0] + 8 ) >> 4, ( sum[1] + 8 ) >> 4, ( sum[2] + 8 ) >> 4 };
+      int cov[6] = { 0, 0, 0, 0, 0, 0 };
+      for (unsigned i = 0; i != 16; ++i) {
+        int r = block[i*4+0] - mean[0];
+        int g = block[i*4+1] - mean[1];
+        int b = block[i*4+2] - mean[2];
+        cov[0] += r * r;
+        cov[1] += r * g;
+        cov[2] += r * b;
+        cov[3] += g * g;
+        cov[4] += g * b;
+        cov[5] += b * b;
+      }
+
+      // power method: start with the diagonal of the bounding box
+      float covf[6];
+      for (unsigned i = 0; i != 6; ++i) {
+        covf[i] = cov[i] * ( 1.0f / 255 );
+      }
+      float vr = (float)( hi[0] - lo[0] );
+      float vg = (float)( hi[1] - lo[1] );
+      float vb = (float)( hi[2] - lo[2] );
+      for (unsigned i = 0; i != 4; ++i) {
+        float r = vr * covf[0] + vg * covf[1] + vb * covf[2];
+        float g = vr * covf[1] + vg * covf[3] + vb * covf[4];
+        float b = vr * covf[2] + vg * covf[4] + vb * covf[5];
+        vr = r; vg = g; vb = b;
+      }
+
+      float magnitude = fabsf(vr);
+      magnitude = fabsf(vg) > magnitude ? fabsf(vg) : magnitude;
+      magnitude = fabsf(vb) > magnitude ? fabsf(vb) : magnitude;
+
+      int dr, dg, db;
+      if (magnitude < 4.0f) {
+        // no clear axis, use luminance
+        dr = 299; dg = 587; db = 114;
+      } else {
+        float scale = 512.0f / magnitude;
+        dr = (int)( vr * scale );
+        dg = (int)( vg * scale );
+        db = (int)( vb * scale );
+      }
+
+      int dots[16];
+      get_dots(dots, block, dr, dg, db);
+      unsigned min_i = 0, max_i = 0;
+      for (unsigned i = 1; i != 16; ++i) {
+        if (dots[i] < dots[min_i]) min_i = i;
+        if (dots[i] > dots[max_i]) max_i = i;
+      }
+      c0 = to565(block + max_i * 4);
+      c1 = to565(block + min_i * 4);
+    }
+
+    // least squares fit of the end points to the pixels for these indices.
+    // returns false if the end points did not change.
+    bool refine(const uint8_t *block, unsigned &c0, unsigned &c1, unsigned mask) const {
+      // weight of colour 0 (out of 3) for each index
+      static const int w0_table[4] = { 3, 0, 2, 1 };
+      unsigned old0 = c0, old1 = c1;
+
+      if ((mask ^ ( mask << 2 )) < 4) {
+        // all the same index: the equations have no single answer, so use the mean colour.
+        int r = 8, g = 8, b = 8;
+        for (unsigned i = 0; i != 16; ++i) {
+          r += block[i*4+0];
+          g += block[i*4+1];
+          b += block[i*4+2];
+        }
+        r >>= 4; g >>= 4; b >>= 4;
+        c0 = ( match5[r][0] << 11 ) | ( match6[g][0] << 5 ) | match5[b][0];
+        c1 = ( match5[r][1] << 11 ) | ( match6[g][1] << 5 ) | match5[b][1];
+      } else {
+        int xx = 0, yy = 0, xy = 0;
+        int at0[3] = { 0, 0, 0 };
+        int at1[3] = { 0, 0, 0 };
+        for (unsigned i = 0; i != 16; ++i, mask >>= 2) {
+          int w0 = w0_table[mask & 3];
+          int w1 = 3 - w0;
+          xx += w0 * w0;
+          yy += w1 * w1;
+          xy += w0 * w1;
+          for (unsigned c = 0; c != 3; ++c) {
+            at0[c] += w0 * block[i*4+c];
+            at1[c] += w1 * block[i*4+c];
+          }
+        }
+
+        // solve [xx xy; xy yy] [c0; c1] = 3 [at0; at1] and scale to 5 and 6 bits.
+        float f5 = 3.0f * 31.0f / 255.0f / ( xx * yy - xy * xy );
+        float f6 = f5 * ( 63.0f / 31.0f );
+        c0 =
+          ( clamp(( at0[0] * yy - at1[0] * xy ) * f5 + 0.5f, 31) << 11 ) |
+          ( clamp(( at0[1] * yy - at1[1] * xy ) * f6 + 0.5f, 63) << 5 ) |
+          ( clamp(( at0[2] * yy - at1[2] * xy ) * f5 + 0.5f, 31) << 0 )
+        ;
+        c1 =
+          ( clamp(( at1[0] * xx - at0[0] * xy ) * f5 + 0.5f, 31) << 11 ) |
+          ( clamp(( at1[1] * xx - at0[1] * xy ) * f6 + 0.5f, 63) << 5 ) |
+          ( clamp(( at1[2] * xx - at0[2] * xy ) * f5 + 0.5f, 31) << 0 )
+        ;
+      }
+      return c0 != old0 || c1 != old1;
+    }
+
+    // colour part of a DXT1 or DXT5 block
+    OCTET_HOT void encode_color_block(uint8_t *dest, const uint8_t *block) const {
+      unsigned c0, c1, mask;
+
+      bool solid = true;
+      for (unsigned i = 4; i != 64; i += 4) {
+        if (block[i] != block[0] || block[i+1] != block[1] || block[i+2] != block[2]) {
+          solid = false;
+          break;
+        }
+      }
+
+      uint8_t palette[16];
+      if (solid) {
+        int r = block[0], g = block[1], b = block[2];
+        c0 = ( match5[r][0] << 11 ) | ( match6[g][0] << 5 ) | match5[b][0];
+        c1 = ( match5[r][1] << 11 ) | ( match6[g][1] << 5 ) | match5[b][1];
+        mask = 0xaaaaaaaa;
+      } else {
+        choose_endpoints(block, c0, c1);
+        get_palette(palette, c0, c1);
+        mask = c0 != c1 ? match_colors(block, palette) : 0;
+
+        if (quality == quality_fast) {
+          // one pass of refinement gets most of the benefit
+          if (refine(block, c0, c1, mask)) {
+            get_palette(palette, c0, c1);
+            mask = c0 != c1 ? match_colors(block, palette) : 0;
+          }
+        } else {
+          // keep going while the error falls
+          unsigned best0 = c0, best1 = c1, best_mask = mask;
+          unsigned best_error = get_error(block, palette, mask);
+          for (unsigned pass = 0; pass != max_refine_passes && best_error; ++pass) {
+            if (!refine(block, c0, c1, mask)) break;
+            get_palette(palette, c0, c1);
+            mask = c0 != c1 ? match_colors(block, palette) : 0;
+            unsigned error = get_error(block, palette, mask);
+            if (error >= best_error) break;
+            best_error = error;
+            best0 = c0; best1 = c1; best_mask = mask;
+          }
+          c0 = best0; c1 = best1; mask = best_mask;
+        }
+      }
+
+      // colour 0 must be the larger or we get the three colour mode.
+      if (c0 < c1) {
+        unsigned t = c0; c0 = c1; c1 = t;
+        mask ^= 0x55555555;
+      } else if (c0 == c1) {
+        mask = 0;
+      }
+
+      dest[0] = (uint8_t)c0;
+      dest[1] = (uint8_t)( c0 >> 8 );
+      dest[2] = (uint8_t)c1;
+      dest[3] = (uint8_t)( c1 >> 8 );
+      dest[4] = (uint8_t)mask;
+      dest[5] = (uint8_t)( mask >> 8 );
+      dest[6] = (uint8_t)( mask >> 16 );
+      dest[7] = (uint8_t)( mask >> 24 );
+    }
+
+    // alpha part of a DXT5 block: the end points are the min and max alpha.
+    // the indices are the nearest of the eight values, see
+    // http://fgiesen.wordpress.com/2009/12/15/dxt5-alpha-block-index-determination/
+    static OCTET_HOT void encode_alpha_block(uint8_t *dest, const uint8_t *block) {
+      int lo = block[3], hi = block[3];
+      for (unsigned i = 1; i != 16; ++i) {
+        int a = block[i*4+3];
+        lo = a < lo ? a : lo;
+        hi = a > hi ? a : hi;
+      }
+      dest[0] = (uint8_t)hi;
+      dest[1] = (uint8_t)lo;
+      dest += 2;
+
+      int dist = hi - lo;
+      int dist2 = dist * 2;
+      int dist4 = dist * 4;
+      int bias = ( dist < 8 ? dist - 1 : dist / 2 + 2 ) - lo * 7;
+
+      unsigned acc = 0, bits = 0;
+      for (unsigned i = 0; i != 16; ++i) {
+        // position between lo (0) and hi (7)
+        int a = block[i*4+3] * 7 + bias;
+        int index = 0;
+        if (a >= dist4) { index += 4; a -= dist4; }
+        if (a >= dist2) { index += 2; a -= dist2; }
+        if (a >= dist) { index += 1; }
+
+        // 0 and 1 are the end points, 2..7 are in between from hi to lo
+        index = -index & 7;
+        index ^= index < 2;
+
+        acc |= index << bits;
+        bits += 3;
+        if (bits >= 8) {
+          *dest++ = (uint8_t)acc;
+          acc >>= 8;
+          bits -= 8;
+        }
+      }
+    }
+
+    void encode_row(const row_job &row) const {
+      uint8_t block[64];
+      unsigned block_size = row.bc3 ? 16 : 8;
+      uint8_t *dest = row.dest;
+      for (unsigned x = 0; x < row.width; x += 4) {
+        load_block(block, row.src, x, row.width, row.height, row.num_comps);
+        if (row.bc3) {
+          encode_alpha_block(dest, block);
+          encode_color_block(dest + 8, block);
+        } else {
+          encode_color_block(dest, block);
+        }
+        dest += block_size;
+      }
+    }
+
+    static void encode_row_task(void *arg, unsigned index) {
+      job *j = (job*)arg;
+      j->enc->encode_row(j->rows[index]);
+    }
+
+    // add the rows of one level to a list of jobs
+    static void add_rows(dynarray<row_job> &rows, uint8_t *dest, const uint8_t *src, unsigned width, unsigned height, unsigned num_comps, bool bc3) {
+      unsigned block_size = bc3 ? 16 : 8;
+      unsigned row_bytes = ( width + 3 ) / 4 * block_size;
+      for (unsigned y = 0; y < height; y += 4) {
+        row_job r = { src + y * width * num_comps, dest, width, height - y < 4 ? height - y : 4, num_comps, bc3 };
+        rows.push_back(r);
+        dest += row_bytes;
+      }
+    }
+
+    void run(dynarray<row_job> &rows, unsigned num_blocks) {
+      job j = { this, rows.size() ? &rows[0] : 0 };
+      unsigned threads = num_threads ? num_threads : thread::get_num_cpus();
+      if (num_blocks < min_thread_blocks) threads = 1;
+      parallel_for::run(rows.size(), encode_row_task, (void*)&j, threads);
+    }
+
+    dxt_encoder(const dxt_encoder &rhs);
+    void operator=(const dxt_encoder &rhs);
+  public:
+    dxt_encoder() {
+      quality = quality_fast;
+      num_threads = 0;
+      build_tables();
+    }
+
+    // quality_fast or quality_high
+    void set_quality(unsigned value) {
+      quality = value;
+    }
+
+    // threads to use for big images. 0 is one per cpu and 1 never starts threads.
+    void set_num_threads(unsigned value) {
+      num_threads = value;
+    }
+
+    static unsigned next_size(unsigned size) {
+      return size > 1 ? size >> 1 : 1;
+    }
+
+    // bytes in one encoded level
+    static unsigned get_level_size(unsigned width, unsigned height, bool bc3) {
+      return ( ( width + 3 ) / 4 ) * ( ( height + 3 ) / 4 ) * ( bc3 ? 16 : 8 );
+    }
+
+    // true if any pixel is not opaque, so we need DXT5.
+    static bool has_alpha(const uint8_t *src, unsigned num_pixels) {
+      for (unsigned i = 0; i != num_pixels; ++i) {
+        if (src[i*4+3] != 0xff) return true;
+      }
+      return false;
+    }
+
+    // encode an image of 3 (RGB) or 4 (RGBA) byte pixels.
+    // dest must have room for get_level_size() bytes.
+    void encode(uint8_t *dest, const uint8_t *src, unsigned width, unsigned height, unsigned num_comps, bool bc3) {
+      if (!width || !height) return;
+      dynarray<row_job> rows;
+      add_rows(rows, dest, src, width, height, num_comps, bc3);
+      run(rows, get_level_size(width, height, false) / 8);
+    }
+
+    // encode a chain of mip levels, one after the other, each half the size of
+    // the one before but never less than one (see mip_builder). returns the number of levels.
+    unsigned encode_mips(dynarray<uint8_t> &result, const uint8_t *src, unsigned src_size, unsigned width, unsigned height, unsigned num_comps, bool bc3) {
+      // find the levels first so that we can do all the rows at once.
+      unsigned num_levels = 0;
+      unsigned dest_size = 0;
+      unsigned src_offset = 0;
+      for (unsigned w = width, h = height; w && h; w = next_size(w), h = next_size(h)) {
+        if (src_offset + w * h * num_comps > src_size) break;
+        src_offset += w * h * num_comps;
+        dest_size += get_level_size(w, h, bc3);
+        num_levels++;
+        if (w == 1 && h == 1) break;
+      }
+
+      result.resize(dest_size);
+      if (!num_levels) return 0;
+
+      dynarray<row_job> rows;
+      unsigned dest_offset = 0;
+      src_offset = 0;
+      unsigned w = width, h = height;
+      for (unsigned level = 0; level != num_levels; ++level) {
+        add_rows(rows, &result[dest_offset], src + src_offset, w, h, num_comps, bc3);
+        src_offset += w * h * num_comps;
+        dest_offset += get_level_size(w, h, bc3);
+        w = next_size(w);
+        h = next_size(h);
+      }
+
+      run(rows, dest_size / ( bc3 ? 16 : 8 ));
+      return num_levels;
+    }
+  };
+}
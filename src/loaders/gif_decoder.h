@@ -6,205 +6,494 @@
 //
 //
 // gif file decoder - only the most common variants
-// 
+//
+// get_image() gives the first frame. For animations, open the file and ask
+// for frames as you need them:
+//
+//   gif_decoder dec;
+//   dec.open(&file[0], &file[0] + file.size());   // file must stay in memory
+//   for (unsigned i = 0; i != dec.get_num_frames(); ++i) {
+//     dec.get_frame(image, i);
+//     ... show image for dec.get_delay(i) hundredths of a second ...
+//   }
+//
+// Each frame is drawn over the one before, so the decoder keeps the last
+// frame it made. Playing forwards costs one frame decode per frame.
+// Frames asked for out of order come from a small cache or are rebuilt
+// from the nearest frame we have.
+//
 namespace octet {
   class gif_decoder {
-    uint16_t lzw_head[0x1001];
-    uint8_t lzw_tail[0x1001];
     enum { debug_gif = 0 };
 
-    // add a lzw string for a specific code.
-    // all strings consist of a head and a single byte tail.
-    // we follow the chains to get the whole string.
-    uint8_t add_lwz_string(unsigned code, uint8_t *&bytes, uint8_t *max_bytes, unsigned reset_code) {
-      unsigned i = code;
-      unsigned num_bytes = 1;
-      for (; i > reset_code; i = lzw_head[i]) {
-        num_bytes++;
-      }
+    // LZW codes are up to 12 bits
+    enum { max_codes = 0x1000 };
+
+    // frames we keep for get_frame()
+    enum { max_cache_size = 16 };
+
+    // The LZW string table.
+    // A new code is the previous string plus the first byte of the next one,
+    // and these are next to each other in the output. So every string is
+    // somewhere in the output already and we copy it as a run.
+    uint32_t lzw_pos[max_codes];
+    uint16_t lzw_len[max_codes];
+
+    // disposal methods from the graphics control extension
+    enum {
+      dispose_none = 1,
+      dispose_background = 2,
+      dispose_previous = 3,
+    };
+
+    // where to find each frame in the file
+    struct frame {
+      const uint8_t *data;          // the LZW minimum code size, then the data blocks
+      const uint8_t *color_table;
+      unsigned color_table_size;
+      unsigned left, top, width, height;
+      unsigned delay;               // hundredths of a second
+      unsigned disposal;
+      unsigned transparent_index;   // 0x100 for none
+      bool interlaced;
+    };
+
+    struct cache_entry {
+      int frame_index;
+      unsigned last_used;
+      dynarray<uint8_t> pixels;
+    };
+
+    const uint8_t *file_max;
+    unsigned width;
+    unsigned height;
+    unsigned loop_count;
+    dynarray<frame> frames;
+
+    // the canvas after drawing canvas_frame (-1 if blank)
+    dynarray<uint8_t> canvas;
+    int canvas_frame;
+
+    // the canvas before canvas_frame for dispose_previous
+    dynarray<uint8_t> previous;
+
+    // palette indices for one frame
+    dynarray<uint8_t> indices;
+
+    cache_entry cache[max_cache_size];
+    unsigned cache_size;
+    unsigned use_count;
 
-      uint8_t *dest = bytes += num_bytes;
-      if (bytes > max_bytes) return 0;
-      i = code;
-      for (; i > reset_code; i = lzw_head[i]) {
-        *--dest = lzw_tail[i];
+    // skip a chain of data sub-blocks. returns 0 if it runs off the end of the file.
+    static const uint8_t *skip_blocks(const uint8_t *src, const uint8_t *src_max) {
+      while (src < src_max && *src) {
+        src += *src + 1;
       }
-      *--dest = i;
+      return src < src_max ? src + 1 : 0;
+    }
 
-      if (debug_gif) {
-        for (unsigned i = 0; i != num_bytes; ++i) {
-          printf("out %02x\n", dest[i]);
+    // copy a run of output. The source can overlap the destination
+    // (the string for a code we are just adding) so we copy forwards.
+    // Most strings are short, so memcpy is only worth it for long ones.
+    static void copy_run(uint8_t *dest, const uint8_t *src, unsigned len) {
+      if (len > 16 && src + len <= dest) {
+        memcpy(dest, src, len);
+      } else {
+        for (unsigned i = 0; i != len; ++i) {
+          dest[i] = src[i];
         }
-      }    
-      return i;
+      }
     }
 
     // decode image data from a gif file as a lzw coding of palette values
-    bool gif_decode_bytes(uint8_t *bytes, uint8_t *max_bytes, int min_lzw_size, const uint8_t *&srcref) {
+    // returns true if the data is broken.
+    bool gif_decode_bytes(uint8_t *bytes, uint8_t *max_bytes, int min_lzw_size, const uint8_t *&srcref, const uint8_t *src_max) {
+      if (min_lzw_size < 2 || min_lzw_size > 11) return true;
+
       const uint8_t *src = srcref;
+      unsigned clear_code = 1 << min_lzw_size;
+      unsigned end_code = clear_code + 1;
+      unsigned next_code = clear_code + 2;
       unsigned lzw_size = min_lzw_size + 1;
-      unsigned reset_code = ( 1 << min_lzw_size );
-      unsigned mask = reset_code * 2 - 1;
-      unsigned cur_code = reset_code + 1;
+      unsigned mask = ( 1 << lzw_size ) - 1;
 
       unsigned acc = 0;
       unsigned bits = 0;
-      unsigned prev_code = ~0;
+      unsigned size = (unsigned)(max_bytes - bytes);
+      unsigned pos = 0;
+
+      // the last string we output
+      bool has_prev = false;
+      unsigned prev_pos = 0;
+      unsigned prev_len = 0;
+      bool done = false;
 
-      while (*src) {
+      while (!done && src < src_max && *src) {
         unsigned len = *src++;
-        do {
-          unsigned byte = *src++;
-          acc |= byte << bits;
+        if (src + len > src_max) return true;
+        const uint8_t *block_max = src + len;
+        while (!done && src != block_max) {
+          acc |= *src++ << bits;
           bits += 8;
-          if (debug_gif) printf("byte %02x acc=%08x bits=%d\n", byte, acc, bits);
           while (bits >= lzw_size) {
             unsigned code = acc & mask;
-            if (debug_gif) printf("code=%03x\n", code);
-            bits -= lzw_size;
             acc >>= lzw_size;
-            if ((code & ~1) == reset_code) {
-              if (code == reset_code+1) {
-                // end
-                break;
-              } else {
-                // reset
-                lzw_size = min_lzw_size + 1;
-                cur_code = reset_code + 1;
-                mask = reset_code * 2 - 1;
-              }
+            bits -= lzw_size;
+            if (debug_gif) printf("code=%03x\n", code);
+
+            if (code == clear_code) {
+              next_code = clear_code + 2;
+              lzw_size = min_lzw_size + 1;
+              mask = ( 1 << lzw_size ) - 1;
+              has_prev = false;
+              continue;
+            } else if (code == end_code) {
+              done = true;
+              break;
+            }
+
+            // work out the string for this code
+            const uint8_t *str;
+            unsigned str_len;
+            uint8_t root;
+            if (code < clear_code) {
+              root = (uint8_t)code;
+              str = &root;
+              str_len = 1;
+            } else if (has_prev && code < next_code) {
+              str = bytes + lzw_pos[code];
+              str_len = lzw_len[code];
+            } else if (has_prev && code == next_code) {
+              // the code we are about to add: previous string + its own first byte
+              str = bytes + prev_pos;
+              str_len = prev_len + 1;
             } else {
-              if (
-                (prev_code == ~0 && code >= reset_code) ||
-                code > cur_code
-              ) {
-                return true;
-              }
+              return true;
+            }
 
-              uint8_t tail = 0;
-              if (code == cur_code) {
-                *bytes++ = tail = add_lwz_string(prev_code, bytes, max_bytes-1, reset_code);
-                if (debug_gif) printf("out %02x\n", tail);
-              } else {
-                tail = add_lwz_string(code, bytes, max_bytes, reset_code);
-              }
+            // too much data is allowed, but we ignore it.
+            if (str_len > size - pos) {
+              str_len = size - pos;
+              done = true;
+            }
+            copy_run(bytes + pos, str, str_len);
 
-              if (bytes > max_bytes) return true;
-
-              lzw_head[cur_code] = prev_code;
-              lzw_tail[cur_code] = tail;
-              prev_code = code;
-
-              cur_code++;
-              if (cur_code > mask) {
-                if (debug_gif) printf("resize\n");
-                if (mask != 0xfff) {
-                  lzw_size++;
-                  mask = mask * 2 + 1;
-                } else {
-                  cur_code = 0x1000;
-                }
+            if (has_prev && next_code < max_codes) {
+              lzw_pos[next_code] = prev_pos;
+              lzw_len[next_code] = (uint16_t)( prev_len + 1 );
+              next_code++;
+              if (next_code > mask && lzw_size < 12) {
+                lzw_size++;
+                mask = mask * 2 + 1;
               }
             }
-          } 
-        } while( --len );
+
+            has_prev = true;
+            prev_pos = pos;
+            prev_len = str_len;
+            pos += str_len;
+            if (done) break;
+          }
+        }
+        src = block_max;
       }
-      src++;
+
+      // skip any blocks we did not need
+      src = skip_blocks(src, src_max);
+      if (!src) return true;
       srcref = src;
       return false;
     }
 
-  public:
-    // get an opengl texture from a file in memory
-    void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width, uint16_t &height, const uint8_t *src, const uint8_t *src_max) {
+    // find the frames in a file
+    bool parse(const uint8_t *src, const uint8_t *src_max) {
+      if (src_max - src < 13 || memcmp(src, "GIF", 3)) return false;
+
       width = src[6] + src[7]*256;
       height = src[8] + src[9]*256;
+      if (!width || !height) return false;
       unsigned flags = src[10];
       unsigned gct_size = flags & 0x80 ? 1 << ((flags & 7)+1) : 0;
-      //unsigned background = src[11];
-      //unsigned aspect = src[12];
-      unsigned transparency_index = 0x100; // disable transparency
-
-      unsigned size = width * height * 4;
-      image.resize(size);
-      format = 0x1908; // GL_RGBA
-
-      memset(&image[0], 0xff, size);
       src += 13;
       const uint8_t *gct = src;
       src += gct_size * 3;
+
+      // the graphics control extension applies to the next image
+      unsigned delay = 0;
+      unsigned disposal = 0;
+      unsigned transparent_index = 0x100;
+
       while (src < src_max) {
         unsigned code = *src++;
         if (code == 0x3b) {
           // end
           break;
         } else if (code == 0x21) {
-          if (*src == 0xf9) {
+          if (src + 2 > src_max) return false;
+          if (src[0] == 0xf9 && src[1] >= 4 && src + 6 <= src_max) {
             // graphics control extension
-            //unsigned block_size = src[1];
             unsigned flags = src[2];
-            //unsigned delay = src[3] + src[4] * 256;
-            transparency_index = flags & 1 ? src[5] : 0x100;
-
-            src++;
-            while (*src) {
-              if (debug_gif) printf("    len=%02x\n", *src);
-              src += *src + 1;
-            }
-            src++;
-          } else {
-            // unknown extension
-            src++;
-            while (*src) {
-              if (debug_gif) printf("    len=%02x\n", *src);
-              src += *src + 1;
-            }
-            src++;
+            delay = src[3] + src[4] * 256;
+            disposal = ( flags >> 2 ) & 7;
+            transparent_index = flags & 1 ? src[5] : 0x100;
+          } else if (src[0] == 0xff && src[1] == 11 && src + 17 <= src_max && !memcmp(src + 2, "NETSCAPE2.0", 11) && src[13] >= 3) {
+            // looping animation
+            loop_count = src[15] + src[16] * 256;
           }
+          src = skip_blocks(src + 1, src_max);
+          if (!src) return false;
         } else if (code == 0x2c) {
           // image descriptor
-          unsigned left = src[0] + src[1]*256;
-          unsigned top = src[2] + src[3]*256;
-          unsigned lwidth = src[4] + src[5]*256;
-          unsigned lheight = src[6] + src[7]*256;
+          if (src + 10 > src_max) return false;
+          frame f;
+          f.left = src[0] + src[1]*256;
+          f.top = src[2] + src[3]*256;
+          f.width = src[4] + src[5]*256;
+          f.height = src[6] + src[7]*256;
           unsigned flags = src[8];
-          unsigned lct_size = ( flags & 0x80 ) ? 1 << ((flags & 7)+1) : 0;
+          f.interlaced = ( flags & 0x40 ) != 0;
           src += 9;
-          const uint8_t *color_table = ( flags & 0x80 ) ? src : gct;
-          src += lct_size * 3;
-          unsigned min_lzw_size = *src++;
-
-          dynarray<uint8_t> bytes(lwidth*lheight);
-          bool error = 
-            left + lwidth > width ||
-            top + lheight > height ||
-            gif_decode_bytes(&bytes[0], &bytes[lwidth*lheight], min_lzw_size, src)
-          ;
-          if (error) {
-            printf("warning: gif_decode_bytes - broken gif file\n");
-            goto fail;
+          if (flags & 0x80) {
+            f.color_table = src;
+            f.color_table_size = 1 << ((flags & 7)+1);
+            src += f.color_table_size * 3;
           } else {
-            uint8_t *src = &bytes[0];
-            for (unsigned j = 0; j != lheight; ++j) {
-              uint8_t *dest = &image[((height - 1 - j - top) * width + left) * 4];
-              for (unsigned i = 0; i != lwidth; ++i) {
-                unsigned idx = *src++;
-                dest[0] = color_table[idx*3+0];
-                dest[1] = color_table[idx*3+1];
-                dest[2] = color_table[idx*3+2];
-                dest[3] = idx == transparency_index ? 0x00 : 0xff;
-                //printf("%02x %02x %02x\n", dest[0], dest[1], dest[2]);
-                dest += 4;
-              }
-            }
+            f.color_table = gct;
+            f.color_table_size = gct_size;
           }
+          f.data = src;
+          f.delay = delay;
+          f.disposal = disposal;
+          f.transparent_index = transparent_index;
+          if (src >= src_max) return false;
+          src = skip_blocks(src + 1, src_max);
+          if (!src) return false;
+          frames.push_back(f);
+
+          delay = 0;
+          disposal = 0;
+          transparent_index = 0x100;
         } else {
           printf("warning: unknown gif file section type\n");
+          return false;
         }
       }
-    fail:;
-      //num_components = transparency_index == 0x100 ? 3 : 4;
+      return frames.size() != 0;
+    }
+
+    // draw a frame over the canvas. Transparent pixels leave the canvas alone.
+    bool draw_frame(const frame &f) {
+      unsigned size = f.width * f.height;
+      indices.resize(size ? size : 1);
+      memset(&indices[0], 0, indices.size());
+
+      const uint8_t *src = f.data;
+      unsigned min_lzw_size = *src++;
+      if (gif_decode_bytes(&indices[0], &indices[0] + size, min_lzw_size, src, file_max)) {
+        return false;
+      }
+
+      // unused palette entries are black
+      uint8_t palette[256][4];
+      memset(palette, 0, sizeof(palette));
+      for (unsigned i = 0; i != f.color_table_size; ++i) {
+        palette[i][0] = f.color_table[i*3+0];
+        palette[i][1] = f.color_table[i*3+1];
+        palette[i][2] = f.color_table[i*3+2];
+        palette[i][3] = 0xff;
+      }
+
+      // clip to the canvas
+      unsigned w = f.left >= width ? 0 : f.left + f.width > width ? width - f.left : f.width;
+      unsigned h = f.top >= height ? 0 : f.top + f.height > height ? height - f.top : f.height;
+
+      // interlaced images send every 8th row, then the 4th, 2nd and the rest.
+      unsigned row = 0, pass = 0, step = f.interlaced ? 8 : 1;
+      for (unsigned j = 0; j != f.height; ++j) {
+        if (row < h) {
+          const uint8_t *idx = &indices[j * f.width];
+          // opengl textures are upside down
+          uint8_t *dest = &canvas[((height - 1 - row - f.top) * width + f.left) * 4];
+          for (unsigned i = 0; i != w; ++i, dest += 4) {
+            unsigned index = idx[i];
+            if (index != f.transparent_index) {
+              memcpy(dest, palette[index], 4);
+            }
+          }
+        }
+
+        row += step;
+        while (f.interlaced && row >= f.height && pass != 3) {
+          static const uint8_t starts[] = { 4, 2, 1 };
+          row = starts[pass];
+          step = starts[pass] * 2;
+          pass++;
+        }
+      }
+      return true;
+    }
+
+    // undo a frame before drawing the next one
+    void dispose(const frame &f) {
+      if (f.disposal == dispose_background) {
+        // browsers clear to transparent rather than the background colour
+        unsigned w = f.left >= width ? 0 : f.left + f.width > width ? width - f.left : f.width;
+        unsigned h = f.top >= height ? 0 : f.top + f.height > height ? height - f.top : f.height;
+        for (unsigned j = 0; j != h; ++j) {
+          memset(&canvas[((height - 1 - j - f.top) * width + f.left) * 4], 0, w * 4);
+        }
+      } else if (f.disposal == dispose_previous && previous.size() == canvas.size()) {
+        memcpy(&canvas[0], &previous[0], canvas.size());
+      }
+    }
+
+    // move the canvas on by one frame
+    bool next_frame() {
+      if (canvas_frame >= 0) {
+        dispose(frames[canvas_frame]);
+      }
+      const frame &f = frames[canvas_frame + 1];
+      if (f.disposal == dispose_previous) {
+        previous.resize(canvas.size());
+        memcpy(&previous[0], &canvas[0], canvas.size());
+      }
+      canvas_frame++;
+      return draw_frame(f);
+    }
+
+    cache_entry *find_cached(int n) {
+      for (unsigned i = 0; i != cache_size; ++i) {
+        if (cache[i].frame_index == n) return &cache[i];
+      }
+      return 0;
+    }
+
+    // keep a frame, replacing the one used longest ago
+    void add_to_cache(int n) {
+      if (cache_size == 0) return;
+      cache_entry *best = &cache[0];
+      for (unsigned i = 0; i != cache_size; ++i) {
+        if (cache[i].frame_index < 0) { best = &cache[i]; break; }
+        if (cache[i].last_used < best->last_used) best = &cache[i];
+      }
+      best->frame_index = n;
+      best->last_used = ++use_count;
+      best->pixels.resize(canvas.size());
+      memcpy(&best->pixels[0], &canvas[0], canvas.size());
+    }
+
+    void reset() {
+      width = height = 0;
+      loop_count = 1;
+      frames.resize(0);
+      canvas_frame = -1;
+      for (unsigned i = 0; i != max_cache_size; ++i) {
+        cache[i].frame_index = -1;
+        cache[i].last_used = 0;
+      }
+    }
+
+    gif_decoder(const gif_decoder &rhs);
+    void operator=(const gif_decoder &rhs);
+  public:
+    gif_decoder() {
+      file_max = 0;
+      cache_size = 4;
+      use_count = 0;
+      reset();
+    }
+
+    // find the frames in a gif file. The file must stay in memory while we use it.
+    bool open(const uint8_t *src, const uint8_t *src_max) {
+      reset();
+      file_max = src_max;
+      if (!parse(src, src_max)) {
+        printf("warning: gif_decoder - broken gif file\n");
+        frames.resize(0);
+        return false;
+      }
+      canvas.resize(width * height * 4);
+      memset(&canvas[0], 0, canvas.size());
+      return true;
+    }
+
+    unsigned get_width() const { return width; }
+    unsigned get_height() const { return height; }
+    unsigned get_num_frames() const { return frames.size(); }
+
+    // how long to show a frame, in hundredths of a second
+    unsigned get_delay(unsigned n) const {
+      return n < frames.size() ? frames[n].delay : 0;
+    }
+
+    // times to play the animation, 0 for forever
+    unsigned get_loop_count() const {
+      return loop_count;
+    }
+
+    // how many frames get_frame() keeps, up to 16
+    void set_cache_size(unsigned value) {
+      cache_size = value > max_cache_size ? max_cache_size : value;
+      for (unsigned i = cache_size; i != max_cache_size; ++i) {
+        cache[i].frame_index = -1;
+        cache[i].pixels.reset();
+      }
+    }
+
+    // get frame n as RGBA with all the frames before it drawn underneath.
+    bool get_frame(dynarray<uint8_t> &image, unsigned n) {
+      if (n >= frames.size()) return false;
+
+      image.resize(width * height * 4);
+      if ((int)n == canvas_frame) {
+        memcpy(&image[0], &canvas[0], canvas.size());
+        return true;
+      }
+
+      cache_entry *entry = find_cached((int)n);
+      if (entry) {
+        entry->last_used = ++use_count;
+        memcpy(&image[0], &entry->pixels[0], entry->pixels.size());
+        return true;
+      }
+
+      // start from the blank canvas, the current one or a cached frame, whichever is nearest.
+      // We can't start from a cached frame that restores the one before it.
+      if ((int)n < canvas_frame) {
+        canvas_frame = -1;
+        memset(&canvas[0], 0, canvas.size());
+      }
+      for (unsigned i = 0; i != cache_size; ++i) {
+        cache_entry &e = cache[i];
+        if (e.frame_index > canvas_frame && e.frame_index < (int)n && frames[e.frame_index].disposal != dispose_previous) {
+          canvas_frame = e.frame_index;
+          memcpy(&canvas[0], &e.pixels[0], canvas.size());
+        }
+      }
+
+      while (canvas_frame != (int)n) {
+        if (!next_frame()) {
+          printf("warning: gif_decode_bytes - broken gif file\n");
+          canvas_frame = -1;
+          memset(&canvas[0], 0, canvas.size());
+          return false;
+        }
+      }
+
+      add_to_cache((int)n);
+      memcpy(&image[0], &canvas[0], canvas.size());
+      return true;
+    }
+
+    // get an opengl texture from a file in memory. Animations give the first frame.
+    void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width_, uint16_t &height_, const uint8_t *src, const uint8_t *src_max) {
+      format = 0x1908; // GL_RGBA
+      width_ = height_ = 0;
+      set_cache_size(0);
+      if (open(src, src_max) && get_frame(image, 0)) {
+        width_ = (uint16_t)width;
+        height_ = (uint16_t)height;
+      }
     }
   };
 }
-
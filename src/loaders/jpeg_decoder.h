@@ -8,11 +8,46 @@
 // jpeg file decoder - tiny and fast
 //
 // See http://en.wikipedia.org/wiki/JPEG
-// 
+//
+// The decoder works one row of MCUs at a time:
+//   huffman decode each 8x8 block (most codes take one table lookup)
+//   fixed point inverse DCT into a plane for each component
+//   upsample the chroma planes and convert YCbCr to RGBA
+//
+// The IDCT and colour conversion have SSE2 versions (see OCTET_SSE2)
+// that give exactly the same results as the C versions.
+//
+// Progressive files, and files that send each component in a separate scan,
+// keep the coefficients for the whole image and convert them after the last scan.
+//
+// Data can arrive a bit at a time:
+//
+//   jpeg_decoder dec;
+//   dec.begin(image);
+//   while (... more data ...) dec.add(buffer, size);
+//   dec.end(format, width, height);
+//
+// Baseline files are decoded a row of MCUs at a time as the data arrives,
+// progressive files a scan at a time.
+//
+// Big images use all the cpus (see parallel_for in threads.h) once the
+// whole scan has arrived. Files with restart markers decode each restart
+// interval on its own thread. Without them, one thread does the huffman
+// decoding while the others do the IDCT. Colour conversion is split into bands.
+//
 namespace octet {
   class jpeg_decoder {
     enum { debug = 0 };
 
+    // huffman codes up to this length are decoded with one table lookup.
+    enum { fast_bits = 9 };
+
+    // smaller images are not worth starting threads for.
+    enum { min_thread_pixels = 256 * 256 };
+
+    // threads to decode with. 0 is one per cpu.
+    unsigned num_threads;
+
     // image dimensions
     unsigned precision;
     unsigned width;
@@ -28,26 +63,121 @@ namespace octet {
     unsigned successive_high;
     unsigned successive_low;
 
-    // how many blocks in a MCU (see mcu_block below)
-    unsigned num_mcu_blocks;
+    // MCUs between restart markers (0 for none)
+    unsigned restart_interval;
+
+    // Adobe APP14 chunk: 0 = RGB or CMYK, 1 = YCbCr, 2 = YCCK
+    bool has_adobe;
+    unsigned adobe_transform;
+
     unsigned num_components_in_scan;
 
-    // skip a number of bits in the file.
+    // where we are in the file
+    enum {
+      state_marker,
+      state_scan,
+      state_done,
+      state_error,
+    };
+    unsigned state;
+
+    // the image we are decoding into
+    dynarray<uint8_t> *image;
+    uint16_t format;
+
+    // image size in MCUs
+    unsigned max_hsamp;
+    unsigned max_vsamp;
+    unsigned mcus_x;
+    unsigned mcus_y;
+
+    // true if we keep all the coefficients until the end
+    bool buffered;
+    bool output_done;
+
+    // progress through the current scan
+    unsigned scan_mcus_x;
+    unsigned scan_mcus_y;
+    unsigned scan_mcu_y;
+    unsigned mcus_to_restart;
+    unsigned eobrun;
+
+    // when streaming, don't try again until we have this much data
+    unsigned retry_size;
+
+    // Entropy coded data comes in as a stream of bits.
     // there is a special case where every 0xff byte is followed by 0x00
-    static void skip_bits(unsigned bits, unsigned &acc, const uint8_t *&src, int &shift) {
-      shift -= bits;
-      while (shift < 0) {
-        // grab more bytes
-        uint8_t byte = *src++;
-        acc = acc * 256 + byte;
-        if (byte == 0xff) {
-          // in JPEG, an 0xff byte is followed by a zero
-          // do not advance past any other 0xff marker
-          src += src[0] == 0x00 ? 1 : -1;
+    // Any other byte after 0xff is a marker, so we stop there and feed zeros.
+    // If we run out of data, we also feed zeros and set ran_out.
+    struct bit_reader {
+      const uint8_t *src;
+      const uint8_t *src_max;
+      unsigned acc;       // the next bits, starting at the top bit
+      int num_bits;       // how many bits of acc are valid
+      bool at_marker;
+      bool ran_out;
+
+      void init(const uint8_t *src_, const uint8_t *src_max_) {
+        src = src_;
+        src_max = src_max_;
+        acc = 0;
+        num_bits = 0;
+        at_marker = false;
+        ran_out = false;
+      }
+
+      // top up acc to at least 25 bits
+      void fill() {
+        while (num_bits <= 24) {
+          unsigned byte = 0;
+          if (at_marker) {
+          } else if (src < src_max && *src != 0xff) {
+            byte = *src++;
+          } else if (src + 1 < src_max) {
+            if (src[1] == 0x00) {
+              byte = 0xff;
+              src += 2;
+            } else {
+              // do not advance past a marker
+              at_marker = true;
+            }
+          } else {
+            ran_out = true;
+          }
+          acc |= byte << (24 - num_bits);
+          num_bits += 8;
         }
-        shift += 8;
       }
-    }
+
+      // read 1-16 bits as an unsigned number
+      unsigned get_bits(unsigned bits) {
+        if (num_bits < (int)bits) fill();
+        unsigned v = peek(bits);
+        skip(bits);
+        return v;
+      }
+
+      unsigned peek(unsigned bits) const {
+        return acc >> (32 - bits);
+      }
+
+      void skip(unsigned bits) {
+        acc <<= bits;
+        num_bits -= bits;
+      }
+
+      // read a value of 1-16 bits.
+      // negative numbers need to be twiddled as all numbers coming in are positive.
+      int extend(unsigned bits) {
+        if (num_bits < (int)bits) fill();
+        unsigned v = peek(bits);
+        skip(bits);
+        return v < ( 1u << ( bits-1 ) ) ? (int)v - ( 1 << bits ) + 1 : (int)v;
+      }
+    };
+
+    // the entropy coded data of the current scan
+    bit_reader bits;
 
     // this is a component usually Y (brightness), Cb (blueness) and Cr (redness)
     // from the file.
@@ -58,8 +188,46 @@ namespace octet {
       uint8_t hsamp;
       uint8_t vsamp;
       uint8_t quantisation_table;
+
+      // decoded pixels for one row of MCUs
+      unsigned plane_stride;
+
+      // coefficients for the whole image if we are buffering
+      unsigned blocks_x;
+      unsigned blocks_y;
+
+      // size of this component in the whole image
+      unsigned comp_width;
+      unsigned comp_height;
     } components[4];
 
+    // Each component decodes a row of MCUs into a plane. The planes have
+    // an extra row above and below from the neighbouring MCU rows
+    // so that we can filter chroma vertically.
+    // We decode one row of MCUs ahead of the one we are converting.
+    dynarray<uint8_t> planes[2][4];
+
+    // undequantised coefficients for buffered images, in natural order.
+    dynarray<int16_t> coeffs[4];
+
+    // The whole image for each component when we decode with threads.
+    dynarray<uint8_t> image_planes[4];
+
+    // scratch rows for upsampling. Each thread needs its own.
+    struct row_buffers {
+      uint16_t *colsums;
+      uint8_t *upsampled[4];
+    };
+    row_buffers buffers;
+    dynarray<uint8_t> buffer_space;
+
+    // where to find the decoded rows of each component:
+    // row r of component c is at base[c] + (r - first_row[c]) * plane_stride.
+    struct plane_rows {
+      const uint8_t *base[4];
+      int first_row[4];
+    };
+
     // this is a component that is used for a particluar "scan"
     // of the image data. With progressive files there may be more than
     // one scan.
@@ -67,15 +235,13 @@ namespace octet {
       uint8_t comp;
       uint8_t ac_table;
       uint8_t dc_table;
-      unsigned width_in_blocks;
-      unsigned height_in_blocks;
       int last_dc;
     } scan_components[4];
 
-    // quantisation table. We multiply the dc and ac coefficients by these numbers.
+    // quantisation table in zig-zag order. We multiply the dc and ac coefficients by these numbers.
     // this is the lossy part of the compression
     struct quant_table {
-      float table[64];
+      uint16_t table[64];
     } quant_tables[4];
 
     // A huffman table maps variable length codes to lengths and values.
@@ -83,50 +249,92 @@ namespace octet {
     // where each code is distinct from the previous one, even if it has more bits.
     // (ie. 100(0) and 100(1) are less than 1010).
     struct huffman_table {
+      // (length << 8) | value for every code of fast_bits or less. 0 for longer codes.
+      uint16_t fast[1 << fast_bits];
       unsigned min_len;
       uint8_t huffval[257];
       uint16_t maxcodes[17];
       uint16_t offset[17];
 
+      // set by a DHT chunk. decode() is only safe after build().
+      bool defined;
+
+      // build the decode tables from the 16 code counts in a DHT chunk
+      bool build(const uint8_t *num_codes) {
+        unsigned dest = 0;
+        unsigned code = 0;
+        min_len = 0;
+        bool done_min_len = false;
+        memset(fast, 0, sizeof(fast));
+        for (unsigned len = 1; len < 17; ++len) {
+          offset[len-1] = code - dest;
+          if (!done_min_len && num_codes[len-1]) {
+            min_len = len - 1;
+            done_min_len = true;
+          }
+          for (unsigned i = 0; i != num_codes[len-1]; ++i) {
+            if (debug) printf("code=%04x len=%d\n", ( ( code + i ) << (16 - len) ), len );
+            if (code + i >= ( 1u << len )) return false;
+            if (len <= fast_bits) {
+              unsigned first = ( code + i ) << ( fast_bits - len );
+              unsigned count = 1 << ( fast_bits - len );
+              for (unsigned j = 0; j != count; ++j) {
+                fast[first + j] = (uint16_t)( ( len << 8 ) | huffval[dest + i] );
+              }
+            }
+          }
+          dest += num_codes[len-1];
+          code = code + num_codes[len-1];
+          maxcodes[len-1] = ( code << (16 - len) ) - 1;
+          code *= 2;
+          if (debug) printf("h.maxcodes[%d] = %04x\n", len-1, maxcodes[len-1]);
+        }
+        maxcodes[16] = 0xffff;
+        defined = true;
+        return true;
+      }
+
       // decode a variable length huffman code
-      // we grab the next 16 bits and look in the maxcodes table to see how many
-      // bits the code has. After that, we strip the right hand bits and
-      // look up the code in a table.
-      unsigned decode(unsigned &acc, const uint8_t *&src, int &shift) {
-        unsigned i = min_len;
-        unsigned short acc16 = acc >> shift;
+      // we look up the next fast_bits bits in a table which gives us the
+      // length and value of most codes. For longer codes we grab the next 16 bits
+      // and look in the maxcodes table to see how many bits the code has.
+      unsigned decode(bit_reader &bits) {
+        if (bits.num_bits < 16) bits.fill();
+
+        unsigned f = fast[bits.peek(fast_bits)];
+        if (f) {
+          bits.skip(f >> 8);
+          return f & 0xff;
+        }
+
+        unsigned i = min_len > fast_bits ? min_len : fast_bits;
+        unsigned acc16 = bits.peek(16);
 
         // find the shortest code that this could be
-        for (; acc16 > maxcodes[i]; ++i) {
+        for (; i < 16 && acc16 > maxcodes[i]; ++i) {
+        }
+
+        if (i >= 16) {
+          // bad code
+          bits.skip(16);
+          return 0;
         }
 
         unsigned code = ( acc16 >> (15-i) ) - offset[i];
-        skip_bits(i + 1, acc, src, shift);
-        return huffval[code];
+        bits.skip(i + 1);
+        return huffval[code & 0xff];
       }
     } huffman_tables[2][4];
 
-    // a mcu_block is an 8x8 component of a MCU
-    // (Minimal coding unit). The image is tiled by MCUs
-    // which have components.
-    struct mcu_block {
-      huffman_table *dc_table;
-      huffman_table *ac_table;
-      quant_table *quant;
-      scan_component *scan_comp;
-    } mcu_blocks[8];
-
-    float dct_coeffs[8*64];
-    float ycrcb_values[8*64];
-
-    unsigned u2(const uint8_t *src) {
+    static unsigned u2(const uint8_t *src) {
       return src[0] * 256 + src[1];
     }
 
     // dct coefficients are stored in zig-zag order because the top
     // left is far more common.
-    uint8_t zig_zag(unsigned i) {
-      static const uint8_t zig_zag_[64] = {
+    // the extra entries catch bad files that run off the end of the block.
+    static const uint8_t *zig_zag() {
+      static const uint8_t zig_zag_[64+16] = {
         0, 1, 8, 16, 9, 2, 3, 10,
         17, 24, 32, 25, 18, 11, 4, 5,
         12, 19, 26, 33, 40, 48, 41, 34,
@@ -135,211 +343,1348 @@ namespace octet {
         29, 22, 15, 23, 30, 37, 44, 51,
         58, 59, 52, 45, 38, 31, 39, 46,
         53, 60, 61, 54, 47, 55, 62, 63,
+        63, 63, 63, 63, 63, 63, 63, 63,
+        63, 63, 63, 63, 63, 63, 63, 63,
       };
-      return i < 63 ? zig_zag_[i] : 63;
-    }
-
-    // negative numbers need to be twiddled as all numbers coming in are positive.
-    static int extend(unsigned bits, unsigned &acc, const uint8_t *&src, int &shift) {
-      uint16_t acc16 = acc >> shift;
-      unsigned v = acc16 >> (16 - bits);
-      return v < ( 1u << ( bits-1 ) ) ? (int)v + ( -1 << bits ) + 1 : (int)v;
+      return zig_zag_;
     }
 
-    // decode one block of an MCU which may contain many blocks
-    // The Y component may have four blocks, for example, and only one each of Cr, Cb
-    void decode_mcu_block(unsigned block_num, unsigned &acc, const uint8_t *&src, int &shift, float *outptr) {
-      mcu_block &block = mcu_blocks[block_num];
+    // decode one 8x8 block of coefficients of a baseline scan.
+    // quant is the quantisation table or a table of ones if we are buffering.
+    void decode_block(bit_reader &bits, scan_component &sc, int16_t *outptr, const uint16_t *quant) {
+      huffman_table &dc_table = huffman_tables[0][sc.dc_table];
+      huffman_table &ac_table = huffman_tables[1][sc.ac_table];
+      const uint8_t *zz = zig_zag();
 
-      unsigned value = block.dc_table->decode(acc, src, shift);
+      memset(outptr, 0, 64 * sizeof(int16_t));
 
-      int dc = 0;
-      if (value) {
-        dc = extend(value, acc, src, shift);
-        skip_bits(value, acc, src, shift);
-        //if (debug) printf("dc=%d\n", dc);
-      }
-      int abs_dc = block.scan_comp->last_dc += dc;
-      outptr[0] = abs_dc * block.quant->table[0];
+      unsigned value = dc_table.decode(bits) & 0x0f;
+      int dc = value ? bits.extend(value) : 0;
+      sc.last_dc += dc;
+      outptr[0] = (int16_t)( sc.last_dc * quant[0] );
 
-      for (int ac_coef = 1; ac_coef < 64; ++ac_coef) {
-        unsigned value = block.ac_table->decode(acc, src, shift);
+      for (unsigned ac_coef = 1; ac_coef < 64; ++ac_coef) {
+        unsigned value = ac_table.decode(bits);
         unsigned skip = value >> 4;
         value &= 0x0f;
         ac_coef += skip;
 
         if (value) {
-          int ac = extend(value, acc, src, shift);
-          skip_bits(value, acc, src, shift);
-          //if (debug) printf("ac=%d,%d coef=%d zig_zag=%d\n", skip, ac, ac_coef, zig_zag(ac_coef));
-          outptr[zig_zag(ac_coef)] = (float)ac * block.quant->table[ac_coef];
+          int ac = bits.extend(value);
+          outptr[zz[ac_coef]] = (int16_t)( ac * quant[ac_coef & 63] );
         } else if (skip != 15) {
           break;
         }
       }
+
       if (debug) {
         for (int j = 0; j != 8; ++j) {
           for (int i = 0; i != 8; ++i) {
-            printf("%3.0f ", outptr[i+j*8]);
+            printf("%4d ", outptr[i+j*8]);
           }
           printf("\n");
         }
       }
     }
 
+    // Progressive files send the coefficients in several scans:
+    // the DC terms first, then bands of AC terms (spectral selection),
+    // often the top bits first with the low bits refined later (successive approximation).
+    // These work on undequantised coefficients in natural order.
+    void decode_dc_first(bit_reader &bits, scan_component &sc, int16_t *block) {
+      unsigned value = huffman_tables[0][sc.dc_table].decode(bits) & 0x0f;
+      int dc = value ? bits.extend(value) : 0;
+      sc.last_dc += dc;
+      block[0] = (int16_t)( sc.last_dc * ( 1 << successive_low ) );
+    }
+
+    void decode_dc_refine(bit_reader &bits, int16_t *block) {
+      if (bits.get_bits(1)) {
+        block[0] |= (int16_t)( 1 << successive_low );
+      }
+    }
+
+    void decode_ac_first(bit_reader &bits, scan_component &sc, int16_t *block) {
+      // a run of blocks with no coefficients in this band
+      if (eobrun) {
+        eobrun--;
+        return;
+      }
+
+      huffman_table &ac_table = huffman_tables[1][sc.ac_table];
+      const uint8_t *zz = zig_zag();
+      for (unsigned k = spectral_start; k <= spectral_end; ++k) {
+        unsigned value = ac_table.decode(bits);
+        unsigned run = value >> 4;
+        value &= 0x0f;
+        if (value) {
+          k += run;
+          block[zz[k]] = (int16_t)( bits.extend(value) * ( 1 << successive_low ) );
+        } else if (run == 15) {
+          k += 15;
+        } else {
+          eobrun = ( 1 << run ) - 1;
+          if (run) eobrun += bits.get_bits(run);
+          break;
+        }
+      }
+    }
+
+    // add one more bit to the coefficients we already have and
+    // fill in any new ones (which will be +1 or -1 at this bit)
+    void decode_ac_refine(bit_reader &bits, scan_component &sc, int16_t *block) {
+      huffman_table &ac_table = huffman_tables[1][sc.ac_table];
+      const uint8_t *zz = zig_zag();
+      int p1 = 1 << successive_low;
+      int m1 = -( 1 << successive_low );
+      unsigned k = spectral_start;
+
+      if (eobrun == 0) {
+        for (; k <= spectral_end; ++k) {
+          unsigned value = ac_table.decode(bits);
+          int run = value >> 4;
+          int new_coef = 0;
+          if (value & 0x0f) {
+            new_coef = bits.get_bits(1) ? p1 : m1;
+          } else if (run != 15) {
+            eobrun = 1 << run;
+            if (run) eobrun += bits.get_bits(run);
+            break;
+          }
+
+          // skip run zero coefficients, refining the non-zero ones on the way.
+          for (; k <= spectral_end; ++k) {
+            int16_t &coef = block[zz[k]];
+            if (coef) {
+              if (bits.get_bits(1) && ( coef & p1 ) == 0) {
+                coef = (int16_t)( coef + ( coef >= 0 ? p1 : m1 ) );
+              }
+            } else if (--run < 0) {
+              break;
+            }
+          }
+
+          if (new_coef && k <= spectral_end) {
+            block[zz[k]] = (int16_t)new_coef;
+          }
+        }
+      }
+
+      if (eobrun) {
+        // refine the rest of the band
+        for (; k <= spectral_end; ++k) {
+          int16_t &coef = block[zz[k]];
+          if (coef && bits.get_bits(1) && ( coef & p1 ) == 0) {
+            coef = (int16_t)( coef + ( coef >= 0 ? p1 : m1 ) );
+          }
+        }
+        eobrun--;
+      }
+    }
+
+    // decode one block of a buffered scan
+    void decode_buffered_block(bit_reader &bits, scan_component &sc, int16_t *block) {
+      if (sof_code != 0xc2) {
+        static const uint16_t ones[64] = {
+          1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+          1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+          1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+          1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        };
+        decode_block(bits, sc, block, ones);
+      } else if (spectral_start == 0) {
+        if (successive_high == 0) {
+          decode_dc_first(bits, sc, block);
+        } else {
+          decode_dc_refine(bits, block);
+        }
+      } else {
+        if (successive_high == 0) {
+          decode_ac_first(bits, sc, block);
+        } else {
+          decode_ac_refine(bits, sc, block);
+        }
+      }
+    }
+
+    // fixed point constants for the IDCT, 13 bits after the point.
+    enum {
+      fix_0_298631336 = 2446,
+      fix_0_390180644 = 3196,
+      fix_0_541196100 = 4433,
+      fix_0_765366865 = 6270,
+      fix_0_899976223 = 7373,
+      fix_1_175875602 = 9633,
+      fix_1_501321110 = 12299,
+      fix_1_847759065 = 15137,
+      fix_1_961570560 = 16069,
+      fix_2_053119869 = 16819,
+      fix_2_562915447 = 20995,
+      fix_3_072711026 = 25172,
+    };
+
     // one dimensional inverse DCT.
-    // c0 is the DC term and c1..c7 increase in frequency
-    // example: c0 = 128, c1..c7 = 0 -> 128, 128, 128, 128, 128, 128, 128, 128
-    // todo: improve this!
-    OCTET_HOT void idct(float &c0, float &c1, float &c2, float &c3, float &c4, float &c5, float &c6, float &c7) {
-      float c2c6_1 = (c2 + c6) * 0.541196100f;
-      float c2c6_2 = c2c6_1 + c6 * -1.847759065f;
-      float c2c6_3 = c2c6_1 + c2 * 0.765366865f;
-    
-      float c0c4_1 = c0 + c4;
-      float c0c4_2 = c0 - c4;
-    
-      float ceven_1 = c0c4_1 + c2c6_3;
-      float ceven_2 = c0c4_1 - c2c6_3;
-      float ceven_3 = c0c4_2 + c2c6_2;
-      float ceven_4 = c0c4_2 - c2c6_2;
-    
-      float c1c7 = c7 + c1;
-      float c3c5 = c5 + c3;
-      float c7c3 = c7 + c3;
-      float c5c1 = c5 + c1;
-      float codd_0 = (c7c3 + c5c1) * 1.175875602f;
-    
-      float codd_4 = c7 * 0.298631336f;
-      float codd_3 = c5 * 2.053119869f;
-      float codd_2 = c3 * 3.072711026f;
-      float codd_1 = c1 * 1.501321110f;
-      c1c7 = c1c7 * -0.899976223f;
-      c3c5 = c3c5 * -2.562915447f;
-      c7c3 = c7c3 * -1.961570560f;
-      c5c1 = c5c1 * -0.390180644f;
-    
-      c7c3 += codd_0;
-      c5c1 += codd_0;
-    
-      codd_4 += c1c7 + c7c3;
-      codd_3 += c3c5 + c5c1;
-      codd_2 += c3c5 + c7c3;
-      codd_1 += c1c7 + c5c1;
-    
-      c0 = ceven_1 + codd_1;
-      c7 = ceven_1 - codd_1;
-      c1 = ceven_3 + codd_2;
-      c6 = ceven_3 - codd_2;
-      c2 = ceven_4 + codd_3;
-      c5 = ceven_4 - codd_3;
-      c3 = ceven_2 + codd_4;
-      c4 = ceven_2 - codd_4;
+    // s0 is the DC term and s1..s7 increase in frequency
+    // The results are x0+t3, x1+t2, x2+t1, x3+t0, x3-t0, x2-t1, x1-t2, x0-t3
+    // The inputs are scaled by 8192 on the way out.
+    struct idct_1d {
+      int x0, x1, x2, x3;
+      int t0, t1, t2, t3;
+
+      OCTET_HOT idct_1d(int s0, int s1, int s2, int s3, int s4, int s5, int s6, int s7) {
+        // even part
+        int p1 = (s2 + s6) * fix_0_541196100;
+        int c2c6_2 = p1 + s6 * -fix_1_847759065;
+        int c2c6_3 = p1 + s2 * fix_0_765366865;
+        int c0c4_1 = (s0 + s4) * 8192;
+        int c0c4_2 = (s0 - s4) * 8192;
+        x0 = c0c4_1 + c2c6_3;
+        x3 = c0c4_1 - c2c6_3;
+        x1 = c0c4_2 + c2c6_2;
+        x2 = c0c4_2 - c2c6_2;
+
+        // odd part
+        int c7c3 = s7 + s3;
+        int c5c1 = s5 + s1;
+        int c1c7 = s7 + s1;
+        int c3c5 = s5 + s3;
+        int codd_0 = (c7c3 + c5c1) * fix_1_175875602;
+        t0 = s7 * fix_0_298631336;
+        t1 = s5 * fix_2_053119869;
+        t2 = s3 * fix_3_072711026;
+        t3 = s1 * fix_1_501321110;
+        c1c7 = codd_0 + c1c7 * -fix_0_899976223;
+        c3c5 = codd_0 + c3c5 * -fix_2_562915447;
+        c7c3 = c7c3 * -fix_1_961570560;
+        c5c1 = c5c1 * -fix_0_390180644;
+        t3 += c1c7 + c5c1;
+        t2 += c3c5 + c7c3;
+        t1 += c3c5 + c5c1;
+        t0 += c1c7 + c7c3;
+      }
+    };
+
+    static uint8_t clamp(int v) {
+      return (uint8_t)( v < 0 ? 0 : v > 255 ? 255 : v );
     }
 
     // Two dimensional inverse DCT
-    // we can do the rows and columns separately.
-    // Optimisations include spotting blank rows and columns, but this
-    // is just a reference design.
-    void inverse_dct(float *inptr) {
-      // do rows
+    // we can do the columns and then the rows separately.
+    // The result is level shifted by 128 and clamped to 0..255.
+    static void inverse_dct_c(const int16_t *inptr, uint8_t *outptr, unsigned stride) {
+      int tmp[64];
+
+      // do columns, keeping two extra bits of precision
       for (unsigned i = 0; i != 8; ++i) {
-        idct(inptr[8*0+i], inptr[8*1+i], inptr[8*2+i], inptr[8*3+i], inptr[8*4+i], inptr[8*5+i], inptr[8*6+i], inptr[8*7+i]);
+        const int16_t *c = inptr + i;
+        if (!(c[8] | c[16] | c[24] | c[32] | c[40] | c[48] | c[56])) {
+          // flat column
+          int dc = c[0] * 4;
+          for (unsigned j = 0; j != 8; ++j) tmp[i + j*8] = dc;
+          continue;
+        }
+        idct_1d d(c[0], c[8], c[16], c[24], c[32], c[40], c[48], c[56]);
+        int x0 = d.x0 + 1024, x1 = d.x1 + 1024, x2 = d.x2 + 1024, x3 = d.x3 + 1024;
+        tmp[i + 8*0] = (x0 + d.t3) >> 11;
+        tmp[i + 8*7] = (x0 - d.t3) >> 11;
+        tmp[i + 8*1] = (x1 + d.t2) >> 11;
+        tmp[i + 8*6] = (x1 - d.t2) >> 11;
+        tmp[i + 8*2] = (x2 + d.t1) >> 11;
+        tmp[i + 8*5] = (x2 - d.t1) >> 11;
+        tmp[i + 8*3] = (x3 + d.t0) >> 11;
+        tmp[i + 8*4] = (x3 - d.t0) >> 11;
       }
 
-      // do columns
-      for (unsigned i = 0; i != 8; ++i) {
-        idct(inptr[8*i+0], inptr[8*i+1], inptr[8*i+2], inptr[8*i+3], inptr[8*i+4], inptr[8*i+5], inptr[8*i+6], inptr[8*i+7]);
+      // do rows, rounding and adding 128
+      for (unsigned j = 0; j != 8; ++j) {
+        const int *r = tmp + j*8;
+        idct_1d d(r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7]);
+        int bias = 131072 + (128 << 18);
+        int x0 = d.x0 + bias, x1 = d.x1 + bias, x2 = d.x2 + bias, x3 = d.x3 + bias;
+        uint8_t *o = outptr + j * stride;
+        o[0] = clamp((x0 + d.t3) >> 18);
+        o[7] = clamp((x0 - d.t3) >> 18);
+        o[1] = clamp((x1 + d.t2) >> 18);
+        o[6] = clamp((x1 - d.t2) >> 18);
+        o[2] = clamp((x2 + d.t1) >> 18);
+        o[5] = clamp((x2 - d.t1) >> 18);
+        o[3] = clamp((x3 + d.t0) >> 18);
+        o[4] = clamp((x3 - d.t0) >> 18);
       }
+    }
 
-      if (debug) {
-        for (int j = 0; j != 8; ++j) {
-          for (int i = 0; i != 8; ++i) {
-            printf("%f ", inptr[i+j*8]);
-          }
-          printf("\n");
+    #if OCTET_SSE2
+      // a*x + b*y for pairs of 16 bit values, giving 32 bit results
+      struct wide {
+        __m128i lo, hi;
+      };
+
+      static OCTET_HOT wide rotate(__m128i x, __m128i y, int cx, int cy) {
+        __m128i c = _mm_setr_epi16((short)cx, (short)cy, (short)cx, (short)cy, (short)cx, (short)cy, (short)cx, (short)cy);
+        wide w;
+        w.lo = _mm_madd_epi16(_mm_unpacklo_epi16(x, y), c);
+        w.hi = _mm_madd_epi16(_mm_unpackhi_epi16(x, y), c);
+        return w;
+      }
+
+      // x * 8192
+      static OCTET_HOT wide widen(__m128i x) {
+        wide w;
+        w.lo = _mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), x), 3);
+        w.hi = _mm_srai_epi32(_mm_unpackhi_epi16(_mm_setzero_si128(), x), 3);
+        return w;
+      }
+
+      static OCTET_HOT wide add(const wide &a, const wide &b) {
+        wide w = { _mm_add_epi32(a.lo, b.lo), _mm_add_epi32(a.hi, b.hi) };
+        return w;
+      }
+
+      static OCTET_HOT wide sub(const wide &a, const wide &b) {
+        wide w = { _mm_sub_epi32(a.lo, b.lo), _mm_sub_epi32(a.hi, b.hi) };
+        return w;
+      }
+
+      // out0 = (a + bias + b) >> shift, out1 = (a + bias - b) >> shift
+      static OCTET_HOT void butterfly(__m128i &out0, __m128i &out1, const wide &a, const wide &b, __m128i bias, int shift) {
+        __m128i alo = _mm_add_epi32(a.lo, bias);
+        __m128i ahi = _mm_add_epi32(a.hi, bias);
+        __m128i sum_lo = _mm_srai_epi32(_mm_add_epi32(alo, b.lo), shift);
+        __m128i sum_hi = _mm_srai_epi32(_mm_add_epi32(ahi, b.hi), shift);
+        __m128i dif_lo = _mm_srai_epi32(_mm_sub_epi32(alo, b.lo), shift);
+        __m128i dif_hi = _mm_srai_epi32(_mm_sub_epi32(ahi, b.hi), shift);
+        out0 = _mm_packs_epi32(sum_lo, sum_hi);
+        out1 = _mm_packs_epi32(dif_lo, dif_hi);
+      }
+
+      // the same sums as idct_1d on eight columns at once
+      static OCTET_HOT void idct_pass(__m128i *r, __m128i bias, int shift) {
+        int c0 = fix_0_541196100;
+        int c1 = fix_1_175875602;
+        int c2 = -fix_1_961570560;
+        int c3 = -fix_0_390180644;
+
+        // even part
+        wide t2e = rotate(r[2], r[6], c0, c0 - fix_1_847759065);
+        wide t3e = rotate(r[2], r[6], c0 + fix_0_765366865, c0);
+        wide t0e = widen(_mm_add_epi16(r[0], r[4]));
+        wide t1e = widen(_mm_sub_epi16(r[0], r[4]));
+        wide x0 = add(t0e, t3e);
+        wide x3 = sub(t0e, t3e);
+        wide x1 = add(t1e, t2e);
+        wide x2 = sub(t1e, t2e);
+
+        // odd part
+        wide y0 = rotate(r[7], r[3], c2 + fix_0_298631336, c2);
+        wide y2 = rotate(r[7], r[3], c2, c2 + fix_3_072711026);
+        wide y1 = rotate(r[5], r[1], c3 + fix_2_053119869, c3);
+        wide y3 = rotate(r[5], r[1], c3, c3 + fix_1_501321110);
+        __m128i sum17 = _mm_add_epi16(r[1], r[7]);
+        __m128i sum35 = _mm_add_epi16(r[3], r[5]);
+        wide y4 = rotate(sum17, sum35, c1 - fix_0_899976223, c1);
+        wide y5 = rotate(sum17, sum35, c1, c1 - fix_2_562915447);
+        wide x4 = add(y0, y4);
+        wide x5 = add(y1, y5);
+        wide x6 = add(y2, y5);
+        wide x7 = add(y3, y4);
+
+        butterfly(r[0], r[7], x0, x7, bias, shift);
+        butterfly(r[1], r[6], x1, x6, bias, shift);
+        butterfly(r[2], r[5], x2, x5, bias, shift);
+        butterfly(r[3], r[4], x3, x4, bias, shift);
+      }
+
+      static OCTET_HOT void interleave16(__m128i &a, __m128i &b) {
+        __m128i tmp = a;
+        a = _mm_unpacklo_epi16(a, b);
+        b = _mm_unpackhi_epi16(tmp, b);
+      }
+
+      static OCTET_HOT void interleave8(__m128i &a, __m128i &b) {
+        __m128i tmp = a;
+        a = _mm_unpacklo_epi8(a, b);
+        b = _mm_unpackhi_epi8(tmp, b);
+      }
+
+      // SSE2 inverse DCT. Same results as inverse_dct_c.
+      static void inverse_dct_sse2(const int16_t *inptr, uint8_t *outptr, unsigned stride) {
+        __m128i r[8];
+        for (unsigned i = 0; i != 8; ++i) {
+          r[i] = _mm_loadu_si128((const __m128i*)(inptr + i*8));
         }
+
+        // columns
+        idct_pass(r, _mm_set1_epi32(1024), 11);
+
+        // transpose 8x8 16 bit values
+        interleave16(r[0], r[4]);
+        interleave16(r[1], r[5]);
+        interleave16(r[2], r[6]);
+        interleave16(r[3], r[7]);
+        interleave16(r[0], r[2]);
+        interleave16(r[1], r[3]);
+        interleave16(r[4], r[6]);
+        interleave16(r[5], r[7]);
+        interleave16(r[0], r[1]);
+        interleave16(r[2], r[3]);
+        interleave16(r[4], r[5]);
+        interleave16(r[6], r[7]);
+
+        // rows
+        idct_pass(r, _mm_set1_epi32(131072 + (128 << 18)), 18);
+
+        // pack to bytes and transpose back
+        __m128i p0 = _mm_packus_epi16(r[0], r[1]);
+        __m128i p1 = _mm_packus_epi16(r[2], r[3]);
+        __m128i p2 = _mm_packus_epi16(r[4], r[5]);
+        __m128i p3 = _mm_packus_epi16(r[6], r[7]);
+        interleave8(p0, p2);
+        interleave8(p1, p3);
+        interleave8(p0, p1);
+        interleave8(p2, p3);
+        interleave8(p0, p2);
+        interleave8(p1, p3);
+
+        _mm_storel_epi64((__m128i*)(outptr + stride*0), p0);
+        _mm_storel_epi64((__m128i*)(outptr + stride*1), _mm_shuffle_epi32(p0, 0x4e));
+        _mm_storel_epi64((__m128i*)(outptr + stride*2), p2);
+        _mm_storel_epi64((__m128i*)(outptr + stride*3), _mm_shuffle_epi32(p2, 0x4e));
+        _mm_storel_epi64((__m128i*)(outptr + stride*4), p1);
+        _mm_storel_epi64((__m128i*)(outptr + stride*5), _mm_shuffle_epi32(p1, 0x4e));
+        _mm_storel_epi64((__m128i*)(outptr + stride*6), p3);
+        _mm_storel_epi64((__m128i*)(outptr + stride*7), _mm_shuffle_epi32(p3, 0x4e));
       }
+    #endif
+
+    static void inverse_dct(const int16_t *inptr, uint8_t *outptr, unsigned stride) {
+      #if OCTET_SSE2
+        inverse_dct_sse2(inptr, outptr, stride);
+      #else
+        inverse_dct_c(inptr, outptr, stride);
+      #endif
     }
 
-    // clamp to 0..255 range without using branches.
-    // fabsf is usually implemented in hardware (with fast math options)
-    OCTET_HOT uint8_t clamp(float v) {
-      // v + fabsf(v) = 2v when v > 0
-      // v + fabsf(v) = 0  when v < 0
-      float clamp0 = v + fabsf(v);
+    // colour conversion constants, 12 bits after the point.
+    enum {
+      cr_r = 5743,    // 1.402
+      cb_g = -1410,   // -0.34414
+      cr_g = -2925,   // -0.71414
+      cb_b = 7258,    // 1.772
+    };
 
-      // v - fabsf(v-n) = n when v > n
-      // v - fabsf(v-n) = 2v - n when v < n
-      return (uint8_t)( ( clamp0 - fabsf( clamp0 - (255.999f * 2) ) ) * 0.25f + 128 );
+    // (a * b) >> 16 like _mm_mulhi_epi16
+    static int mulhi(int a, int b) {
+      return ( a * b ) >> 16;
     }
 
-    // convert from YCrCb to RGB
+    // convert from YCbCr to RGBA
     // See http://en.wikipedia.org/wiki/YCbCr
-    // The 0.125 scaling factor is because the DCT data has a scale of 8
-    void color_convert_444(uint8_t *outptr, int stride, float *inptr) {
-      for (unsigned j = 0; j != 8; ++j) {
-        for (unsigned i = 0; i != 8; ++i) {
-          float y = inptr[0];
-          float cb = inptr[64];
-          float cr = inptr[128];
-          inptr++;
-          outptr[0] = clamp(128 + y * 0.125f + cr * (1.402f * 0.125f));
-          outptr[1] = clamp(128 + y * 0.125f - cb * (0.34414f * 0.125f) - cr * (0.71414f * 0.125f));
-          outptr[2] = clamp(128 + y * 0.125f + cb * (1.772f * 0.125f));
-          //static int times;
-          //if (++times < 100) printf("cr=%f y=%f cb=%f  r=%d g=%d b=%d\n", cr * 0.125 + 128, y * 0.125 + 128, cb * 0.125 + 128, outptr[0], outptr[1], outptr[2]);
-          outptr[3] = 0xff;
-          outptr += 4;
+    // y is scaled by 16 and cb, cr by 256 so that we can use 16 bit multiplies.
+    static void color_convert_row(uint8_t *outptr, const uint8_t *y, const uint8_t *cb, const uint8_t *cr, unsigned count) {
+      unsigned i = 0;
+      #if OCTET_SSE2
+        __m128i signflip = _mm_set1_epi8(-0x80);
+        __m128i y_bias = _mm_set1_epi8((char)0x80);
+        __m128i alpha = _mm_set1_epi16(255);
+        __m128i zero = _mm_setzero_si128();
+        for (; i + 8 <= count; i += 8) {
+          __m128i yb = _mm_loadl_epi64((const __m128i*)(y + i));
+          __m128i cbb = _mm_xor_si128(_mm_loadl_epi64((const __m128i*)(cb + i)), signflip);
+          __m128i crb = _mm_xor_si128(_mm_loadl_epi64((const __m128i*)(cr + i)), signflip);
+
+          // y * 16 + 8, (cb - 128) * 256, (cr - 128) * 256
+          __m128i yw = _mm_srli_epi16(_mm_unpacklo_epi8(y_bias, yb), 4);
+          __m128i cbw = _mm_unpacklo_epi8(zero, cbb);
+          __m128i crw = _mm_unpacklo_epi8(zero, crb);
+
+          __m128i rw = _mm_add_epi16(yw, _mm_mulhi_epi16(crw, _mm_set1_epi16(cr_r)));
+          __m128i gw = _mm_add_epi16(_mm_add_epi16(yw, _mm_mulhi_epi16(cbw, _mm_set1_epi16(cb_g))), _mm_mulhi_epi16(crw, _mm_set1_epi16(cr_g)));
+          __m128i bw = _mm_add_epi16(yw, _mm_mulhi_epi16(cbw, _mm_set1_epi16(cb_b)));
+
+          // r0..r7 b0..b7 and g0..g7 a0..a7
+          __m128i rb = _mm_packus_epi16(_mm_srai_epi16(rw, 4), _mm_srai_epi16(bw, 4));
+          __m128i ga = _mm_packus_epi16(_mm_srai_epi16(gw, 4), alpha);
+
+          // interleave to rgba
+          __m128i t0 = _mm_unpacklo_epi8(rb, ga);
+          __m128i t1 = _mm_unpackhi_epi8(rb, ga);
+          _mm_storeu_si128((__m128i*)(outptr + i*4), _mm_unpacklo_epi16(t0, t1));
+          _mm_storeu_si128((__m128i*)(outptr + i*4 + 16), _mm_unpackhi_epi16(t0, t1));
         }
-        outptr += stride - 32;
+      #endif
+
+      for (; i != count; ++i) {
+        int yw = y[i] * 16 + 8;
+        int cbw = ( cb[i] - 128 ) * 256;
+        int crw = ( cr[i] - 128 ) * 256;
+        uint8_t *o = outptr + i*4;
+        o[0] = clamp(( yw + mulhi(crw, cr_r) ) >> 4);
+        o[1] = clamp(( yw + mulhi(cbw, cb_g) + mulhi(crw, cr_g) ) >> 4);
+        o[2] = clamp(( yw + mulhi(cbw, cb_b) ) >> 4);
+        o[3] = 0xff;
       }
     }
 
-    // JPEG files are split up into chunks starting with 0xff
-    unsigned decode_chunk(const uint8_t *src, dynarray<uint8_t> &image, uint16_t &format) {
-      if (debug) printf("decode_chunk %02x\n", src[1]);
+    // greyscale to RGBA
+    static void grey_convert_row(uint8_t *outptr, const uint8_t *y, unsigned count) {
+      for (unsigned i = 0; i != count; ++i) {
+        uint8_t *o = outptr + i*4;
+        o[0] = o[1] = o[2] = y[i];
+        o[3] = 0xff;
+      }
+    }
 
-      unsigned length = 2;
+    // RGB files with an Adobe chunk that says so
+    static void rgb_convert_row(uint8_t *outptr, const uint8_t *r, const uint8_t *g, const uint8_t *b, unsigned count) {
+      for (unsigned i = 0; i != count; ++i) {
+        uint8_t *o = outptr + i*4;
+        o[0] = r[i];
+        o[1] = g[i];
+        o[2] = b[i];
+        o[3] = 0xff;
+      }
+    }
 
-      switch (src[1]) {
-        // different kinds of image (SOF0-7)
-        case 0xc0: case 0xc1: case 0xc2: case 0xc3: case 0xc5: case 0xc6: case 0xc7: {
-          sof_code = src[1];
-          length = u2(src + 2) + 2;
-          precision = src[4];
-          height = u2(src + 5);
-          width = u2(src + 7);
-          num_components = src[9];
-
-          if (src[1] != 0xc0) {
-            printf("warning: only baseline JPEG is supported - disable progressive\n");
-            return 0;
+    // x * y / 255, rounded
+    static uint8_t mul255(unsigned x, unsigned y) {
+      unsigned t = x * y + 128;
+      return (uint8_t)( ( t + ( t >> 8 ) ) >> 8 );
+    }
+
+    // CMYK or YCCK to RGBA.
+    // Adobe files store CMYK inverted (255 is no ink) and we treat
+    // YCCK as YCbCr for the inverted CMY.
+    void cmyk_convert_row(uint8_t *outptr, const uint8_t **rows, unsigned count) {
+      bool is_ycck = has_adobe && adobe_transform == 2;
+      if (is_ycck) {
+        color_convert_row(outptr, rows[0], rows[1], rows[2], count);
+      }
+      for (unsigned i = 0; i != count; ++i) {
+        uint8_t *o = outptr + i*4;
+        unsigned c, m, y, k = rows[3][i];
+        if (is_ycck) {
+          c = 255 - o[0]; m = 255 - o[1]; y = 255 - o[2];
+        } else {
+          c = rows[0][i]; m = rows[1][i]; y = rows[2][i];
+        }
+        if (!has_adobe) {
+          c = 255 - c; m = 255 - m; y = 255 - y; k = 255 - k;
+        }
+        o[0] = mul255(c, k);
+        o[1] = mul255(m, k);
+        o[2] = mul255(y, k);
+        o[3] = 0xff;
+      }
+    }
+
+    // Chroma upsampling uses the triangle filters from the jpeg reference code,
+    // so we get the same pixels as libjpeg. Each output sample is 3/4 of the
+    // nearest chroma sample and 1/4 of the next nearest.
+
+    // vertical pass: colsum = near * 3 + far, or near * 4 if there is no vertical upsampling.
+    // colsum[-1] and colsum[count] repeat the edge samples for the horizontal pass.
+    static void upsample_vertical(uint16_t *colsum, const uint8_t *near, const uint8_t *far, unsigned count) {
+      unsigned i = 0;
+      #if OCTET_SSE2
+        __m128i zero = _mm_setzero_si128();
+        for (; i + 8 <= count; i += 8) {
+          __m128i n = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(near + i)), zero);
+          __m128i f = far ? _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(far + i)), zero) : n;
+          __m128i sum = _mm_add_epi16(_mm_add_epi16(n, _mm_add_epi16(n, n)), f);
+          _mm_storeu_si128((__m128i*)(colsum + i), sum);
+        }
+      #endif
+      for (; i != count; ++i) {
+        colsum[i] = (uint16_t)( near[i] * 3 + ( far ? far[i] : near[i] ) );
+      }
+      colsum[-1] = colsum[0];
+      colsum[count] = colsum[count-1];
+    }
+
+    // horizontal pass for 2:1: two output samples for every colsum.
+    // even = (colsum * 3 + left + even_bias) >> shift
+    // odd = (colsum * 3 + right + odd_bias) >> shift
+    static void upsample_h2(uint8_t *dest, const uint16_t *colsum, unsigned count, int even_bias, int odd_bias, int shift) {
+      unsigned i = 0;
+      #if OCTET_SSE2
+        __m128i ebias = _mm_set1_epi16((short)even_bias);
+        __m128i obias = _mm_set1_epi16((short)odd_bias);
+        __m128i sh = _mm_cvtsi32_si128(shift);
+        for (; i + 8 <= count; i += 8) {
+          __m128i left = _mm_loadu_si128((const __m128i*)(colsum + i - 1));
+          __m128i cur = _mm_loadu_si128((const __m128i*)(colsum + i));
+          __m128i right = _mm_loadu_si128((const __m128i*)(colsum + i + 1));
+          __m128i cur3 = _mm_add_epi16(cur, _mm_add_epi16(cur, cur));
+          __m128i even = _mm_srl_epi16(_mm_add_epi16(_mm_add_epi16(cur3, left), ebias), sh);
+          __m128i odd = _mm_srl_epi16(_mm_add_epi16(_mm_add_epi16(cur3, right), obias), sh);
+          __m128i lo = _mm_unpacklo_epi16(even, odd);
+          __m128i hi = _mm_unpackhi_epi16(even, odd);
+          _mm_storeu_si128((__m128i*)(dest + i*2), _mm_packus_epi16(lo, hi));
+        }
+      #endif
+      for (; i != count; ++i) {
+        const uint16_t *cs = colsum + i;
+        dest[i*2+0] = (uint8_t)( ( cs[0] * 3 + cs[-1] + even_bias ) >> shift );
+        dest[i*2+1] = (uint8_t)( ( cs[0] * 3 + cs[1] + odd_bias ) >> shift );
+      }
+    }
+
+    // stretch a row of chroma samples to full width and height.
+    // far is the next nearest row if we are upsampling vertically by 2.
+    // is_lower is true for the second of the two rows we make from near.
+    static void upsample_row(uint8_t *dest, const uint8_t *near, const uint8_t *far, bool is_lower, unsigned count, unsigned hfactor, unsigned vfactor, uint16_t *colsum) {
+      if (hfactor == 2 && vfactor <= 2) {
+        upsample_vertical(colsum, near, vfactor == 2 ? far : 0, count);
+        if (vfactor == 2) {
+          upsample_h2(dest, colsum, count, 8, 7, 4);
+        } else {
+          // colsum is 4 * near here
+          upsample_h2(dest, colsum, count, 4, 8, 4);
+        }
+      } else if (hfactor == 1 && vfactor == 2) {
+        int bias = is_lower ? 2 : 1;
+        for (unsigned i = 0; i != count; ++i) {
+          dest[i] = (uint8_t)( ( near[i] * 3 + far[i] + bias ) >> 2 );
+        }
+      } else {
+        // other factors are rare, use the nearest sample.
+        for (unsigned i = 0; i != count; ++i) {
+          for (unsigned j = 0; j != hfactor; ++j) {
+            *dest++ = near[i];
           }
+        }
+      }
+    }
+
+    // find the next marker that is not a restart marker.
+    // returns src_max if it has not arrived yet.
+    static const uint8_t *find_marker(const uint8_t *src, const uint8_t *src_max) {
+      for (; src + 1 < src_max; ++src) {
+        if (src[0] == 0xff && src[1] != 0x00 && src[1] != 0xff && !(src[1] >= 0xd0 && src[1] <= 0xd7)) {
+          return src;
+        }
+      }
+      return src_max;
+    }
+
+    // the bits for each restart interval start on a byte after a RSTn marker.
+    void restart(bit_reader &bits) {
+      const uint8_t *src = bits.src;
+      const uint8_t *src_max = bits.src_max;
+      while (src + 1 < src_max && !(src[0] == 0xff && src[1] != 0x00 && src[1] != 0xff)) {
+        src++;
+      }
 
-          if (precision != 8 || width == 0 || height == 0 || num_components > 4) return 0;
+      if (src + 1 >= src_max) {
+        // not here yet
+        bits.init(src_max, src_max);
+        bits.ran_out = true;
+      } else if (src[1] >= 0xd0 && src[1] <= 0xd7) {
+        bits.init(src + 2, src_max);
+      } else {
+        // missing restart marker. leave the marker for the parser.
+        bits.init(src, src_max);
+        bits.at_marker = true;
+      }
+
+      for (unsigned i = 0; i != num_components_in_scan; ++i) {
+        scan_components[i].last_dc = 0;
+      }
+      eobrun = 0;
+      mcus_to_restart = restart_interval;
+    }
 
-          if (debug) printf("SOF w=%d h=%d nc=%d\n", width, height, num_components);
+    // convert image rows y0..y1-1 to RGBA.
+    void output_rows(const plane_rows &src, unsigned y0, unsigned y1, row_buffers &rb) {
+      unsigned stride = width * 4;
 
-          // ycrcb only
-          if (num_components != 3) return 0;
+      // RGB files have an Adobe chunk or components called R, G and B.
+      bool is_rgb = num_components == 3 && (
+        has_adobe ? adobe_transform == 0 :
+        components[0].id == 'R' && components[1].id == 'G' && components[2].id == 'B'
+      );
 
-          for (unsigned i = 0; i != num_components; ++i) {
-            component &c = components[i];
-            c.id = src[10 + i*3 + 0];
-            c.hsamp = src[10 + i*3 + 1] >> 4;
-            c.vsamp = src[10 + i*3 + 1] & 15;
-            c.quantisation_table = src[10 + i*3 + 2] & 3;
-            if (debug) printf("id=%d h=%d v=%d q=%d\n", c.id, c.hsamp, c.vsamp, c.quantisation_table);
+      for (unsigned y = y0; y != y1; ++y) {
+        const uint8_t *rows[4];
+        for (unsigned c = 0; c != num_components; ++c) {
+          component &comp = components[c];
+          unsigned hfactor = max_hsamp / comp.hsamp;
+          unsigned vfactor = max_vsamp / comp.vsamp;
+          int near_y = (int)( y / vfactor );
+          const uint8_t *near = src.base[c] + ( near_y - src.first_row[c] ) * comp.plane_stride;
+          if (hfactor == 1 && vfactor == 1) {
+            rows[c] = near;
+          } else {
+            // the next nearest row, repeating the top and bottom rows of the image
+            bool is_lower = y % vfactor != 0;
+            int far_y = is_lower ? near_y + 1 : near_y - 1;
+            far_y = far_y < 0 ? 0 : far_y >= (int)comp.comp_height ? comp.comp_height - 1 : far_y;
+            const uint8_t *far = src.base[c] + ( far_y - src.first_row[c] ) * comp.plane_stride;
+            upsample_row(rb.upsampled[c], near, far, is_lower, comp.comp_width, hfactor, vfactor, rb.colsums + 1);
+            rows[c] = rb.upsampled[c];
           }
-          
-        } break;
+        }
+
+        // opengl textures are upside down
+        uint8_t *dest = &(*image)[( height - 1 - y ) * stride];
+        if (num_components == 1) {
+          grey_convert_row(dest, rows[0], width);
+        } else if (is_rgb) {
+          rgb_convert_row(dest, rows[0], rows[1], rows[2], width);
+        } else if (num_components == 3) {
+          color_convert_row(dest, rows[0], rows[1], rows[2], width);
+        } else {
+          cmyk_convert_row(dest, rows, width);
+        }
+      }
+    }
+
+    // bytes needed for one set of row buffers
+    unsigned get_buffer_size() {
+      return ( mcus_x * max_hsamp * 8 + 16 ) * ( num_components + 2 );
+    }
+
+    // point the row buffers at get_buffer_size() bytes of memory.
+    void init_buffers(row_buffers &rb, uint8_t *mem) {
+      unsigned size = mcus_x * max_hsamp * 8 + 16;
+      rb.colsums = (uint16_t*)mem;
+      mem += size * 2;
+      for (unsigned c = 0; c != num_components; ++c) {
+        rb.upsampled[c] = mem;
+        mem += size;
+      }
+    }
+
+    // image rows in MCU row y
+    void get_mcu_rows(unsigned y, unsigned &y0, unsigned &y1) {
+      y0 = y * max_vsamp * 8;
+      y1 = y0 + max_vsamp * 8 < height ? y0 + max_vsamp * 8 : height;
+    }
+
+    // MCU row y is in planes[y & 1], so we can now convert the row above it.
+    // plane row 0 is the last row of the MCU row above and
+    // plane row vsamp*8+1 is the first row of the MCU row below.
+    void finish_mcu_row(unsigned y) {
+      dynarray<uint8_t> *cur = planes[y & 1];
+      plane_rows src;
+      unsigned y0 = 0, y1 = 0;
+      if (y != 0) {
+        dynarray<uint8_t> *prev = planes[( y & 1 ) ^ 1];
+        for (unsigned c = 0; c != num_components; ++c) {
+          component &comp = components[c];
+          unsigned rows = comp.vsamp * 8;
+          memcpy(&prev[c][( rows + 1 ) * comp.plane_stride], &cur[c][comp.plane_stride], comp.plane_stride);
+          memcpy(&cur[c][0], &prev[c][rows * comp.plane_stride], comp.plane_stride);
+          src.base[c] = &prev[c][0];
+          src.first_row[c] = (int)( ( y - 1 ) * rows ) - 1;
+        }
+        get_mcu_rows(y - 1, y0, y1);
+        output_rows(src, y0, y1, buffers);
+      }
+
+      if (y == mcus_y - 1) {
+        for (unsigned c = 0; c != num_components; ++c) {
+          src.base[c] = &cur[c][0];
+          src.first_row[c] = (int)( y * components[c].vsamp * 8 ) - 1;
+        }
+        get_mcu_rows(y, y0, y1);
+        output_rows(src, y0, y1, buffers);
+        output_done = true;
+      }
+    }
+
+    // decode the blocks of MCU x of a row and IDCT them.
+    // dest[c] is the top left of the MCU row in the plane for component c.
+    void decode_mcu(bit_reader &bits, scan_component *scs, unsigned x, uint8_t **dest) {
+      int16_t block[64];
+      for (unsigned i = 0; i != num_components_in_scan; ++i) {
+        scan_component &sc = scs[i];
+        component &comp = components[sc.comp];
+        const uint16_t *quant = quant_tables[comp.quantisation_table].table;
+        uint8_t *plane = dest[sc.comp] + x * comp.hsamp * 8;
+        for (unsigned v = 0; v != comp.vsamp; ++v) {
+          for (unsigned h = 0; h != comp.hsamp; ++h) {
+            decode_block(bits, sc, block, quant);
+            inverse_dct(block, plane + v * 8 * comp.plane_stride + h * 8, comp.plane_stride);
+          }
+        }
+      }
+    }
+
+    // decode rows of MCUs from a baseline scan that has all the components.
+    // If a row is not all here yet, we go back to the start of the row and wait.
+    // returns true at the end of the scan.
+    bool decode_rows(const uint8_t *&src, const uint8_t *src_max, bool is_last) {
+      // if data arrives a few bytes at a time, don't decode the same row over and over.
+      if (!is_last && (unsigned)(src_max - src) < retry_size) return false;
+      retry_size = 0;
+
+      // if we have the whole scan, big images can use threads.
+      if (scan_mcu_y == 0 && use_threads()) {
+        const uint8_t *end = find_marker(src, src_max);
+        if (end != src_max || is_last) {
+          decode_parallel(src, end);
+          src = end;
+          return true;
+        }
+      }
+
+      bits.src = src;
+      bits.src_max = src_max;
+
+      for (; scan_mcu_y != mcus_y; ++scan_mcu_y) {
+        bit_reader saved_bits = bits;
+        int saved_dc[4];
+        for (unsigned i = 0; i != num_components_in_scan; ++i) {
+          saved_dc[i] = scan_components[i].last_dc;
+        }
+        unsigned saved_restart = mcus_to_restart;
+
+        uint8_t *dest[4];
+        for (unsigned c = 0; c != num_components; ++c) {
+          dest[c] = &planes[scan_mcu_y & 1][c][components[c].plane_stride];
+        }
+
+        for (unsigned x = 0; x != mcus_x; ++x) {
+          if (restart_interval) {
+            if (mcus_to_restart == 0) restart(bits);
+            mcus_to_restart--;
+          }
+          decode_mcu(bits, scan_components, x, dest);
+        }
+
+        if (bits.ran_out && !is_last) {
+          bits = saved_bits;
+          for (unsigned i = 0; i != num_components_in_scan; ++i) {
+            scan_components[i].last_dc = saved_dc[i];
+          }
+          mcus_to_restart = saved_restart;
+          src = bits.src;
+          retry_size = (unsigned)(src_max - src) * 2;
+          return false;
+        }
+
+        finish_mcu_row(scan_mcu_y);
+      }
+
+      src = bits.src;
+      return true;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    // Decoding with threads.
+    //
+    // We decode the whole image into image_planes and then convert bands of
+    // rows to RGBA on all the cpus.
+    //
+    // With restart markers, each restart interval can be decoded on its own.
+    // Without them, one thread does the huffman decoding and the others
+    // do the IDCT a few rows behind.
+    //
+
+    bool use_threads() {
+      return get_num_threads() > 1 && width * height >= min_thread_pixels;
+    }
+
+    unsigned get_num_threads() {
+      return num_threads ? num_threads : thread::get_num_cpus();
+    }
+
+    // the first row of MCU row y of component c in image_planes
+    uint8_t *get_image_plane(unsigned c, unsigned y) {
+      component &comp = components[c];
+      return &image_planes[c][y * comp.vsamp * 8 * comp.plane_stride];
+    }
+
+    void make_image_planes() {
+      for (unsigned c = 0; c != num_components; ++c) {
+        component &comp = components[c];
+        image_planes[c].resize(comp.plane_stride * comp.blocks_y * 8);
+      }
+    }
+
+    // find the start of each restart interval. returns false if some are missing.
+    bool find_restarts(const uint8_t *src, const uint8_t *end, dynarray<const uint8_t *> &segments) {
+      segments.push_back(src);
+      for (const uint8_t *p = src; p + 1 < end; ++p) {
+        if (p[0] == 0xff && p[1] >= 0xd0 && p[1] <= 0xd7) {
+          segments.push_back(p + 2);
+          p++;
+        }
+      }
+      return segments.size() == ( mcus_x * mcus_y + restart_interval - 1 ) / restart_interval;
+    }
+
+    struct restart_job {
+      jpeg_decoder *dec;
+      const uint8_t **segments;
+      unsigned num_segments;
+      unsigned segments_per_task;
+      const uint8_t *end;
+    };
+
+    // decode a few restart intervals
+    static void decode_intervals(void *arg, unsigned task) {
+      restart_job &job = *(restart_job*)arg;
+      jpeg_decoder &dec = *job.dec;
+      unsigned total = dec.mcus_x * dec.mcus_y;
+      unsigned first = task * job.segments_per_task;
+      unsigned last = first + job.segments_per_task < job.num_segments ? first + job.segments_per_task : job.num_segments;
+
+      for (unsigned seg = first; seg != last; ++seg) {
+        bit_reader bits;
+        bits.init(job.segments[seg], seg + 1 < job.num_segments ? job.segments[seg + 1] : job.end);
+
+        scan_component scs[4];
+        for (unsigned i = 0; i != dec.num_components_in_scan; ++i) {
+          scs[i] = dec.scan_components[i];
+          scs[i].last_dc = 0;
+        }
+
+        unsigned m0 = seg * dec.restart_interval;
+        unsigned m1 = m0 + dec.restart_interval < total ? m0 + dec.restart_interval : total;
+        uint8_t *dest[4];
+        unsigned dest_y = ~0u;
+        for (unsigned m = m0; m != m1; ++m) {
+          unsigned x = m % dec.mcus_x;
+          unsigned y = m / dec.mcus_x;
+          if (y != dest_y) {
+            for (unsigned c = 0; c != dec.num_components; ++c) {
+              dest[c] = dec.get_image_plane(c, y);
+            }
+            dest_y = y;
+          }
+          dec.decode_mcu(bits, scs, x, dest);
+        }
+      }
+    }
+
+    // Without restart markers, index 0 does the huffman decoding
+    // into a ring of rows of coefficients and the others do the IDCT.
+    struct pipeline_job {
+      jpeg_decoder *dec;
+      unsigned ring_rows;
+      unsigned row_size;
+      dynarray<int16_t> ring;
+      dynarray<int> row_done;
+      volatile int rows_decoded;
+      volatile int next_row;
+    };
+
+    // IDCT a row of MCUs from the ring
+    void idct_row(pipeline_job &job, unsigned y) {
+      const int16_t *block = &job.ring[( y % job.ring_rows ) * job.row_size];
+      for (unsigned x = 0; x != mcus_x; ++x) {
+        for (unsigned i = 0; i != num_components_in_scan; ++i) {
+          component &comp = components[scan_components[i].comp];
+          uint8_t *plane = get_image_plane(scan_components[i].comp, y) + x * comp.hsamp * 8;
+          for (unsigned v = 0; v != comp.vsamp; ++v) {
+            for (unsigned h = 0; h != comp.hsamp; ++h, block += 64) {
+              inverse_dct(block, plane + v * 8 * comp.plane_stride + h * 8, comp.plane_stride);
+            }
+          }
+        }
+      }
+      atomic::store((volatile int&)job.row_done[y], 1);
+    }
+
+    // IDCT the next row if it has been decoded. returns false if there isn't one.
+    bool help_idct(pipeline_job &job) {
+      int y = atomic::load(job.next_row);
+      if (y >= atomic::load(job.rows_decoded)) return false;
+      if (atomic::compare_and_swap(job.next_row, y, y + 1)) {
+        idct_row(job, (unsigned)y);
+      }
+      return true;
+    }
+
+    static void pipeline_worker(void *arg, unsigned index) {
+      pipeline_job &job = *(pipeline_job*)arg;
+      jpeg_decoder &dec = *job.dec;
+
+      if (index == 0) {
+        // huffman decode
+        for (unsigned y = 0; y != dec.mcus_y; ++y) {
+          // wait for the IDCT to finish with this part of the ring
+          while (y >= job.ring_rows && !atomic::load((volatile int&)job.row_done[y - job.ring_rows])) {
+            if (!dec.help_idct(job)) thread::sleep(0);
+          }
+
+          int16_t *block = &job.ring[( y % job.ring_rows ) * job.row_size];
+          for (unsigned x = 0; x != dec.mcus_x; ++x) {
+            if (dec.restart_interval) {
+              if (dec.mcus_to_restart == 0) dec.restart(dec.bits);
+              dec.mcus_to_restart--;
+            }
+            for (unsigned i = 0; i != dec.num_components_in_scan; ++i) {
+              scan_component &sc = dec.scan_components[i];
+              component &comp = dec.components[sc.comp];
+              const uint16_t *quant = dec.quant_tables[comp.quantisation_table].table;
+              for (unsigned b = 0; b != (unsigned)comp.hsamp * comp.vsamp; ++b, block += 64) {
+                dec.decode_block(dec.bits, sc, block, quant);
+              }
+            }
+          }
+          atomic::store(job.rows_decoded, (int)y + 1);
+        }
+
+        // then help with the rest
+        while (dec.help_idct(job)) {
+        }
+      } else {
+        for (;;) {
+          int y = atomic::add(job.next_row, 1) - 1;
+          if (y >= (int)dec.mcus_y) break;
+          while (atomic::load(job.rows_decoded) <= y) {
+            thread::sleep(0);
+          }
+          dec.idct_row(job, (unsigned)y);
+        }
+      }
+    }
+
+    struct output_job {
+      jpeg_decoder *dec;
+      unsigned rows_per_task;
+      dynarray<uint8_t> space;
+    };
+
+    // convert a band of rows from image_planes to RGBA
+    static void output_band(void *arg, unsigned task) {
+      output_job &job = *(output_job*)arg;
+      jpeg_decoder &dec = *job.dec;
+      unsigned y0 = task * job.rows_per_task;
+      unsigned y1 = y0 + job.rows_per_task < dec.height ? y0 + job.rows_per_task : dec.height;
+
+      // threads should not allocate memory, so the buffers are made in advance.
+      row_buffers rb;
+      dec.init_buffers(rb, &job.space[task * dec.get_buffer_size()]);
+      plane_rows src;
+      for (unsigned c = 0; c != dec.num_components; ++c) {
+        src.base[c] = &dec.image_planes[c][0];
+        src.first_row[c] = 0;
+      }
+      dec.output_rows(src, y0, y1, rb);
+    }
+
+    // convert image_planes to RGBA on all the cpus.
+    void output_parallel() {
+      unsigned threads = get_num_threads();
+      unsigned mcu_rows_per_task = ( mcus_y + threads * 4 - 1 ) / ( threads * 4 );
+      output_job job;
+      job.dec = this;
+      job.rows_per_task = mcu_rows_per_task * max_vsamp * 8;
+      unsigned num_tasks = ( height + job.rows_per_task - 1 ) / job.rows_per_task;
+      job.space.resize(num_tasks * get_buffer_size());
+      parallel_for::run(num_tasks, output_band, (void*)&job, threads);
+      output_done = true;
+    }
+
+    // decode a whole baseline scan with threads.
+    void decode_parallel(const uint8_t *src, const uint8_t *end) {
+      unsigned threads = get_num_threads();
+      make_image_planes();
+
+      dynarray<const uint8_t *> segments;
+      if (restart_interval && find_restarts(src, end, segments)) {
+        restart_job job;
+        job.dec = this;
+        job.segments = &segments[0];
+        job.num_segments = segments.size();
+        job.segments_per_task = ( job.num_segments + threads * 4 - 1 ) / ( threads * 4 );
+        job.end = end;
+        unsigned num_tasks = ( job.num_segments + job.segments_per_task - 1 ) / job.segments_per_task;
+        parallel_for::run(num_tasks, decode_intervals, (void*)&job, threads);
+      } else {
+        pipeline_job job;
+        job.dec = this;
+        job.ring_rows = threads * 4 < mcus_y ? threads * 4 : mcus_y;
+        job.row_size = 0;
+        for (unsigned i = 0; i != num_components_in_scan; ++i) {
+          component &comp = components[scan_components[i].comp];
+          job.row_size += mcus_x * comp.hsamp * comp.vsamp * 64;
+        }
+        job.ring.resize(job.ring_rows * job.row_size);
+        job.row_done.resize(mcus_y);
+        memset(&job.row_done[0], 0, mcus_y * sizeof(int));
+        job.rows_decoded = 0;
+        job.next_row = 0;
+        bits.init(src, end);
+        parallel_for::run(threads, pipeline_worker, (void*)&job, threads);
+      }
+
+      output_parallel();
+    }
+
+    // decode a whole scan into the coefficient buffers.
+    // returns false if the scan is not all here yet.
+    bool decode_buffered_scan(const uint8_t *&src, const uint8_t *src_max, bool is_last) {
+      // retry_size is how far we have looked for the end of the scan.
+      const uint8_t *end = find_marker(src + retry_size, src_max);
+      if (end == src_max && !is_last) {
+        retry_size = src_max - src > 1 ? (unsigned)(src_max - src) - 1 : 0;
+        return false;
+      }
+      retry_size = 0;
+
+      bits.init(src, end);
+      for (unsigned y = 0; y != scan_mcus_y; ++y) {
+        for (unsigned x = 0; x != scan_mcus_x; ++x) {
+          if (restart_interval) {
+            if (mcus_to_restart == 0) restart(bits);
+            mcus_to_restart--;
+          }
+
+          if (num_components_in_scan == 1) {
+            // non-interleaved scans have one block per MCU
+            scan_component &sc = scan_components[0];
+            component &comp = components[sc.comp];
+            decode_buffered_block(bits, sc, &coeffs[sc.comp][( y * comp.blocks_x + x ) * 64]);
+          } else {
+            for (unsigned i = 0; i != num_components_in_scan; ++i) {
+              scan_component &sc = scan_components[i];
+              component &comp = components[sc.comp];
+              for (unsigned v = 0; v != comp.vsamp; ++v) {
+                for (unsigned h = 0; h != comp.hsamp; ++h) {
+                  unsigned block = ( y * comp.vsamp + v ) * comp.blocks_x + x * comp.hsamp + h;
+                  decode_buffered_block(bits, sc, &coeffs[sc.comp][block * 64]);
+                }
+              }
+            }
+          }
+        }
+      }
+
+      src = end;
+      return true;
+    }
+
+    // dequantise and IDCT MCU row y of a buffered image.
+    void idct_coeffs(unsigned y, uint8_t **dest) {
+      const uint8_t *zz = zig_zag();
+      int16_t dct_coeffs[64];
+      for (unsigned c = 0; c != num_components; ++c) {
+        component &comp = components[c];
+        uint16_t quant[64];
+        const uint16_t *table = quant_tables[comp.quantisation_table].table;
+        for (unsigned i = 0; i != 64; ++i) {
+          quant[zz[i]] = table[i];
+        }
+
+        for (unsigned v = 0; v != comp.vsamp; ++v) {
+          const int16_t *block = &coeffs[c][( y * comp.vsamp + v ) * comp.blocks_x * 64];
+          uint8_t *plane = dest[c] + v * 8 * comp.plane_stride;
+          for (unsigned bx = 0; bx != comp.blocks_x; ++bx, block += 64) {
+            for (unsigned i = 0; i != 64; ++i) {
+              dct_coeffs[i] = (int16_t)( block[i] * quant[i] );
+            }
+            inverse_dct(dct_coeffs, plane + bx * 8, comp.plane_stride);
+          }
+        }
+      }
+    }
+
+    static void idct_coeffs_task(void *arg, unsigned y) {
+      jpeg_decoder &dec = *(jpeg_decoder*)arg;
+      uint8_t *dest[4];
+      for (unsigned c = 0; c != dec.num_components; ++c) {
+        dest[c] = dec.get_image_plane(c, y);
+      }
+      dec.idct_coeffs(y, dest);
+    }
+
+    // IDCT and convert a buffered image after the last scan.
+    void output_coeffs() {
+      if (use_threads()) {
+        make_image_planes();
+        parallel_for::run(mcus_y, idct_coeffs_task, (void*)this, get_num_threads());
+        output_parallel();
+        return;
+      }
+
+      for (unsigned y = 0; y != mcus_y; ++y) {
+        uint8_t *dest[4];
+        for (unsigned c = 0; c != num_components; ++c) {
+          dest[c] = &planes[y & 1][c][components[c].plane_stride];
+        }
+        idct_coeffs(y, dest);
+        finish_mcu_row(y);
+      }
+    }
+
+    // SOFn: image size and components
+    bool start_frame(const uint8_t *src, unsigned length) {
+      if (length < 10) return false;
+      sof_code = src[1];
+      precision = src[4];
+      height = u2(src + 5);
+      width = u2(src + 7);
+      num_components = src[9];
+
+      if (sof_code != 0xc0 && sof_code != 0xc1 && sof_code != 0xc2) {
+        printf("warning: lossless, hierarchical and arithmetic coded JPEGs are not supported\n");
+        return false;
+      }
+
+      if (precision != 8 || width == 0 || height == 0) return false;
+
+      if (num_components != 1 && num_components != 3 && num_components != 4) {
+        printf("warning: JPEG files need 1, 3 or 4 components\n");
+        return false;
+      }
+
+      if (length < 10 + num_components * 3) return false;
+
+      if (debug) printf("SOF w=%d h=%d nc=%d\n", width, height, num_components);
+
+      max_hsamp = max_vsamp = 1;
+      for (unsigned i = 0; i != num_components; ++i) {
+        component &c = components[i];
+        c.id = src[10 + i*3 + 0];
+        c.hsamp = src[10 + i*3 + 1] >> 4;
+        c.vsamp = src[10 + i*3 + 1] & 15;
+        c.quantisation_table = src[10 + i*3 + 2] & 3;
+        if (debug) printf("id=%d h=%d v=%d q=%d\n", c.id, c.hsamp, c.vsamp, c.quantisation_table);
+        if (c.hsamp == 0 || c.vsamp == 0 || c.hsamp > 4 || c.vsamp > 4) return false;
+
+        // greyscale images have one block per MCU whatever they say.
+        if (num_components == 1) c.hsamp = c.vsamp = 1;
+
+        max_hsamp = c.hsamp > max_hsamp ? c.hsamp : max_hsamp;
+        max_vsamp = c.vsamp > max_vsamp ? c.vsamp : max_vsamp;
+      }
+
+      mcus_x = ( width + max_hsamp * 8 - 1 ) / (max_hsamp * 8);
+      mcus_y = ( height + max_vsamp * 8 - 1 ) / (max_vsamp * 8);
+
+      for (unsigned i = 0; i != num_components; ++i) {
+        component &c = components[i];
+        if (max_hsamp % c.hsamp || max_vsamp % c.vsamp) {
+          printf("warning: unsupported JPEG sampling factors\n");
+          return false;
+        }
+        c.blocks_x = mcus_x * c.hsamp;
+        c.blocks_y = mcus_y * c.vsamp;
+        c.plane_stride = c.blocks_x * 8;
+        c.comp_width = ( width * c.hsamp + max_hsamp - 1 ) / max_hsamp;
+        c.comp_height = ( height * c.vsamp + max_vsamp - 1 ) / max_vsamp;
+        planes[0][i].resize(c.plane_stride * ( c.vsamp * 8 + 2 ));
+        planes[1][i].resize(c.plane_stride * ( c.vsamp * 8 + 2 ));
+      }
+      buffer_space.resize(get_buffer_size());
+      init_buffers(buffers, &buffer_space[0]);
+
+      image->resize(width * height * 4);
+      format = 0x1908; // GL_RGBA
+
+      if (sof_code == 0xc2) start_buffering();
+      return true;
+    }
+
+    // keep all the coefficients until the end of the image.
+    void start_buffering() {
+      buffered = true;
+      for (unsigned i = 0; i != num_components; ++i) {
+        component &c = components[i];
+        coeffs[i].resize(c.blocks_x * c.blocks_y * 64);
+        memset(&coeffs[i][0], 0, c.blocks_x * c.blocks_y * 64 * sizeof(int16_t));
+      }
+    }
+
+    // SOS: the components in this scan, followed by entropy coded data.
+    bool start_scan(const uint8_t *src, unsigned length) {
+      if (!num_components) return false;
+      num_components_in_scan = src[4];
+      if (num_components_in_scan < 1 || num_components_in_scan > num_components || length < 8 + num_components_in_scan * 2) return false;
+
+      src += 5;
+      for (unsigned i = 0; i != num_components_in_scan; ++i) {
+        scan_component &sc = scan_components[i];
+        unsigned id = *src++;
+        sc.ac_table = *src & 0x03;
+        sc.dc_table = ( *src++ >> 4 ) & 0x03;
+        unsigned comp = 0;
+        while (comp < num_components) {
+          if (components[comp].id == id) break;
+          comp++;
+        }
+        if (comp >= num_components) return false;
+        sc.comp = comp;
+        sc.last_dc = 0;
+        if (debug) printf("SOS comp=%d ac=%d dc=%d\n", comp, sc.ac_table, sc.dc_table);
+      }
+
+      spectral_start = *src++;
+      spectral_end = *src++;
+      successive_high = src[0] >> 4;
+      successive_low = *src++ & 0x0f;
+
+      // the tables this scan decodes with must have come in a DHT chunk.
+      // progressive dc refinement uses none, other dc scans no ac table.
+      bool progressive = sof_code == 0xc2;
+      bool uses_dc = !progressive || ( spectral_start == 0 && successive_high == 0 );
+      bool uses_ac = !progressive || spectral_start != 0;
+      for (unsigned i = 0; i != num_components_in_scan; ++i) {
+        scan_component &sc = scan_components[i];
+        if (uses_dc && !huffman_tables[0][sc.dc_table].defined) return false;
+        if (uses_ac && !huffman_tables[1][sc.ac_table].defined) return false;
+      }
+
+      if (sof_code == 0xc2) {
+        bool is_dc = spectral_start == 0;
+        if (spectral_end > 63 || spectral_start > spectral_end || successive_low > 13 ||
+          ( is_dc && spectral_end != 0 ) || ( !is_dc && num_components_in_scan != 1 )
+        ) {
+          return false;
+        }
+      } else {
+        spectral_start = 0;
+        spectral_end = 63;
+        if (num_components_in_scan != num_components && !buffered) {
+          if (output_done || scan_mcu_y) {
+            printf("warning: unsupported JPEG scans\n");
+            return false;
+          }
+          // each component has its own scan
+          start_buffering();
+        }
+      }
+
+      if (buffered && num_components_in_scan == 1) {
+        component &comp = components[scan_components[0].comp];
+        scan_mcus_x = ( comp.comp_width + 7 ) / 8;
+        scan_mcus_y = ( comp.comp_height + 7 ) / 8;
+      } else {
+        scan_mcus_x = mcus_x;
+        scan_mcus_y = mcus_y;
+      }
+
+      scan_mcu_y = 0;
+      mcus_to_restart = restart_interval;
+      eobrun = 0;
+      retry_size = 0;
+      bits.init(0, 0);
+      state = state_scan;
+      return true;
+    }
+
+    // JPEG files are split up into chunks starting with 0xff
+    bool decode_chunk(const uint8_t *src, unsigned length) {
+      if (debug) printf("decode_chunk %02x\n", src[1]);
+
+      switch (src[1]) {
+        // different kinds of image (SOF0-15)
+        case 0xc0: case 0xc1: case 0xc2: case 0xc3: case 0xc5: case 0xc6: case 0xc7:
+        case 0xc9: case 0xca: case 0xcb: case 0xcd: case 0xce: case 0xcf: {
+          if (num_components) return false;
+          return start_frame(src, length);
+        }
 
         // huffman tables
         case 0xc4: {
-          length = u2(src + 2) + 2;
-          src += 4;
           const uint8_t *src_max = src + length;
+          src += 4;
           while (src + 17 <= src_max) {
             unsigned index = src[0];
             unsigned is_ac = (index >> 4) & 1;
@@ -351,31 +1696,12 @@ namespace octet {
               count += num_codes[i];
             }
             src += 17;
-            if (src + count > src_max || count > 256) return 0;
+            if (src + count > src_max || count > 256) return false;
             memcpy(h.huffval, src, count);
             src += count;
 
-            unsigned dest = 0;
-            unsigned code = 0;
-            h.min_len = 0;
-            bool done_min_len = false;
-            for (unsigned len = 1; len < 17; ++len) {
-              h.offset[len-1] = code - dest;
-              if (!done_min_len && num_codes[len-1]) {
-                h.min_len = len - 1;
-                done_min_len = true;
-              }
-              for (unsigned i = 0; i != num_codes[len-1]; ++i) {
-                if (debug) printf("code=%04x len=%d\n", ( ( code + i ) << (16 - len) ), len );
-              }
-              dest += num_codes[len-1];
-              code = code + num_codes[len-1];
-              h.maxcodes[len-1] = ( code << (16 - len) ) - 1;
-              code *= 2;
-              if (debug) printf("h.maxcodes[%d] = %04x\n", len-1, h.maxcodes[len-1]);
-            }
-            h.maxcodes[16] = 0xffff;
-            
+            if (!h.build(num_codes)) return false;
+
             if (debug) printf("DHT %d\n", index);
           }
         } break;
@@ -388,149 +1714,201 @@ namespace octet {
         // end
         case 0xd9: {
           if (debug) printf("EOI\n");
+          if (buffered && !output_done) output_coeffs();
+          state = state_done;
         } break;
 
         // image data
         case 0xda: {
-          const uint8_t *src0 = src;
-          length = u2(src + 2) + 2;
-          src += 4;
-          num_components_in_scan = *src++;
-          unsigned max_hsamp = 1;
-          unsigned max_vsamp = 1;
-          num_mcu_blocks = 0;
-          const uint8_t *src_max = src + length;
-          for (unsigned i = 0; i != num_components_in_scan; ++i) {
-            scan_component &sc = scan_components[i];
-            unsigned id = *src++;
-            sc.ac_table = *src & 0x0f;
-            sc.dc_table = *src++ >> 4;
-            unsigned comp = 0;
-            while (comp < num_components) {
-              if (components[comp].id == id) break;
-              comp++;
-            }
-            if (comp >= num_components) return 0;
-            component &c = components[comp];
-            max_hsamp = c.hsamp > max_hsamp ? c.hsamp : max_hsamp;
-            max_vsamp = c.vsamp > max_vsamp ? c.vsamp : max_vsamp;
-            sc.comp = comp;
-            if (debug) printf("SOS comp=%d ac=%d dc=%d\n", comp, sc.ac_table, sc.dc_table);
-            unsigned samps = c.hsamp * c.vsamp;
-
-            if (num_mcu_blocks + samps > sizeof(mcu_blocks)/sizeof(mcu_blocks[0])) return 0;
-
-            for (unsigned j = 0; j != samps; ++j) {
-              mcu_block &m = mcu_blocks[num_mcu_blocks++];
-              m.dc_table = &huffman_tables[0][sc.dc_table];
-              m.ac_table = &huffman_tables[1][sc.ac_table];
-              m.quant = &quant_tables[c.quantisation_table];
-              m.scan_comp = &sc;
-            }
-
-            sc.last_dc = 0;
-          }
-
-          // at present, we only support YCrCb
-          if (num_mcu_blocks != 3) {
-            return 0;
-          }
-
-          spectral_start = *src++;
-          spectral_end = *src++;
-          successive_high = src[0] >> 4;
-          successive_low = *src++ & 0x0f;
-          if (src > src_max) return 0;
-
-          for (unsigned i = 0; i != num_components_in_scan; ++i) {
-            scan_component &sc = scan_components[i];
-            component &c = components[sc.comp];
-            sc.width_in_blocks = width * c.hsamp / max_hsamp;
-            sc.height_in_blocks = height * c.hsamp / max_hsamp;
-          }
-
-          unsigned xmax = ( width + max_hsamp * 8 - 1 ) / (max_hsamp * 8);
-          unsigned ymax = ( height + max_vsamp * 8 - 1 ) / (max_vsamp * 8);
-
-          unsigned acc = 0;
-          int shift = 0;
-          skip_bits(16, acc, src, shift);
-          
-          int stride = width * 4;
-          if (num_mcu_blocks == 3) {
-            unsigned size = width * height * 4;
-            image.resize(size);
-            format = 0x1908; // GL_RGBA
-          }
-          for (unsigned y = 0; y != ymax; ++y) {
-            for (unsigned x = 0; x != xmax; ++x) {
-              float *coeffs = dct_coeffs;
-              memset(coeffs, 0, 64 * num_mcu_blocks * sizeof(float));
-              for (unsigned b = 0; b < num_mcu_blocks; ++b) {
-                decode_mcu_block(b, acc, src, shift, coeffs);
-                inverse_dct(coeffs);
-                coeffs += 64;
-              }
-              if (num_mcu_blocks == 3) {
-                // assume 4:4:4 YCbCr
-                color_convert_444(&image[( ( height - 1 - y * 8 ) * stride ) + ( x * 8 * 4 )], -stride, dct_coeffs);
-              }
-            }
-          }
-          skip_bits(shift, acc, src, shift);
-          length = (unsigned)(src - src0);
-        } break;
+          return start_scan(src, length);
+        }
 
         // quantisation tables (the lossy bit)
         case 0xdb: {
-          length = u2(src + 2) + 2;
           const uint8_t *src_max = src + length;
           src += 4;
           while (src < src_max) {
             unsigned prec = (src[0] >> 4) & 1;
             unsigned n = src[0] & 0x0f;
             src++;
+            if (src + 64 * (prec + 1) > src_max) return false;
             for (unsigned i = 0; i != 64; ++i) {
-              quant_tables[n&3].table[i] = (float)( prec ? u2(src) : *src );
+              quant_tables[n&3].table[i] = (uint16_t)( prec ? u2(src) : *src );
               src += prec + 1;
             }
             if (debug) printf("DQT %d %d\n", prec, n);
           }
         } break;
 
+        // restart interval
+        case 0xdd: {
+          if (length < 6) return false;
+          restart_interval = u2(src + 4);
+          if (debug) printf("DRI %d\n", restart_interval);
+        } break;
+
         // JFIF stubset of JPEG
         case 0xe0: {
-          length = u2(src + 2) + 2;
           if (debug) printf("M_APP0 (JFIF)\n");
         } break;
 
+        // Adobe: tells us if the colours are RGB, YCbCr, CMYK or YCCK
+        case 0xee: {
+          if (length >= 16 && !memcmp(src + 4, "Adobe", 5)) {
+            has_adobe = true;
+            adobe_transform = src[15];
+          }
+        } break;
+
         // unknown chunk
         default: {
-          if (src[2] != 0xff) length = u2(src + 2) + 2;
           if (debug) printf("unknown\n");
         } break;
       }
-      return length;
+      return true;
     }
-  public:
-    // get an opengl texture from a file in memory
-    void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width_, uint16_t &height_, const uint8_t *src, const uint8_t *src_max) {
-      while (src < src_max) {
-        if (src[0] != 0xff) {
-          printf("warning: bad JPEG file\n");
-          return;
+
+    // decode as much of src..src_max as we can. returns the number of bytes used.
+    // is_last is true if there is no more data to come.
+    unsigned parse(const uint8_t *src0, const uint8_t *src_max, bool is_last) {
+      const uint8_t *src = src0;
+      while (state == state_marker || state == state_scan) {
+        if (state == state_scan) {
+          bool done = buffered ? decode_buffered_scan(src, src_max, is_last) : decode_rows(src, src_max, is_last);
+          if (!done) break;
+          state = state_marker;
+        }
+
+        // skip anything before the next marker
+        if (src < src_max && src[0] != 0xff) {
+          const uint8_t *next = find_marker(src, src_max);
+          if (debug) printf("%d bytes before marker\n", (int)(next - src));
+          if (next == src_max) {
+            src = is_last || src_max[-1] != 0xff ? src_max : src_max - 1;
+            break;
+          }
+          src = next;
+        }
+
+        if (src + 2 > src_max) break;
+
+        unsigned marker = src[1];
+        if (marker == 0xff) {
+          // fill byte
+          src++;
+          continue;
         }
-        unsigned length = decode_chunk(src, image, format);
-        if (!length) {
-          printf("warning: bad JPEG file\n");
-          return;
+
+        // these markers are on their own. the rest have a length
+        unsigned length = 2;
+        if (marker != 0x01 && !(marker >= 0xd0 && marker <= 0xd9)) {
+          if (src + 4 > src_max) break;
+          length = u2(src + 2) + 2;
+          if (length < 4) {
+            state = state_error;
+            break;
+          }
+          if (src + length > src_max) break;
+        }
+
+        if (!decode_chunk(src, length)) {
+          state = state_error;
+          break;
         }
         src += length;
       }
+      return (unsigned)(src - src0);
+    }
+
+    // bytes we have been given but not used yet
+    dynarray<uint8_t> pending;
+  public:
+    jpeg_decoder() {
+      image = 0;
+      num_threads = 0;
+      state = state_done;
+      memset(huffman_tables, 0, sizeof(huffman_tables));
+      memset(quant_tables, 0, sizeof(quant_tables));
+    }
+
+    // start decoding a file into image.
+    void begin(dynarray<uint8_t> &image_) {
+      image = &image_;
+      state = state_marker;
+      width = height = 0;
+      num_components = 0;
+      restart_interval = 0;
+      has_adobe = false;
+      adobe_transform = 1;
+      buffered = false;
+      output_done = false;
+      scan_mcu_y = 0;
+      format = 0;
+      pending.resize(0);
+      for (unsigned i = 0; i != 8; ++i) {
+        huffman_tables[i >> 2][i & 3].defined = false;
+      }
+    }
+
+    // decode as much as we can with the next part of the file.
+    // returns false if the file is bad.
+    bool add(const uint8_t *src, unsigned size) {
+      if (state != state_marker && state != state_scan) {
+        return state != state_error;
+      }
+
+      if (pending.size() == 0) {
+        // try to use the data where it is
+        unsigned used = parse(src, src + size, false);
+        pending.resize(size - used);
+        if (size != used) memcpy(&pending[0], src + used, size - used);
+      } else {
+        unsigned old_size = pending.size();
+        pending.resize(old_size + size);
+        memcpy(&pending[old_size], src, size);
+        unsigned used = parse(&pending[0], &pending[0] + pending.size(), false);
+        if (used) {
+          memmove(&pending[0], &pending[used], pending.size() - used);
+          pending.resize(pending.size() - used);
+        }
+      }
+      return state != state_error;
+    }
+
+    // threads to use for big images. 0 is one per cpu and 1 never starts threads.
+    void set_num_threads(unsigned value) {
+      num_threads = value;
+    }
+
+    // finish decoding. returns false if we did not get an image.
+    // if the file was cut short, we return what we have.
+    bool end(uint16_t &format_, uint16_t &width_, uint16_t &height_) {
+      if (state == state_marker || state == state_scan) {
+        const uint8_t *src = pending.size() ? &pending[0] : 0;
+        parse(src, src + pending.size(), true);
+        if (buffered && !output_done && state != state_error) {
+          output_coeffs();
+        }
+      }
+      pending.reset();
+
+      if (state == state_error || !output_done) {
+        return false;
+      }
+
+      format_ = format;
       width_ = width;
       height_ = height;
-      num_components = 3;
+      return true;
+    }
+
+    // get an opengl texture from a file in memory
+    void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width_, uint16_t &height_, const uint8_t *src, const uint8_t *src_max) {
+      begin(image);
+      add(src, (unsigned)(src_max - src));
+      if (!end(format, width_, height_)) {
+        printf("warning: bad JPEG file\n");
+      }
     }
   };
 }
-
@@ -8,72 +8,910 @@
 // jpeg file encoder - tiny and fast
 //
 // See http://en.wikipedia.org/wiki/JPEG
-// 
+//
+// Baseline files for screenshots and frame dumps. The encoder works one row
+// of MCUs at a time:
+//   convert RGBA to YCbCr, halving the chroma in both directions for 4:2:0
+//   fixed point forward DCT and quantisation of each 8x8 block
+//   huffman code the non-zero coefficients with the standard tables
+//
+// The colour conversion and DCT have SSE2 versions (see OCTET_SSE2)
+// that give exactly the same results as the C versions.
+//
+// example:
+//
+//   jpeg_encoder enc;
+//   enc.set_quality(90);
+//   dynarray<uint8_t> file;
+//   enc.encode(file, width, height, width * 4, pixels);
+//
+// OpenGL reads pixels from the bottom up, so point at the last row and
+// use a negative stride:
+//
+//   enc.encode(file, width, height, -width * 4, pixels + (height-1) * width * 4);
+//
 namespace octet {
   class jpeg_encoder {
-  public:
-    jpeg_encoder() {
+    // quality 1..100 scales the standard quantisation tables
+    unsigned quality;
+
+    // true for 4:2:0 (half resolution chroma), false for 4:4:4
+    bool subsample;
+
+    // quantisation tables for luma and chroma in natural order.
+    // we divide by 8 * quant because the DCT is scaled by 8:
+    //   (abs(x) + half) * recip >> 16
+    uint8_t quant[2][64];
+    uint16_t recip[2][64];
+    uint16_t half[2][64];
+
+    // huffman codes for luma and chroma
+    uint16_t dc_code[2][16];
+    uint8_t dc_size[2][16];
+    uint16_t ac_code[2][256];
+    uint8_t ac_size[2][256];
+
+    // where the file goes
+    uint8_t *dest;
+    uint8_t *dest_max;
+    bool overflow;
+
+    // bits not written yet, the last num_bits bits of acc.
+    uint64_t acc;
+    unsigned num_bits;
+
+    // one row of MCUs: 16 (4:2:0) or 8 (4:4:4) rows of Y, Cb and Cr,
+    // level shifted to -128..127.
+    // With 4:2:0, full size chroma has two extra bits and we average it into half_chroma.
+    dynarray<int16_t> planes[3];
+    dynarray<int16_t> half_chroma[2];
+    unsigned plane_stride;
+
+    // a row of source pixels padded to a whole number of MCUs
+    dynarray<uint8_t> padded_row;
+
+    int last_dc[3];
+
+    // the largest a huffman coded block can be with 0xff stuffing
+    enum { max_block_bytes = 512 };
+
+    // space for the headers
+    enum { max_header_bytes = 1024 };
+
+    // dct coefficients are stored in zig-zag order in the file.
+    // entry i is the natural order position of coefficient i.
+    static const uint8_t *zig_zag() {
+      static const uint8_t zig_zag_[64] = {
+        0, 1, 8, 16, 9, 2, 3, 10,
+        17, 24, 32, 25, 18, 11, 4, 5,
+        12, 19, 26, 33, 40, 48, 41, 34,
+        27, 20, 13, 6, 7, 14, 21, 28,
+        35, 42, 49, 56, 57, 50, 43, 36,
+        29, 22, 15, 23, 30, 37, 44, 51,
+        58, 59, 52, 45, 38, 31, 39, 46,
+        53, 60, 61, 54, 47, 55, 62, 63,
+      };
+      return zig_zag_;
+    }
+
+    // quantisation tables from the JPEG standard (Annex K), natural order.
+    static const uint8_t *std_quant(unsigned table) {
+      static const uint8_t std_quant_[2][64] = {
+        {
+          16, 11, 10, 16, 24, 40, 51, 61,
+          12, 12, 14, 19, 26, 58, 60, 55,
+          14, 13, 16, 24, 40, 57, 69, 56,
+          14, 17, 22, 29, 51, 87, 80, 62,
+          18, 22, 37, 56, 68, 109, 103, 77,
+          24, 35, 55, 64, 81, 104, 113, 92,
+          49, 64, 78, 87, 103, 121, 120, 101,
+          72, 92, 95, 98, 112, 100, 103, 99,
+        }, {
+          17, 18, 24, 47, 99, 99, 99, 99,
+          18, 21, 26, 66, 99, 99, 99, 99,
+          24, 26, 56, 99, 99, 99, 99, 99,
+          47, 66, 99, 99, 99, 99, 99, 99,
+          99, 99, 99, 99, 99, 99, 99, 99,
+          99, 99, 99, 99, 99, 99, 99, 99,
+          99, 99, 99, 99, 99, 99, 99, 99,
+          99, 99, 99, 99, 99, 99, 99, 99,
+        }
+      };
+      return std_quant_[table];
+    }
+
+    // huffman tables from the JPEG standard (Annex K):
+    // 16 counts of codes of each length followed by the symbols.
+    static const uint8_t *std_dc_table(unsigned table) {
+      static const uint8_t std_dc_[2][16+12] = {
+        {
+          0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0,
+          0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+        }, {
+          0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0,
+          0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+        }
+      };
+      return std_dc_[table];
+    }
+
+    static const uint8_t *std_ac_table(unsigned table) {
+      static const uint8_t std_ac_[2][16+162] = {
+        {
+          0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d,
+          0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+          0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+          0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+          0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+          0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+          0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+          0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+          0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+          0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+          0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+          0xf9, 0xfa,
+        }, {
+          0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77,
+          0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+          0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+          0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+          0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+          0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+          0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+          0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+          0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+          0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+          0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+          0xf9, 0xfa,
+        }
+      };
+      return std_ac_[table];
+    }
+
+    // number of symbols in a huffman table
+    static unsigned table_size(const uint8_t *table) {
+      unsigned total = 0;
+      for (unsigned i = 0; i != 16; ++i) total += table[i];
+      return total;
+    }
+
+    // canonical huffman codes: codes of each length count up from
+    // twice the last code of the length before.
+    static void build_codes(const uint8_t *table, uint16_t *codes, uint8_t *sizes) {
+      const uint8_t *symbols = table + 16;
+      unsigned code = 0;
+      for (unsigned len = 1; len <= 16; ++len) {
+        for (unsigned i = 0; i != table[len-1]; ++i) {
+          unsigned symbol = *symbols++;
+          codes[symbol] = (uint16_t)code++;
+          sizes[symbol] = (uint8_t)len;
+        }
+        code <<= 1;
+      }
+    }
+
+    // scale the standard tables like the IJG library does, so quality means the same.
+    void build_tables() {
+      unsigned q = quality < 1 ? 1 : quality > 100 ? 100 : quality;
+      unsigned scale = q < 50 ? 5000 / q : 200 - q * 2;
+      for (unsigned t = 0; t != 2; ++t) {
+        const uint8_t *std = std_quant(t);
+        for (unsigned i = 0; i != 64; ++i) {
+          unsigned value = ( std[i] * scale + 50 ) / 100;
+          value = value < 1 ? 1 : value > 255 ? 255 : value;
+          unsigned divisor = value * 8;
+          quant[t][i] = (uint8_t)value;
+          recip[t][i] = (uint16_t)( ( 65536 + divisor - 1 ) / divisor );
+          half[t][i] = (uint16_t)( divisor / 2 );
+        }
+
+        memset(dc_size[t], 0, sizeof(dc_size[t]));
+        memset(ac_size[t], 0, sizeof(ac_size[t]));
+        build_codes(std_dc_table(t), dc_code[t], dc_size[t]);
+        build_codes(std_ac_table(t), ac_code[t], ac_size[t]);
+      }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    // writing bytes and bits
+    //
+
+    void put_byte(unsigned value) {
+      if (dest == dest_max) {
+        overflow = true;
+      } else {
+        *dest++ = (uint8_t)value;
+      }
+    }
+
+    void put_u16(unsigned value) {
+      put_byte(value >> 8);
+      put_byte(value & 0xff);
     }
 
-    bool encode(dynarray<uint8_t> data, uint32_t width, uint32_t height, int stride, const uint8_t *src) {
-      /*if ((height & 7) != 0 || (width & 7) != 0) {
-        return false;
+    // write the next 32 bits of acc
+    void flush_word() {
+      num_bits -= 32;
+      uint32_t word = (uint32_t)( acc >> num_bits );
+
+      // every 0xff byte in the entropy coded data is followed by 0x00.
+      // This finds 0xff bytes with the "has a zero byte" trick on ~word.
+      if (( ~word - 0x01010101 ) & word & 0x80808080) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+          uint8_t byte = (uint8_t)( word >> shift );
+          *dest++ = byte;
+          if (byte == 0xff) *dest++ = 0;
+        }
+      } else {
+        dest[0] = (uint8_t)( word >> 24 );
+        dest[1] = (uint8_t)( word >> 16 );
+        dest[2] = (uint8_t)( word >> 8 );
+        dest[3] = (uint8_t)word;
+        dest += 4;
+      }
+    }
+
+    // add up to 32 bits to the stream
+    OCTET_HOT void put_bits(unsigned bits, unsigned size) {
+      acc = ( acc << size ) | bits;
+      num_bits += size;
+      if (num_bits >= 32) flush_word();
+    }
+
+    // pad the last byte with ones and write what is left of acc
+    void flush_bits() {
+      put_bits(0x7f, 7);
+      while (num_bits >= 8) {
+        num_bits -= 8;
+        uint8_t byte = (uint8_t)( acc >> num_bits );
+        put_byte(byte);
+        if (byte == 0xff) put_byte(0);
       }
+      num_bits = 0;
+    }
+
+    static unsigned lowest_bit(uint32_t x) {
+      #ifdef WIN32
+        unsigned long index;
+        _BitScanForward(&index, x);
+        return (unsigned)index;
+      #else
+        return (unsigned)__builtin_ctz(x);
+      #endif
+    }
+
+    // number of bits needed for a positive value
+    static unsigned bit_length(unsigned x) {
+      #ifdef WIN32
+        unsigned long index;
+        return _BitScanReverse(&index, x) ? (unsigned)index + 1 : 0;
+      #else
+        return x ? 32 - (unsigned)__builtin_clz(x) : 0;
+      #endif
+    }
 
-      // guess
-      data.reserve(width * height / 2);
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    // headers
+    //
 
-      static const uint8_t hdr[] = {
+    void write_headers(unsigned width, unsigned height) {
+      static const uint8_t jfif[] = {
         0xff, 0xd8, // SOI
         0xff, 0xe0, 0x00, 0x10, // APP0
-          'J', 'F', 'I', 'F', 0x00, 0x01, 0x01, 0x01, 0x00, 0x48, 0x00, 0x48, 0x00, 0x00,
-
-        0xff, 0xdb, 0x00, 0x43, // DQT
-          0x00,
-          0x03, 0x02, 0x02, 0x03, 0x02, 0x02, 0x03, 0x03,
-          0x03, 0x03, 0x04, 0x03, 0x03, 0x04, 0x05, 0x08,
-          0x05, 0x05, 0x04, 0x04, 0x05, 0x0a, 0x07, 0x07,
-          0x06, 0x08, 0x0c, 0x0a, 0x0c, 0x0c, 0x0b, 0x0a,
-          0x0b, 0x0b, 0x0d, 0x0e, 0x12, 0x10, 0x0d, 0x0e,
-          0x11, 0x0e, 0x0b, 0x0b, 0x10, 0x16, 0x10, 0x11,
-          0x13, 0x14, 0x15, 0x15, 0x15, 0x0c, 0x0f, 0x17,
-          0x18, 0x16, 0x14, 0x18, 0x12, 0x14, 0x15, 0x14,
-        0xff, 0xdb, 0x00, 0x43, // DQT
-          0x01,
-          0x03, 0x04, 0x04, 0x05, 0x04, 0x05, 0x09, 0x05,
-          0x05, 0x09, 0x14, 0x0d, 0x0b, 0x0d, 0x14, 0x14,
-          0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14,
-          0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14,
-          0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14,
-          0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14,
-          0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14,
-          0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14,
-        0xff, 0xc0, 0x00, 0x11, // SOF0
-          0x08, 0x02, 0x00, 0x02, 0x00, 0x03, 0x01, 0x11, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01,
-        0xff, 0xc4, 0x00, 0x1e, // DHT
-          0x00, 0x01, 0x00, 0x03, 0x00, 0x02, 0x03, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-          0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x06, 0x05, 0x07, 0x09, 0x08, 0x0a,
-        0xff, 0xc4, 0x00, 0x55, // DHT
-          0x10, 0x00, 0x02, 0x00, 0x03, 0x04, 0x05, 0x08, 0x06, 0x06, 0x04, 0x0b, 0x05, 0x07, 0x05, 0x00,
-          0x00, 0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x61, 0x07,
-          0x14, 0x53, 0x71, 0x81, 0x92, 0xb1, 0xf0, 0x08, 0x13, 0x34, 0x72, 0x91, 0xa1, 0x09, 0x22, 0x32,
-          0x42, 0xc1, 0xd1, 0x23, 0x52, 0xe1, 0xf1, 0x15, 0x16, 0x17, 0x36, 0x43, 0x62, 0x73, 0x82, 0x94,
-          0xb2, 0xd2, 0x24, 0x55, 0x63, 0xa3, 0xc2, 0x18, 0x33, 0x35, 0x64, 0x74, 0x93, 0xa2, 0x25, 0x44,
-          0x45, 0x54, 0x83,
-        0xff, 0xc4, 0x00, 0x1d, // DHT
-          0x01, 0x01, 0x01, 0x01, 0x00, 0x02, 0x03, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-          0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09,
-        0xff, 0xc4, 0x00, 0x43, // DHT
-          0x11, 0x01, 0x00, 0x01, 0x02, 0x03, 0x05, 0x02, 0x0b, 0x06, 0x04, 0x05, 0x04, 0x03, 0x01, 0x00,
-          0x00, 0x00, 0x01, 0x02, 0x11, 0x03, 0x04, 0x31, 0x05, 0x12, 0x21, 0x32, 0x51, 0x06, 0x41, 0x07,
-          0x13, 0x14, 0x22, 0x61, 0x71, 0x81, 0x91, 0xa1, 0xb1, 0xd1, 0x15, 0x34, 0x42, 0x53, 0x72, 0xf0,
-          0x52, 0x62, 0xc1, 0xe1, 0x23, 0x82, 0x92, 0xa2, 0xc2, 0x24, 0x43, 0xb2, 0xd2, 0x33, 0x63, 0x73,
-          0x93,
-        0xff, 0xda, 0x00, 0x0c, // SOS
-          0x03, 0x01, 0x00, 0x02, 0x11, 0x03, 0x11, 0x00, 0x3f, 0x00, 0xfd, 0x7f, 
-      };*/
-      return 0;
+        'J', 'F', 'I', 'F', 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+      };
+      for (unsigned i = 0; i != sizeof(jfif); ++i) {
+        put_byte(jfif[i]);
+      }
+
+      // DQT
+      const uint8_t *zz = zig_zag();
+      for (unsigned t = 0; t != 2; ++t) {
+        put_u16(0xffdb);
+        put_u16(2 + 1 + 64);
+        put_byte(t);
+        for (unsigned i = 0; i != 64; ++i) {
+          put_byte(quant[t][zz[i]]);
+        }
+      }
+
+      // SOF0: Y then Cb and Cr
+      put_u16(0xffc0);
+      put_u16(2 + 6 + 3 * 3);
+      put_byte(8);
+      put_u16(height);
+      put_u16(width);
+      put_byte(3);
+      for (unsigned c = 0; c != 3; ++c) {
+        put_byte(c + 1);
+        put_byte(c == 0 && subsample ? 0x22 : 0x11);
+        put_byte(c == 0 ? 0 : 1);
+      }
+
+      // DHT
+      for (unsigned t = 0; t != 4; ++t) {
+        const uint8_t *table = t & 1 ? std_ac_table(t >> 1) : std_dc_table(t >> 1);
+        unsigned size = table_size(table);
+        put_u16(0xffc4);
+        put_u16(2 + 1 + 16 + size);
+        put_byte(( t & 1 ) << 4 | ( t >> 1 ));
+        for (unsigned i = 0; i != 16 + size; ++i) {
+          put_byte(table[i]);
+        }
+      }
+
+      // SOS
+      put_u16(0xffda);
+      put_u16(2 + 1 + 3 * 2 + 3);
+      put_byte(3);
+      for (unsigned c = 0; c != 3; ++c) {
+        put_byte(c + 1);
+        put_byte(c == 0 ? 0x00 : 0x11);
+      }
+      put_byte(0);
+      put_byte(63);
+      put_byte(0);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    // colour conversion
+    //
+
+    // RGB to YCbCr constants, 14 bits after the point.
+    enum {
+      y_r = 4899,     // 0.299
+      y_g = 9617,     // 0.587
+      y_b = 1868,     // 0.114
+      cb_r = -2765,   // -0.168736
+      cb_g = -5427,   // -0.331264
+      cb_b = 8192,    // 0.5
+      cr_r = 8192,    // 0.5
+      cr_g = -6860,   // -0.418688
+      cr_b = -1332,   // -0.081312
+    };
+
+    // convert RGBA to Y - 128 and Cb, Cr.
+    // chroma_shift is 14 for the plain values or 12 to keep two extra bits.
+    // count must be a multiple of 8.
+    static void color_convert_row(int16_t *y, int16_t *cb, int16_t *cr, const uint8_t *src, unsigned count, unsigned chroma_shift) {
+      int y_bias = 8192 - (128 << 14);
+      int c_bias = 1 << ( chroma_shift - 1 );
+      unsigned i = 0;
+
+      #if OCTET_SSE2
+        // red and blue are in the even 16 bit words of a pixel, green and alpha in the odd ones,
+        // so each _mm_madd_epi16 does two of the three multiplies for four pixels.
+        __m128i lo_bytes = _mm_set1_epi16(0x00ff);
+        __m128i y_rb = _mm_setr_epi16(y_r, y_b, y_r, y_b, y_r, y_b, y_r, y_b);
+        __m128i y_g0 = _mm_setr_epi16(y_g, 0, y_g, 0, y_g, 0, y_g, 0);
+        __m128i cb_rb = _mm_setr_epi16(cb_r, cb_b, cb_r, cb_b, cb_r, cb_b, cb_r, cb_b);
+        __m128i cb_g0 = _mm_setr_epi16(cb_g, 0, cb_g, 0, cb_g, 0, cb_g, 0);
+        __m128i cr_rb = _mm_setr_epi16(cr_r, cr_b, cr_r, cr_b, cr_r, cr_b, cr_r, cr_b);
+        __m128i cr_g0 = _mm_setr_epi16(cr_g, 0, cr_g, 0, cr_g, 0, cr_g, 0);
+        __m128i y_bias4 = _mm_set1_epi32(y_bias);
+        __m128i c_bias4 = _mm_set1_epi32(c_bias);
+        __m128i y_shift = _mm_cvtsi32_si128(14);
+        __m128i c_shift = _mm_cvtsi32_si128((int)chroma_shift);
+
+        for (; i != count; i += 8) {
+          __m128i p0 = _mm_loadu_si128((const __m128i*)(src + i*4));
+          __m128i p1 = _mm_loadu_si128((const __m128i*)(src + i*4 + 16));
+          __m128i rb0 = _mm_and_si128(p0, lo_bytes);
+          __m128i ga0 = _mm_srli_epi16(p0, 8);
+          __m128i rb1 = _mm_and_si128(p1, lo_bytes);
+          __m128i ga1 = _mm_srli_epi16(p1, 8);
+
+          __m128i y0 = _mm_add_epi32(_mm_madd_epi16(rb0, y_rb), _mm_madd_epi16(ga0, y_g0));
+          __m128i y1 = _mm_add_epi32(_mm_madd_epi16(rb1, y_rb), _mm_madd_epi16(ga1, y_g0));
+          y0 = _mm_sra_epi32(_mm_add_epi32(y0, y_bias4), y_shift);
+          y1 = _mm_sra_epi32(_mm_add_epi32(y1, y_bias4), y_shift);
+          _mm_storeu_si128((__m128i*)(y + i), _mm_packs_epi32(y0, y1));
+
+          __m128i cb0 = _mm_add_epi32(_mm_madd_epi16(rb0, cb_rb), _mm_madd_epi16(ga0, cb_g0));
+          __m128i cb1 = _mm_add_epi32(_mm_madd_epi16(rb1, cb_rb), _mm_madd_epi16(ga1, cb_g0));
+          cb0 = _mm_sra_epi32(_mm_add_epi32(cb0, c_bias4), c_shift);
+          cb1 = _mm_sra_epi32(_mm_add_epi32(cb1, c_bias4), c_shift);
+          _mm_storeu_si128((__m128i*)(cb + i), _mm_packs_epi32(cb0, cb1));
+
+          __m128i cr0 = _mm_add_epi32(_mm_madd_epi16(rb0, cr_rb), _mm_madd_epi16(ga0, cr_g0));
+          __m128i cr1 = _mm_add_epi32(_mm_madd_epi16(rb1, cr_rb), _mm_madd_epi16(ga1, cr_g0));
+          cr0 = _mm_sra_epi32(_mm_add_epi32(cr0, c_bias4), c_shift);
+          cr1 = _mm_sra_epi32(_mm_add_epi32(cr1, c_bias4), c_shift);
+          _mm_storeu_si128((__m128i*)(cr + i), _mm_packs_epi32(cr0, cr1));
+        }
+      #endif
+
+      for (; i != count; ++i) {
+        int r = src[i*4+0], g = src[i*4+1], b = src[i*4+2];
+        y[i] = (int16_t)( ( r * y_r + g * y_g + b * y_b + y_bias ) >> 14 );
+        cb[i] = (int16_t)( ( r * cb_r + g * cb_g + b * cb_b + c_bias ) >> chroma_shift );
+        cr[i] = (int16_t)( ( r * cr_r + g * cr_g + b * cr_b + c_bias ) >> chroma_shift );
+      }
+    }
+
+    // average 2x2 blocks of chroma with two extra bits.
+    // count is the number of outputs and must be a multiple of 8.
+    static void downsample_row(int16_t *dest, const int16_t *row0, const int16_t *row1, unsigned count) {
+      unsigned i = 0;
+
+      #if OCTET_SSE2
+        __m128i ones = _mm_set1_epi16(1);
+        __m128i bias = _mm_set1_epi32(8);
+        for (; i != count; i += 8) {
+          __m128i a = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(row0 + i*2)), _mm_loadu_si128((const __m128i*)(row1 + i*2)));
+          __m128i b = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(row0 + i*2 + 8)), _mm_loadu_si128((const __m128i*)(row1 + i*2 + 8)));
+          a = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(a, ones), bias), 4);
+          b = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(b, ones), bias), 4);
+          _mm_storeu_si128((__m128i*)(dest + i), _mm_packs_epi32(a, b));
+        }
+      #endif
+
+      for (; i != count; ++i) {
+        dest[i] = (int16_t)( ( row0[i*2] + row0[i*2+1] + row1[i*2] + row1[i*2+1] + 8 ) >> 4 );
+      }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    // Forward DCT and quantisation
+    //
+    // This is the accurate integer DCT from the IJG library. The columns keep
+    // two extra bits for the rows and the result is scaled by 8.
+    //
+
+    // fixed point constants, 13 bits after the point.
+    enum {
+      fix_0_298631336 = 2446,
+      fix_0_390180644 = 3196,
+      fix_0_541196100 = 4433,
+      fix_0_765366865 = 6270,
+      fix_0_899976223 = 7373,
+      fix_1_175875602 = 9633,
+      fix_1_501321110 = 12299,
+      fix_1_847759065 = 15137,
+      fix_1_961570560 = 16069,
+      fix_2_053119869 = 16819,
+      fix_2_562915447 = 20995,
+      fix_3_072711026 = 25172,
+    };
+
+    // one dimensional forward DCT of s[0], s[step] ... s[7*step]
+    // first pass: results have two extra bits. second pass: the extra bits are removed.
+    static void fdct_1d(int *d, const int *s, unsigned step, bool first) {
+      int tmp0 = s[0*step] + s[7*step];
+      int tmp7 = s[0*step] - s[7*step];
+      int tmp1 = s[1*step] + s[6*step];
+      int tmp6 = s[1*step] - s[6*step];
+      int tmp2 = s[2*step] + s[5*step];
+      int tmp5 = s[2*step] - s[5*step];
+      int tmp3 = s[3*step] + s[4*step];
+      int tmp4 = s[3*step] - s[4*step];
+
+      int bias = first ? 1 << 10 : 1 << 14;
+      int shift = first ? 11 : 15;
+
+      // even part
+      int tmp10 = tmp0 + tmp3;
+      int tmp13 = tmp0 - tmp3;
+      int tmp11 = tmp1 + tmp2;
+      int tmp12 = tmp1 - tmp2;
+      if (first) {
+        d[0*step] = ( tmp10 + tmp11 ) * 4;
+        d[4*step] = ( tmp10 - tmp11 ) * 4;
+      } else {
+        d[0*step] = ( tmp10 + tmp11 + 2 ) >> 2;
+        d[4*step] = ( tmp10 - tmp11 + 2 ) >> 2;
+      }
+      int c0 = fix_0_541196100;
+      d[2*step] = ( tmp13 * (c0 + fix_0_765366865) + tmp12 * c0 + bias ) >> shift;
+      d[6*step] = ( tmp13 * c0 + tmp12 * (c0 - fix_1_847759065) + bias ) >> shift;
+
+      // odd part
+      int c1 = fix_1_175875602;
+      int z3 = tmp4 + tmp6;
+      int z4 = tmp5 + tmp7;
+      int z3r = z3 * (c1 - fix_1_961570560) + z4 * c1;
+      int z4r = z3 * c1 + z4 * (c1 - fix_0_390180644);
+      d[7*step] = ( tmp4 * (fix_0_298631336 - fix_0_899976223) + tmp7 * -fix_0_899976223 + z3r + bias ) >> shift;
+      d[1*step] = ( tmp4 * -fix_0_899976223 + tmp7 * (fix_1_501321110 - fix_0_899976223) + z4r + bias ) >> shift;
+      d[5*step] = ( tmp5 * (fix_2_053119869 - fix_2_562915447) + tmp6 * -fix_2_562915447 + z4r + bias ) >> shift;
+      d[3*step] = ( tmp5 * -fix_2_562915447 + tmp6 * (fix_3_072711026 - fix_2_562915447) + z3r + bias ) >> shift;
+    }
+
+    // DCT an 8x8 block of level shifted samples and divide by the quantisation table.
+    static void forward_dct_c(const int16_t *src, unsigned stride, const uint16_t *recip, const uint16_t *half, int16_t *out) {
+      int tmp[64];
+      for (unsigned j = 0; j != 8; ++j) {
+        for (unsigned i = 0; i != 8; ++i) {
+          tmp[j*8 + i] = src[j * stride + i];
+        }
+      }
+
+      // columns then rows
+      for (unsigned i = 0; i != 8; ++i) {
+        fdct_1d(tmp + i, tmp + i, 8, true);
+      }
+      for (unsigned j = 0; j != 8; ++j) {
+        fdct_1d(tmp + j*8, tmp + j*8, 1, false);
+      }
+
+      for (unsigned i = 0; i != 64; ++i) {
+        int x = tmp[i];
+        unsigned a = (unsigned)( x < 0 ? -x : x ) + half[i];
+        int q = (int)( ( a * recip[i] ) >> 16 );
+        out[i] = (int16_t)( x < 0 ? -q : q );
+      }
+    }
+
+    #if OCTET_SSE2
+      // a*x + b*y for pairs of 16 bit values, giving 32 bit results
+      struct wide {
+        __m128i lo, hi;
+      };
+
+      static OCTET_HOT wide rotate(__m128i x, __m128i y, int cx, int cy) {
+        __m128i c = _mm_setr_epi16((short)cx, (short)cy, (short)cx, (short)cy, (short)cx, (short)cy, (short)cx, (short)cy);
+        wide w;
+        w.lo = _mm_madd_epi16(_mm_unpacklo_epi16(x, y), c);
+        w.hi = _mm_madd_epi16(_mm_unpackhi_epi16(x, y), c);
+        return w;
+      }
+
+      static OCTET_HOT wide add(const wide &a, const wide &b) {
+        wide w = { _mm_add_epi32(a.lo, b.lo), _mm_add_epi32(a.hi, b.hi) };
+        return w;
+      }
+
+      // (a + bias) >> shift, packed to 16 bits
+      static OCTET_HOT __m128i descale(const wide &a, __m128i bias, int shift) {
+        __m128i lo = _mm_srai_epi32(_mm_add_epi32(a.lo, bias), shift);
+        __m128i hi = _mm_srai_epi32(_mm_add_epi32(a.hi, bias), shift);
+        return _mm_packs_epi32(lo, hi);
+      }
+
+      // the same sums as fdct_1d on eight columns at once
+      static OCTET_HOT void fdct_pass(__m128i *r, bool first) {
+        __m128i tmp0 = _mm_add_epi16(r[0], r[7]);
+        __m128i tmp7 = _mm_sub_epi16(r[0], r[7]);
+        __m128i tmp1 = _mm_add_epi16(r[1], r[6]);
+        __m128i tmp6 = _mm_sub_epi16(r[1], r[6]);
+        __m128i tmp2 = _mm_add_epi16(r[2], r[5]);
+        __m128i tmp5 = _mm_sub_epi16(r[2], r[5]);
+        __m128i tmp3 = _mm_add_epi16(r[3], r[4]);
+        __m128i tmp4 = _mm_sub_epi16(r[3], r[4]);
+
+        __m128i bias = _mm_set1_epi32(first ? 1 << 10 : 1 << 14);
+        int shift = first ? 11 : 15;
+
+        // even part
+        __m128i tmp10 = _mm_add_epi16(tmp0, tmp3);
+        __m128i tmp13 = _mm_sub_epi16(tmp0, tmp3);
+        __m128i tmp11 = _mm_add_epi16(tmp1, tmp2);
+        __m128i tmp12 = _mm_sub_epi16(tmp1, tmp2);
+        if (first) {
+          r[0] = _mm_slli_epi16(_mm_add_epi16(tmp10, tmp11), 2);
+          r[4] = _mm_slli_epi16(_mm_sub_epi16(tmp10, tmp11), 2);
+        } else {
+          __m128i two = _mm_set1_epi16(2);
+          r[0] = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(tmp10, tmp11), two), 2);
+          r[4] = _mm_srai_epi16(_mm_add_epi16(_mm_sub_epi16(tmp10, tmp11), two), 2);
+        }
+        int c0 = fix_0_541196100;
+        r[2] = descale(rotate(tmp13, tmp12, c0 + fix_0_765366865, c0), bias, shift);
+        r[6] = descale(rotate(tmp13, tmp12, c0, c0 - fix_1_847759065), bias, shift);
+
+        // odd part
+        int c1 = fix_1_175875602;
+        __m128i z3 = _mm_add_epi16(tmp4, tmp6);
+        __m128i z4 = _mm_add_epi16(tmp5, tmp7);
+        wide z3r = rotate(z3, z4, c1 - fix_1_961570560, c1);
+        wide z4r = rotate(z3, z4, c1, c1 - fix_0_390180644);
+        r[7] = descale(add(rotate(tmp4, tmp7, fix_0_298631336 - fix_0_899976223, -fix_0_899976223), z3r), bias, shift);
+        r[1] = descale(add(rotate(tmp4, tmp7, -fix_0_899976223, fix_1_501321110 - fix_0_899976223), z4r), bias, shift);
+        r[5] = descale(add(rotate(tmp5, tmp6, fix_2_053119869 - fix_2_562915447, -fix_2_562915447), z4r), bias, shift);
+        r[3] = descale(add(rotate(tmp5, tmp6, -fix_2_562915447, fix_3_072711026 - fix_2_562915447), z3r), bias, shift);
+      }
+
+      static OCTET_HOT void interleave16(__m128i &a, __m128i &b) {
+        __m128i tmp = a;
+        a = _mm_unpacklo_epi16(a, b);
+        b = _mm_unpackhi_epi16(tmp, b);
+      }
+
+      static OCTET_HOT void transpose(__m128i *r) {
+        interleave16(r[0], r[4]);
+        interleave16(r[1], r[5]);
+        interleave16(r[2], r[6]);
+        interleave16(r[3], r[7]);
+        interleave16(r[0], r[2]);
+        interleave16(r[1], r[3]);
+        interleave16(r[4], r[6]);
+        interleave16(r[5], r[7]);
+        interleave16(r[0], r[1]);
+        interleave16(r[2], r[3]);
+        interleave16(r[4], r[5]);
+        interleave16(r[6], r[7]);
+      }
+
+      // SSE2 forward DCT. Same results as forward_dct_c.
+      static void forward_dct_sse2(const int16_t *src, unsigned stride, const uint16_t *recip, const uint16_t *half, int16_t *out) {
+        __m128i r[8];
+        for (unsigned i = 0; i != 8; ++i) {
+          r[i] = _mm_loadu_si128((const __m128i*)(src + i * stride));
+        }
+
+        fdct_pass(r, true);
+        transpose(r);
+        fdct_pass(r, false);
+        transpose(r);
+
+        for (unsigned i = 0; i != 8; ++i) {
+          __m128i sign = _mm_srai_epi16(r[i], 15);
+          __m128i a = _mm_sub_epi16(_mm_xor_si128(r[i], sign), sign);
+          a = _mm_add_epi16(a, _mm_loadu_si128((const __m128i*)(half + i*8)));
+          __m128i q = _mm_mulhi_epu16(a, _mm_loadu_si128((const __m128i*)(recip + i*8)));
+          q = _mm_sub_epi16(_mm_xor_si128(q, sign), sign);
+          _mm_storeu_si128((__m128i*)(out + i*8), q);
+        }
+      }
+    #endif
+
+    static void forward_dct(const int16_t *src, unsigned stride, const uint16_t *recip, const uint16_t *half, int16_t *out) {
+      #if OCTET_SSE2
+        forward_dct_sse2(src, stride, recip, half, out);
+      #else
+        forward_dct_c(src, stride, recip, half, out);
+      #endif
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    // huffman coding
+    //
+
+    #if OCTET_SSE2
+      // load eight coefficients in zig-zag order.
+      // Building the vector in registers avoids storing and reloading a reordered block.
+      static OCTET_HOT __m128i gather8(const int16_t *block, const uint8_t *zz) {
+        __m128i x = _mm_cvtsi32_si128((uint16_t)block[zz[0]]);
+        x = _mm_insert_epi16(x, block[zz[1]], 1);
+        x = _mm_insert_epi16(x, block[zz[2]], 2);
+        x = _mm_insert_epi16(x, block[zz[3]], 3);
+        x = _mm_insert_epi16(x, block[zz[4]], 4);
+        x = _mm_insert_epi16(x, block[zz[5]], 5);
+        x = _mm_insert_epi16(x, block[zz[6]], 6);
+        x = _mm_insert_epi16(x, block[zz[7]], 7);
+        return x;
+      }
+    #endif
+
+    // bit i of the result is set if coefficient i in zig-zag order is not zero.
+    static void nonzero_mask(const int16_t *block, uint32_t *mask) {
+      const uint8_t *zz = zig_zag();
+      #if OCTET_SSE2
+        __m128i zero = _mm_setzero_si128();
+        unsigned bits[4];
+        for (unsigned i = 0; i != 4; ++i) {
+          __m128i a = _mm_cmpeq_epi16(gather8(block, zz + i*16), zero);
+          __m128i b = _mm_cmpeq_epi16(gather8(block, zz + i*16 + 8), zero);
+          bits[i] = ~(unsigned)_mm_movemask_epi8(_mm_packs_epi16(a, b)) & 0xffff;
+        }
+        mask[0] = bits[0] | bits[1] << 16;
+        mask[1] = bits[2] | bits[3] << 16;
+      #else
+        mask[0] = mask[1] = 0;
+        for (unsigned i = 0; i != 32; ++i) {
+          mask[0] |= (uint32_t)( block[zz[i]] != 0 ) << i;
+          mask[1] |= (uint32_t)( block[zz[i+32]] != 0 ) << i;
+        }
+      #endif
+    }
+
+    // code a quantised block in natural order
+    void encode_block(const int16_t *block, unsigned comp) {
+      unsigned table = comp != 0;
+
+      // DC is coded as the difference from the last block.
+      // negative values are sent as value - 1 in size bits.
+      int diff = block[0] - last_dc[comp];
+      last_dc[comp] = block[0];
+      unsigned size = bit_length(diff < 0 ? -diff : diff);
+      if (diff < 0) diff--;
+      put_bits(( dc_code[table][size] << size ) | ( diff & ( ( 1 << size ) - 1 ) ), dc_size[table][size] + size);
+
+      // AC is coded as (zeros before, size) then the value.
+      const uint8_t *zz = zig_zag();
+      uint32_t mask[2];
+      nonzero_mask(block, mask);
+      mask[0] &= ~1u;
+      const uint16_t *codes = ac_code[table];
+      const uint8_t *sizes = ac_size[table];
+      unsigned last = 0;
+      for (unsigned m = 0; m != 2; ++m) {
+        uint32_t bits = mask[m];
+        while (bits) {
+          unsigned i = m * 32 + lowest_bit(bits);
+          bits &= bits - 1;
+
+          unsigned run = i - last - 1;
+          last = i;
+          while (run >= 16) {
+            // sixteen zeros
+            put_bits(codes[0xf0], sizes[0xf0]);
+            run -= 16;
+          }
+
+          int value = block[zz[i]];
+          unsigned size = bit_length(value < 0 ? -value : value);
+          if (size > 10) {
+            // only happens at very high quality
+            value = value < 0 ? -1023 : 1023;
+            size = 10;
+          }
+          if (value < 0) value--;
+          unsigned symbol = run << 4 | size;
+          put_bits(( codes[symbol] << size ) | ( value & ( ( 1 << size ) - 1 ) ), sizes[symbol] + size);
+        }
+      }
+
+      if (last != 63) {
+        // end of block
+        put_bits(codes[0x00], sizes[0x00]);
+      }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //
+    // MCU rows
+    //
+
+    // convert a row of pixels to the planes, repeating the last pixel to the edge of the MCU.
+    void convert_row(const uint8_t *src, unsigned width, unsigned bytes_per_pixel, unsigned row) {
+      const uint8_t *rgba = src;
+      if (bytes_per_pixel != 4 || width != plane_stride) {
+        uint8_t *dest = &padded_row[0];
+        for (unsigned x = 0; x != plane_stride; ++x) {
+          const uint8_t *p = src + ( x < width ? x : width - 1 ) * bytes_per_pixel;
+          dest[x*4+0] = p[0];
+          dest[x*4+1] = p[1];
+          dest[x*4+2] = p[2];
+          dest[x*4+3] = 0xff;
+        }
+        rgba = dest;
+      }
+
+      unsigned offset = row * plane_stride;
+      color_convert_row(&planes[0][offset], &planes[1][offset], &planes[2][offset], rgba, plane_stride, subsample ? 12 : 14);
+    }
+
+    // encode one row of MCUs from the planes
+    void encode_mcu_row() {
+      int16_t block[64];
+      if (subsample) {
+        for (unsigned c = 0; c != 2; ++c) {
+          for (unsigned j = 0; j != 8; ++j) {
+            const int16_t *row0 = &planes[c+1][j * 2 * plane_stride];
+            downsample_row(&half_chroma[c][j * plane_stride / 2], row0, row0 + plane_stride, plane_stride / 2);
+          }
+        }
+
+        for (unsigned x = 0; x != plane_stride; x += 16) {
+          if (dest_max - dest < max_block_bytes * 6) {
+            overflow = true;
+            return;
+          }
+          const int16_t *y = &planes[0][x];
+          forward_dct(y, plane_stride, recip[0], half[0], block);
+          encode_block(block, 0);
+          forward_dct(y + 8, plane_stride, recip[0], half[0], block);
+          encode_block(block, 0);
+          forward_dct(y + plane_stride * 8, plane_stride, recip[0], half[0], block);
+          encode_block(block, 0);
+          forward_dct(y + plane_stride * 8 + 8, plane_stride, recip[0], half[0], block);
+          encode_block(block, 0);
+          for (unsigned c = 0; c != 2; ++c) {
+            forward_dct(&half_chroma[c][x / 2], plane_stride / 2, recip[1], half[1], block);
+            encode_block(block, c + 1);
+          }
+        }
+      } else {
+        for (unsigned x = 0; x != plane_stride; x += 8) {
+          if (dest_max - dest < max_block_bytes * 3) {
+            overflow = true;
+            return;
+          }
+          for (unsigned c = 0; c != 3; ++c) {
+            forward_dct(&planes[c][x], plane_stride, recip[c != 0], half[c != 0], block);
+            encode_block(block, c);
+          }
+        }
+      }
+    }
+
+    jpeg_encoder(const jpeg_encoder &rhs);
+    void operator=(const jpeg_encoder &rhs);
+  public:
+    jpeg_encoder() {
+      quality = 85;
+      subsample = true;
+      build_tables();
+    }
+
+    // 1 (small) to 100 (best). The default is 85.
+    void set_quality(unsigned value) {
+      quality = value;
+      build_tables();
+    }
+
+    // true (the default) for half resolution colour (4:2:0), false for 4:4:4.
+    void set_subsampling(bool value) {
+      subsample = value;
+    }
+
+    // the most bytes encode can write for an image this size
+    static unsigned get_max_size(unsigned width, unsigned height) {
+      unsigned blocks = ( ( width + 15 ) / 16 ) * ( ( height + 15 ) / 16 ) * 12;
+      return max_header_bytes + blocks * max_block_bytes;
+    }
+
+    // encode RGB or RGBA pixels into a buffer supplied by the caller.
+    // stride is the distance between rows in bytes and may be negative.
+    // returns the size of the file, or 0 if it did not fit.
+    unsigned encode(uint8_t *buffer, unsigned buffer_size, uint32_t width, uint32_t height, int stride, const uint8_t *src, unsigned bytes_per_pixel = 4) {
+      if (width == 0 || height == 0 || width > 65535 || height > 65535 || bytes_per_pixel < 3) {
+        return 0;
+      }
+
+      dest = buffer;
+      dest_max = buffer + buffer_size;
+      overflow = false;
+      acc = 0;
+      num_bits = 0;
+      last_dc[0] = last_dc[1] = last_dc[2] = 0;
+
+      write_headers(width, height);
+      if (overflow) return 0;
+
+      unsigned mcu_size = subsample ? 16 : 8;
+      plane_stride = ( width + mcu_size - 1 ) / mcu_size * mcu_size;
+      for (unsigned c = 0; c != 3; ++c) {
+        planes[c].resize(plane_stride * mcu_size);
+      }
+      if (subsample) {
+        half_chroma[0].resize(plane_stride * 4);
+        half_chroma[1].resize(plane_stride * 4);
+      }
+      padded_row.resize(plane_stride * 4);
+
+      for (unsigned y = 0; y < height && !overflow; y += mcu_size) {
+        for (unsigned j = 0; j != mcu_size; ++j) {
+          // repeat the last row to fill the MCU
+          unsigned row = y + j < height ? y + j : height - 1;
+          convert_row(src + (ptrdiff_t)row * stride, width, bytes_per_pixel, j);
+        }
+        encode_mcu_row();
+      }
+
+      if (overflow) return 0;
+      flush_bits();
+      put_u16(0xffd9); // EOI
+      return overflow ? 0 : (unsigned)( dest - buffer );
+    }
+
+    // encode into a dynarray, which is resized to fit the file.
+    bool encode(dynarray<uint8_t> &data, uint32_t width, uint32_t height, int stride, const uint8_t *src, unsigned bytes_per_pixel = 4) {
+      // one byte a pixel is plenty for most images. If not, try again with the worst case.
+      data.resize(max_header_bytes + width * height);
+      unsigned size = encode(&data[0], data.size(), width, height, stride, src, bytes_per_pixel);
+      if (size == 0) {
+        data.resize(get_max_size(width, height));
+        size = encode(&data[0], data.size(), width, height, stride, src, bytes_per_pixel);
+      }
+      data.resize(size);
+      return size != 0;
     }
   };
 }
-
@@ -0,0 +1,240 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+//
+// KTX file decoder - Khronos texture container (version 1)
+//
+// KTX files hold textures that have been prepared offline (see ktx_encoder)
+// in the form that glTexImage2D and glCompressedTexImage2D want, with all
+// the mip levels. There is nothing to decode, so parse() just finds the
+// levels and leaves them where they are. Use it on a mapped_file to send
+// the pixels to the GPU without copying them (see app_utils::make_texture).
+//
+// We support 2D textures with one face. Rows of uncompressed levels are padded
+// to four bytes, which matches the default GL_UNPACK_ALIGNMENT.
+//
+
+namespace octet {
+  class ktx_decoder {
+    // http://www.khronos.org/opengles/sdk/tools/KTX/file_format_spec/
+    enum {
+      ktx_endianness = 0x04030201,
+      ktx_endianness_swapped = 0x01020304,
+      header_size = 64,
+      max_levels = 16,
+    };
+
+    struct ktx_header {
+      uint8_t identifier[12];
+      uint8_t endianness[4];
+      uint8_t gl_type[4];
+      uint8_t gl_type_size[4];
+      uint8_t gl_format[4];
+      uint8_t gl_internal_format[4];
+      uint8_t gl_base_internal_format[4];
+      uint8_t width[4];
+      uint8_t height[4];
+      uint8_t depth[4];
+      uint8_t num_array_elements[4];
+      uint8_t num_faces[4];
+      uint8_t num_levels[4];
+      uint8_t bytes_of_key_value_data[4];
+    };
+
+    struct level {
+      const uint8_t *data;
+      unsigned size;
+      unsigned width;
+      unsigned height;
+    };
+
+    bool swapped;
+    unsigned gl_type;
+    unsigned gl_format;
+    unsigned gl_internal_format;
+    unsigned width;
+    unsigned height;
+    unsigned num_levels;
+    level levels[max_levels];
+
+    // read four bytes in the byte order of the file
+    unsigned u4(const uint8_t val[4]) const {
+      return swapped ?
+        val[3] + val[2] * 0x100 + val[1] * 0x10000 + val[0] * 0x1000000u :
+        val[0] + val[1] * 0x100 + val[2] * 0x10000 + val[3] * 0x1000000u
+      ;
+    }
+
+    static unsigned next_size(unsigned size) {
+      return size > 1 ? size >> 1 : 1;
+    }
+
+    // bytes per pixel of an uncompressed format
+    static unsigned get_num_comps(unsigned format) {
+      switch (format) {
+        case 0x1906: return 1; // GL_ALPHA
+        case 0x1909: return 1; // GL_LUMINANCE
+        case 0x190A: return 2; // GL_LUMINANCE_ALPHA
+        case 0x1907: return 3; // GL_RGB
+        case 0x1908: return 4; // GL_RGBA
+      }
+      return 0;
+    }
+
+  public:
+    ktx_decoder() {
+      swapped = false;
+      gl_type = gl_format = gl_internal_format = 0;
+      width = height = num_levels = 0;
+    }
+
+    // true if the bytes start with the KTX identifier
+    static bool is_ktx(const uint8_t *src, unsigned size) {
+      static const uint8_t identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+      return size >= 12 && !memcmp(src, identifier, 12);
+    }
+
+    // find the levels in a KTX file. src must stay valid while you use get_level().
+    bool parse(const uint8_t *src, const uint8_t *src_max) {
+      num_levels = 0;
+      if (src_max - src < header_size || !is_ktx(src, (unsigned)(src_max - src))) return false;
+
+      const ktx_header *header = (const ktx_header *)src;
+      swapped = false;
+      unsigned endianness = u4(header->endianness);
+      if (endianness == ktx_endianness_swapped) {
+        swapped = true;
+      } else if (endianness != ktx_endianness) {
+        printf("warning: bad KTX file\n");
+        return false;
+      }
+
+      gl_type = u4(header->gl_type);
+      gl_format = u4(header->gl_format);
+      gl_internal_format = u4(header->gl_internal_format);
+      width = u4(header->width);
+      height = u4(header->height);
+      unsigned gl_type_size = u4(header->gl_type_size);
+      unsigned depth = u4(header->depth);
+      unsigned num_array_elements = u4(header->num_array_elements);
+      unsigned num_faces = u4(header->num_faces);
+      unsigned file_levels = u4(header->num_levels);
+      unsigned kv_bytes = u4(header->bytes_of_key_value_data);
+
+      if (depth || num_array_elements || num_faces != 1 || !width || !height || width > 0x8000 || height > 0x8000) {
+        printf("warning: KTX decoder only supports 2D textures\n");
+        return false;
+      }
+      if (swapped && gl_type_size != 1) {
+        printf("warning: KTX file needs byte swapping\n");
+        return false;
+      }
+      if (gl_type == 0 ? gl_format != 0 : get_num_comps(gl_format) == 0 || gl_type != 0x1401) {
+        printf("warning: KTX decoder only supports GL_UNSIGNED_BYTE and compressed textures\n");
+        return false;
+      }
+
+      // 0 levels means "make the mip levels yourself"
+      if (file_levels == 0) file_levels = 1;
+      if (file_levels > max_levels) file_levels = max_levels;
+
+      const uint8_t *ptr = src + header_size;
+      if (kv_bytes > (unsigned)(src_max - ptr)) return false;
+      ptr += kv_bytes;
+
+      unsigned num_comps = get_num_comps(gl_format);
+      unsigned w = width, h = height;
+      while (num_levels != file_levels && src_max - ptr >= 4) {
+        unsigned size = u4(ptr);
+        ptr += 4;
+        if (size > (unsigned)(src_max - ptr)) break;
+
+        // uncompressed levels must have all their rows
+        unsigned row_size = w * num_comps;
+        unsigned stride = ( row_size + 3 ) & ~3;
+        if (!is_compressed() && size < (uint64_t)stride * ( h - 1 ) + row_size) break;
+
+        level &l = levels[num_levels++];
+        l.data = ptr;
+        l.size = size;
+        l.width = w;
+        l.height = h;
+        ptr += ( size + 3 ) & ~3;
+        if (ptr > src_max) break;
+        w = next_size(w);
+        h = next_size(h);
+      }
+      return num_levels != 0;
+    }
+
+    bool is_compressed() const {
+      return gl_type == 0;
+    }
+
+    // the format to give to OpenGL: the internal format for compressed files
+    unsigned get_format() const {
+      return is_compressed() ? gl_internal_format : gl_format;
+    }
+
+    unsigned get_width() const {
+      return width;
+    }
+
+    unsigned get_height() const {
+      return height;
+    }
+
+    unsigned get_num_levels() const {
+      return num_levels;
+    }
+
+    // pixels of one level, as they are in the file
+    const uint8_t *get_level(unsigned index, unsigned &size, unsigned &level_width, unsigned &level_height) const {
+      const level &l = levels[index];
+      size = l.size;
+      level_width = l.width;
+      level_height = l.height;
+      return l.data;
+    }
+
+    // copy all the levels, one after the other, with the row padding removed.
+    void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &image_width, uint16_t &image_height, const uint8_t *src, const uint8_t *src_max) {
+      if (!parse(src, src_max)) {
+        image_width = image_height = 0;
+        return;
+      }
+
+      unsigned num_comps = get_num_comps(gl_format);
+      unsigned total = 0;
+      for (unsigned i = 0; i != num_levels; ++i) {
+        const level &l = levels[i];
+        total += is_compressed() ? l.size : l.width * l.height * num_comps;
+      }
+
+      image.resize(total);
+      uint8_t *dest = &image[0];
+      for (unsigned i = 0; i != num_levels; ++i) {
+        const level &l = levels[i];
+        if (is_compressed()) {
+          memcpy(dest, l.data, l.size);
+          dest += l.size;
+        } else {
+          unsigned row_size = l.width * num_comps;
+          unsigned stride = ( row_size + 3 ) & ~3;
+          for (unsigned y = 0; y != l.height && y * stride + row_size <= l.size; ++y) {
+            memcpy(dest, l.data + y * stride, row_size);
+            dest += row_size;
+          }
+        }
+      }
+      image.resize((unsigned)(dest - &image[0]));
+
+      format = (uint16_t)get_format();
+      image_width = (uint16_t)width;
+      image_height = (uint16_t)height;
+    }
+  };
+}
@@ -0,0 +1,136 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+//
+// KTX file encoder - Khronos texture container (version 1)
+//
+// Writes a mip chain (from mip_builder or dxt_encoder::encode_mips) as a KTX
+// file so that it can be loaded later without decoding (see ktx_decoder).
+// image::save_ktx uses this to convert GIF, JPEG, TGA and DDS files offline.
+//
+// example:
+//
+//   dynarray<uint8_t> ktx;
+//   ktx_encoder::encode(ktx, GL_RGBA, width, height, levels, &pixels[0], pixels.size());
+//
+
+namespace octet {
+  class ktx_encoder {
+    enum {
+      COMPRESSED_RGB_S3TC_DXT1_EXT = 0x83F0,
+      COMPRESSED_RGBA_S3TC_DXT1_EXT = 0x83F1,
+      COMPRESSED_RGBA_S3TC_DXT3_EXT = 0x83F2,
+      COMPRESSED_RGBA_S3TC_DXT5_EXT = 0x83F3,
+    };
+
+    static void put4(dynarray<uint8_t> &dest, unsigned value) {
+      dest.push_back((uint8_t)value);
+      dest.push_back((uint8_t)(value >> 8));
+      dest.push_back((uint8_t)(value >> 16));
+      dest.push_back((uint8_t)(value >> 24));
+    }
+
+    static void pad4(dynarray<uint8_t> &dest) {
+      while (dest.size() & 3) dest.push_back(0);
+    }
+
+    static unsigned next_size(unsigned size) {
+      return size > 1 ? size >> 1 : 1;
+    }
+
+    static unsigned get_num_comps(unsigned format) {
+      switch (format) {
+        case 0x1906: return 1; // GL_ALPHA
+        case 0x1909: return 1; // GL_LUMINANCE
+        case 0x190A: return 2; // GL_LUMINANCE_ALPHA
+        case 0x1907: return 3; // GL_RGB
+        case 0x1908: return 4; // GL_RGBA
+      }
+      return 0;
+    }
+
+    static unsigned get_block_size(unsigned format) {
+      switch (format) {
+        case COMPRESSED_RGB_S3TC_DXT1_EXT: return 8;
+        case COMPRESSED_RGBA_S3TC_DXT1_EXT: return 8;
+        case COMPRESSED_RGBA_S3TC_DXT3_EXT: return 16;
+        case COMPRESSED_RGBA_S3TC_DXT5_EXT: return 16;
+      }
+      return 0;
+    }
+  public:
+    // write levels one after the other with tightly packed rows.
+    // format is a GL format such as GL_RGBA or COMPRESSED_RGBA_S3TC_DXT5_EXT.
+    static bool encode(dynarray<uint8_t> &dest, unsigned format, unsigned width, unsigned height, unsigned levels, const uint8_t *src, unsigned src_size) {
+      unsigned num_comps = get_num_comps(format);
+      unsigned block_size = get_block_size(format);
+      if (!num_comps && !block_size) {
+        printf("warning: KTX encoder does not support format %04x\n", format);
+        return false;
+      }
+      if (!width || !height || !levels) return false;
+
+      static const uint8_t identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+      // our images have the first row at t=0, as glTexImage2D does.
+      static const char orientation[] = "KTXorientation\0S=r,T=u";
+
+      dest.reset();
+      for (unsigned i = 0; i != 12; ++i) dest.push_back(identifier[i]);
+      put4(dest, 0x04030201);
+      put4(dest, num_comps ? 0x1401 : 0); // GL_UNSIGNED_BYTE
+      put4(dest, 1);
+      put4(dest, num_comps ? format : 0);
+      put4(dest, format);
+      put4(dest, num_comps ? format : format == COMPRESSED_RGB_S3TC_DXT1_EXT ? 0x1907 : 0x1908);
+      put4(dest, width);
+      put4(dest, height);
+      put4(dest, 0);
+      put4(dest, 0);
+      put4(dest, 1);
+      put4(dest, levels);
+
+      // one key value pair, padded to four bytes
+      unsigned kv_size = sizeof(orientation);
+      put4(dest, ( 4 + kv_size + 3 ) & ~3);
+      put4(dest, kv_size);
+      for (unsigned i = 0; i != kv_size; ++i) dest.push_back((uint8_t)orientation[i]);
+      pad4(dest);
+
+      unsigned w = width, h = height;
+      unsigned offset = 0;
+      for (unsigned level = 0; level != levels; ++level) {
+        unsigned row_size = w * num_comps;
+        unsigned stride = ( row_size + 3 ) & ~3;
+        unsigned src_level_size = block_size ? ( ( w + 3 ) / 4 ) * ( ( h + 3 ) / 4 ) * block_size : row_size * h;
+        if (offset + src_level_size > src_size) {
+          printf("warning: KTX encoder ran out of pixels\n");
+          return false;
+        }
+
+        if (block_size) {
+          put4(dest, src_level_size);
+          unsigned pos = dest.size();
+          dest.resize(pos + src_level_size);
+          memcpy(&dest[pos], src + offset, src_level_size);
+        } else {
+          put4(dest, stride * h);
+          unsigned pos = dest.size();
+          dest.resize(pos + stride * h);
+          for (unsigned y = 0; y != h; ++y) {
+            memcpy(&dest[pos + y * stride], src + offset + y * row_size, row_size);
+            if (stride != row_size) memset(&dest[pos + y * stride + row_size], 0, stride - row_size);
+          }
+        }
+        pad4(dest);
+
+        offset += src_level_size;
+        w = next_size(w);
+        h = next_size(h);
+      }
+      return true;
+    }
+  };
+}
@@ -0,0 +1,520 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+//
+// Fast text to number conversion for long arrays of numbers
+//
+// COLLADA files are mostly long lists like "1.5 -0.25 3e-2 ...", and converting
+// them a character at a time in double precision was the slowest part of loading.
+//
+// Floats are correctly rounded: you get the float nearest to the decimal (ties go to even).
+// Short decimals such as 0.123456 are read in one pass as an integer and take one
+// exact divide in double precision. Other numbers use the Eisel-Lemire algorithm,
+// which multiplies by a 128 bit power of five. Arrays are sized once if you give
+// the count (from a COLLADA count attribute, for example).
+//
+// Long numbers have their digits found sixteen at a time with SSE2 and converted
+// eight at a time: eight ASCII digits in a 64 bit word become a number with three
+// multiplies. Most COLLADA numbers are too short for this to pay, a simple loop
+// keeps more of them going at once.
+// Numbers with more than 19 digits that are very close to halfway between two floats
+// compare all of their digits with the halfway point using big integers.
+//
+// example:
+//
+//   dynarray<float> values;
+//   number_parser::parse_floats(values, text, text + strlen(text));
+//
+
+namespace octet {
+  class number_parser {
+    // below 10^smallest_power a float is zero, above 10^largest_power it is infinite.
+    enum {
+      smallest_power = -64,
+      largest_power = 38,
+      mantissa_bits = 23,
+      min_exponent = -127,
+      infinite_power = 0xff,
+    };
+
+    // 5^q for q = smallest_power .. largest_power as 128 bit numbers (high, low) with the top bit set.
+    // negative powers are rounded up.
+    static const uint64_t *get_powers_of_five() {
+      static const uint64_t table[] = {
+        0xa87fea27a539e9a5ull, 0x3f2398d747b36224ull, 0xd29fe4b18e88640eull, 0x8eec7f0d19a03aadull,
+        0x83a3eeeef9153e89ull, 0x1953cf68300424acull, 0xa48ceaaab75a8e2bull, 0x5fa8c3423c052dd7ull,
+        0xcdb02555653131b6ull, 0x3792f412cb06794dull, 0x808e17555f3ebf11ull, 0xe2bbd88bbee40bd0ull,
+        0xa0b19d2ab70e6ed6ull, 0x5b6aceaeae9d0ec4ull, 0xc8de047564d20a8bull, 0xf245825a5a445275ull,
+        0xfb158592be068d2eull, 0xeed6e2f0f0d56712ull, 0x9ced737bb6c4183dull, 0x55464dd69685606bull,
+        0xc428d05aa4751e4cull, 0xaa97e14c3c26b886ull, 0xf53304714d9265dfull, 0xd53dd99f4b3066a8ull,
+        0x993fe2c6d07b7fabull, 0xe546a8038efe4029ull, 0xbf8fdb78849a5f96ull, 0xde98520472bdd033ull,
+        0xef73d256a5c0f77cull, 0x963e66858f6d4440ull, 0x95a8637627989aadull, 0xdde7001379a44aa8ull,
+        0xbb127c53b17ec159ull, 0x5560c018580d5d52ull, 0xe9d71b689dde71afull, 0xaab8f01e6e10b4a6ull,
+        0x9226712162ab070dull, 0xcab3961304ca70e8ull, 0xb6b00d69bb55c8d1ull, 0x3d607b97c5fd0d22ull,
+        0xe45c10c42a2b3b05ull, 0x8cb89a7db77c506aull, 0x8eb98a7a9a5b04e3ull, 0x77f3608e92adb242ull,
+        0xb267ed1940f1c61cull, 0x55f038b237591ed3ull, 0xdf01e85f912e37a3ull, 0x6b6c46dec52f6688ull,
+        0x8b61313bbabce2c6ull, 0x2323ac4b3b3da015ull, 0xae397d8aa96c1b77ull, 0xabec975e0a0d081aull,
+        0xd9c7dced53c72255ull, 0x96e7bd358c904a21ull, 0x881cea14545c7575ull, 0x7e50d64177da2e54ull,
+        0xaa242499697392d2ull, 0xdde50bd1d5d0b9e9ull, 0xd4ad2dbfc3d07787ull, 0x955e4ec64b44e864ull,
+        0x84ec3c97da624ab4ull, 0xbd5af13bef0b113eull, 0xa6274bbdd0fadd61ull, 0xecb1ad8aeacdd58eull,
+        0xcfb11ead453994baull, 0x67de18eda5814af2ull, 0x81ceb32c4b43fcf4ull, 0x80eacf948770ced7ull,
+        0xa2425ff75e14fc31ull, 0xa1258379a94d028dull, 0xcad2f7f5359a3b3eull, 0x096ee45813a04330ull,
+        0xfd87b5f28300ca0dull, 0x8bca9d6e188853fcull, 0x9e74d1b791e07e48ull, 0x775ea264cf55347eull,
+        0xc612062576589ddaull, 0x95364afe032a819eull, 0xf79687aed3eec551ull, 0x3a83ddbd83f52205ull,
+        0x9abe14cd44753b52ull, 0xc4926a9672793543ull, 0xc16d9a0095928a27ull, 0x75b7053c0f178294ull,
+        0xf1c90080baf72cb1ull, 0x5324c68b12dd6339ull, 0x971da05074da7beeull, 0xd3f6fc16ebca5e04ull,
+        0xbce5086492111aeaull, 0x88f4bb1ca6bcf585ull, 0xec1e4a7db69561a5ull, 0x2b31e9e3d06c32e6ull,
+        0x9392ee8e921d5d07ull, 0x3aff322e62439fd0ull, 0xb877aa3236a4b449ull, 0x09befeb9fad487c3ull,
+        0xe69594bec44de15bull, 0x4c2ebe687989a9b4ull, 0x901d7cf73ab0acd9ull, 0x0f9d37014bf60a11ull,
+        0xb424dc35095cd80full, 0x538484c19ef38c95ull, 0xe12e13424bb40e13ull, 0x2865a5f206b06fbaull,
+        0x8cbccc096f5088cbull, 0xf93f87b7442e45d4ull, 0xafebff0bcb24aafeull, 0xf78f69a51539d749ull,
+        0xdbe6fecebdedd5beull, 0xb573440e5a884d1cull, 0x89705f4136b4a597ull, 0x31680a88f8953031ull,
+        0xabcc77118461cefcull, 0xfdc20d2b36ba7c3eull, 0xd6bf94d5e57a42bcull, 0x3d32907604691b4dull,
+        0x8637bd05af6c69b5ull, 0xa63f9a49c2c1b110ull, 0xa7c5ac471b478423ull, 0x0fcf80dc33721d54ull,
+        0xd1b71758e219652bull, 0xd3c36113404ea4a9ull, 0x83126e978d4fdf3bull, 0x645a1cac083126eaull,
+        0xa3d70a3d70a3d70aull, 0x3d70a3d70a3d70a4ull, 0xccccccccccccccccull, 0xcccccccccccccccdull,
+        0x8000000000000000ull, 0x0000000000000000ull, 0xa000000000000000ull, 0x0000000000000000ull,
+        0xc800000000000000ull, 0x0000000000000000ull, 0xfa00000000000000ull, 0x0000000000000000ull,
+        0x9c40000000000000ull, 0x0000000000000000ull, 0xc350000000000000ull, 0x0000000000000000ull,
+        0xf424000000000000ull, 0x0000000000000000ull, 0x9896800000000000ull, 0x0000000000000000ull,
+        0xbebc200000000000ull, 0x0000000000000000ull, 0xee6b280000000000ull, 0x0000000000000000ull,
+        0x9502f90000000000ull, 0x0000000000000000ull, 0xba43b74000000000ull, 0x0000000000000000ull,
+        0xe8d4a51000000000ull, 0x0000000000000000ull, 0x9184e72a00000000ull, 0x0000000000000000ull,
+        0xb5e620f480000000ull, 0x0000000000000000ull, 0xe35fa931a0000000ull, 0x0000000000000000ull,
+        0x8e1bc9bf04000000ull, 0x0000000000000000ull, 0xb1a2bc2ec5000000ull, 0x0000000000000000ull,
+        0xde0b6b3a76400000ull, 0x0000000000000000ull, 0x8ac7230489e80000ull, 0x0000000000000000ull,
+        0xad78ebc5ac620000ull, 0x0000000000000000ull, 0xd8d726b7177a8000ull, 0x0000000000000000ull,
+        0x878678326eac9000ull, 0x0000000000000000ull, 0xa968163f0a57b400ull, 0x0000000000000000ull,
+        0xd3c21bcecceda100ull, 0x0000000000000000ull, 0x84595161401484a0ull, 0x0000000000000000ull,
+        0xa56fa5b99019a5c8ull, 0x0000000000000000ull, 0xcecb8f27f4200f3aull, 0x0000000000000000ull,
+        0x813f3978f8940984ull, 0x4000000000000000ull, 0xa18f07d736b90be5ull, 0x5000000000000000ull,
+        0xc9f2c9cd04674edeull, 0xa400000000000000ull, 0xfc6f7c4045812296ull, 0x4d00000000000000ull,
+        0x9dc5ada82b70b59dull, 0xf020000000000000ull, 0xc5371912364ce305ull, 0x6c28000000000000ull,
+        0xf684df56c3e01bc6ull, 0xc732000000000000ull, 0x9a130b963a6c115cull, 0x3c7f400000000000ull,
+        0xc097ce7bc90715b3ull, 0x4b9f100000000000ull, 0xf0bdc21abb48db20ull, 0x1e86d40000000000ull,
+        0x96769950b50d88f4ull, 0x1314448000000000ull
+      };
+      return table;
+    }
+
+    static bool is_digit(char c) {
+      return c >= '0' && c <= '9';
+    }
+
+    // matches the old collada_builder: zero ends the string, other control characters are spaces.
+    static bool is_space(char c) {
+      return c > 0 && c <= ' ';
+    }
+
+    static const char *skip_space(const char *src, const char *src_max) {
+      while (src < src_max && is_space(*src)) ++src;
+      return src;
+    }
+
+    static unsigned lowest_bit(unsigned x) {
+      #ifdef WIN32
+        unsigned long index;
+        _BitScanForward(&index, x);
+        return (unsigned)index;
+      #else
+        return (unsigned)__builtin_ctz(x);
+      #endif
+    }
+
+    static unsigned leading_zeros(uint64_t x) {
+      unsigned n = 0;
+      if (!( x >> 32 )) { n += 32; x <<= 32; }
+      if (!( x >> 48 )) { n += 16; x <<= 16; }
+      if (!( x >> 56 )) { n += 8; x <<= 8; }
+      if (!( x >> 60 )) { n += 4; x <<= 4; }
+      if (!( x >> 62 )) { n += 2; x <<= 2; }
+      if (!( x >> 63 )) { n += 1; }
+      return n;
+    }
+
+    #if OCTET_SSE2
+      // bit i is set if byte i of c is a digit.
+      static unsigned digit_mask(__m128i c) {
+        // c - '0' < 10 as an unsigned compare, made signed by adding 128 to both sides.
+        __m128i bias = _mm_set1_epi8((char)( '0' + 128 ));
+        __m128i limit = _mm_set1_epi8((char)( 10 - 128 ));
+        return (unsigned)_mm_movemask_epi8(_mm_cmplt_epi8(_mm_sub_epi8(c, bias), limit));
+      }
+    #endif
+
+    // the number of digits at p. *src_max must not be a digit.
+    static unsigned digit_run(const char *p, const char *src_max) {
+      const char *begin = p;
+      #if OCTET_SSE2
+        while (src_max - p >= 16) {
+          unsigned digits = digit_mask(_mm_loadu_si128((const __m128i*)p));
+          if (digits != 0xffff) return (unsigned)( p - begin ) + lowest_bit(~digits);
+          p += 16;
+        }
+      #endif
+      while (is_digit(*p)) ++p;
+      return (unsigned)( p - begin );
+    }
+
+    // eight ASCII digits to a number. the first digit is in the bottom byte (we are little endian).
+    static unsigned parse_eight_digits(uint64_t val) {
+      val = ( val & 0x0F0F0F0F0F0F0F0Full ) * 2561 >> 8;
+      val = ( val & 0x00FF00FF00FF00FFull ) * 6553601 >> 16;
+      return (unsigned)( ( val & 0x0000FFFF0000FFFFull ) * 42949672960001ull >> 32 );
+    }
+
+    static unsigned parse_eight_digits(const char *p) {
+      uint64_t val;
+      memcpy(&val, p, 8);
+      return parse_eight_digits(val);
+    }
+
+    // e-12 etc. returns the power of ten.
+    static int parse_exponent(const char *&src) {
+      if (*src != 'e' && *src != 'E') return 0;
+      src++;
+      bool negative = *src == '-';
+      if (*src == '-' || *src == '+') src++;
+      int exp = 0;
+      while (is_digit(*src)) {
+        if (exp < 100000) exp = exp * 10 + ( *src - '0' );
+        src++;
+      }
+      return negative ? -exp : exp;
+    }
+
+    // add digits from p to w until we have max_digits. returns where we stopped.
+    static const char *add_digits(uint64_t &w, unsigned &num_digits, unsigned max_digits, const char *p, const char *end) {
+      while (end - p >= 8 && num_digits + 8 <= max_digits) {
+        w = w * 100000000 + parse_eight_digits(p);
+        p += 8;
+        num_digits += 8;
+      }
+      for (; p != end && num_digits != max_digits; ++p, ++num_digits) {
+        w = w * 10 + ( *p - '0' );
+      }
+      return p;
+    }
+
+    // 64 x 64 -> 128 bit multiply
+    static uint64_t multiply(uint64_t a, uint64_t b, uint64_t &lo) {
+      #if defined(__SIZEOF_INT128__)
+        unsigned __int128 r = (unsigned __int128)a * b;
+        lo = (uint64_t)r;
+        return (uint64_t)( r >> 64 );
+      #else
+        uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+        uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+        uint64_t ll = a_lo * b_lo, lh = a_lo * b_hi, hl = a_hi * b_lo, hh = a_hi * b_hi;
+        uint64_t mid = ( ll >> 32 ) + (uint32_t)lh + (uint32_t)hl;
+        lo = ( mid << 32 ) | (uint32_t)ll;
+        return hh + ( lh >> 32 ) + ( hl >> 32 ) + ( mid >> 32 );
+      #endif
+    }
+
+    // the bits of the float nearest to w * 10^q (Eisel-Lemire).
+    // see Daniel Lemire, "Number Parsing at a Gigabyte per Second" (2021).
+    static uint32_t eisel_lemire(uint64_t w, int q) {
+      if (w == 0 || q < smallest_power) return 0;
+      if (q > largest_power) return infinite_power << mantissa_bits;
+
+      unsigned lz = leading_zeros(w);
+      w <<= lz;
+
+      // only the top mantissa_bits + 3 bits of the product need to be right.
+      // the second half of the power is only needed if they might carry.
+      const uint64_t *pow5 = get_powers_of_five() + ( q - smallest_power ) * 2;
+      uint64_t lo;
+      uint64_t hi = multiply(w, pow5[0], lo);
+      const uint64_t precision_mask = ~0ull >> ( mantissa_bits + 3 );
+      if (( hi & precision_mask ) == precision_mask) {
+        uint64_t lo2;
+        uint64_t hi2 = multiply(w, pow5[1], lo2);
+        lo += hi2;
+        if (hi2 > lo) hi++;
+      }
+
+      unsigned upper_bit = (unsigned)( hi >> 63 );
+      unsigned shift = upper_bit + 64 - mantissa_bits - 3;
+      uint64_t mantissa = hi >> shift;
+      // ( ( 152170 + 65536 ) * q ) >> 16 is floor(q * log2(10))
+      int power2 = ( ( ( 152170 + 65536 ) * q ) >> 16 ) + 63 + (int)upper_bit - (int)lz - min_exponent;
+
+      if (power2 <= 0) {
+        // denormal (or zero)
+        if (1 - power2 >= 64) return 0;
+        mantissa >>= 1 - power2;
+        mantissa += mantissa & 1;
+        return (uint32_t)( mantissa >> 1 );
+      }
+
+      // exactly halfway between two floats: round to even. this can only happen for small q.
+      if (lo <= 1 && q >= -17 && q <= 10 && ( mantissa & 3 ) == 1 && ( mantissa << shift ) == hi) {
+        mantissa &= ~1ull;
+      }
+      mantissa += mantissa & 1;
+      mantissa >>= 1;
+      if (mantissa >= ( 2ull << mantissa_bits )) {
+        mantissa = 1ull << mantissa_bits;
+        power2++;
+      }
+      if (power2 >= infinite_power) return infinite_power << mantissa_bits;
+      return ( (uint32_t)mantissa & ~( 1u << mantissa_bits ) ) | (uint32_t)power2 << mantissa_bits;
+    }
+
+    static const double *get_powers_of_ten() {
+      static const double table[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+      };
+      return table;
+    }
+
+    // the float nearest to w * 10^q
+    static float to_float(uint64_t w, int q) {
+      // if w and 10^|q| are exact floats, one double multiply or divide rounded to a float
+      // is correctly rounded (a double has more than 2 * 24 + 2 bits).
+      if (w <= ( 1 << 24 ) && q >= -10 && q <= 10) {
+        double d = (double)(int)w;
+        return (float)( q < 0 ? d / get_powers_of_ten()[-q] : d * get_powers_of_ten()[q] );
+      }
+      uint32_t bits = eisel_lemire(w, q);
+      float f;
+      memcpy(&f, &bits, 4);
+      return f;
+    }
+
+    // just enough of an unsigned big integer to compare a decimal with a halfway point.
+    class big_number {
+      enum { max_limbs = 64 };
+      uint32_t limbs[max_limbs];
+      unsigned size;
+    public:
+      big_number(uint32_t value) {
+        limbs[0] = value;
+        size = value ? 1 : 0;
+      }
+
+      // this = this * mul + add
+      void multiply_add(uint32_t mul, uint32_t add) {
+        uint64_t carry = add;
+        for (unsigned i = 0; i != size; ++i) {
+          carry += (uint64_t)limbs[i] * mul;
+          limbs[i] = (uint32_t)carry;
+          carry >>= 32;
+        }
+        if (carry && size != max_limbs) limbs[size++] = (uint32_t)carry;
+      }
+
+      void multiply_pow5(unsigned power) {
+        // 5^13 is the largest power of five that fits in 32 bits
+        for (; power >= 13; power -= 13) multiply_add(1220703125, 0);
+        uint32_t mul = 1;
+        while (power--) mul *= 5;
+        multiply_add(mul, 0);
+      }
+
+      void shift_left(unsigned bits) {
+        if (!size) return;
+        unsigned words = bits / 32;
+        bits %= 32;
+        if (size + words + 1 > max_limbs) return;
+        limbs[size] = 0;
+        for (unsigned i = size + 1; i-- != 0; ) {
+          uint32_t lower = i == 0 || !bits ? 0 : limbs[i-1] >> ( 32 - bits );
+          limbs[i + words] = limbs[i] << bits | lower;
+        }
+        for (unsigned i = 0; i != words; ++i) limbs[i] = 0;
+        size += words + 1;
+        while (size && !limbs[size-1]) --size;
+      }
+
+      // -1, 0 or 1
+      int compare(const big_number &rhs) const {
+        if (size != rhs.size) return size < rhs.size ? -1 : 1;
+        for (unsigned i = size; i-- != 0; ) {
+          if (limbs[i] != rhs.limbs[i]) return limbs[i] < rhs.limbs[i] ? -1 : 1;
+        }
+        return 0;
+      }
+    };
+
+    // the float halfway between two others has at most 112 significant digits.
+    enum { max_exact_digits = 128 };
+
+    // lower and the float after it are the two nearest to the number. the digits decide
+    // which: we compare all of them with the halfway point, exactly.
+    static float round_long_number(float lower, const char *int_begin, const char *int_end, const char *frac_begin, const char *frac_end, int exp10) {
+      // digits * 10^exponent, with anything after max_exact_digits only in the tail flag.
+      big_number digits(0);
+      unsigned num_digits = 0;
+      int exponent = exp10 + (int)( int_end - int_begin );
+      bool tail = false;
+      for (const char *p = int_begin; p != frac_end; ++p) {
+        if (p == int_end) p = frac_begin;
+        if (p == frac_end) break;
+        if (num_digits == max_exact_digits) {
+          tail |= *p != '0';
+        } else {
+          digits.multiply_add(10, *p - '0');
+          exponent--;
+          num_digits += num_digits || *p != '0';
+        }
+      }
+
+      // the halfway point is halfway * 2^power2
+      uint32_t bits;
+      memcpy(&bits, &lower, 4);
+      unsigned biased = bits >> mantissa_bits;
+      uint32_t mantissa = bits & ( ( 1u << mantissa_bits ) - 1 );
+      if (biased) mantissa |= 1u << mantissa_bits;
+      int power2 = ( biased ? (int)biased : 1 ) + min_exponent - mantissa_bits - 1;
+      big_number halfway(mantissa * 2 + 1);
+
+      // the float after lower is not much more than 2^-150 or 2^128
+      if (exponent < -400 || exponent > 400) return lower;
+
+      // digits * 5^exponent * 2^exponent against halfway * 2^power2
+      if (exponent >= 0) digits.multiply_pow5(exponent); else halfway.multiply_pow5(-exponent);
+      if (exponent > power2) digits.shift_left(exponent - power2); else halfway.shift_left(power2 - exponent);
+
+      int cmp = digits.compare(halfway);
+      if (cmp == 0) cmp = tail ? 1 : ( bits & 1 ) ? 1 : -1;
+      if (cmp > 0) bits++;
+      float result;
+      memcpy(&result, &bits, 4);
+      return result;
+    }
+
+    static OCTET_HOT const char *parse_number(const char *src, const char *src_max, float &value) {
+      return parse_float(src, src_max, value);
+    }
+
+    static OCTET_HOT const char *parse_number(const char *src, const char *src_max, int &value) {
+      return parse_int(src, src_max, value);
+    }
+
+    template <class value_t> static void parse_array(dynarray<value_t> &values, const char *src, const char *src_max, unsigned count) {
+      // don't trust the count too much: each number needs at least two bytes.
+      unsigned limit = (unsigned)( ( src_max - src ) / 2 + 1 );
+      if (count > limit) count = limit;
+      unsigned size = values.size() + count;
+      if (size > values.capacity()) {
+        // keep doubling, or appending lots of small arrays would copy every time.
+        values.reserve(size > values.capacity() * 2 ? size : values.capacity() * 2);
+      }
+
+      src = skip_space(src, src_max);
+      while (src < src_max) {
+        value_t value;
+        src = parse_number(src, src_max, value);
+        if (!src) break;
+        values.push_back(value);
+        src = skip_space(src, src_max);
+      }
+    }
+
+    // numbers that are not short: long mantissas, exponents and text near the end.
+    static const char *parse_float_general(const char *src, const char *src_max, bool negative, float &value) {
+      const char *int_begin = src;
+      src += digit_run(src, src_max);
+      const char *int_end = src;
+      const char *frac_begin = src, *frac_end = src;
+      if (*src == '.') {
+        frac_begin = ++src;
+        src += digit_run(src, src_max);
+        frac_end = src;
+      } else if (int_begin == int_end) {
+        return NULL;
+      }
+
+      // the first 19 significant digits fit in a uint64_t.
+      uint64_t w = 0;
+      unsigned num_digits = 0;
+      const char *p = int_begin;
+      while (p != int_end && *p == '0') ++p;
+      const char *int_stop = add_digits(w, num_digits, 19, p, int_end);
+      p = frac_begin;
+      if (!w) while (p != frac_end && *p == '0') ++p;
+      const char *frac_stop = add_digits(w, num_digits, 19, p, frac_end);
+      int exponent = (int)( int_end - int_stop ) - (int)( frac_stop - frac_begin );
+
+      // any digits left over?
+      bool truncated = false;
+      for (p = int_stop; p != int_end; ++p) truncated |= *p != '0';
+      for (p = frac_stop; p != frac_end; ++p) truncated |= *p != '0';
+
+      int exp10 = parse_exponent(src);
+      exponent += exp10;
+
+      float result = to_float(w, exponent);
+      if (truncated && result != to_float(w + 1, exponent)) {
+        // the digits we dropped decide which way to round.
+        result = round_long_number(result, int_begin, int_end, frac_begin, frac_end, exp10);
+      }
+      value = negative ? -result : result;
+      return src;
+    }
+
+  public:
+    // convert a number like -1.25e3 at src. *src_max must not be part of a number.
+    // returns the end of the number, or NULL if there is no number at src.
+    static OCTET_HOT const char *parse_float(const char *src, const char *src_max, float &value) {
+      bool negative = false;
+      if (*src == '-') { negative = true; src++; }
+      const char *begin = src;
+
+      // most numbers are short, like 0.123456: one pass in integers and one divide.
+      uint64_t w = 0;
+      while (is_digit(*src)) w = w * 10 + ( *src++ - '0' );
+      unsigned frac_size = 0, has_dot = 0;
+      if (*src == '.') {
+        has_dot = 1;
+        const char *frac_begin = ++src;
+        while (is_digit(*src)) w = w * 10 + ( *src++ - '0' );
+        frac_size = (unsigned)( src - frac_begin );
+      } else if (src == begin) {
+        return NULL;
+      }
+
+      if (( *src | 0x20 ) == 'e' || src - begin - has_dot > 19) {
+        return parse_float_general(begin, src_max, negative, value);
+      }
+
+      // if w and 10^frac_size are exact floats, one divide rounded to a float is correctly rounded.
+      float result = w <= ( 1 << 24 ) && frac_size <= 10 ?
+        (float)( (double)(int)w / get_powers_of_ten()[frac_size] ) :
+        to_float(w, -(int)frac_size)
+      ;
+      value = negative ? -result : result;
+      return src;
+    }
+
+    // convert an integer like -123 at src. *src_max must not be a digit.
+    // returns the end of the number, or NULL if there is no number at src.
+    static OCTET_HOT const char *parse_int(const char *src, const char *src_max, int &value) {
+      // indices are short, so a simple loop beats loading sixteen bytes.
+      bool negative = false;
+      if (src < src_max && *src == '-') { negative = true; src++; }
+      if (src >= src_max || !is_digit(*src)) return NULL;
+      unsigned result = 0;
+      while (src < src_max && is_digit(*src)) result = result * 10 + ( *src++ - '0' );
+      value = (int)( negative ? 0 - result : result );
+      return src;
+    }
+
+    // add the floats in some text like "1.2 3.4 43.12" to values.
+    // count is how many we expect, for example from a COLLADA count attribute (0 if we don't know).
+    // *src_max must not be part of a number (a zero or the '<' of the next tag).
+    static void parse_floats(dynarray<float> &values, const char *src, const char *src_max, unsigned count = 0) {
+      parse_array(values, src, src_max, count);
+    }
+
+    // add the integers in some text like "1 3 9 12 34" to values.
+    static void parse_ints(dynarray<int> &values, const char *src, const char *src_max, unsigned count = 0) {
+      parse_array(values, src, src_max, count);
+    }
+  };
+}
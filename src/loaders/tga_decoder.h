@@ -5,11 +5,19 @@
 // Modular Framework for OpenGLES2 rendering on multiple platforms.
 //
 //
-// tga file decoder - only the most common variants
+// tga file decoder
 //
 // TGA files are used for artwork generation but almost never for production
 // as they are very large (you should use GIF files or other compressed formats by choice)
-// 
+//
+// We read true colour (15, 16, 24 and 32 bit), colour mapped and grey images,
+// both raw and RLE packed. Grey images become RGB and anything with alpha
+// becomes RGBA. Rows are written straight to where they belong, so files
+// with the origin at the top don't need an extra flip.
+//
+// The BGR to RGB swizzle of the raw 24 and 32 bit files uses SSSE3 shuffles
+// (see OCTET_SSSE3) or SSE2 masks for 32 bit pixels if we only have SSE2.
+//
 
 namespace octet {
   class tga_decoder {
@@ -35,70 +43,331 @@ namespace octet {
       uint8_t descriptor;         // image descriptor bits (vh flip bits)
     };
 
+    enum {
+      // imagetype
+      type_indexed = 1,
+      type_rgb = 2,
+      type_grey = 3,
+      type_rle = 8,
+
+      // descriptor
+      desc_alpha_bits = 0x0f,
+      desc_right_to_left = 0x10,
+      desc_top_to_bottom = 0x20,
+    };
+
+    // how the pixels are stored in the file
+    enum {
+      pixel_bgr,
+      pixel_bgra,
+      pixel_bgr15,
+      pixel_bgra16,
+      pixel_grey,
+      pixel_grey_alpha,
+      pixel_index8,
+      pixel_index16,
+    };
+
+    unsigned pixel_kind;
+    unsigned in_bytes;          // bytes per pixel in the file
+    unsigned out_comps;         // 3 (RGB) or 4 (RGBA)
+
+    // colour map converted to RGB or RGBA
+    dynarray<uint8_t> palette;
+    unsigned palette_start;
+    unsigned palette_size;
+
     // read a pair of bytes as a little-endian value
     int le2( uint8_t val[2] )
     {
       return val[0] + val[1] * 0x100;
     }
+
+    // ARRRRRGGGGGBBBBB to 8 bit RGB(A)
+    static void convert_16(uint8_t *dest, const uint8_t *src, bool alpha) {
+      unsigned v = src[0] + src[1] * 0x100;
+      unsigned r = ( v >> 10 ) & 0x1f, g = ( v >> 5 ) & 0x1f, b = v & 0x1f;
+      dest[0] = (uint8_t)( ( r << 3 ) | ( r >> 2 ) );
+      dest[1] = (uint8_t)( ( g << 3 ) | ( g >> 2 ) );
+      dest[2] = (uint8_t)( ( b << 3 ) | ( b >> 2 ) );
+      if (alpha) dest[3] = v & 0x8000 ? 0xff : 0;
+    }
+
+    // BGR(A) to RGB(A)
+    static OCTET_HOT void swizzle(uint8_t *dest, const uint8_t *src, unsigned n, unsigned num_comps) {
+      unsigned x = 0;
+      if (num_comps == 4) {
+        #if OCTET_SSSE3
+          __m128i shuffle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+          for (; x + 4 <= n; x += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + x * 4));
+            _mm_storeu_si128((__m128i*)(dest + x * 4), _mm_shuffle_epi8(v, shuffle));
+          }
+        #elif OCTET_SSE2
+          __m128i ga = _mm_set1_epi32(0xff00ff00);
+          __m128i low = _mm_set1_epi32(0x000000ff);
+          __m128i high = _mm_set1_epi32(0x00ff0000);
+          for (; x + 4 <= n; x += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + x * 4));
+            __m128i r = _mm_and_si128(_mm_srli_epi32(v, 16), low);
+            __m128i b = _mm_and_si128(_mm_slli_epi32(v, 16), high);
+            _mm_storeu_si128((__m128i*)(dest + x * 4), _mm_or_si128(_mm_and_si128(v, ga), _mm_or_si128(r, b)));
+          }
+        #endif
+        for (; x != n; ++x) {
+          dest[x*4+0] = src[x*4+2];
+          dest[x*4+1] = src[x*4+1];
+          dest[x*4+2] = src[x*4+0];
+          dest[x*4+3] = src[x*4+3];
+        }
+      } else {
+        #if OCTET_SSSE3
+          // five pixels in each 16 bytes. The last byte is written again next time round.
+          __m128i shuffle = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+          for (; x + 6 <= n; x += 5) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + x * 3));
+            _mm_storeu_si128((__m128i*)(dest + x * 3), _mm_shuffle_epi8(v, shuffle));
+          }
+        #endif
+        for (; x != n; ++x) {
+          dest[x*3+0] = src[x*3+2];
+          dest[x*3+1] = src[x*3+1];
+          dest[x*3+2] = src[x*3+0];
+        }
+      }
+    }
+
+    // convert n pixels from the file to RGB(A)
+    void convert(uint8_t *dest, const uint8_t *src, unsigned n) const {
+      switch (pixel_kind) {
+        case pixel_bgr: swizzle(dest, src, n, 3); break;
+        case pixel_bgra: swizzle(dest, src, n, 4); break;
+        case pixel_bgr15: {
+          for (unsigned x = 0; x != n; ++x) convert_16(dest + x * 3, src + x * 2, false);
+        } break;
+        case pixel_bgra16: {
+          for (unsigned x = 0; x != n; ++x) convert_16(dest + x * 4, src + x * 2, true);
+        } break;
+        case pixel_grey: {
+          for (unsigned x = 0; x != n; ++x) {
+            dest[x*3+0] = dest[x*3+1] = dest[x*3+2] = src[x];
+          }
+        } break;
+        case pixel_grey_alpha: {
+          for (unsigned x = 0; x != n; ++x) {
+            dest[x*4+0] = dest[x*4+1] = dest[x*4+2] = src[x*2];
+            dest[x*4+3] = src[x*2+1];
+          }
+        } break;
+        case pixel_index8:
+        case pixel_index16: {
+          for (unsigned x = 0; x != n; ++x) {
+            unsigned index = pixel_kind == pixel_index8 ? src[x] : src[x*2] + src[x*2+1] * 0x100;
+            index -= palette_start;
+            const uint8_t *colour = index < palette_size ? &palette[index * out_comps] : &palette[palette_size * out_comps];
+            for (unsigned c = 0; c != out_comps; ++c) dest[x * out_comps + c] = colour[c];
+          }
+        } break;
+      }
+    }
+
+    // read the colour map. There is an extra black entry at the end for bad indices.
+    bool read_palette(const TgaHeader *header, const uint8_t *src, const uint8_t *src_max) {
+      palette_start = header->colourmapstart[0] + header->colourmapstart[1] * 0x100;
+      palette_size = header->colourmaplength[0] + header->colourmaplength[1] * 0x100;
+      unsigned bits = header->colourmapbits;
+      unsigned entry_bytes = ( bits + 7 ) / 8;
+      if ((unsigned)(src_max - src) < palette_size * entry_bytes) return false;
+
+      out_comps = bits == 32 || bits == 16 ? 4 : 3;
+      palette.resize(( palette_size + 1 ) * out_comps);
+      for (unsigned i = 0; i != palette_size; ++i) {
+        uint8_t *dest = &palette[i * out_comps];
+        const uint8_t *entry = src + i * entry_bytes;
+        switch (bits) {
+          case 15: convert_16(dest, entry, false); break;
+          case 16: convert_16(dest, entry, true); break;
+          case 24: swizzle(dest, entry, 1, 3); break;
+          case 32: swizzle(dest, entry, 1, 4); break;
+          default: return false;
+        }
+      }
+      memset(&palette[palette_size * out_comps], 0, out_comps);
+      return true;
+    }
+
+    // flip a row written right to left
+    void reverse_row(uint8_t *row, unsigned width) const {
+      for (unsigned x = 0; x < width / 2; ++x) {
+        uint8_t *a = row + x * out_comps;
+        uint8_t *b = row + ( width - 1 - x ) * out_comps;
+        for (unsigned c = 0; c != out_comps; ++c) {
+          uint8_t t = a[c]; a[c] = b[c]; b[c] = t;
+        }
+      }
+    }
   public:
+    tga_decoder() {
+      pixel_kind = pixel_bgr;
+      in_bytes = 3;
+      out_comps = 3;
+      palette_start = palette_size = 0;
+    }
+
+    // TGA has no signature, so check that the header makes sense.
+    static bool is_tga(const uint8_t *src, unsigned size) {
+      if (size < sizeof(TgaHeader)) return false;
+      unsigned type = src[2] & ~type_rle;
+      return src[1] <= 1 && ( type == type_indexed || type == type_rgb || type == type_grey );
+    }
+
     // get an opengl texture from a file in memory
     void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width, uint16_t &height, const uint8_t *src, const uint8_t *src_max) {
       // convert the data
       TgaHeader *header = (TgaHeader*)src;
-      const uint8_t *data = (uint8_t *)src + sizeof(TgaHeader);
-    
-      width = le2(header->width);
-      height = le2(header->height);
-
-      // make sure this is the GIMP flavour  
-      assert(header->identsize == 0);
-      assert(header->colourmaptype == 0);
-      assert(header->imagetype == 2);
-      //assert(header->descriptor == 0);
-      assert(header->bits == 32 || header->bits == 24);
-    
-      unsigned num_components = header->bits / 8;
-
-      unsigned size = width * height * num_components;
-      image.resize(size);
-      format = num_components == 3 ? 0x1907 : 0x1908; // GL_RGB / GL_RGBA
-
-      uint8_t *dest = &image[0];
-
-      if (num_components == 4) {
-        // swap red and blue!
-        for (int y = 0; y != height; ++y)
-        {
-          const uint8_t *src = data + y * width * num_components;
-          for (int x = 0; x != width; ++x)
-          {
-            uint8_t alpha = src[ x*4 + 3 ];
-            uint8_t red = src[ x*4 + 2 ];
-            uint8_t green = src[ x*4 + 1 ];
-            uint8_t blue = src[ x*4 + 0 ];
-            dest[0] = red;
-            dest[1] = green;
-            dest[2] = blue;
-            dest[3] = alpha;
-            dest += 4;
-          }
+      width = height = 0;
+      if (!is_tga(src, (unsigned)(src_max - src))) {
+        printf("warning: bad TGA file\n");
+        return;
+      }
+
+      const uint8_t *data = (uint8_t *)src + sizeof(TgaHeader) + header->identsize;
+      unsigned type = header->imagetype & ~type_rle;
+      bool rle = ( header->imagetype & type_rle ) != 0;
+      unsigned bits = header->bits;
+      unsigned alpha_bits = header->descriptor & desc_alpha_bits;
+      if (data > src_max) {
+        printf("warning: bad TGA file\n");
+        return;
+      }
+
+      // skip or read the colour map
+      if (header->colourmaptype) {
+        unsigned palette_bytes = le2(header->colourmaplength) * ( ( header->colourmapbits + 7 ) / 8 );
+        if (type == type_indexed && !read_palette(header, data, src_max)) {
+          printf("warning: bad TGA colour map\n");
+          return;
+        }
+        data += palette_bytes;
+      }
+
+      if (type == type_indexed && header->colourmaptype && ( bits == 8 || bits == 16 )) {
+        pixel_kind = bits == 8 ? pixel_index8 : pixel_index16;
+      } else if (type == type_rgb && bits == 24) {
+        pixel_kind = pixel_bgr;
+        out_comps = 3;
+      } else if (type == type_rgb && bits == 32) {
+        pixel_kind = pixel_bgra;
+        out_comps = 4;
+      } else if (type == type_rgb && ( bits == 15 || bits == 16 )) {
+        pixel_kind = bits == 16 && alpha_bits ? pixel_bgra16 : pixel_bgr15;
+        out_comps = pixel_kind == pixel_bgra16 ? 4 : 3;
+      } else if (type == type_grey && bits == 8) {
+        pixel_kind = pixel_grey;
+        out_comps = 3;
+      } else if (type == type_grey && bits == 16) {
+        pixel_kind = pixel_grey_alpha;
+        out_comps = 4;
+      } else {
+        printf("warning: TGA type %d with %d bits is not supported\n", header->imagetype, bits);
+        return;
+      }
+      in_bytes = ( bits + 7 ) / 8;
+
+      unsigned w = le2(header->width);
+      unsigned h = le2(header->height);
+      if (data > src_max || w == 0 || h == 0) {
+        printf("warning: bad TGA file\n");
+        return;
+      }
+
+      // an RLE packet of two bytes makes at most 128 pixels, so a header that
+      // asks for more than that is broken and we don't allocate the memory.
+      if ((uint64_t)w * h > (uint64_t)( src_max - data ) * 64 + 128) {
+        printf("warning: bad TGA file\n");
+        return;
+      }
+
+      image.resize(w * h * out_comps);
+      format = out_comps == 3 ? 0x1907 : 0x1908; // GL_RGB / GL_RGBA
+
+      // our row 0 is at the bottom, as it is in most TGA files
+      bool top_to_bottom = ( header->descriptor & desc_top_to_bottom ) != 0;
+      bool right_to_left = ( header->descriptor & desc_right_to_left ) != 0;
+      unsigned stride = w * out_comps;
+      uint8_t *first_row = &image[0] + ( top_to_bottom ? ( h - 1 ) * stride : 0 );
+      int row_step = top_to_bottom ? -(int)stride : (int)stride;
+
+      unsigned x = 0, y = 0;
+      uint8_t *row = first_row;
+      if (!rle) {
+        for (; y != h; ++y, row += row_step) {
+          if ((unsigned)(src_max - data) < w * in_bytes) break;
+          convert(row, data, w);
+          if (right_to_left) reverse_row(row, w);
+          data += w * in_bytes;
         }
       } else {
-        for (int y = 0; y != height; ++y)
-        {
-          const uint8_t *src = data + y * width * num_components;
-          for (int x = 0; x != width; ++x)
-          {
-            uint8_t red = src[ x*3 + 2 ];
-            uint8_t green = src[ x*3 + 1 ];
-            uint8_t blue = src[ x*3 + 0 ];
-            dest[0] = red;
-            dest[1] = green;
-            dest[2] = blue;
-            dest += 3;
+        // packets can run on to the next row
+        while (y != h && data < src_max) {
+          unsigned packet = *data++;
+          unsigned count = ( packet & 0x7f ) + 1;
+          if (packet & 0x80) {
+            // one pixel repeated
+            if ((unsigned)(src_max - data) < in_bytes) break;
+            uint8_t pixel[4];
+            convert(pixel, data, 1);
+            data += in_bytes;
+            while (count && y != h) {
+              unsigned n = count < w - x ? count : w - x;
+              for (unsigned i = 0; i != n; ++i) {
+                memcpy(row + ( x + i ) * out_comps, pixel, out_comps);
+              }
+              x += n;
+              count -= n;
+              if (x == w) {
+                if (right_to_left) reverse_row(row, w);
+                x = 0;
+                y++;
+                row += row_step;
+              }
+            }
+          } else {
+            // raw pixels
+            while (count && y != h) {
+              unsigned n = count < w - x ? count : w - x;
+              if ((unsigned)(src_max - data) < n * in_bytes) {
+                data = src_max;
+                break;
+              }
+              convert(row + x * out_comps, data, n);
+              data += n * in_bytes;
+              x += n;
+              count -= n;
+              if (x == w) {
+                if (right_to_left) reverse_row(row, w);
+                x = 0;
+                y++;
+                row += row_step;
+              }
+            }
           }
         }
       }
+
+      if (y != h) {
+        // clear what we did not get
+        printf("warning: TGA file is truncated\n");
+        for (; y != h; ++y, row += row_step) {
+          memset(row + x * out_comps, 0, ( w - x ) * out_comps);
+          // the pixels we got in a partial row go the same way as whole rows
+          if (right_to_left && x) reverse_row(row, w);
+          x = 0;
+        }
+      }
+
+      width = (uint16_t)w;
+      height = (uint16_t)h;
     }
   };
 }
@@ -0,0 +1,354 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+//
+// XML pull tokenizer
+//
+// Reads an XML document in place (for example from a mapped_file) and returns
+// one token at a time: the start of an element with its attributes, some text
+// or the end of an element. Nothing is allocated per token and nothing is
+// copied: names, values and text point into the source.
+//
+// Comments, processing instructions and DOCTYPEs are skipped. Text that is only
+// whitespace is skipped. Entities are left as they are, use decode() to get a
+// string in the form that TinyXML would give you.
+//
+// example:
+//
+//   xml_tokenizer tok;
+//   tok.init(src, src + size);
+//   for (xml_tokenizer::token_t t = tok.next(); t > xml_tokenizer::token_error; t = tok.next()) {
+//     if (t == xml_tokenizer::token_start) {
+//       unsigned size;
+//       const char *name = tok.get_name(size);
+//     }
+//   }
+//
+
+namespace octet {
+  class xml_tokenizer {
+  public:
+    enum token_t {
+      token_eof,
+      token_error,
+      token_start,
+      token_end,
+      token_text,
+    };
+
+    struct attribute {
+      const char *name;
+      unsigned name_size;
+      const char *value;
+      unsigned value_size;
+    };
+
+  private:
+    const char *src_begin;
+    const char *src;
+    const char *src_max;
+
+    const char *name;
+    unsigned name_size;
+    const char *text;
+    unsigned text_size;
+    bool cdata;
+
+    dynarray<attribute> attributes;
+    unsigned num_attributes;
+
+    // "<a/>" gives us a start and an end
+    bool pending_end;
+    unsigned depth;
+    const char *error;
+
+    static bool is_space(char c) {
+      return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+    static bool is_name_end(char c) {
+      return is_space(c) || c == '/' || c == '>' || c == '=';
+    }
+
+    void skip_space() {
+      while (src != src_max && is_space(*src)) ++src;
+    }
+
+    bool starts_with(const char *str, unsigned size) const {
+      return (unsigned)(src_max - src) >= size && !memcmp(src, str, size);
+    }
+
+    // move src to the start of str, or return false.
+    bool find(const char *str, unsigned size) {
+      for (;;) {
+        const char *p = (const char*)memchr(src, str[0], src_max - src);
+        if (!p || (unsigned)(src_max - p) < size) return false;
+        src = p;
+        if (!memcmp(p, str, size)) return true;
+        src++;
+      }
+    }
+
+    const char *read_name(unsigned &size) {
+      const char *begin = src;
+      while (src != src_max && !is_name_end(*src)) ++src;
+      size = (unsigned)(src - begin);
+      return begin;
+    }
+
+    token_t fail(const char *message) {
+      error = message;
+      src = src_max;
+      return token_error;
+    }
+
+    token_t read_end_tag() {
+      src += 2;
+      name = read_name(name_size);
+      skip_space();
+      if (src == src_max || *src != '>' || !name_size || !depth) {
+        return fail("bad end tag");
+      }
+      src++;
+      depth--;
+      return token_end;
+    }
+
+    token_t read_start_tag() {
+      src++;
+      name = read_name(name_size);
+      if (!name_size) return fail("bad tag");
+      num_attributes = 0;
+      for (;;) {
+        skip_space();
+        if (src == src_max) return fail("unterminated tag");
+        if (*src == '>') {
+          src++;
+          break;
+        } else if (*src == '/') {
+          if (!starts_with("/>", 2)) return fail("bad tag");
+          src += 2;
+          pending_end = true;
+          break;
+        }
+
+        attribute attr;
+        attr.name = read_name(attr.name_size);
+        skip_space();
+        if (!attr.name_size || src == src_max || *src != '=') return fail("bad attribute");
+        src++;
+        skip_space();
+        if (src == src_max || ( *src != '"' && *src != '\'' )) return fail("bad attribute");
+        const char *quote = (const char*)memchr(src + 1, *src, src_max - src - 1);
+        if (!quote) return fail("unterminated attribute");
+        attr.value = src + 1;
+        attr.value_size = (unsigned)(quote - attr.value);
+        src = quote + 1;
+
+        if (num_attributes == attributes.size()) attributes.push_back(attr);
+        else attributes[num_attributes] = attr;
+        num_attributes++;
+      }
+      if (!pending_end) depth++;
+      return token_start;
+    }
+
+    // write a unicode character as UTF-8
+    static void put_utf8(dynarray<char> &dest, unsigned c) {
+      if (c < 0x80) {
+        dest.push_back((char)c);
+      } else if (c < 0x800) {
+        dest.push_back((char)( 0xc0 | c >> 6 ));
+        dest.push_back((char)( 0x80 | ( c & 0x3f ) ));
+      } else if (c < 0x10000) {
+        dest.push_back((char)( 0xe0 | c >> 12 ));
+        dest.push_back((char)( 0x80 | ( c >> 6 & 0x3f ) ));
+        dest.push_back((char)( 0x80 | ( c & 0x3f ) ));
+      } else {
+        dest.push_back((char)( 0xf0 | c >> 18 ));
+        dest.push_back((char)( 0x80 | ( c >> 12 & 0x3f ) ));
+        dest.push_back((char)( 0x80 | ( c >> 6 & 0x3f ) ));
+        dest.push_back((char)( 0x80 | ( c & 0x3f ) ));
+      }
+    }
+
+    // decode &amp; etc. returns the number of source bytes used, or 0 if it is not an entity.
+    static unsigned decode_entity(dynarray<char> &dest, const char *src, const char *src_max) {
+      struct entity { const char *name; unsigned size; char value; };
+      static const entity entities[] = {
+        { "&amp;", 5, '&' }, { "&lt;", 4, '<' }, { "&gt;", 4, '>' }, { "&quot;", 6, '"' }, { "&apos;", 6, '\'' },
+      };
+      for (unsigned i = 0; i != sizeof(entities)/sizeof(entities[0]); ++i) {
+        const entity &e = entities[i];
+        if ((unsigned)(src_max - src) >= e.size && !memcmp(src, e.name, e.size)) {
+          dest.push_back(e.value);
+          return e.size;
+        }
+      }
+
+      if (src_max - src < 4 || src[1] != '#') return 0;
+      const char *p = src + 2;
+      bool hex = *p == 'x';
+      p += hex;
+      unsigned c = 0, digits = 0;
+      for (; p != src_max && *p != ';' && digits < 8; ++p, ++digits) {
+        unsigned d = *p >= '0' && *p <= '9' ? *p - '0' : hex && ( *p | 0x20 ) >= 'a' && ( *p | 0x20 ) <= 'f' ? ( *p | 0x20 ) - 'a' + 10 : 16;
+        if (d == 16) return 0;
+        c = c * ( hex ? 16 : 10 ) + d;
+      }
+      if (p == src_max || *p != ';' || !digits) return 0;
+      put_utf8(dest, c);
+      return (unsigned)(p + 1 - src);
+    }
+
+  public:
+    xml_tokenizer() {
+      init(0, 0);
+    }
+
+    // src must stay valid while you use the tokens.
+    void init(const char *src, const char *src_max) {
+      src_begin = this->src = src;
+      this->src_max = src_max;
+      name = text = 0;
+      name_size = text_size = 0;
+      cdata = false;
+      num_attributes = 0;
+      pending_end = false;
+      depth = 0;
+      error = 0;
+
+      // UTF-8 byte order mark
+      if (src_max - src >= 3 && !memcmp(src, "\xef\xbb\xbf", 3)) this->src += 3;
+    }
+
+    // get the next token. text outside the root element is skipped.
+    token_t next() {
+      if (pending_end) {
+        pending_end = false;
+        return token_end;
+      }
+
+      while (src != src_max) {
+        if (*src != '<') {
+          const char *begin = src;
+          const char *lt = (const char*)memchr(src, '<', src_max - src);
+          src = lt ? lt : src_max;
+          if (!depth) continue;
+          for (const char *p = begin; p != src; ++p) {
+            if (!is_space(*p)) {
+              text = begin;
+              text_size = (unsigned)(src - begin);
+              cdata = false;
+              return token_text;
+            }
+          }
+        } else if (starts_with("<!--", 4)) {
+          src += 4;
+          if (!find("-->", 3)) return fail("unterminated comment");
+          src += 3;
+        } else if (starts_with("<![CDATA[", 9)) {
+          src += 9;
+          text = src;
+          if (!find("]]>", 3)) return fail("unterminated CDATA");
+          text_size = (unsigned)(src - text);
+          cdata = true;
+          src += 3;
+          return token_text;
+        } else if (starts_with("<?", 2)) {
+          if (!find("?>", 2)) return fail("unterminated processing instruction");
+          src += 2;
+        } else if (starts_with("<!", 2)) {
+          if (!find(">", 1)) return fail("unterminated declaration");
+          src += 1;
+        } else if (starts_with("</", 2)) {
+          return read_end_tag();
+        } else {
+          return read_start_tag();
+        }
+      }
+      return depth ? fail("unexpected end of file") : token_eof;
+    }
+
+    // the element name of token_start and token_end
+    const char *get_name(unsigned &size) const {
+      size = name_size;
+      return name;
+    }
+
+    // the attributes of token_start
+    unsigned get_num_attributes() const {
+      return num_attributes;
+    }
+
+    const attribute &get_attribute(unsigned index) const {
+      return attributes[index];
+    }
+
+    // the text of token_text. the character after the text is never part of a number
+    // ('<' or ']'), so numbers can be parsed without checking the end every time.
+    const char *get_text(unsigned &size) const {
+      size = text_size;
+      return text;
+    }
+
+    // true if the text came from a <![CDATA[ ]]> section.
+    bool is_cdata() const {
+      return cdata;
+    }
+
+    // the depth of the current element, zero outside the root element.
+    unsigned get_depth() const {
+      return depth;
+    }
+
+    // after token_error
+    const char *get_error() const {
+      return error ? error : "";
+    }
+
+    // the line we are on, for error messages
+    unsigned get_line() const {
+      unsigned line = 1;
+      for (const char *p = src_begin; p != src; ++p) line += *p == '\n';
+      return line;
+    }
+
+    // append text to dest with a terminating zero. line endings are made into '\n'.
+    // condense does what TinyXML does to text: trim the ends and make runs of whitespace into one space.
+    // entities is false for CDATA.
+    static void decode(dynarray<char> &dest, const char *src, unsigned size, bool condense, bool entities) {
+      const char *src_max = src + size;
+      bool space = false;
+      if (condense) {
+        while (src != src_max && is_space(*src)) ++src;
+      }
+      while (src != src_max) {
+        char c = *src;
+        if (condense && is_space(c)) {
+          space = true;
+          src++;
+          continue;
+        }
+        if (space) {
+          dest.push_back(' ');
+          space = false;
+        }
+        unsigned used = c == '&' && entities ? decode_entity(dest, src, src_max) : 0;
+        if (used) {
+          src += used;
+        } else if (c == '\r') {
+          dest.push_back('\n');
+          src += src + 1 != src_max && src[1] == '\n' ? 2 : 1;
+        } else {
+          dest.push_back(c);
+          src++;
+        }
+      }
+      dest.push_back(0);
+    }
+  };
+}
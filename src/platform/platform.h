@@ -36,6 +36,10 @@
 #include <math.h>
 #include <assert.h>
 
+#ifdef WIN32
+  #include <intrin.h>
+#endif
+
 // xml library
 #include "../tinyxml/tinystr.cpp"
 #include "../tinyxml/tinyxml.cpp"
@@ -79,12 +83,45 @@ static char *get_sprintf_buffer() {
   #include <sys/ioctl.h>
   #include <fcntl.h>
   #include <netinet/in.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <pthread.h>
   #define OCTET_HOT __attribute__( ( always_inline ) )
   #define ioctlsocket ioctl
   #define closesocket close
   #include "glut_specific.h"
 #endif
 
+// SSE2 integer intrinsics for image decoders and encoders.
+// define OCTET_SSE2 as 0 to use the plain C versions.
+#ifndef OCTET_SSE2
+  #if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+    #define OCTET_SSE2 1
+  #else
+    #define OCTET_SSE2 0
+  #endif
+#endif
+
+#if OCTET_SSE2
+  #include <emmintrin.h>
+#endif
+
+// SSSE3 byte shuffles. Compilers only say they have these with -mssse3 or /arch:AVX.
+#ifndef OCTET_SSSE3
+  #if OCTET_SSE2 && ( defined(__SSSE3__) || defined(__AVX__) )
+    #define OCTET_SSSE3 1
+  #else
+    #define OCTET_SSSE3 0
+  #endif
+#endif
+
+#if OCTET_SSSE3
+  #include <tmmintrin.h>
+#endif
+
+// threads, locks and atomics
+#include "threads.h"
+
 #include "../math/scalar.h"
 #include "../math/rational.h"
 #include "../math/vec2.h"
@@ -116,21 +153,35 @@ static char *get_sprintf_buffer() {
 #include "../loaders/gif_decoder.h"
 #include "../loaders/jpeg_decoder.h"
 #include "../loaders/jpeg_encoder.h"
+#include "../loaders/dxt_encoder.h"
 #include "../loaders/tga_decoder.h"
 #include "../loaders/dds_decoder.h"
+#include "../loaders/ktx_decoder.h"
+#include "../loaders/ktx_encoder.h"
+#include "../loaders/xml_tokenizer.h"
+#include "../loaders/number_parser.h"
 
 // resources
+#include "../resources/logger.h"
+#include "../resources/atom_table.h"
+#include "../resources/mip_builder.h"
 #include "../resources/app_utils.h"
+#include "../resources/mapped_file.h"
+#include "../resources/image_cache.h"
 #include "../resources/visitor.h"
+#include "../resources/fields.h"
 #include "../resources/binary_writer.h"
 #include "../resources/binary_reader.h"
 #include "../resources/xml_writer.h"
 #include "../resources/http_writer.h"
 #include "../resources/resource.h"
 #include "../resources/resources.h"
+#include "../resources/snapshot.h"
 #include "../resources/gl_resource.h"
 #include "../resources/bitmap_font.h"
 #include "../resources/mesh_builder.h"
+#include "../resources/mesh_edges.h"
+#include "../resources/scene_cache.h"
 
 // shaders
 #include "../shaders/shader.h"
@@ -157,6 +208,9 @@ static char *get_sprintf_buffer() {
 #include "../scene/scene.h"
 #include "../scene/displacement_map.h"
 #include "../scene/indexer.h"
+#include "../scene/cache_optimizer.h"
+#include "../scene/simplifier.h"
+#include "../scene/quantizer.h"
 #include "../scene/smooth.h"
 #include "../scene/mesh_text.h"
 #include "../scene/wireframe.h"
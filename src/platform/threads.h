@@ -0,0 +1,286 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Threads, locks and atomics
+//
+// A thin layer over win32 threads and pthreads. This is deliberately
+// small: just enough to run a few worker threads.
+//
+// example:
+//
+//   static void work(void *arg) { printf("hello from a thread\n"); }
+//
+//   thread t;
+//   t.start(work, NULL);
+//   t.join();
+//
+// For loops, parallel_for shares the iterations between the cpus:
+//
+//   static void row(void *arg, unsigned y) { ... }
+//
+//   parallel_for::run(height, row, (void*)&context);
+//
+
+namespace octet {
+  // atomic operations on 32 bit ints. These are all full memory barriers.
+  class atomic {
+  public:
+    // add delta to value and return the new value.
+    static int add(volatile int &value, int delta) {
+      #ifdef WIN32
+        return (int)InterlockedExchangeAdd((volatile LONG*)&value, delta) + delta;
+      #else
+        return __sync_add_and_fetch(&value, delta);
+      #endif
+    }
+
+    // if value == expected, set it to desired. returns true if we did this.
+    static bool compare_and_swap(volatile int &value, int expected, int desired) {
+      #ifdef WIN32
+        return InterlockedCompareExchange((volatile LONG*)&value, desired, expected) == expected;
+      #else
+        return __sync_bool_compare_and_swap(&value, expected, desired);
+      #endif
+    }
+
+    // set value and return the old value.
+    static int exchange(volatile int &value, int desired) {
+      #ifdef WIN32
+        return (int)InterlockedExchange((volatile LONG*)&value, desired);
+      #else
+        int old = value;
+        while (!__sync_bool_compare_and_swap(&value, old, desired)) {
+          old = value;
+        }
+        return old;
+      #endif
+    }
+
+    // read a value written by another thread.
+    static int load(volatile int &value) {
+      int result = value;
+      #ifdef WIN32
+        MemoryBarrier();
+      #else
+        __sync_synchronize();
+      #endif
+      return result;
+    }
+
+    // write a value for another thread to read.
+    static void store(volatile int &value, int desired) {
+      exchange(value, desired);
+    }
+  };
+
+  // a lock for data shared between threads.
+  class mutex {
+    #ifdef WIN32
+      CRITICAL_SECTION cs;
+    #elif defined(__APPLE__)
+      pthread_mutex_t mtx;
+    #endif
+
+    mutex(const mutex &rhs);
+    void operator=(const mutex &rhs);
+  public:
+    mutex() {
+      #ifdef WIN32
+        InitializeCriticalSection(&cs);
+      #elif defined(__APPLE__)
+        pthread_mutex_init(&mtx, NULL);
+      #endif
+    }
+
+    ~mutex() {
+      #ifdef WIN32
+        DeleteCriticalSection(&cs);
+      #elif defined(__APPLE__)
+        pthread_mutex_destroy(&mtx);
+      #endif
+    }
+
+    void lock() {
+      #ifdef WIN32
+        EnterCriticalSection(&cs);
+      #elif defined(__APPLE__)
+        pthread_mutex_lock(&mtx);
+      #endif
+    }
+
+    void unlock() {
+      #ifdef WIN32
+        LeaveCriticalSection(&cs);
+      #elif defined(__APPLE__)
+        pthread_mutex_unlock(&mtx);
+      #endif
+    }
+  };
+
+  // lock a mutex for the lifetime of a scope
+  class scoped_lock {
+    mutex &m;
+    scoped_lock(const scoped_lock &rhs);
+    void operator=(const scoped_lock &rhs);
+  public:
+    scoped_lock(mutex &m_) : m(m_) {
+      m.lock();
+    }
+
+    ~scoped_lock() {
+      m.unlock();
+    }
+  };
+
+  // a thread of execution.
+  class thread {
+  public:
+    typedef void (*func_t)(void *arg);
+
+  private:
+    func_t func;
+    void *arg;
+    bool started;
+
+    #ifdef WIN32
+      HANDLE handle;
+
+      static DWORD WINAPI entry(LPVOID param) {
+        thread *t = (thread*)param;
+        t->func(t->arg);
+        return 0;
+      }
+    #elif defined(__APPLE__)
+      pthread_t handle;
+
+      static void *entry(void *param) {
+        thread *t = (thread*)param;
+        t->func(t->arg);
+        return NULL;
+      }
+    #endif
+
+    thread(const thread &rhs);
+    void operator=(const thread &rhs);
+  public:
+    thread() {
+      func = 0;
+      arg = 0;
+      started = false;
+    }
+
+    // threads must be joined before they are destroyed.
+    ~thread() {
+      join();
+    }
+
+    // call func(arg) on a new thread. returns false if threads are not available.
+    bool start(func_t func_, void *arg_) {
+      if (started) return false;
+      func = func_;
+      arg = arg_;
+      #ifdef WIN32
+        handle = CreateThread(NULL, 0, entry, (LPVOID)this, 0, NULL);
+        started = handle != NULL;
+      #elif defined(__APPLE__)
+        started = pthread_create(&handle, NULL, entry, (void*)this) == 0;
+      #endif
+      return started;
+    }
+
+    // wait for the thread to finish.
+    void join() {
+      if (!started) return;
+      #ifdef WIN32
+        WaitForSingleObject(handle, INFINITE);
+        CloseHandle(handle);
+      #elif defined(__APPLE__)
+        pthread_join(handle, NULL);
+      #endif
+      started = false;
+    }
+
+    bool is_started() const {
+      return started;
+    }
+
+    // give up the cpu for a while.
+    static void sleep(unsigned ms) {
+      #ifdef WIN32
+        Sleep(ms);
+      #elif defined(__APPLE__)
+        usleep(ms * 1000);
+      #endif
+    }
+
+    // how many threads can run at once.
+    static unsigned get_num_cpus() {
+      #ifdef WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwNumberOfProcessors ? (unsigned)info.dwNumberOfProcessors : 1;
+      #elif defined(__APPLE__)
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        return n > 0 ? (unsigned)n : 1;
+      #else
+        return 1;
+      #endif
+    }
+  };
+
+  // run func(arg, i) for i = 0..count-1 on all the cpus.
+  // Threads take the next index as they finish, so uneven work balances out.
+  // The calling thread helps, so this still works if threads are not available.
+  class parallel_for {
+  public:
+    typedef void (*func_t)(void *arg, unsigned index);
+
+  private:
+    enum { max_threads = 32 };
+
+    func_t func;
+    void *arg;
+    unsigned count;
+    volatile int next;
+
+    static void worker(void *param) {
+      parallel_for *pf = (parallel_for*)param;
+      for (;;) {
+        unsigned index = (unsigned)atomic::add(pf->next, 1) - 1;
+        if (index >= pf->count) break;
+        pf->func(pf->arg, index);
+      }
+    }
+
+    parallel_for(const parallel_for &rhs);
+    void operator=(const parallel_for &rhs);
+    parallel_for() {}
+  public:
+    // num_threads = 0 means one per cpu.
+    static void run(unsigned count, func_t func, void *arg, unsigned num_threads = 0) {
+      parallel_for pf;
+      pf.func = func;
+      pf.arg = arg;
+      pf.count = count;
+      pf.next = 0;
+
+      if (num_threads == 0) num_threads = thread::get_num_cpus();
+      if (num_threads > count) num_threads = count;
+      if (num_threads > max_threads) num_threads = max_threads;
+
+      thread threads[max_threads];
+      for (unsigned i = 1; i < num_threads; ++i) {
+        threads[i].start(worker, (void*)&pf);
+      }
+
+      worker((void*)&pf);
+
+      for (unsigned i = 1; i < num_threads; ++i) {
+        threads[i].join();
+      }
+    }
+  };
+}
@@ -11,6 +11,9 @@
 // some standard c++ definitions
 #include <stdlib.h>
 
+// sceIoMkdir
+#include <kernel.h>
+
 #include "gl_skeleton.h"
 #include "al_defs.h"
 
@@ -7,14 +7,6 @@
 //
 
 namespace octet {
-  enum atom_t {
-    atom_, // null atom
-    
-    #define OCTET_ATOM(X) atom_##X,
-    #include "atoms.h"
-    #undef OCTET_ATOM
-  };
-  
   class app_utils {
   public:
     static const char *prefix(const char *new_prefix=NULL) {
@@ -65,6 +57,53 @@ namespace octet {
       }
     }
 
+    // make a directory if it isn't there. the parent must exist.
+    static void make_dir(const char *path) {
+      #ifdef WIN32
+        CreateDirectoryA(path, NULL);
+      #elif defined(SN_TARGET_PSP2)
+        sceIoMkdir(path, 0777);
+      #else
+        mkdir(path, 0777);
+      #endif
+    }
+
+    // fast 64 bit hash of a block of memory (MurmurHash64A).
+    // reads eight bytes at a time, so it is good for large blobs like image files.
+    static uint64_t hash64(const void *data, size_t size, uint64_t seed = 0) {
+      const uint64_t m = 0xc6a4a7935bd1e995ULL;
+      const unsigned r = 47;
+      uint64_t hash = seed ^ ( (uint64_t)size * m );
+
+      const uint8_t *src = (const uint8_t*)data;
+      const uint8_t *src_max = src + ( size & ~(size_t)7 );
+      for (; src != src_max; src += 8) {
+        uint64_t k;
+        memcpy(&k, src, 8);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        hash ^= k;
+        hash *= m;
+      }
+
+      switch (size & 7) {
+        case 7: hash ^= (uint64_t)src[6] << 48;
+        case 6: hash ^= (uint64_t)src[5] << 40;
+        case 5: hash ^= (uint64_t)src[4] << 32;
+        case 4: hash ^= (uint64_t)src[3] << 24;
+        case 3: hash ^= (uint64_t)src[2] << 16;
+        case 2: hash ^= (uint64_t)src[1] << 8;
+        case 1: hash ^= (uint64_t)src[0];
+                hash *= m;
+      }
+
+      hash ^= hash >> r;
+      hash *= m;
+      hash ^= hash >> r;
+      return hash;
+    }
+
     static GLuint get_stock_texture(unsigned gl_kind, const char *name) {
       //stock_texture_generator stock;
       if (!strcmp(name, "bricks")) {
@@ -146,6 +185,37 @@ namespace octet {
       return handle;
     }
 
+    // make a texture from a parsed KTX file. The pixels go straight from the
+    // file (usually a mapped_file) to OpenGL without being copied.
+    static GLuint make_texture(const ktx_decoder &ktx) {
+      GLuint handle = 0;
+      glGenTextures(1, &handle);
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, handle);
+
+      unsigned format = ktx.get_format();
+      unsigned num_levels = ktx.get_num_levels();
+      for (unsigned level = 0; level != num_levels; ++level) {
+        unsigned size = 0, width = 0, height = 0;
+        const uint8_t *pixels = ktx.get_level(level, size, width, height);
+        if (ktx.is_compressed()) {
+          glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height, 0, size, (void*)pixels);
+        } else {
+          glTexImage2D(GL_TEXTURE_2D, level, format, width, height, 0, format, GL_UNSIGNED_BYTE, (void*)pixels);
+        }
+      }
+
+      // a chain that stops before 1x1 is incomplete, so we can't use mipmapping.
+      bool complete = num_levels == mip_builder::get_num_levels(ktx.get_width(), ktx.get_height());
+      if (!complete && num_levels == 1 && !ktx.is_compressed()) {
+        glGenerateMipmap(GL_TEXTURE_2D);
+        complete = true;
+      }
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, complete ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      return handle;
+    }
+
     static ALuint make_sound_buffer(unsigned kind, unsigned rate, dynarray<unsigned char> &buffer, unsigned offset, unsigned size) {
       ALuint id = 0;
       alGenBuffers(1, &id);
@@ -153,79 +223,14 @@ namespace octet {
       return id;
     }
 
-    // write some text to log.txt
-    static FILE * log(const char *fmt, ...) {
-      static FILE *file;
-      va_list list;
-      va_start(list, fmt);
-      if (!file) file = fopen("log.txt", "w");
-      vfprintf(file, fmt, list);
-      va_end(list);
-      fflush(file);
-      return file;
-    }
-
-    static dictionary<atom_t> *get_atom_dict() {
-      static dictionary<atom_t> *dict;
-      if (!dict) dict = new dictionary<atom_t>();
-      return dict;
-    }
-
     // get a unique int for a string.
     // these values are much cheaper to work with than strings.
     static atom_t get_atom(const char *name) {
-      // the null name is 0
-      if (name == 0 || name[0] == 0) {
-        return atom_;
-      }
-
-      dictionary<atom_t> *dict = get_atom_dict();
-
-      static int num_atoms = 0;
-      if (num_atoms == 0) {
-        for (++num_atoms; predefined_atom(num_atoms); num_atoms++) {
-          (*dict)[predefined_atom(num_atoms)] = (atom_t)num_atoms;
-        }
-      }
-      if (dict->contains(name)) {
-        //app_utils::log("old atom %s %d\n", name, (*dict)[name]);
-        return (*dict)[name];
-      } else {
-        //app_utils::log("new atom %s %d\n", name, num_atoms);
-        return (*dict)[name] = (atom_t)num_atoms++;
-      }
-    }
-
-    static const char *predefined_atom(unsigned i) {
-      static const char *names[] = {
-        "",
-
-        #define OCTET_ATOM(X) #X,
-        #include "atoms.h"
-        #undef OCTET_ATOM
-        NULL
-      };
-      if (i < sizeof(names)/sizeof(names[0])-1) {
-        return names[i];
-      } else {
-        return NULL;
-      }
+      return atom_table::get().get_atom(name);
     }
 
     static const char *get_atom_name(atom_t atom) {
-      const char *name = predefined_atom((unsigned)atom);
-      if (name) return name;
-
-      // slow!
-      dictionary<atom_t> *dict = get_atom_dict();
-      unsigned num_indices = dict->get_num_indices();
-      for (unsigned i = 0; i != num_indices; ++i) {
-        if (dict->get_value(i) == atom) {
-          return dict->get_key(i);
-        }
-      }
-      return "???";
+      return atom_table::get().get_name(atom);
     }
-
   };
 }
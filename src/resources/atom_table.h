@@ -0,0 +1,239 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Atoms: unique ints for strings
+//
+// Names known when we compile go in atoms.h. They become enum values
+// (atom_node, atom_sid...) and cost nothing to look up at runtime.
+// Other names (collada sids, node names...) are added to the table as we meet them.
+//
+// The table is read mostly. Looking up an existing name does not take a lock
+// and atom to name is an array index. Adding a new name takes a lock.
+//
+// example:
+//
+//   atom_t sid = app_utils::get_atom("Bone01");
+//   printf("%s\n", app_utils::get_atom_name(sid));
+//
+
+namespace octet {
+  enum atom_t {
+    atom_, // null atom
+
+    #define OCTET_ATOM(X) atom_##X,
+    #include "atoms.h"
+    #undef OCTET_ATOM
+  };
+
+  class atom_table {
+    enum {
+      // names are stored in chunks that never move, so readers
+      // do not need a lock while the table grows.
+      chunk_bits = 10,
+      chunk_size = 1 << chunk_bits,
+      max_chunks = 1024,
+
+      // each generation of the hash table is twice the size of the last.
+      max_generations = 32,
+      min_table_size = 1024,
+    };
+
+    struct entry {
+      const char *name;
+      unsigned hash;
+    };
+
+    // open addressed hash table of atoms. 0 is an empty slot.
+    struct table {
+      volatile int *slots;
+      unsigned mask;
+    };
+
+    entry *chunks[max_chunks];
+    volatile int num_atoms;
+    int num_predefined;
+
+    // old generations are kept until we exit as a reader may still be using one.
+    table tables[max_generations];
+    volatile int generation;
+
+    mutex add_mutex;
+
+    static unsigned calc_hash(const char *name) {
+      // FNV-1a
+      unsigned hash = 2166136261u;
+      for (int i = 0; name[i]; ++i) {
+        hash = ( hash ^ (name[i] & 0xff) ) * 16777619u;
+      }
+      return hash;
+    }
+
+    entry &get_entry(int atom) {
+      return chunks[atom >> chunk_bits][atom & (chunk_size-1)];
+    }
+
+    int find(const char *name, unsigned hash) {
+      const table &t = tables[atomic::load(generation)];
+      for (unsigned i = hash & t.mask; ; i = (i + 1) & t.mask) {
+        int atom = atomic::load(t.slots[i]);
+        if (atom == 0) return 0;
+        entry &e = get_entry(atom);
+        if (e.hash == hash && !strcmp(e.name, name)) return atom;
+      }
+    }
+
+    static void insert(table &t, int atom, unsigned hash) {
+      unsigned i = hash & t.mask;
+      while (t.slots[i]) i = (i + 1) & t.mask;
+      atomic::store(t.slots[i], atom);
+    }
+
+    // make the next generation of the hash table. add_mutex must be held.
+    void grow() {
+      int gen = generation;
+      table &t = tables[gen+1];
+      unsigned size = (tables[gen].mask + 1) * 2;
+      t.slots = (volatile int*)allocator::malloc(size * sizeof(int));
+      memset((void*)t.slots, 0, size * sizeof(int));
+      t.mask = size - 1;
+      for (int atom = 1; atom != num_atoms; ++atom) {
+        insert(t, atom, get_entry(atom).hash);
+      }
+      atomic::store(generation, gen+1);
+    }
+
+    // add a name to the table. add_mutex must be held.
+    int add(const char *name, unsigned hash, bool copy) {
+      int atom = num_atoms;
+      if ((atom >> chunk_bits) >= max_chunks) {
+        // we can't hand back the null atom for a real name, so give up.
+        OCTET_LOG_WARNING("atom_table: more than %d atoms, can't add %s\n", max_chunks * chunk_size, name);
+        assert(0 && "atom table full");
+        exit(1);
+      }
+
+      entry *&chunk = chunks[atom >> chunk_bits];
+      if (!chunk) {
+        chunk = (entry*)allocator::malloc(sizeof(entry) * chunk_size);
+      }
+
+      entry &e = chunk[atom & (chunk_size-1)];
+      if (copy) {
+        size_t bytes = strlen(name) + 1;
+        char *new_name = (char*)allocator::malloc(bytes);
+        memcpy(new_name, name, bytes);
+        e.name = new_name;
+      } else {
+        e.name = name;
+      }
+      e.hash = hash;
+
+      // keep the hash table under half full
+      if ((unsigned)(atom + 1) * 2 > tables[generation].mask + 1) {
+        atomic::store(num_atoms, atom + 1);
+        grow();
+      } else {
+        atomic::store(num_atoms, atom + 1);
+        insert(tables[generation], atom, hash);
+      }
+      return atom;
+    }
+
+    atom_table(const atom_table &rhs);
+    void operator=(const atom_table &rhs);
+  public:
+    atom_table() {
+      memset(chunks, 0, sizeof(chunks));
+      memset(tables, 0, sizeof(tables));
+      generation = 0;
+      tables[0].slots = (volatile int*)allocator::malloc(min_table_size * sizeof(int));
+      memset((void*)tables[0].slots, 0, min_table_size * sizeof(int));
+      tables[0].mask = min_table_size - 1;
+
+      // atom 0 is the null atom ""
+      static const char *names[] = {
+        "",
+
+        #define OCTET_ATOM(X) #X,
+        #include "atoms.h"
+        #undef OCTET_ATOM
+      };
+
+      chunks[0] = (entry*)allocator::malloc(sizeof(entry) * chunk_size);
+      chunks[0][0].name = names[0];
+      chunks[0][0].hash = 0;
+      num_atoms = 1;
+
+      scoped_lock lock(add_mutex);
+      for (unsigned i = 1; i != sizeof(names)/sizeof(names[0]); ++i) {
+        add(names[i], calc_hash(names[i]), false);
+      }
+      num_predefined = num_atoms;
+    }
+
+    ~atom_table() {
+      for (int atom = num_predefined; atom != num_atoms; ++atom) {
+        const char *name = get_entry(atom).name;
+        allocator::free((void*)name, strlen(name)+1);
+      }
+      for (int i = 0; i != max_chunks && chunks[i]; ++i) {
+        allocator::free(chunks[i], sizeof(entry) * chunk_size);
+      }
+      for (int i = 0; i <= generation; ++i) {
+        allocator::free((void*)tables[i].slots, (tables[i].mask + 1) * sizeof(int));
+      }
+    }
+
+    // the table used by app_utils::get_atom.
+    // C++03 statics are not thread safe, so the first call should be on the main thread.
+    static atom_table &get() {
+      static atom_table instance;
+      return instance;
+    }
+
+    // get the atom for a name, adding it if we have not seen it before.
+    atom_t get_atom(const char *name) {
+      // the null name is 0
+      if (name == 0 || name[0] == 0) {
+        return atom_;
+      }
+
+      unsigned hash = calc_hash(name);
+      int atom = find(name, hash);
+      if (atom) return (atom_t)atom;
+
+      scoped_lock lock(add_mutex);
+
+      // another thread may have added it while we waited
+      atom = find(name, hash);
+      if (atom) return (atom_t)atom;
+
+      //OCTET_LOG_DEBUG("new atom %s %d\n", name, num_atoms);
+      return (atom_t)add(name, hash, true);
+    }
+
+    // atoms below this come from atoms.h and are the same in every run.
+    int get_num_predefined() const {
+      return num_predefined;
+    }
+
+    // atoms from get_num_predefined() up to this were added while running, in order.
+    int get_num_atoms() {
+      return atomic::load(num_atoms);
+    }
+
+    // get the name of an atom. This is an array lookup.
+    const char *get_name(atom_t atom) {
+      if ((unsigned)atom >= (unsigned)num_atoms) return "???";
+      return get_entry((int)atom).name;
+    }
+
+    // number of atoms including the predefined ones
+    unsigned get_size() const {
+      return (unsigned)num_atoms;
+    }
+  };
+}
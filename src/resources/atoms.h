@@ -25,6 +25,7 @@ OCTET_ATOM(end_time)
 OCTET_ATOM(falloff_angle)
 OCTET_ATOM(falloff_exponent)
 OCTET_ATOM(farVal)
+OCTET_ATOM(fields)
 OCTET_ATOM(format)
 OCTET_ATOM(index_type)
 OCTET_ATOM(indices)
@@ -101,8 +102,15 @@ OCTET_ATOM(mip_levels)
 OCTET_ATOM(cube_faces)
 OCTET_ATOM(src)
 OCTET_ATOM(view_pos)
+OCTET_ATOM(pixels_per_unit)
+OCTET_ATOM(min_pixels)
+OCTET_ATOM(max_angle)
+OCTET_ATOM(max_depth)
 OCTET_ATOM(font)
 OCTET_ATOM(font_info)
+OCTET_ATOM(lods)
+OCTET_ATOM(lod_errors)
+OCTET_ATOM(attribute_decode)
 
 #define OCTET_CLASS(X) OCTET_ATOM(X)
 #include "classes.h"
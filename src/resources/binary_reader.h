@@ -9,14 +9,13 @@
 
 namespace octet {
   class binary_reader : public visitor {
-    enum { debug = true };
     hash_map<void *, int> refs;
     dynarray<void *> id_to_ref;
     FILE *file;
     char tmp[256];
 
     void read(uint8_t *src, unsigned bytes) {
-      //if (debug) app_utils::log("read %08x bytes\n", bytes);
+      //OCTET_LOG_DEBUG("read %08x bytes\n", bytes);
       fread(src, 1, bytes, file);
     }
 
@@ -24,7 +23,7 @@ namespace octet {
       uint8_t b[4];
       read(b, 4);
       int value = b[0] + (b[1] << 8) + (b[2] << 16) + (b[3] << 24);
-      if (debug) app_utils::log("%*sread %08x\n", get_depth()*2, "", value);
+      OCTET_LOG_DEBUG("%*sread %08x\n", get_depth()*2, "", value);
       return value;
     }
 
@@ -32,7 +31,7 @@ namespace octet {
       uint8_t b[4];
       read(b, 4);
       int value = b[0] + (b[1] << 8) + (b[2] << 16) + (b[3] << 24);
-      if (debug) app_utils::log("%*sread %08x (%s)\n", get_depth()*2, "", value, app_utils::get_atom_name((atom_t)value));
+      OCTET_LOG_DEBUG("%*sread %08x (%s)\n", get_depth()*2, "", value, app_utils::get_atom_name((atom_t)value));
       return (atom_t)value;
     }
 
@@ -44,16 +43,16 @@ namespace octet {
         if (c == 0) break;
         nchars += nchars != sizeof(tmp)-1;
       }
-      if (debug) app_utils::log("%*sread %s\n", get_depth()*2, "", tmp);
+      OCTET_LOG_DEBUG("%*sread %s\n", get_depth()*2, "", tmp);
       return tmp;
     }
 
     bool check_atom(atom_t sid) {
       if (!get_error()) {
         atom_t test = read_atom();
-        app_utils::log("%*scheck_atom %s\n", get_depth()*2, "", app_utils::get_atom_name(sid));
+        OCTET_LOG_DEBUG("%*scheck_atom %s\n", get_depth()*2, "", app_utils::get_atom_name(sid));
         if (test != sid) {
-          app_utils::log("error: expected %s\n", app_utils::get_atom_name(sid));
+          OCTET_LOG_ERROR("error: expected %s\n", app_utils::get_atom_name(sid));
           set_error(true);
         }
       }
@@ -63,9 +62,9 @@ namespace octet {
     bool check_size(unsigned size) {
       if (!get_error()) {
         int test = read_int();
-        app_utils::log("%*scheck_size %d\n", get_depth()*2, "", size);
+        OCTET_LOG_DEBUG("%*scheck_size %d\n", get_depth()*2, "", size);
         if (test != (int)size) {
-          app_utils::log("error: expected %d bytes\n", size);
+          OCTET_LOG_ERROR("error: expected %d bytes\n", size);
           set_error(true);
         }
       }
@@ -73,11 +72,11 @@ namespace octet {
     }
 
     void *get_ref(int id) {
-      app_utils::log("%*sget_ref %d/%d\n", get_depth()*2, "", id, id_to_ref.size());
+      OCTET_LOG_DEBUG("%*sget_ref %d/%d\n", get_depth()*2, "", id, id_to_ref.size());
       if (id == (int)id_to_ref.size()) {
         return NULL;
       } else if (id > (int)id_to_ref.size()) {
-        app_utils::log("error: id overflow\n");
+        OCTET_LOG_ERROR("error: id overflow\n");
         set_error(true);
         return NULL;
       } else {
@@ -87,7 +86,7 @@ namespace octet {
 
   public:
     binary_reader(FILE *file) {
-      if (debug) app_utils::log("binary_reader\n");
+      OCTET_LOG_DEBUG("binary_reader\n");
       id_to_ref.reserve(256);
       id_to_ref.push_back(NULL);
 
@@ -129,17 +128,17 @@ namespace octet {
       sid = read_atom();
       int id = read_int();
       ref = get_ref(id);
-      if (debug) app_utils::log("%*sbegin_read_ref %p %s %s %d\n", get_depth()*2, "", ref, app_utils::get_atom_name(sid), app_utils::get_atom_name(type), id);
+      OCTET_LOG_DEBUG("%*sbegin_read_ref %p %s %s %d\n", get_depth()*2, "", ref, app_utils::get_atom_name(sid), app_utils::get_atom_name(type), id);
       return !get_error();
     }
 
     // read an array reference
     bool begin_read_ref(void *&ref, int index, atom_t &type) {
-      if (debug) app_utils::log("begin_read_ref\n");
+      OCTET_LOG_DEBUG("begin_read_ref\n");
       type = read_atom();
       int id = read_int();
       ref = get_ref(id);
-      if (debug) app_utils::log("%*sbegin_read_ref %p %d %s\n", get_depth()*2, "", ref, index, app_utils::get_atom_name(type), id);
+      OCTET_LOG_DEBUG("%*sbegin_read_ref %p %d %s\n", get_depth()*2, "", ref, index, app_utils::get_atom_name(type), id);
       return !get_error();
     }
 
@@ -147,7 +146,7 @@ namespace octet {
     bool begin_read_ref(void *&ref, const char *&sid, atom_t &type) {
       type = read_atom();
       sid = read_string();
-      if (debug) app_utils::log("%*sbegin_read_ref %s\n", get_depth()*2, "", sid);
+      OCTET_LOG_DEBUG("%*sbegin_read_ref %s\n", get_depth()*2, "", sid);
       int id = read_int();
       ref = get_ref(id);
       return !get_error();
@@ -180,13 +179,13 @@ namespace octet {
 
     // called after visiting a new object
     void end_ref() {
-      if (debug) app_utils::log("%*send_ref\n", get_depth()*2, "");
+      OCTET_LOG_DEBUG("%*send_ref\n", get_depth()*2, "");
       check_atom(atom_end_ref);
     }
 
     // called before reading an array or dictionary
     bool begin_refs(atom_t sid, int &size, bool is_dict) {
-      if (debug) app_utils::log("%*sbegin_refs %s\n", get_depth()*2, "", app_utils::get_atom_name(sid));
+      OCTET_LOG_DEBUG("%*sbegin_refs %s\n", get_depth()*2, "", app_utils::get_atom_name(sid));
       if (!check_atom(sid) && !check_atom(atom_begin_refs)) {
         size = read_int();
         return true;
@@ -196,14 +195,33 @@ namespace octet {
 
     // called after reading an array or dictionary
     void end_refs(bool is_dict) {
-      if (debug) app_utils::log("%*send_refs\n", get_depth()*2, "");
+      OCTET_LOG_DEBUG("%*send_refs\n", get_depth()*2, "");
       //check_atom(atom_end_refs);
     }
 
-    void visit_bin(void *value, unsigned size, atom_t sid, atom_t type) {
-      if (debug) app_utils::log("%*svisit_bin %s %d\n", get_depth()*2, "", app_utils::get_atom_name(sid), size);
-      if (!check_atom(type) && !check_atom(sid) && !check_size(size)) {
-        read((uint8_t*)value, size);
+    // read runs of plain old data fields in one go
+    bool visit_fields(void *obj, const field_list &fields) {
+      if (check_atom(atom_fields)) return true;
+      if ((unsigned)read_int() != fields.get_layout_hash()) {
+        OCTET_LOG_ERROR("error: class layout has changed since this file was saved\n");
+        set_error(true);
+        return true;
+      }
+      for (unsigned i = 0; i != fields.get_num_runs() && !get_error(); ++i) {
+        const field_list::run &r = fields.get_run(i);
+        if (r.is_pod) {
+          read((uint8_t*)obj + r.offset, r.size);
+        } else {
+          fields.visit_field(obj, r.first_field, *this);
+        }
+      }
+      return true;
+    }
+
+    void visit_bin(void *value, size_t size, atom_t sid, atom_t type) {
+      OCTET_LOG_DEBUG("%*svisit_bin %s %d\n", get_depth()*2, "", app_utils::get_atom_name(sid), (int)size);
+      if (!check_atom(type) && !check_atom(sid) && !check_size((unsigned)size)) {
+        read((uint8_t*)value, (unsigned)size);
       }
     }
 
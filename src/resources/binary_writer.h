@@ -9,36 +9,35 @@
 
 namespace octet {
   class binary_writer : public visitor {
-    enum { debug = true };
     hash_map<void *, int> refs;
     int next_id;
     FILE *file;
 
     void write(const uint8_t *src, unsigned bytes) {
-      //if (debug) app_utils::log("%*swrite %08x bytes\n", get_depth()*2, "", bytes);
+      //OCTET_LOG_DEBUG("%*swrite %08x bytes\n", get_depth()*2, "", bytes);
       fwrite(src, 1, bytes, file);
     }
 
     void write_int(int value) {
-      if (debug) app_utils::log("%*swrite %08x\n", get_depth()*2, "", value);
+      OCTET_LOG_DEBUG("%*swrite %08x\n", get_depth()*2, "", value);
       uint8_t b[4] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
       write(b, 4);
     }
 
     void write_atom(atom_t value) {
-      if (debug) app_utils::log("%*swrite %08x (%s)\n", get_depth()*2, "", value, app_utils::get_atom_name((atom_t)value));
+      OCTET_LOG_DEBUG("%*swrite %08x (%s)\n", get_depth()*2, "", value, app_utils::get_atom_name((atom_t)value));
       uint8_t b[4] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
       write(b, 4);
     }
 
     void write_string(const char *value) {
-      if (debug) app_utils::log("%*swrite %s\n", get_depth()*2, "", value);
+      OCTET_LOG_DEBUG("%*swrite %s\n", get_depth()*2, "", value);
       write((const uint8_t*)value, (int)strlen(value)+1);
     }
 
   public:
     binary_writer(FILE *file) {
-      if (debug) app_utils::log("%*sbinary_writer\n", get_depth()*2, "");
+      OCTET_LOG_DEBUG("%*sbinary_writer\n", get_depth()*2, "");
       next_id = 1;
       this->file = file;
 
@@ -50,7 +49,7 @@ namespace octet {
 
     // dictionary entry
     bool begin_ref(void *ref, const char *sid, atom_t type) {
-      if (debug) app_utils::log("%*sbegin_ref %p %s %s\n", get_depth()*2, "", ref, sid, app_utils::get_atom_name(type));
+      OCTET_LOG_DEBUG("%*sbegin_ref %p %s %s\n", get_depth()*2, "", ref, sid, app_utils::get_atom_name(type));
       if (ref == NULL) {
         write_atom(atom_);
         write_string(sid);
@@ -74,7 +73,7 @@ namespace octet {
 
     // ordinary ref
     bool begin_ref(void *ref, atom_t sid, atom_t type) {
-      if (debug) app_utils::log("%*sbegin_ref %p %s %s\n", get_depth()*2, "", ref, app_utils::get_atom_name(sid), app_utils::get_atom_name(type));
+      OCTET_LOG_DEBUG("%*sbegin_ref %p %s %s\n", get_depth()*2, "", ref, app_utils::get_atom_name(sid), app_utils::get_atom_name(type));
       if (ref == NULL) {
         write_atom(atom_);
         write_atom(sid);
@@ -98,7 +97,7 @@ namespace octet {
 
     // array entry
     bool begin_ref(void *ref, int index, atom_t type) {
-      if (debug) app_utils::log("%*sbegin_ref %p %d %s\n", get_depth()*2, "", ref, index, app_utils::get_atom_name(type));
+      OCTET_LOG_DEBUG("%*sbegin_ref %p %d %s\n", get_depth()*2, "", ref, index, app_utils::get_atom_name(type));
       if (ref == NULL) {
         write_atom(atom_);
         write_int(0);
@@ -118,7 +117,7 @@ namespace octet {
     }
 
     void end_ref() {
-      if (debug) app_utils::log("%*send_ref\n", get_depth()*2, "");
+      OCTET_LOG_DEBUG("%*send_ref\n", get_depth()*2, "");
       write_atom(atom_end_ref);
     }
 
@@ -132,7 +131,7 @@ namespace octet {
     }
 
     bool begin_refs(atom_t sid, int &size, bool is_dict) {
-      if (debug) app_utils::log("%*sbegin_refs sid=%s size=%d is_dict=%d\n", get_depth()*2, "", app_utils::get_atom_name(sid), size, is_dict);
+      OCTET_LOG_DEBUG("%*sbegin_refs sid=%s size=%d is_dict=%d\n", get_depth()*2, "", app_utils::get_atom_name(sid), size, is_dict);
       write_atom(sid);
       write_atom(atom_begin_refs);
       write_int(size);
@@ -140,15 +139,30 @@ namespace octet {
     }
 
     void end_refs(bool is_dict) {
-      if (debug) app_utils::log("%*send_refs\n", get_depth()*2, "");
+      OCTET_LOG_DEBUG("%*send_refs\n", get_depth()*2, "");
       //write_atom(atom_end_refs);
     }
 
-    void visit_bin(void *value, unsigned size, atom_t sid, atom_t type) {
+    // write runs of plain old data fields in one go
+    bool visit_fields(void *obj, const field_list &fields) {
+      write_atom(atom_fields);
+      write_int(fields.get_layout_hash());
+      for (unsigned i = 0; i != fields.get_num_runs() && !get_error(); ++i) {
+        const field_list::run &r = fields.get_run(i);
+        if (r.is_pod) {
+          write((const uint8_t*)obj + r.offset, r.size);
+        } else {
+          fields.visit_field(obj, r.first_field, *this);
+        }
+      }
+      return true;
+    }
+
+    void visit_bin(void *value, size_t size, atom_t sid, atom_t type) {
       write_atom(type);
       write_atom(sid);
-      write_int(size);
-      write((const uint8_t*)value, size);
+      write_int((int)size);
+      write((const uint8_t*)value, (unsigned)size);
     }
 
     void visit_string(string &value, atom_t sid) {
@@ -18,3 +18,6 @@ OCTET_CLASS(param)
 OCTET_CLASS(gl_resource)
 OCTET_CLASS(bitmap_font)
 OCTET_CLASS(mesh_text)
+OCTET_CLASS(cache_optimizer)
+OCTET_CLASS(simplifier)
+OCTET_CLASS(quantizer)
@@ -0,0 +1,259 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// static field lists for resources
+//
+// A class lists its fields once, next to RESOURCE_META. The list gives us
+// the visit() function and also lets binary_reader and binary_writer copy runs
+// of adjacent plain old data fields with one read or write, without a virtual
+// call and a tag for every int.
+//
+// example:
+//
+//   class camera_instance : public resource {
+//     ref<scene_node> node;
+//     float nearVal;
+//     float farVal;
+//   public:
+//     RESOURCE_META(camera_instance)
+//
+//     OCTET_FIELDS_BEGIN(camera_instance)
+//       OCTET_FIELD(node)
+//       OCTET_FIELD(nearVal)
+//       OCTET_FIELD(farVal)      // nearVal and farVal are copied together
+//     OCTET_FIELDS_END()
+//   };
+//
+// Classes that need to run code in visit() still write it by hand.
+//
+
+namespace octet {
+  // how the field list treats each type.
+  // plain old data is anything the visitor would pass to visit_bin.
+  template <class type> struct field_traits {
+    enum { is_pod = 1 };
+    static bool equal(const type &a, const type &b) {
+      return !memcmp(&a, &b, sizeof(type));
+    }
+  };
+
+  template <class type, class allocator_t> struct field_traits<ref<type, allocator_t> > {
+    enum { is_pod = 0 };
+    static bool equal(const ref<type, allocator_t> &a, const ref<type, allocator_t> &b) {
+      return !memcmp(&a, &b, sizeof(a));
+    }
+  };
+
+  template <class type, class allocator_t, bool use_new_delete> struct field_traits<dynarray<type, allocator_t, use_new_delete> > {
+    enum { is_pod = 0 };
+    static bool equal(const dynarray<type, allocator_t, use_new_delete> &a, const dynarray<type, allocator_t, use_new_delete> &b) {
+      return a.size() == b.size() && ( a.size() == 0 || !memcmp(&a[0], &b[0], sizeof(type) * a.size()) );
+    }
+  };
+
+  template <class type, class allocator_t> struct field_traits<dictionary<type, allocator_t> > {
+    enum { is_pod = 0 };
+    static bool equal(const dictionary<type, allocator_t> &ca, const dictionary<type, allocator_t> &cb) {
+      dictionary<type, allocator_t> &a = (dictionary<type, allocator_t> &)ca;
+      dictionary<type, allocator_t> &b = (dictionary<type, allocator_t> &)cb;
+      if (a.get_size() != b.get_size()) return false;
+      for (unsigned i = 0; i != a.get_num_indices(); ++i) {
+        const char *key = a.get_key(i);
+        if (key) {
+          int j = b.get_index(key);
+          if (j < 0 || memcmp(&a.get_value(i), &b.get_value(j), sizeof(type))) return false;
+        }
+      }
+      return true;
+    }
+  };
+
+  template <> struct field_traits<string> {
+    enum { is_pod = 0 };
+    static bool equal(const string &a, const string &b) {
+      return !strcmp(a.c_str(), b.c_str());
+    }
+  };
+
+  // the fields of one class
+  class field_list {
+  public:
+    struct field {
+      atom_t sid;
+      unsigned offset;
+      unsigned size;
+      bool is_pod;
+      void (*visit)(void *value, visitor &v, atom_t sid);
+      bool (*equal)(const void *a, const void *b);
+    };
+
+    // a run is either a block of adjacent plain old data fields or one other field.
+    struct run {
+      unsigned offset;
+      unsigned size;
+      unsigned first_field;
+      unsigned num_fields;
+      bool is_pod;
+    };
+
+  private:
+    dynarray<field> fields;
+    dynarray<run> runs;
+    unsigned layout_hash;
+    bool built;
+
+    template <class type> static void visit_thunk(void *value, visitor &v, atom_t sid) {
+      v.visit(*(type*)value, sid);
+    }
+
+    template <class type> static bool equal_thunk(const void *a, const void *b) {
+      return field_traits<type>::equal(*(const type*)a, *(const type*)b);
+    }
+
+    field_list(const field_list &rhs);
+    void operator=(const field_list &rhs);
+  public:
+    field_list() {
+      layout_hash = 0;
+      built = false;
+    }
+
+    // add a field. Use the OCTET_FIELD macro rather than calling this.
+    template <class class_t, class type> void add(type class_t::*member, atom_t sid) {
+      field f;
+      f.sid = sid;
+      f.offset = (unsigned)((char*)&(((class_t*)16)->*member) - (char*)16);
+      f.size = sizeof(type);
+      f.is_pod = field_traits<type>::is_pod != 0;
+      f.visit = &visit_thunk<type>;
+      f.equal = &equal_thunk<type>;
+      fields.push_back(f);
+    }
+
+    // add the fields of a base class. offset is where the base class starts.
+    void add_base(const field_list &base, unsigned offset) {
+      for (unsigned i = 0; i != base.fields.size(); ++i) {
+        field f = base.fields[i];
+        f.offset += offset;
+        fields.push_back(f);
+      }
+    }
+
+    // merge adjacent plain old data fields into runs.
+    void build() {
+      runs.resize(0);
+      for (unsigned i = 0; i != fields.size(); ++i) {
+        const field &f = fields[i];
+        if (runs.size() && f.is_pod && runs.back().is_pod && runs.back().offset + runs.back().size == f.offset) {
+          runs.back().size += f.size;
+          runs.back().num_fields++;
+        } else {
+          run r = { f.offset, f.size, i, 1, f.is_pod };
+          runs.push_back(r);
+        }
+      }
+
+      // the hash changes if a field is added, moved or resized.
+      dynarray<unsigned> layout;
+      for (unsigned i = 0; i != fields.size(); ++i) {
+        layout.push_back(fields[i].sid);
+        layout.push_back(fields[i].offset);
+        layout.push_back(fields[i].size);
+        layout.push_back(fields[i].is_pod);
+      }
+      layout_hash = layout.size() ? (unsigned)app_utils::hash64(&layout[0], layout.size() * sizeof(unsigned)) : 0;
+      built = true;
+    }
+
+    bool is_built() const {
+      return built;
+    }
+
+    unsigned get_num_fields() const {
+      return fields.size();
+    }
+
+    const field &get_field(unsigned i) const {
+      return fields[i];
+    }
+
+    unsigned get_num_runs() const {
+      return runs.size();
+    }
+
+    const run &get_run(unsigned i) const {
+      return runs[i];
+    }
+
+    // binary files store this to check that the layout has not changed.
+    unsigned get_layout_hash() const {
+      return layout_hash;
+    }
+
+    // visit one field of obj
+    void visit_field(void *obj, unsigned i, visitor &v) const {
+      const field &f = fields[i];
+      f.visit((uint8_t*)obj + f.offset, v, f.sid);
+    }
+
+    // visit all fields of obj. The visitor can take over with visit_fields.
+    void visit(void *obj, visitor &v) const {
+      if (v.visit_fields(obj, *this)) return;
+      for (unsigned i = 0; i != fields.size() && !v.get_error(); ++i) {
+        visit_field(obj, i, v);
+      }
+    }
+
+    // compare two objects of this class. returns the number of fields that differ
+    // and optionally their sids.
+    unsigned diff(const void *a, const void *b, dynarray<atom_t> *changed = 0) const {
+      unsigned num_changed = 0;
+      for (unsigned i = 0; i != runs.size(); ++i) {
+        const run &r = runs[i];
+        const uint8_t *pa = (const uint8_t*)a;
+        const uint8_t *pb = (const uint8_t*)b;
+        if (r.is_pod && !memcmp(pa + r.offset, pb + r.offset, r.size)) continue;
+        for (unsigned j = r.first_field; j != r.first_field + r.num_fields; ++j) {
+          const field &f = fields[j];
+          if (!f.equal(pa + f.offset, pb + f.offset)) {
+            num_changed++;
+            if (changed) changed->push_back(f.sid);
+          }
+        }
+      }
+      return num_changed;
+    }
+  };
+}
+
+// start a field list. This goes in the public part of the class after RESOURCE_META
+#define OCTET_FIELDS_BEGIN(classname) \
+  static const octet::field_list &get_field_list() { \
+    typedef classname class_t; \
+    static octet::field_list fields; \
+    if (!fields.is_built()) {
+
+// include the fields of a base class (do this first)
+#define OCTET_FIELDS_BASE(base) \
+      fields.add_base(base::get_field_list(), (unsigned)((char*)static_cast<base*>((class_t*)16) - (char*)16));
+
+// a field called "member" with the sid atom_member
+#define OCTET_FIELD(member) \
+      fields.add(&class_t::member, atom_##member);
+
+// a field with a different sid
+#define OCTET_FIELD_SID(member, sid) \
+      fields.add(&class_t::member, sid);
+
+// end the field list and generate visit()
+#define OCTET_FIELDS_END() \
+      fields.build(); \
+    } \
+    return fields; \
+  } \
+  void visit(visitor &v) { \
+    get_field_list().visit((void*)this, v); \
+  }
@@ -30,10 +30,10 @@ namespace octet {
     }
 
     // serialize this object.
-    void visit(visitor &v) {
-      v.visit(bytes, atom_bytes);
-      v.visit(target, atom_target);
-    }
+    OCTET_FIELDS_BEGIN(gl_resource)
+      OCTET_FIELD(bytes)
+      OCTET_FIELD(target)
+    OCTET_FIELDS_END()
 
     // 
     void allocate(GLuint target, unsigned size) {
@@ -0,0 +1,253 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// on-disk cache of decoded images
+//
+// Decoding GIFs and JPEGs and building mip chains is most of our startup time.
+// The cache keeps the final pixels of each source image in a file named after
+// a hash of the url and the variant, so an unchanged image is only decoded once.
+// On later runs the entry is memory mapped and used as it is.
+//
+// Entries are invalidated automatically and rebuilt into the same file:
+//   * editing the source image changes the source hash in the header.
+//   * changing a decoder should bump decoder_version, which is in the header.
+//   * entries with a bad header or the wrong size are deleted and rebuilt.
+//
+
+namespace octet {
+  class image_cache {
+    enum {
+      // bump this if the layout of header changes.
+      cache_version = 2,
+
+      // bump this if any decoder or the mip filter produces different pixels.
+      decoder_version = 5,
+    };
+
+    // the cache file starts with this header, followed by the pixels.
+    // the header is 64 bytes to keep the pixels aligned.
+    struct header {
+      uint8_t magic[4];
+      uint32_t cache_version;
+      uint32_t decoder_version;
+      uint32_t variant;
+      uint32_t key_lo;
+      uint32_t key_hi;
+      uint32_t source_lo;
+      uint32_t source_hi;
+      uint32_t source_size;
+      uint32_t payload_size;
+      uint32_t format;
+      uint32_t width;
+      uint32_t height;
+      uint32_t mip_levels;
+      uint32_t cube_faces;
+      uint32_t reserved[1];
+    };
+
+    string dir;
+    bool enabled;
+    bool made_dir;
+
+    // statistics
+    unsigned num_hits;
+    unsigned num_misses;
+    unsigned num_stale;
+    unsigned num_stores;
+    unsigned bytes_mapped;
+
+    void get_entry_path(string &path, uint64_t key) {
+      path.format("%simg_%08x%08x.oct", dir.c_str(), (unsigned)(key >> 32), (unsigned)key);
+    }
+
+    void make_dir() {
+      if (made_dir) return;
+      made_dir = true;
+      app_utils::make_dir(dir);
+    }
+
+  public:
+    // a view of a cached image. pixels point into the mapped file.
+    struct entry {
+      const uint8_t *pixels;
+      unsigned size;
+      uint16_t format;
+      uint16_t width;
+      uint16_t height;
+      uint8_t mip_levels;
+      uint8_t cube_faces;
+    };
+
+    // what happened to the pixels after decoding. part of the key.
+    enum {
+      variant_decoded = 0,
+      variant_mipmapped = 1,
+      variant_compressed = 2,
+      variant_compressed_hq = 3,
+
+      // added to the others if the mips were filtered in linear light.
+      variant_srgb = 0x10,
+
+      // added to the others if DDS files were decompressed in software.
+      variant_software_dxt = 0x20,
+    };
+
+    image_cache() {
+      dir = app_utils::get_path("cache/");
+      enabled = true;
+      made_dir = false;
+      num_hits = num_misses = num_stale = num_stores = bytes_mapped = 0;
+    }
+
+    // the cache used by image and resources
+    static image_cache &get() {
+      static image_cache instance;
+      return instance;
+    }
+
+    // use a different directory for the cache. path should end in '/'
+    void set_directory(const char *path) {
+      dir = path;
+      made_dir = false;
+    }
+
+    void set_enabled(bool value) {
+      enabled = value;
+    }
+
+    bool get_enabled() const {
+      return enabled;
+    }
+
+    // the key identifies the url and the variant, but not the source bytes
+    // or the decoders, so that edits reuse the same entry.
+    static uint64_t get_key(const char *url, unsigned variant) {
+      uint64_t seed = ( variant << 8 ) | cache_version;
+      return app_utils::hash64(url, strlen(url), seed);
+    }
+
+    // the hash of the source bytes, which the entry must match.
+    static uint64_t get_source_hash(const uint8_t *src, unsigned size) {
+      return app_utils::hash64(src, size, 0);
+    }
+
+    // find an image in the cache. On success, result.pixels is valid until file is closed.
+    bool find(mapped_file &file, entry &result, uint64_t key, uint64_t source_hash, unsigned source_size, unsigned variant) {
+      if (!enabled) return false;
+
+      string path;
+      get_entry_path(path, key);
+      if (!file.open(path)) {
+        OCTET_LOG_DEBUG("image_cache: miss %s\n", path.c_str());
+        num_misses++;
+        return false;
+      }
+
+      const header *hdr = (const header *)file.data();
+      bool ok =
+        file.size() >= sizeof(header) &&
+        !memcmp(hdr->magic, "octi", 4) &&
+        hdr->cache_version == cache_version &&
+        hdr->decoder_version == decoder_version &&
+        hdr->variant == variant &&
+        hdr->key_lo == (uint32_t)key &&
+        hdr->key_hi == (uint32_t)(key >> 32) &&
+        hdr->source_lo == (uint32_t)source_hash &&
+        hdr->source_hi == (uint32_t)(source_hash >> 32) &&
+        hdr->source_size == source_size &&
+        hdr->payload_size == file.size() - sizeof(header)
+      ;
+
+      if (!ok) {
+        OCTET_LOG_INFO("image_cache: stale entry %s\n", path.c_str());
+        file.close();
+        remove(path);
+        num_stale++;
+        num_misses++;
+        return false;
+      }
+
+      result.pixels = file.data() + sizeof(header);
+      result.size = hdr->payload_size;
+      result.format = (uint16_t)hdr->format;
+      result.width = (uint16_t)hdr->width;
+      result.height = (uint16_t)hdr->height;
+      result.mip_levels = (uint8_t)hdr->mip_levels;
+      result.cube_faces = (uint8_t)hdr->cube_faces;
+      OCTET_LOG_DEBUG("image_cache: hit %s\n", path.c_str());
+      num_hits++;
+      bytes_mapped += result.size;
+      return true;
+    }
+
+    // add a decoded image to the cache.
+    void store(uint64_t key, uint64_t source_hash, unsigned source_size, unsigned variant, const entry &value) {
+      if (!enabled || !value.size) return;
+
+      make_dir();
+
+      header hdr;
+      memset(&hdr, 0, sizeof(hdr));
+      memcpy(hdr.magic, "octi", 4);
+      hdr.cache_version = cache_version;
+      hdr.decoder_version = decoder_version;
+      hdr.variant = variant;
+      hdr.key_lo = (uint32_t)key;
+      hdr.key_hi = (uint32_t)(key >> 32);
+      hdr.source_lo = (uint32_t)source_hash;
+      hdr.source_hi = (uint32_t)(source_hash >> 32);
+      hdr.source_size = source_size;
+      hdr.payload_size = value.size;
+      hdr.format = value.format;
+      hdr.width = value.width;
+      hdr.height = value.height;
+      hdr.mip_levels = value.mip_levels;
+      hdr.cube_faces = value.cube_faces;
+
+      // write to a temporary file so that a crash does not leave a half written entry.
+      string path;
+      get_entry_path(path, key);
+      string tmp_path;
+      tmp_path.format("%s.tmp", path.c_str());
+
+      FILE *file = fopen(tmp_path, "wb");
+      if (!file) {
+        OCTET_LOG_WARNING("image_cache: could not write %s\n", tmp_path.c_str());
+        return;
+      }
+      bool ok =
+        fwrite(&hdr, 1, sizeof(hdr), file) == sizeof(hdr) &&
+        fwrite(value.pixels, 1, value.size, file) == value.size
+      ;
+      fclose(file);
+
+      remove(path);
+      if (!ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return;
+      }
+      num_stores++;
+    }
+
+    unsigned get_num_hits() const { return num_hits; }
+    unsigned get_num_misses() const { return num_misses; }
+    unsigned get_num_stale() const { return num_stale; }
+
+    // percentage of lookups that were found in the cache
+    float get_hit_rate() const {
+      unsigned total = num_hits + num_misses;
+      return total ? num_hits * 100.0f / total : 0.0f;
+    }
+
+    // write the hit rates to log.txt
+    void log_stats() {
+      OCTET_LOG_INFO(
+        "image_cache: %d hits, %d misses (%d stale), %d stored, %.1f%% hit rate, %d bytes mapped\n",
+        num_hits, num_misses, num_stale, num_stores, get_hit_rate(), bytes_mapped
+      );
+    }
+  };
+}
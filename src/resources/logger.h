@@ -0,0 +1,203 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Asynchronous logger
+//
+// Messages are formatted into a ring buffer and a background thread
+// writes them to log.txt, so logging from a hot loop does not wait for the disk
+// unless the ring buffer fills up.
+// The ring buffer is lock free: writers claim a slot with a compare and swap
+// and the writer thread frees slots in order.
+//
+// Messages below OCTET_LOG_LEVEL are compiled out, including the arguments.
+//
+// example:
+//
+//   OCTET_LOG_DEBUG("vertex %d\n", i);          // gone unless OCTET_LOG_LEVEL is 0
+//   OCTET_LOG_WARNING("missing mesh %s\n", url);
+//
+
+// 0=debug 1=info 2=warning 3=error
+#ifndef OCTET_LOG_LEVEL
+  #define OCTET_LOG_LEVEL 1
+#endif
+
+#define OCTET_LOG(level, ...) ( (int)(level) >= OCTET_LOG_LEVEL ? octet::logger::get().write(level, __VA_ARGS__) : (void)0 )
+#define OCTET_LOG_DEBUG(...) OCTET_LOG(octet::logger::level_debug, __VA_ARGS__)
+#define OCTET_LOG_INFO(...) OCTET_LOG(octet::logger::level_info, __VA_ARGS__)
+#define OCTET_LOG_WARNING(...) OCTET_LOG(octet::logger::level_warning, __VA_ARGS__)
+#define OCTET_LOG_ERROR(...) OCTET_LOG(octet::logger::level_error, __VA_ARGS__)
+
+namespace octet {
+  class logger {
+  public:
+    enum level_t {
+      level_debug,
+      level_info,
+      level_warning,
+      level_error,
+    };
+
+  private:
+    enum {
+      // must be a power of two
+      num_slots = 4096,
+      max_message = 248,
+
+      // how long the writer thread sleeps when there is nothing to do.
+      idle_ms = 5,
+    };
+
+    // one message. sequence tells us who owns the slot:
+    //   sequence == pos                 free for a writer at pos
+    //   sequence == pos + 1             holds a message for the reader
+    struct slot {
+      volatile int sequence;
+      int level;
+      char text[max_message];
+    };
+
+    slot slots[num_slots];
+
+    // next slot for writers (shared) and the reader (writer thread only)
+    volatile int write_pos;
+    int read_pos;
+
+    volatile int running;
+    int min_level;
+
+    FILE *file;
+    mutex file_mutex;
+    thread writer;
+
+    static int format(char *dest, const char *fmt, va_list list) {
+      #ifdef WIN32
+        int len = _vsnprintf(dest, max_message - 1, fmt, list);
+      #else
+        int len = vsnprintf(dest, max_message, fmt, list);
+      #endif
+      dest[max_message-1] = 0;
+      return len;
+    }
+
+    // write everything in the ring buffer to the file. file_mutex must be held.
+    unsigned drain() {
+      unsigned count = 0;
+      for (;;) {
+        slot &s = slots[read_pos & (num_slots-1)];
+        if ((int)((unsigned)atomic::load(s.sequence) - (unsigned)(read_pos + 1)) < 0) break;
+        fputs(s.text, file);
+        atomic::store(s.sequence, read_pos + num_slots);
+        read_pos++;
+        count++;
+      }
+
+      if (count) fflush(file);
+      return count;
+    }
+
+    static void writer_main(void *arg) {
+      logger *log = (logger*)arg;
+      while (atomic::load(log->running)) {
+        log->file_mutex.lock();
+        unsigned count = log->drain();
+        log->file_mutex.unlock();
+        if (!count) thread::sleep(idle_ms);
+      }
+    }
+
+    logger(const logger &rhs);
+    void operator=(const logger &rhs);
+  public:
+    logger() {
+      for (int i = 0; i != num_slots; ++i) {
+        slots[i].sequence = i;
+      }
+      write_pos = 0;
+      read_pos = 0;
+      min_level = OCTET_LOG_LEVEL;
+      file = fopen("log.txt", "w");
+      running = file != NULL;
+      if (running && !writer.start(writer_main, (void*)this)) {
+        // no threads: write messages as they arrive.
+        running = 0;
+      }
+    }
+
+    ~logger() {
+      atomic::store(running, 0);
+      writer.join();
+      if (file) {
+        drain();
+        fclose(file);
+      }
+    }
+
+    // the log used by the OCTET_LOG macros
+    static logger &get() {
+      static logger instance;
+      return instance;
+    }
+
+    // filter messages at runtime as well as at compile time
+    void set_level(level_t level) {
+      min_level = level;
+    }
+
+    // add a message to the log. Use the OCTET_LOG macros rather than calling this.
+    void write(level_t level, const char *fmt, ...) {
+      if ((int)level < min_level || !file) return;
+
+      va_list list;
+      va_start(list, fmt);
+
+      if (!writer.is_started()) {
+        char tmp[max_message];
+        format(tmp, fmt, list);
+        va_end(list);
+        scoped_lock lock(file_mutex);
+        fputs(tmp, file);
+        fflush(file);
+        return;
+      }
+
+      // claim a slot. If the writer thread has fallen behind by a whole
+      // ring buffer, wait for it rather than lose the message.
+      int pos = atomic::load(write_pos);
+      slot *s = 0;
+      for (;;) {
+        s = &slots[pos & (num_slots-1)];
+        int diff = (int)((unsigned)atomic::load(s->sequence) - (unsigned)pos);
+        if (diff == 0) {
+          if (atomic::compare_and_swap(write_pos, pos, pos + 1)) break;
+        } else if (diff < 0) {
+          thread::sleep(0);
+        }
+        pos = atomic::load(write_pos);
+      }
+
+      s->level = level;
+      format(s->text, fmt, list);
+      va_end(list);
+
+      // hand the slot to the writer thread
+      atomic::store(s->sequence, pos + 1);
+    }
+
+    // write all pending messages now. Do this before a crash or an exit.
+    void flush() {
+      if (!file) return;
+      scoped_lock lock(file_mutex);
+      drain();
+    }
+
+    // flush and return the log file for large debug dumps such as mesh::dump
+    FILE *get_file() {
+      flush();
+      return file;
+    }
+  };
+}
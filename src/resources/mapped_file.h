@@ -0,0 +1,122 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// read-only memory mapped file
+//
+// Mapping a file lets the OS page the data in on demand and avoids
+// copying the whole file into a dynarray first.
+//
+// example:
+//
+//   mapped_file file;
+//   if (file.open(app_utils::get_path("assets/duckCM.gif"))) {
+//     printf("%d bytes at %p\n", file.size(), file.data());
+//   }
+//
+
+namespace octet {
+  class mapped_file {
+    const uint8_t *data_;
+    unsigned size_;
+
+    #ifdef WIN32
+      HANDLE file;
+      HANDLE mapping;
+    #elif defined(__APPLE__)
+      int fd;
+    #else
+      // no mmap on this platform, fall back to reading the file.
+      dynarray<uint8_t> buffer;
+    #endif
+
+    // mappings can't be copied.
+    mapped_file(const mapped_file &rhs);
+    void operator=(const mapped_file &rhs);
+
+    void init() {
+      data_ = 0;
+      size_ = 0;
+      #ifdef WIN32
+        file = INVALID_HANDLE_VALUE;
+        mapping = 0;
+      #elif defined(__APPLE__)
+        fd = -1;
+      #endif
+    }
+  public:
+    mapped_file() {
+      init();
+    }
+
+    ~mapped_file() {
+      close();
+    }
+
+    // map a whole file for reading. path is a file path, not a url.
+    bool open(const char *path) {
+      close();
+      #ifdef WIN32
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        size_ = (unsigned)GetFileSize(file, NULL);
+        if (size_ == 0 || size_ == INVALID_FILE_SIZE) { close(); return false; }
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!mapping) { close(); return false; }
+        data_ = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      #elif defined(__APPLE__)
+        fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) { close(); return false; }
+        size_ = (unsigned)st.st_size;
+        void *ptr = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        data_ = ptr == MAP_FAILED ? 0 : (const uint8_t*)ptr;
+      #else
+        FILE *fp = fopen(path, "rb");
+        if (!fp) return false;
+        fseek(fp, 0, SEEK_END);
+        buffer.resize((unsigned)ftell(fp));
+        fseek(fp, 0, SEEK_SET);
+        fread(buffer.data(), 1, buffer.size(), fp);
+        fclose(fp);
+        size_ = buffer.size();
+        data_ = size_ ? &buffer[0] : 0;
+      #endif
+      if (!data_) {
+        close();
+        return false;
+      }
+      return true;
+    }
+
+    // unmap the file. data() is invalid after this.
+    void close() {
+      #ifdef WIN32
+        if (data_) UnmapViewOfFile((LPCVOID)data_);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+      #elif defined(__APPLE__)
+        if (data_) munmap((void*)data_, size_);
+        if (fd >= 0) ::close(fd);
+      #else
+        buffer.reset();
+      #endif
+      init();
+    }
+
+    bool is_open() const {
+      return data_ != 0;
+    }
+
+    const uint8_t *data() const {
+      return data_;
+    }
+
+    unsigned size() const {
+      return size_;
+    }
+  };
+}
@@ -0,0 +1,162 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Edge adjacency for indexed triangles
+//
+// Each side of a triangle is a half edge: half edge t*3+j goes from corner j
+// to corner j+1 of triangle t. Half edges with the same two vertices make one
+// edge. Two half edges going opposite ways are twins, so their triangles are
+// neighbours.
+//
+// The half edges are sorted by their vertices with two counting sorts (one
+// per vertex), so there are no hash tables and the edges come out in the
+// same order every time.
+//
+// example:
+//
+//   mesh_edges edges;
+//   msh->get_edges(edges);
+//   for (unsigned e = 0; e != edges.get_num_edges(); ++e) {
+//     draw_line(edges.get_vertex(e, 0), edges.get_vertex(e, 1));
+//   }
+//
+
+namespace octet {
+  class mesh_edges {
+    // two vertices (smallest first) for each edge
+    dynarray<uint32_t> edge_vertices;
+
+    // number of triangles on each edge: 1 on borders, more than 2 if non-manifold
+    dynarray<uint32_t> edge_triangles;
+
+    // edge of each half edge. ~0 for sides of degenerate triangles
+    dynarray<uint32_t> half_edge_edge;
+
+    // twin of each half edge. ~0 on borders and non-manifold edges
+    dynarray<uint32_t> twins;
+
+    // edges with only one triangle
+    dynarray<uint32_t> border_edges;
+
+    // sort the items by key with a counting sort. items with the same key keep their order.
+    static void counting_sort(dynarray<uint32_t> &dest, const dynarray<uint32_t> &src, const dynarray<uint32_t> &keys, unsigned num_keys) {
+      dynarray<uint32_t> start(num_keys + 1);
+      memset(&start[0], 0, ( num_keys + 1 ) * sizeof(start[0]));
+      for (unsigned i = 0; i != src.size(); ++i) {
+        start[keys[src[i]] + 1]++;
+      }
+      for (unsigned k = 0; k != num_keys; ++k) {
+        start[k + 1] += start[k];
+      }
+      dest.resize(src.size());
+      for (unsigned i = 0; i != src.size(); ++i) {
+        dest[start[keys[src[i]]]++] = src[i];
+      }
+    }
+
+  public:
+    mesh_edges() {
+    }
+
+    // find the edges of triangles. every index must be less than num_vertices.
+    void build(const uint32_t *indices, unsigned num_indices, unsigned num_vertices) {
+      unsigned num_half_edges = num_indices - num_indices % 3;
+      edge_vertices.resize(0);
+      edge_triangles.resize(0);
+      border_edges.resize(0);
+      half_edge_edge.resize(num_half_edges);
+      twins.resize(num_half_edges);
+      if (num_half_edges == 0) return;
+      memset(&half_edge_edge[0], 0xff, num_half_edges * sizeof(half_edge_edge[0]));
+      memset(&twins[0], 0xff, num_half_edges * sizeof(twins[0]));
+
+      // the smaller and larger vertex of each half edge
+      dynarray<uint32_t> lo(num_half_edges);
+      dynarray<uint32_t> hi(num_half_edges);
+      dynarray<uint32_t> order;
+      order.reserve(num_half_edges);
+      for (unsigned h = 0; h != num_half_edges; ++h) {
+        unsigned a = indices[h];
+        unsigned b = indices[h % 3 == 2 ? h - 2 : h + 1];
+        lo[h] = a < b ? a : b;
+        hi[h] = a < b ? b : a;
+        if (a != b) order.push_back(h);
+      }
+
+      // sort by lo, then by hi. the second sort keeps the order of the first.
+      dynarray<uint32_t> by_lo;
+      counting_sort(by_lo, order, lo, num_vertices);
+      counting_sort(order, by_lo, hi, num_vertices);
+
+      // runs of half edges with the same vertices make an edge
+      edge_vertices.reserve(num_half_edges);
+      edge_triangles.reserve(num_half_edges / 2 + 1);
+      for (unsigned i = 0; i != order.size(); ) {
+        unsigned h = order[i];
+        unsigned j = i + 1;
+        while (j != order.size() && lo[order[j]] == lo[h] && hi[order[j]] == hi[h]) ++j;
+
+        unsigned e = edge_triangles.size();
+        edge_vertices.push_back(lo[h]);
+        edge_vertices.push_back(hi[h]);
+        edge_triangles.push_back(j - i);
+        for (unsigned k = i; k != j; ++k) {
+          half_edge_edge[order[k]] = e;
+        }
+
+        if (j - i == 1) {
+          border_edges.push_back(e);
+        } else if (j - i == 2 && indices[h] != indices[order[i + 1]]) {
+          // two triangles that agree on which way is out
+          twins[h] = order[i + 1];
+          twins[order[i + 1]] = h;
+        }
+        i = j;
+      }
+    }
+
+    unsigned get_num_edges() const {
+      return edge_triangles.size();
+    }
+
+    // end is 0 or 1. vertex 0 is the smaller.
+    unsigned get_vertex(unsigned edge, unsigned end) const {
+      return edge_vertices[edge * 2 + end];
+    }
+
+    unsigned get_num_triangles(unsigned edge) const {
+      return edge_triangles[edge];
+    }
+
+    bool is_border(unsigned edge) const {
+      return edge_triangles[edge] == 1;
+    }
+
+    unsigned get_num_border_edges() const {
+      return border_edges.size();
+    }
+
+    unsigned get_border_edge(unsigned index) const {
+      return border_edges[index];
+    }
+
+    // the edge from corner side to corner side+1 of a triangle. ~0 if the corners are the same vertex.
+    unsigned get_edge(unsigned triangle, unsigned side) const {
+      return half_edge_edge[triangle * 3 + side];
+    }
+
+    // the half edge going the other way along the same edge, or ~0
+    unsigned get_twin(unsigned half_edge) const {
+      return twins[half_edge];
+    }
+
+    // the triangle across side side of a triangle, or ~0
+    unsigned get_neighbour(unsigned triangle, unsigned side) const {
+      unsigned twin = twins[triangle * 3 + side];
+      return twin == ~0u ? ~0u : twin / 3;
+    }
+  };
+}
@@ -0,0 +1,305 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// mip chain generation
+//
+// Each level is half the size of the one before (rounding down, but never
+// less than one) until we get to 1x1, as OpenGL expects. The levels are
+// stored one after the other.
+//
+// Even sizes use a 2x2 box filter. Odd sizes use three taps with weights
+// that cover the source pixels exactly, so non power of two images don't drift.
+//
+// Averaging sRGB values directly darkens the smaller levels. With set_srgb(true)
+// we convert the colour channels to linear light, filter and convert back
+// (alpha is always linear). This uses tables, so it is not much slower.
+//
+// The common case (RGBA, even sizes, not sRGB) has an SSE2 version (see OCTET_SSE2)
+// which gives exactly the same results as the C version.
+// Big levels are split into bands of rows which are shared between the cpus.
+//
+// example:
+//
+//   mip_builder mips;
+//   pixels.resize(mip_builder::get_chain_size(width, height, 4));
+//   unsigned levels = mips.build(&pixels[0], width, height, 4);
+//
+namespace octet {
+  class mip_builder {
+    // below this many pixels in a level, threads cost more than they save.
+    enum { min_thread_pixels = 65536 };
+
+    // linear values are looked up in this many steps
+    enum { linear_steps = 4096 };
+
+    bool srgb;
+    unsigned num_threads;
+
+    // sRGB value to linear 0..1
+    float to_linear[256];
+
+    // sRGB value to linear 0..4095 with four bits of fraction
+    uint16_t to_linear_fixed[256];
+
+    // linear 0..1 in 1/4095 steps to sRGB value
+    uint8_t to_srgb[linear_steps];
+
+    struct level_job {
+      const mip_builder *builder;
+      const uint8_t *src;
+      uint8_t *dest;
+      unsigned src_width;
+      unsigned src_height;
+      unsigned width;
+      unsigned height;
+      unsigned num_comps;
+      unsigned band_rows;
+    };
+
+    void build_tables() {
+      for (unsigned i = 0; i != 256; ++i) {
+        float c = i * ( 1.0f / 255 );
+        to_linear[i] = c <= 0.04045f ? c * ( 1.0f / 12.92f ) : powf(( c + 0.055f ) * ( 1.0f / 1.055f ), 2.4f);
+        to_linear_fixed[i] = (uint16_t)( to_linear[i] * ( ( linear_steps - 1 ) * 16 ) + 0.5f );
+      }
+      for (unsigned i = 0; i != linear_steps; ++i) {
+        float l = i * ( 1.0f / ( linear_steps - 1 ) );
+        float c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+        int v = (int)( c * 255 + 0.5f );
+        to_srgb[i] = (uint8_t)( v < 0 ? 0 : v > 255 ? 255 : v );
+      }
+    }
+
+    // the source pixels and weights for a destination pixel.
+    static unsigned get_taps(unsigned *index, float *weight, unsigned x, unsigned size, unsigned src_size) {
+      if (src_size == 1) {
+        index[0] = 0;
+        weight[0] = 1;
+        return 1;
+      } else if (src_size == size * 2) {
+        index[0] = x * 2;
+        index[1] = x * 2 + 1;
+        weight[0] = weight[1] = 0.5f;
+        return 2;
+      } else {
+        // src_size = size * 2 + 1
+        float scale = 1.0f / src_size;
+        index[0] = x * 2;
+        index[1] = x * 2 + 1;
+        index[2] = x * 2 + 2;
+        weight[0] = ( size - x ) * scale;
+        weight[1] = size * scale;
+        weight[2] = ( x + 1 ) * scale;
+        return 3;
+      }
+    }
+
+    // 2x2 box filter for even sizes
+    static OCTET_HOT void box_rows(const level_job &j, unsigned y0, unsigned y1) {
+      unsigned n = j.num_comps;
+      unsigned src_stride = j.src_width * n;
+      for (unsigned y = y0; y != y1; ++y) {
+        const uint8_t *r0 = j.src + y * 2 * src_stride;
+        const uint8_t *r1 = r0 + src_stride;
+        uint8_t *dest = j.dest + y * j.width * n;
+        unsigned x = 0;
+
+        #if OCTET_SSE2
+          if (n == 4) {
+            // eight source pixels make four destination pixels
+            __m128i zero = _mm_setzero_si128();
+            __m128i two = _mm_set1_epi16(2);
+            for (; x + 4 <= j.width; x += 4) {
+              __m128i a0 = _mm_loadu_si128((const __m128i*)(r0 + x * 8));
+              __m128i a1 = _mm_loadu_si128((const __m128i*)(r0 + x * 8 + 16));
+              __m128i b0 = _mm_loadu_si128((const __m128i*)(r1 + x * 8));
+              __m128i b1 = _mm_loadu_si128((const __m128i*)(r1 + x * 8 + 16));
+
+              // add the rows: two pixels of four 16 bit channels in each
+              __m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+              __m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+              __m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+              __m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+              // add neighbouring pixels
+              __m128i h0 = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+              __m128i h1 = _mm_add_epi16(_mm_unpacklo_epi64(s2, s3), _mm_unpackhi_epi64(s2, s3));
+              h0 = _mm_srli_epi16(_mm_add_epi16(h0, two), 2);
+              h1 = _mm_srli_epi16(_mm_add_epi16(h1, two), 2);
+              _mm_storeu_si128((__m128i*)(dest + x * 4), _mm_packus_epi16(h0, h1));
+            }
+          }
+        #endif
+
+        for (; x != j.width; ++x) {
+          const uint8_t *p0 = r0 + x * 2 * n;
+          const uint8_t *p1 = r1 + x * 2 * n;
+          for (unsigned c = 0; c != n; ++c) {
+            dest[x * n + c] = (uint8_t)( ( p0[c] + p0[c + n] + p1[c] + p1[c + n] + 2 ) >> 2 );
+          }
+        }
+      }
+    }
+
+    // 2x2 box filter for even sizes in linear light
+    OCTET_HOT void srgb_box_rows(const level_job &j, unsigned y0, unsigned y1) const {
+      unsigned n = j.num_comps;
+      unsigned num_colors = n == 4 ? 3 : n;
+      unsigned src_stride = j.src_width * n;
+      for (unsigned y = y0; y != y1; ++y) {
+        const uint8_t *r0 = j.src + y * 2 * src_stride;
+        const uint8_t *r1 = r0 + src_stride;
+        uint8_t *dest = j.dest + y * j.width * n;
+        for (unsigned x = 0; x != j.width; ++x) {
+          const uint8_t *p0 = r0 + x * 2 * n;
+          const uint8_t *p1 = r1 + x * 2 * n;
+          unsigned c = 0;
+          for (; c != num_colors; ++c) {
+            // four values of up to 4095 * 16 make an index of up to 4095
+            unsigned sum = to_linear_fixed[p0[c]] + to_linear_fixed[p0[c + n]] + to_linear_fixed[p1[c]] + to_linear_fixed[p1[c + n]];
+            dest[x * n + c] = to_srgb[( sum + 32 ) >> 6];
+          }
+          for (; c != n; ++c) {
+            dest[x * n + c] = (uint8_t)( ( p0[c] + p0[c + n] + p1[c] + p1[c + n] + 2 ) >> 2 );
+          }
+        }
+      }
+    }
+
+    // any size, and sRGB
+    OCTET_HOT void filter_rows(const level_job &j, unsigned y0, unsigned y1) const {
+      unsigned n = j.num_comps;
+      unsigned src_stride = j.src_width * n;
+      // alpha is not gamma corrected
+      unsigned num_colors = srgb ? ( n == 4 ? 3 : n ) : 0;
+
+      for (unsigned y = y0; y != y1; ++y) {
+        unsigned ty[3];
+        float wy[3];
+        unsigned num_ty = get_taps(ty, wy, y, j.height, j.src_height);
+        uint8_t *dest = j.dest + y * j.width * n;
+
+        for (unsigned x = 0; x != j.width; ++x) {
+          unsigned tx[3];
+          float wx[3];
+          unsigned num_tx = get_taps(tx, wx, x, j.width, j.src_width);
+
+          for (unsigned c = 0; c != n; ++c) {
+            float acc = 0;
+            for (unsigned v = 0; v != num_ty; ++v) {
+              const uint8_t *row = j.src + ty[v] * src_stride + c;
+              float row_acc = 0;
+              for (unsigned u = 0; u != num_tx; ++u) {
+                uint8_t value = row[tx[u] * n];
+                row_acc += ( c < num_colors ? to_linear[value] : value ) * wx[u];
+              }
+              acc += row_acc * wy[v];
+            }
+            if (c < num_colors) {
+              dest[x * n + c] = to_srgb[(int)( acc * ( linear_steps - 1 ) + 0.5f )];
+            } else {
+              dest[x * n + c] = (uint8_t)( acc + 0.5f );
+            }
+          }
+        }
+      }
+    }
+
+    static void band_task(void *arg, unsigned index) {
+      level_job &j = *(level_job*)arg;
+      unsigned y0 = index * j.band_rows;
+      unsigned y1 = y0 + j.band_rows < j.height ? y0 + j.band_rows : j.height;
+      bool even = j.src_width == j.width * 2 && j.src_height == j.height * 2;
+      if (even && !j.builder->srgb) {
+        box_rows(j, y0, y1);
+      } else if (even) {
+        j.builder->srgb_box_rows(j, y0, y1);
+      } else {
+        j.builder->filter_rows(j, y0, y1);
+      }
+    }
+
+    mip_builder(const mip_builder &rhs);
+    void operator=(const mip_builder &rhs);
+  public:
+    mip_builder() {
+      srgb = false;
+      num_threads = 0;
+      build_tables();
+    }
+
+    // filter the colour channels in linear light
+    void set_srgb(bool value) {
+      srgb = value;
+    }
+
+    // threads to use for big images. 0 is one per cpu and 1 never starts threads.
+    void set_num_threads(unsigned value) {
+      num_threads = value;
+    }
+
+    // the size of the next level down
+    static unsigned get_next_size(unsigned size) {
+      return size > 1 ? size >> 1 : 1;
+    }
+
+    // the number of levels down to 1x1, including the first one.
+    static unsigned get_num_levels(unsigned width, unsigned height) {
+      unsigned levels = 1;
+      while (width > 1 || height > 1) {
+        width = get_next_size(width);
+        height = get_next_size(height);
+        levels++;
+      }
+      return levels;
+    }
+
+    // bytes in a whole chain
+    static unsigned get_chain_size(unsigned width, unsigned height, unsigned num_comps) {
+      unsigned size = width * height * num_comps;
+      while (width > 1 || height > 1) {
+        width = get_next_size(width);
+        height = get_next_size(height);
+        size += width * height * num_comps;
+      }
+      return size;
+    }
+
+    // pixels has the first level and room for get_chain_size() bytes.
+    // makes the rest of the levels and returns the number of levels.
+    unsigned build(uint8_t *pixels, unsigned width, unsigned height, unsigned num_comps) {
+      if (!width || !height) return 0;
+
+      unsigned threads = num_threads ? num_threads : thread::get_num_cpus();
+      unsigned levels = 1;
+      uint8_t *src = pixels;
+      while (width > 1 || height > 1) {
+        level_job j;
+        j.builder = this;
+        j.src = src;
+        j.dest = src + width * height * num_comps;
+        j.src_width = width;
+        j.src_height = height;
+        j.width = get_next_size(width);
+        j.height = get_next_size(height);
+        j.num_comps = num_comps;
+
+        // about four bands per thread so that uneven bands balance out.
+        unsigned level_threads = j.width * j.height >= min_thread_pixels ? threads : 1;
+        j.band_rows = ( j.height + level_threads * 4 - 1 ) / ( level_threads * 4 );
+        if (j.band_rows < 8) j.band_rows = 8;
+        unsigned num_bands = ( j.height + j.band_rows - 1 ) / j.band_rows;
+        parallel_for::run(num_bands, band_task, (void*)&j, level_threads);
+
+        src = j.dest;
+        width = j.width;
+        height = j.height;
+        levels++;
+      }
+      return levels;
+    }
+  };
+}
@@ -31,6 +31,15 @@ namespace octet {
       ref_count = 0;
     }
 
+    // copies (eg. in mesh modifiers) start with no lives of their own.
+    resource(const resource &rhs) {
+      ref_count = 0;
+    }
+
+    resource &operator=(const resource &rhs) {
+      return *this;
+    }
+
     // factory for making new resources of various kinds
     static resource *new_type(atom_t type);
 
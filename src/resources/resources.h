@@ -125,6 +125,19 @@ namespace octet {
     #include "classes.h"
     #undef OCTET_CLASS
 
+    // add all the resources of another dictionary and take its active scene.
+    // resources with the same name are replaced.
+    void merge(resources &rhs) {
+      unsigned num_indices = rhs.dict.get_num_indices();
+      for (unsigned i = 0; i != num_indices; ++i) {
+        const char *key = rhs.dict.get_key(i);
+        if (key) {
+          dict[key] = rhs.dict.get_value(i);
+        }
+      }
+      if (rhs.active_scene) active_scene = rhs.active_scene;
+    }
+
     // find all resources of a certain type
     void find_all(dynarray<resource*> &result, atom_t type) {
       unsigned num_indices = dict.get_num_indices();
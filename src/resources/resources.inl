@@ -15,9 +15,32 @@ namespace octet {
     } else if (url[0] == '#') {
       return app_utils::get_solid_texture(gl_kind, url+1);
     } else {
+      // pre-baked KTX textures are uploaded straight from the mapped file.
+      unsigned url_len = (unsigned)strlen(url);
+      if (url_len >= 4 && !strcmp(url + url_len - 4, ".ktx")) {
+        mapped_file file;
+        ktx_decoder ktx;
+        if (file.open(app_utils::get_path(url)) && ktx.parse(file.data(), file.data() + file.size())) {
+          return app_utils::make_texture(ktx);
+        }
+      }
+
       dynarray<uint8_t> buffer;
       dynarray<uint8_t> image;
       app_utils::get_url(buffer, url);
+      if (buffer.size() == 0) return 0;
+
+      // upload straight from the mapped cache file if we have decoded this before.
+      image_cache &cache = image_cache::get();
+      unsigned variant = image_cache::variant_decoded;
+      uint64_t key = image_cache::get_key(url, variant);
+      uint64_t source_hash = image_cache::get_source_hash(&buffer[0], buffer.size());
+      mapped_file cached;
+      image_cache::entry e;
+      if (cache.find(cached, e, key, source_hash, buffer.size(), variant)) {
+        return app_utils::make_texture(e.format, (uint8_t*)e.pixels, e.size, e.format, e.width, e.height);
+      }
+
       uint16_t format = 0;
       uint16_t width = 0;
       uint16_t height = 0;
@@ -29,7 +52,7 @@ namespace octet {
       } else if (buffer.size() >= 6 && buffer[0] == 0xff && buffer[1] == 0xd8) {
         jpeg_decoder dec;
         dec.get_image(image, format, width, height, src, src_max);
-      } else if (buffer.size() >= 6 && buffer[0] == 0 && buffer[1] == 0 && buffer[2] == 2) {
+      } else if (tga_decoder::is_tga(&buffer[0], buffer.size())) {
         tga_decoder dec;
         dec.get_image(image, format, width, height, src, src_max);
       } else {
@@ -38,6 +61,14 @@ namespace octet {
       }
 
       if (width > 0 && height > 0 && format) {
+        e.pixels = &image[0];
+        e.size = image.size();
+        e.format = format;
+        e.width = width;
+        e.height = height;
+        e.mip_levels = 1;
+        e.cube_faces = 1;
+        cache.store(key, source_hash, buffer.size(), variant, e);
         return app_utils::make_texture(format, &image[0], image.size(), format, width, height);
       } else
       {
@@ -0,0 +1,350 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// on-disk cache of compiled scenes
+//
+// Building the resources of a big COLLADA file takes a while. The cache saves
+// the finished resources with binary_writer the first time a file is loaded and
+// reads them back with binary_reader on later runs.
+//
+// Entries are named after a hash of the source path and the versions below, so
+// each source file has one entry. The header keeps the size and modification
+// time of the source: an edited source file is rebuilt into the same entry.
+// Entries with a bad header, a bad checksum or a class layout that has changed
+// are deleted and rebuilt.
+//
+// Atoms added while running (node sids and so on) are saved in order with the
+// resources. A run that has made different atoms by the time it loads the scene
+// can't use the entry and rebuilds it.
+//
+// example:
+//
+//   if (!scene_cache::get().load(dict, url)) {
+//     collada_builder builder;
+//     builder.load_xml(url);
+//     builder.get_resources(dict);
+//     ...
+//     scene_cache::get().store(dict, url);
+//   }
+//
+
+namespace octet {
+  class scene_cache {
+    enum {
+      // bump this if the layout of header changes.
+      cache_version = 1,
+
+      // bump this if collada_builder makes different resources.
+      builder_version = 1,
+    };
+
+    // the cache file starts with this header, then the names of the atoms
+    // and then the binary_writer stream.
+    struct header {
+      uint8_t magic[4];
+      uint32_t cache_version;
+      uint32_t builder_version;
+      uint32_t key_lo;
+      uint32_t key_hi;
+      uint32_t source_size;
+      uint32_t source_time_lo;
+      uint32_t source_time_hi;
+      uint32_t first_atom;
+      uint32_t num_atoms;
+      uint32_t atoms_size;
+      uint32_t payload_size;
+      uint32_t check_lo;
+      uint32_t check_hi;
+      uint32_t reserved[2];
+    };
+
+    string dir;
+    bool enabled;
+    bool made_dir;
+
+    // statistics
+    unsigned num_hits;
+    unsigned num_misses;
+    unsigned num_stale;
+    unsigned num_stores;
+
+    void get_entry_path(string &path, uint64_t key) {
+      path.format("%sscene_%08x%08x.oct", dir.c_str(), (unsigned)(key >> 32), (unsigned)key);
+    }
+
+    void make_dir() {
+      if (made_dir) return;
+      made_dir = true;
+      app_utils::make_dir(dir);
+    }
+
+    // the modification time and size of a file. false if it isn't there.
+    static bool get_source_info(const char *path, uint64_t &time, unsigned &size) {
+      #ifdef WIN32
+        WIN32_FILE_ATTRIBUTE_DATA data;
+        if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data)) return false;
+        time = ( (uint64_t)data.ftLastWriteTime.dwHighDateTime << 32 ) | data.ftLastWriteTime.dwLowDateTime;
+        size = (unsigned)data.nFileSizeLow;
+        return true;
+      #elif defined(__APPLE__)
+        struct stat st;
+        if (stat(path, &st) != 0) return false;
+        time = (uint64_t)st.st_mtime;
+        size = (unsigned)st.st_size;
+        return true;
+      #else
+        // no file times here: use the size only.
+        FILE *file = fopen(path, "rb");
+        if (!file) return false;
+        fseek(file, 0, SEEK_END);
+        time = 0;
+        size = (unsigned)ftell(file);
+        fclose(file);
+        return true;
+      #endif
+    }
+
+    // the key identifies the source file and the versions, but not the
+    // source's time and size, so that edits reuse the same entry.
+    static uint64_t get_key(const char *path) {
+      uint64_t seed = ( (uint64_t)builder_version << 32 ) | cache_version;
+      return app_utils::hash64(path, strlen(path), seed);
+    }
+
+    // the atoms in the entry must be the atoms we have, or get the same numbers when we add them.
+    static bool check_atoms(const header *hdr, const char *names) {
+      atom_table &atoms = atom_table::get();
+      if (hdr->first_atom != (unsigned)atoms.get_num_predefined()) return false;
+      const char *src = names, *src_max = names + hdr->atoms_size;
+      for (unsigned i = 0; i != hdr->num_atoms; ++i) {
+        const char *end = (const char*)memchr(src, 0, src_max - src);
+        if (!end || atoms.get_atom(src) != (atom_t)( hdr->first_atom + i )) return false;
+        src = end + 1;
+      }
+      return true;
+    }
+
+    void discard(string &path, const char *why) {
+      OCTET_LOG_INFO("scene_cache: %s, rebuilding %s\n", why, path.c_str());
+      remove(path);
+      num_stale++;
+      num_misses++;
+    }
+
+  public:
+    scene_cache() {
+      dir = app_utils::get_path("cache/");
+      enabled = true;
+      made_dir = false;
+      num_hits = num_misses = num_stale = num_stores = 0;
+    }
+
+    // the cache used by the examples
+    static scene_cache &get() {
+      static scene_cache instance;
+      return instance;
+    }
+
+    // use a different directory for the cache. path should end in '/'
+    void set_directory(const char *path) {
+      dir = path;
+      made_dir = false;
+    }
+
+    void set_enabled(bool value) {
+      enabled = value;
+    }
+
+    bool get_enabled() const {
+      return enabled;
+    }
+
+    // read the resources of a source file from the cache. returns false if you need to build them.
+    bool load(resources &dict, const char *url) {
+      if (!enabled) return false;
+
+      string source_path = app_utils::get_path(url);
+      uint64_t time;
+      unsigned size;
+      if (!get_source_info(source_path, time, size)) return false;
+
+      uint64_t key = get_key(source_path);
+      string path;
+      get_entry_path(path, key);
+
+      // check the header and the checksum before we believe anything in the file.
+      {
+        mapped_file file;
+        if (!file.open(path)) {
+          OCTET_LOG_DEBUG("scene_cache: miss %s\n", path.c_str());
+          num_misses++;
+          return false;
+        }
+
+        const header *hdr = (const header *)file.data();
+        const uint8_t *payload = file.data() + sizeof(header);
+        bool ok =
+          file.size() >= sizeof(header) &&
+          !memcmp(hdr->magic, "octs", 4) &&
+          hdr->cache_version == cache_version &&
+          hdr->builder_version == builder_version &&
+          hdr->key_lo == (uint32_t)key &&
+          hdr->key_hi == (uint32_t)(key >> 32) &&
+          hdr->payload_size == file.size() - sizeof(header) &&
+          hdr->atoms_size <= hdr->payload_size
+        ;
+
+        if (ok) {
+          uint64_t check = app_utils::hash64(payload, hdr->payload_size, key);
+          ok = hdr->check_lo == (uint32_t)check && hdr->check_hi == (uint32_t)(check >> 32);
+        }
+
+        if (!ok) {
+          file.close();
+          discard(path, "bad entry");
+          return false;
+        }
+
+        if (
+          hdr->source_size != size ||
+          hdr->source_time_lo != (uint32_t)time ||
+          hdr->source_time_hi != (uint32_t)(time >> 32)
+        ) {
+          file.close();
+          discard(path, "source has changed");
+          return false;
+        }
+
+        if (!check_atoms(hdr, (const char*)payload)) {
+          file.close();
+          discard(path, "atoms have changed");
+          return false;
+        }
+      }
+
+      // binary_reader reads from a FILE
+      FILE *file = fopen(path, "rb");
+      if (!file) {
+        num_misses++;
+        return false;
+      }
+      // read into a dictionary of our own, so a bad entry leaves dict as it was.
+      resources loaded;
+      header hdr;
+      bool ok = fread(&hdr, 1, sizeof(hdr), file) == sizeof(hdr) && !fseek(file, sizeof(hdr) + hdr.atoms_size, SEEK_SET);
+      if (ok) {
+        binary_reader r(file);
+        loaded.visit(r);
+        ok = !r.get_error() && loaded.get_active_scene();
+      }
+      fclose(file);
+
+      if (!ok) {
+        // probably a class has changed. throw away what we read.
+        discard(path, "could not read entry");
+        return false;
+      }
+
+      dict.merge(loaded);
+
+      OCTET_LOG_DEBUG("scene_cache: hit %s\n", path.c_str());
+      num_hits++;
+      return true;
+    }
+
+    // save the resources built from a source file. the active scene should be set.
+    void store(resources &dict, const char *url) {
+      if (!enabled) return;
+
+      string source_path = app_utils::get_path(url);
+      uint64_t time;
+      unsigned size;
+      if (!get_source_info(source_path, time, size)) return;
+
+      make_dir();
+
+      uint64_t key = get_key(source_path);
+      string path;
+      get_entry_path(path, key);
+      string tmp_path;
+      tmp_path.format("%s.tmp", path.c_str());
+
+      header hdr;
+      memset(&hdr, 0, sizeof(hdr));
+      memcpy(hdr.magic, "octs", 4);
+      hdr.cache_version = cache_version;
+      hdr.builder_version = builder_version;
+      hdr.key_lo = (uint32_t)key;
+      hdr.key_hi = (uint32_t)(key >> 32);
+      hdr.source_size = size;
+      hdr.source_time_lo = (uint32_t)time;
+      hdr.source_time_hi = (uint32_t)(time >> 32);
+
+      // write to a temporary file so that a crash does not leave a half written entry.
+      FILE *file = fopen(tmp_path, "wb");
+      if (!file) {
+        OCTET_LOG_WARNING("scene_cache: could not write %s\n", tmp_path.c_str());
+        return;
+      }
+
+      // the header is written again when we know the sizes.
+      fwrite(&hdr, 1, sizeof(hdr), file);
+
+      atom_table &atoms = atom_table::get();
+      hdr.first_atom = (uint32_t)atoms.get_num_predefined();
+      hdr.num_atoms = (uint32_t)atoms.get_num_atoms() - hdr.first_atom;
+      for (unsigned i = 0; i != hdr.num_atoms; ++i) {
+        const char *name = atoms.get_name((atom_t)( hdr.first_atom + i ));
+        unsigned bytes = (unsigned)strlen(name) + 1;
+        fwrite(name, 1, bytes, file);
+        hdr.atoms_size += bytes;
+      }
+
+      {
+        binary_writer w(file);
+        dict.visit(w);
+      }
+      hdr.payload_size = (uint32_t)ftell(file) - sizeof(hdr);
+      bool ok = !ferror(file);
+      fclose(file);
+
+      if (ok) {
+        mapped_file written;
+        ok = written.open(tmp_path) && written.size() == sizeof(hdr) + hdr.payload_size;
+        if (ok) {
+          uint64_t check = app_utils::hash64(written.data() + sizeof(hdr), hdr.payload_size, key);
+          hdr.check_lo = (uint32_t)check;
+          hdr.check_hi = (uint32_t)(check >> 32);
+        }
+      }
+
+      if (ok) {
+        file = fopen(tmp_path, "r+b");
+        ok = file && fwrite(&hdr, 1, sizeof(hdr), file) == sizeof(hdr);
+        if (file) fclose(file);
+      }
+
+      remove(path);
+      if (!ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return;
+      }
+      num_stores++;
+    }
+
+    unsigned get_num_hits() const { return num_hits; }
+    unsigned get_num_misses() const { return num_misses; }
+    unsigned get_num_stale() const { return num_stale; }
+
+    // write the hit rates to log.txt
+    void log_stats() {
+      OCTET_LOG_INFO(
+        "scene_cache: %d hits, %d misses (%d stale), %d stored\n",
+        num_hits, num_misses, num_stale, num_stores
+      );
+    }
+  };
+}
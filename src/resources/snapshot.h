@@ -0,0 +1,262 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// in-memory snapshots of live scenes
+//
+// A snapshot copies the plain old data fields (matrices, animation times,
+// camera settings...) of every object reachable from a root resource.
+// Snapshots can be restored, and the difference between two snapshots
+// can be stored as a small delta and applied later.
+//
+// Finding the objects walks the graph with a visitor, so we do it once in
+// snapshot_layout. Taking a snapshot is then just a memcpy per run of fields.
+// Refs, arrays and strings are not copied: if the shape of the scene changes,
+// make a new layout.
+//
+// example:
+//
+//   snapshot_layout layout(app_scene);
+//   snapshot before(layout), after(layout);
+//   before.capture();
+//   ... simulate a frame ...
+//   after.capture();
+//   dynarray<uint8_t> delta;
+//   snapshot::diff(before, after, delta);   // just the nodes that moved
+//   before.restore();                         // roll back
+//
+
+namespace octet {
+  // the objects in a scene and where their fields go in a snapshot
+  class snapshot_layout {
+    struct object {
+      void *ptr;
+      const field_list *fields;
+      unsigned offset;
+    };
+
+    dynarray<object> objects;
+    unsigned size;
+    unsigned layout_hash;
+
+    // walks the graph and records every object with a field list.
+    class collector : public visitor {
+      hash_map<void *, int> seen;
+      dynarray<object> &objects;
+
+      bool is_new(void *ref) {
+        if (!ref) return false;
+        int &id = seen[ref];
+        if (id) return false;
+        id = 1;
+        return true;
+      }
+    public:
+      collector(dynarray<object> &objects_, void *root) : objects(objects_) {
+        // children point back at their parents, so don't visit the root twice.
+        seen[root] = 1;
+      }
+
+      bool begin_ref(void *ref, atom_t sid, atom_t type) { return is_new(ref); }
+      bool begin_ref(void *ref, int index, atom_t type) { return is_new(ref); }
+      bool begin_ref(void *ref, const char *sid, atom_t type) { return is_new(ref); }
+      void end_ref() {}
+      bool begin_refs(atom_t sid, int &size, bool is_dict) { return true; }
+      void end_refs(bool is_dict) {}
+      void visit_bin(void *value, size_t size, atom_t sid, atom_t type) {}
+
+      // note the object and carry on visiting its fields to find more objects.
+      bool visit_fields(void *obj, const field_list &fields) {
+        object o = { obj, &fields, 0 };
+        objects.push_back(o);
+        return false;
+      }
+    };
+
+    snapshot_layout(const snapshot_layout &rhs);
+    void operator=(const snapshot_layout &rhs);
+  public:
+    snapshot_layout(resource *root = 0) {
+      size = 0;
+      layout_hash = 0;
+      if (root) init(root);
+    }
+
+    // find all the objects reachable from root.
+    void init(resource *root) {
+      objects.resize(0);
+      collector c(objects, (void*)root);
+      root->visit(c);
+
+      size = 0;
+      dynarray<unsigned> hashes;
+      for (unsigned i = 0; i != objects.size(); ++i) {
+        object &o = objects[i];
+        o.offset = size;
+        for (unsigned j = 0; j != o.fields->get_num_runs(); ++j) {
+          const field_list::run &r = o.fields->get_run(j);
+          if (r.is_pod) size += r.size;
+        }
+        hashes.push_back(o.fields->get_layout_hash());
+      }
+      layout_hash = hashes.size() ? (unsigned)app_utils::hash64(&hashes[0], hashes.size() * sizeof(unsigned)) : 0;
+      OCTET_LOG_DEBUG("snapshot_layout: %d objects %d bytes\n", objects.size(), size);
+    }
+
+    unsigned get_num_objects() const { return objects.size(); }
+    unsigned get_size() const { return size; }
+    unsigned get_layout_hash() const { return layout_hash; }
+
+    void *get_object(unsigned i) const { return objects[i].ptr; }
+    const field_list &get_fields(unsigned i) const { return *objects[i].fields; }
+    unsigned get_offset(unsigned i) const { return objects[i].offset; }
+  };
+
+  // the state of a scene at one moment
+  class snapshot {
+    const snapshot_layout *layout;
+    dynarray<uint8_t> bytes;
+
+    struct delta_header {
+      char magic[4];
+      unsigned layout_hash;
+      unsigned num_records;
+    };
+
+    // each record in a delta is followed by the field's bytes.
+    struct delta_record {
+      unsigned object;
+      uint16_t field;
+      uint16_t size;
+    };
+
+    // copy between the live objects and the snapshot
+    void copy(bool to_objects) {
+      uint8_t *dest = bytes.size() ? &bytes[0] : 0;
+      for (unsigned i = 0; i != layout->get_num_objects(); ++i) {
+        uint8_t *obj = (uint8_t*)layout->get_object(i);
+        const field_list &fields = layout->get_fields(i);
+        for (unsigned j = 0; j != fields.get_num_runs(); ++j) {
+          const field_list::run &r = fields.get_run(j);
+          if (r.is_pod) {
+            if (to_objects) {
+              memcpy(obj + r.offset, dest, r.size);
+            } else {
+              memcpy(dest, obj + r.offset, r.size);
+            }
+            dest += r.size;
+          }
+        }
+      }
+    }
+
+  public:
+    snapshot(const snapshot_layout &layout_) {
+      layout = &layout_;
+    }
+
+    // copy the state of the scene into the snapshot.
+    void capture() {
+      bytes.resize(layout->get_size());
+      copy(false);
+    }
+
+    // put the scene back as it was when we called capture().
+    void restore() {
+      if (bytes.size() != layout->get_size()) return;
+      copy(true);
+    }
+
+    const snapshot_layout &get_layout() const {
+      return *layout;
+    }
+
+    unsigned get_size() const {
+      return bytes.size();
+    }
+
+    // make a delta that turns from into to. Only changed fields are stored.
+    // returns false (and an empty delta) if the snapshots do not share a layout or were not captured.
+    static bool diff(const snapshot &from, const snapshot &to, dynarray<uint8_t> &delta) {
+      const snapshot_layout &layout = *from.layout;
+      if (&layout != to.layout || from.bytes.size() != layout.get_size() || to.bytes.size() != layout.get_size()) {
+        OCTET_LOG_WARNING("snapshot: cannot diff snapshots with different layouts or no capture\n");
+        delta.resize(0);
+        return false;
+      }
+
+      delta.resize(sizeof(delta_header));
+      unsigned num_records = 0;
+      unsigned pos = 0;
+      for (unsigned i = 0; i != layout.get_num_objects(); ++i) {
+        const field_list &fields = layout.get_fields(i);
+        for (unsigned j = 0; j != fields.get_num_runs(); ++j) {
+          const field_list::run &r = fields.get_run(j);
+          if (!r.is_pod) continue;
+
+          const uint8_t *a = &from.bytes[pos];
+          const uint8_t *b = &to.bytes[pos];
+          pos += r.size;
+          if (!memcmp(a, b, r.size)) continue;
+
+          for (unsigned k = r.first_field; k != r.first_field + r.num_fields; ++k) {
+            const field_list::field &f = fields.get_field(k);
+            unsigned offset = f.offset - r.offset;
+            if (!memcmp(a + offset, b + offset, f.size)) continue;
+
+            delta_record rec = { i, (uint16_t)k, (uint16_t)f.size };
+            unsigned old_size = delta.size();
+            delta.resize(old_size + sizeof(rec) + f.size);
+            memcpy(&delta[old_size], &rec, sizeof(rec));
+            memcpy(&delta[old_size + sizeof(rec)], b + offset, f.size);
+            num_records++;
+          }
+        }
+      }
+
+      delta_header hdr = { { 'o', 'c', 't', 'd' }, layout.get_layout_hash(), num_records };
+      memcpy(&delta[0], &hdr, sizeof(hdr));
+      return true;
+    }
+
+    // apply a delta made by diff to this snapshot. returns false if it does not fit.
+    bool apply(const dynarray<uint8_t> &delta) {
+      if (delta.size() < sizeof(delta_header) || bytes.size() != layout->get_size()) return false;
+
+      delta_header hdr;
+      memcpy(&hdr, &delta[0], sizeof(hdr));
+      if (memcmp(hdr.magic, "octd", 4) || hdr.layout_hash != layout->get_layout_hash()) {
+        OCTET_LOG_WARNING("snapshot: delta does not match this layout\n");
+        return false;
+      }
+
+      unsigned pos = sizeof(hdr);
+      for (unsigned n = 0; n != hdr.num_records; ++n) {
+        delta_record rec;
+        if (pos + sizeof(rec) > delta.size()) return false;
+        memcpy(&rec, &delta[pos], sizeof(rec));
+        pos += sizeof(rec);
+        if (rec.object >= layout->get_num_objects() || pos + rec.size > delta.size()) return false;
+
+        // find where the field lives in the snapshot
+        const field_list &fields = layout->get_fields(rec.object);
+        unsigned dest = layout->get_offset(rec.object);
+        for (unsigned j = 0; j != fields.get_num_runs(); ++j) {
+          const field_list::run &r = fields.get_run(j);
+          if (!r.is_pod) continue;
+          if (rec.field >= r.first_field && rec.field < r.first_field + r.num_fields) {
+            const field_list::field &f = fields.get_field(rec.field);
+            if (f.size != rec.size) return false;
+            memcpy(&bytes[dest + f.offset - r.offset], &delta[pos], rec.size);
+            break;
+          }
+          dest += r.size;
+        }
+        pos += rec.size;
+      }
+      return true;
+    }
+  };
+}
@@ -11,6 +11,7 @@
 
 namespace octet {
   class visitor;
+  class field_list;
 
   class visitable {
   public:
@@ -20,18 +21,17 @@ namespace octet {
   };
 
   class visitor {
-    enum { debug = true };
     unsigned depth;
     bool error;
 
     void begin_visit(atom_t type) {
-      if (debug) app_utils::log("%*svisit %s\n", get_depth()*2, "", app_utils::get_atom_name(type));
+      OCTET_LOG_DEBUG("%*svisit %s\n", get_depth()*2, "", app_utils::get_atom_name(type));
       depth++;
     }
 
     void end_visit(atom_t type) {
       depth--;
-      if (debug) app_utils::log("%*svisit %s\n", get_depth()*2, "", app_utils::get_atom_name(type));
+      OCTET_LOG_DEBUG("%*svisit %s\n", get_depth()*2, "", app_utils::get_atom_name(type));
     }
   public:
     // implementation
@@ -83,6 +83,9 @@ namespace octet {
     virtual bool begin_agg(void *ref, atom_t sid, atom_t type) { return true; }
     virtual void end_agg() {}
 
+    // classes with a field list call this first. return true to handle all the fields at once.
+    virtual bool visit_fields(void *obj, const field_list &fields) { return false; }
+
     void visit(int8_t &value, atom_t sid) {
       visit_bin(&value, sizeof(value), sid, atom_int8);
     }
@@ -133,7 +136,7 @@ namespace octet {
           if (!ref && type_name != atom_) {
             type *val = (type*)type::new_type(type_name);
             if (!val) {
-              app_utils::log("unable to make type %s\n", app_utils::get_atom_name(type_name));
+              OCTET_LOG_ERROR("unable to make type %s\n", app_utils::get_atom_name(type_name));
               set_error(true);
               return;
             }
@@ -184,7 +187,7 @@ namespace octet {
             if (!ref && type_name != atom_) {
               type *val = (type*)type::new_type(type_name);
               if (!val) {
-                app_utils::log("unable to make type %s\n", app_utils::get_atom_name(type_name));
+                OCTET_LOG_ERROR("unable to make type %s\n", app_utils::get_atom_name(type_name));
                 set_error(true);
                 return;
               }
@@ -229,7 +232,7 @@ namespace octet {
             if (!ref && type_name != atom_) {
               type *val = (type*)type::new_type(type_name);
               if (!val) {
-                app_utils::log("unable to make type %s\n", app_utils::get_atom_name(type_name));
+                OCTET_LOG_ERROR("unable to make type %s\n", app_utils::get_atom_name(type_name));
                 set_error(true);
                 return;
               }
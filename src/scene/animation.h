@@ -38,12 +38,12 @@ namespace octet {
       end_time = 0;
     }
 
-    void visit(visitor &v) {
-      v.visit(data, atom_data);
-      v.visit(channels, atom_channels);
-      v.visit(targets, atom_targets);
-      v.visit(end_time, atom_end_time);
-    }
+    OCTET_FIELDS_BEGIN(animation)
+      OCTET_FIELD(data)
+      OCTET_FIELD(channels)
+      OCTET_FIELD(targets)
+      OCTET_FIELD(end_time)
+    OCTET_FIELDS_END()
 
     int get_num_channels() const {
       return (int)channels.size();
@@ -107,7 +107,7 @@ namespace octet {
       unsigned a = 0;
       unsigned b = ch.num_times - 1;
       unsigned component_size = ch.component_size;
-      //app_utils::log("ec %f %d\n", time, time_ms);
+      //OCTET_LOG_DEBUG("ec %f %d\n", time, time_ms);
 
       if (time_ms < p[0]) {
         time_ms = p[0];
@@ -125,7 +125,7 @@ namespace octet {
         }
       }
 
-      //app_utils::log("t=%d a=%d b=%d p[a]=%d p[b]=%d\n", time_ms, a, b, p[a], p[b]);
+      //OCTET_LOG_DEBUG("t=%d a=%d b=%d p[a]=%d p[b]=%d\n", time_ms, a, b, p[a], p[b]);
 
       unsigned data_offset = ch.offset + ch.num_times * sizeof(unsigned short);
 
@@ -138,7 +138,7 @@ namespace octet {
         for (int i = 0; i != component_size/4; ++i) {
           tmp1[i] = tmp1[i] * (1-t) + tmp2[i] * t;
         }
-        //app_utils::log("  t=%f %f %f %f\n", t, tmp1[0], tmp1[1], tmp1[2]);
+        //OCTET_LOG_DEBUG("  t=%f %f %f %f\n", t, tmp1[0], tmp1[1], tmp1[2]);
         target->set_value(ch.sid, ch.sub_target, ch.component, tmp1);
       }
     }
@@ -25,13 +25,13 @@ namespace octet {
       this->is_paused = false;
     }
 
-    void visit(visitor &v) {
-      v.visit(anim, atom_anim);
-      v.visit(target, atom_target);
-      v.visit(time, atom_time);
-      v.visit(is_looping, atom_is_looping);
-      v.visit(is_paused, atom_is_paused);
-    }
+    OCTET_FIELDS_BEGIN(animation_instance)
+      OCTET_FIELD(anim)
+      OCTET_FIELD(target)
+      OCTET_FIELD(time)
+      OCTET_FIELD(is_looping)
+      OCTET_FIELD(is_paused)
+    OCTET_FIELDS_END()
 
     const animation *get_anim() const {
       return anim;
@@ -53,10 +53,10 @@ namespace octet {
         }
       }
 
-      //app_utils::log("update %f\n", delta_time);
+      //OCTET_LOG_DEBUG("update %f\n", delta_time);
       if (!is_paused) {
         time += delta_time;
-        //app_utils::log("..update %f\n", time);
+        //OCTET_LOG_DEBUG("..update %f\n", time);
         if (time >= anim->get_end_time()) {
           if (is_looping) {
             time -= anim->get_end_time();
@@ -0,0 +1,311 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Cache optimizer modifier. Reorder triangles and vertices for the GPU.
+//
+// The triangles are put in an order that reuses the vertices in the
+// post-transform cache (Tom Forsyth's "Linear-Speed Vertex Cache
+// Optimisation"). Then the vertices are put in the order that the new
+// indices first use them, so that vertex fetches walk through memory.
+//
+// Use it on an indexed mesh, for example the output of indexer:
+//
+//   mi->set_mesh(new cache_optimizer(new indexer(mi->get_mesh())));
+//
+// ACMR (cache misses per triangle, 0.5 is ideal for big grids) and ATVR
+// (cache misses per vertex, 1.0 is ideal) are logged before and after.
+//
+
+namespace octet {
+  class cache_optimizer : public mesh {
+    enum {
+      // size of the LRU cache used for scoring
+      max_cache_size = 32,
+
+      // valences above this get the same score
+      max_valence = 32,
+
+      // size of the FIFO cache used to measure ACMR and ATVR
+      fifo_cache_size = 16,
+    };
+
+    // source mesh. Provides underlying geometry.
+    ref<mesh> src;
+
+    // statistics for the last update()
+    float acmr_before;
+    float acmr_after;
+    float atvr_before;
+    float atvr_after;
+
+    // vertex scores from the paper:
+    // the last triangle's vertices get 0.75, older vertices decay with power 1.5
+    // and vertices with few triangles left get a boost so we don't leave them behind.
+    struct scorer {
+      float cache_score[max_cache_size];
+      float valence_score[max_valence+1];
+
+      scorer() {
+        for (int i = 0; i != max_cache_size; ++i) {
+          cache_score[i] = i < 3 ? 0.75f : powf(1.0f - (i - 3) * ( 1.0f / ( max_cache_size - 3 ) ), 1.5f);
+        }
+        valence_score[0] = 0;
+        for (int i = 1; i <= max_valence; ++i) {
+          valence_score[i] = 2.0f / sqrtf((float)i);
+        }
+      }
+
+      float get_score(int cache_pos, unsigned valence) const {
+        if (valence == 0) return -1.0f;
+        return ( cache_pos < 0 ? 0.0f : cache_score[cache_pos] ) + valence_score[valence < max_valence ? valence : (unsigned)max_valence];
+      }
+    };
+
+    // reorder the triangles in indices.
+    static void optimize_triangles(dynarray<uint32_t> &indices, unsigned num_vertices) {
+      unsigned num_triangles = indices.size() / 3;
+      if (num_triangles == 0) return;
+
+      scorer scores;
+
+      // triangles that use each vertex. the live ones are at the start of each list.
+      dynarray<unsigned> tri_start(num_vertices + 1);
+      dynarray<unsigned> live(num_vertices);
+      memset(&live[0], 0, num_vertices * sizeof(live[0]));
+      for (unsigned i = 0; i != num_triangles * 3; ++i) {
+        live[indices[i]]++;
+      }
+      unsigned total = 0;
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        tri_start[v] = total;
+        total += live[v];
+      }
+      tri_start[num_vertices] = total;
+
+      dynarray<unsigned> tri_list(total);
+      dynarray<unsigned> fill(num_vertices);
+      memset(&fill[0], 0, num_vertices * sizeof(fill[0]));
+      for (unsigned i = 0; i != num_triangles * 3; ++i) {
+        unsigned v = indices[i];
+        tri_list[tri_start[v] + fill[v]++] = i / 3;
+      }
+
+      dynarray<float> vertex_score(num_vertices);
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        vertex_score[v] = scores.get_score(-1, live[v]);
+      }
+
+      dynarray<float> tri_score(num_triangles);
+      dynarray<uint8_t> added(num_triangles);
+      memset(&added[0], 0, num_triangles);
+      int best_tri = -1;
+      float best_score = -1;
+      for (unsigned t = 0; t != num_triangles; ++t) {
+        const uint32_t *idx = &indices[t*3];
+        tri_score[t] = vertex_score[idx[0]] + vertex_score[idx[1]] + vertex_score[idx[2]];
+        if (tri_score[t] > best_score) {
+          best_score = tri_score[t];
+          best_tri = (int)t;
+        }
+      }
+
+      // LRU cache with room for three new vertices
+      unsigned cache[max_cache_size + 3];
+      unsigned new_cache[max_cache_size + 3];
+      unsigned cache_size = 0;
+
+      dynarray<uint32_t> dest;
+      dest.reserve(num_triangles * 3);
+      unsigned next_unadded = 0;
+
+      for (unsigned n = 0; n != num_triangles; ++n) {
+        if (best_tri < 0) {
+          // nothing in the cache has triangles left: take the next one in the source order.
+          while (added[next_unadded]) ++next_unadded;
+          best_tri = (int)next_unadded;
+        }
+
+        unsigned t = (unsigned)best_tri;
+        added[t] = 1;
+        const uint32_t *idx = &indices[t*3];
+
+        // emit the triangle and take it off its vertices' live lists.
+        unsigned new_size = 0;
+        for (unsigned j = 0; j != 3; ++j) {
+          unsigned v = idx[j];
+          dest.push_back(v);
+          unsigned *list = &tri_list[tri_start[v]];
+          unsigned k = 0;
+          while (list[k] != t) ++k;
+          list[k] = list[live[v] - 1];
+          list[live[v] - 1] = t;
+          live[v]--;
+          if (j == 0 || ( v != idx[0] && ( j == 1 || v != idx[1] ) )) {
+            new_cache[new_size++] = v;
+          }
+        }
+
+        // the rest of the old cache goes after the new vertices.
+        for (unsigned i = 0; i != cache_size; ++i) {
+          unsigned v = cache[i];
+          if (v != idx[0] && v != idx[1] && v != idx[2]) {
+            new_cache[new_size++] = v;
+          }
+        }
+
+        // rescore the vertices in the cache (and those that fell out of it).
+        for (unsigned i = 0; i != new_size; ++i) {
+          unsigned v = new_cache[i];
+          float score = scores.get_score(i < max_cache_size ? (int)i : -1, live[v]);
+          float diff = score - vertex_score[v];
+          vertex_score[v] = score;
+          const unsigned *list = &tri_list[tri_start[v]];
+          for (unsigned k = 0; k != live[v]; ++k) {
+            tri_score[list[k]] += diff;
+          }
+        }
+
+        // the best triangle that uses a vertex in the cache.
+        best_tri = -1;
+        best_score = -1;
+        cache_size = new_size < max_cache_size ? new_size : (unsigned)max_cache_size;
+        for (unsigned i = 0; i != cache_size; ++i) {
+          unsigned v = new_cache[i];
+          cache[i] = v;
+          const unsigned *list = &tri_list[tri_start[v]];
+          for (unsigned k = 0; k != live[v]; ++k) {
+            unsigned lt = list[k];
+            if (tri_score[lt] > best_score) {
+              best_score = tri_score[lt];
+              best_tri = (int)lt;
+            }
+          }
+        }
+      }
+
+      memcpy(&indices[0], &dest[0], num_triangles * 3 * sizeof(indices[0]));
+    }
+
+  public:
+    RESOURCE_META(cache_optimizer)
+
+    cache_optimizer(mesh *src=0) {
+      this->src = src;
+      acmr_before = acmr_after = atvr_before = atvr_after = 0;
+      update();
+    }
+
+    // count the misses of a FIFO cache.
+    // ACMR is misses per triangle and ATVR is misses per vertex.
+    static unsigned get_cache_misses(const uint32_t *indices, unsigned num_indices, unsigned num_vertices, unsigned cache_size=fifo_cache_size) {
+      dynarray<unsigned> time(num_vertices);
+      memset(&time[0], 0, num_vertices * sizeof(time[0]));
+
+      // a vertex is in the cache if it was added in the last cache_size misses.
+      unsigned misses = 0;
+      for (unsigned i = 0; i != num_indices; ++i) {
+        unsigned v = indices[i];
+        if (time[v] == 0 || misses - time[v] >= cache_size) {
+          time[v] = ++misses;
+        }
+      }
+      return misses;
+    }
+
+    void update() {
+      if (!src) return;
+
+      *(mesh*)this = *(mesh*)src;
+
+      unsigned index_type = get_index_type();
+      unsigned num_indices = get_num_indices();
+      unsigned num_vertices = get_num_vertices();
+      if (get_mode() != GL_TRIANGLES || num_indices < 3 || num_vertices == 0) return;
+      if (index_type != GL_UNSIGNED_INT && index_type != GL_UNSIGNED_SHORT) return;
+
+      num_indices -= num_indices % 3;
+
+      dynarray<uint32_t> indices(num_indices);
+      const void *ip = get_indices()->lock_read_only();
+      for (unsigned i = 0; i != num_indices; ++i) {
+        indices[i] = index_type == GL_UNSIGNED_INT ? ((const uint32_t*)ip)[i] : ((const uint16_t*)ip)[i];
+        if (indices[i] >= num_vertices) {
+          get_indices()->unlock_read_only();
+          OCTET_LOG_WARNING("cache_optimizer: index %d out of range\n", indices[i]);
+          return;
+        }
+      }
+      get_indices()->unlock_read_only();
+
+      unsigned misses_before = get_cache_misses(&indices[0], num_indices, num_vertices);
+
+      optimize_triangles(indices, num_vertices);
+
+      // renumber the vertices in the order the triangles use them. unused vertices go at the end.
+      dynarray<unsigned> remap(num_vertices);
+      memset(&remap[0], 0xff, num_vertices * sizeof(remap[0]));
+      unsigned num_used = 0;
+      for (unsigned i = 0; i != num_indices; ++i) {
+        unsigned &r = remap[indices[i]];
+        if (r == ~0u) r = num_used++;
+        indices[i] = r;
+      }
+      unsigned next = num_used;
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        if (remap[v] == ~0u) remap[v] = next++;
+      }
+
+      unsigned stride = get_stride();
+      unsigned vsize = num_vertices * stride;
+      gl_resource *vertices = new gl_resource(GL_ARRAY_BUFFER, vsize);
+      const uint8_t *vp = (const uint8_t*)get_vertices()->lock_read_only();
+      uint8_t *dvp = (uint8_t*)vertices->lock();
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        memcpy(dvp + remap[v] * stride, vp + v * stride, stride);
+      }
+      vertices->unlock();
+      get_vertices()->unlock_read_only();
+
+      unsigned isize = kind_size(index_type) * num_indices;
+      gl_resource *new_indices = new gl_resource(GL_ELEMENT_ARRAY_BUFFER, isize);
+      void *dip = new_indices->lock();
+      for (unsigned i = 0; i != num_indices; ++i) {
+        if (index_type == GL_UNSIGNED_INT) {
+          ((uint32_t*)dip)[i] = indices[i];
+        } else {
+          ((uint16_t*)dip)[i] = (uint16_t)indices[i];
+        }
+      }
+      new_indices->unlock();
+
+      unsigned misses_after = get_cache_misses(&indices[0], num_indices, num_vertices);
+
+      set_indices(new_indices);
+      set_vertices(vertices);
+      set_num_indices(num_indices);
+
+      unsigned num_triangles = num_indices / 3;
+      acmr_before = (float)misses_before / num_triangles;
+      acmr_after = (float)misses_after / num_triangles;
+      atvr_before = (float)misses_before / num_used;
+      atvr_after = (float)misses_after / num_used;
+      OCTET_LOG_INFO(
+        "cache_optimizer: %d triangles %d vertices ACMR %.3f -> %.3f ATVR %.3f -> %.3f\n",
+        num_triangles, num_used, acmr_before, acmr_after, atvr_before, atvr_after
+      );
+    }
+
+    float get_acmr_before() const { return acmr_before; }
+    float get_acmr_after() const { return acmr_after; }
+    float get_atvr_before() const { return atvr_before; }
+    float get_atvr_after() const { return atvr_after; }
+
+    OCTET_FIELDS_BEGIN(cache_optimizer)
+      OCTET_FIELDS_BASE(mesh)
+      OCTET_FIELD(src)
+    OCTET_FIELDS_END()
+  };
+}
@@ -55,24 +55,24 @@ namespace octet {
       ymag = 1;
     }
 
-    void visit(visitor &v) {
-    // camera parameters
-      v.visit(node, atom_node);
-      v.visit(is_ortho, atom_is_ortho);
+    OCTET_FIELDS_BEGIN(camera_instance)
+      // camera parameters
+      OCTET_FIELD(node)
+      OCTET_FIELD(is_ortho)
 
       // common to all cameras
-      v.visit(nearVal, atom_nearVal);
-      v.visit(farVal, atom_farVal);
+      OCTET_FIELD(nearVal)
+      OCTET_FIELD(farVal)
 
       // perspective camera
-      v.visit(xfov, atom_xfov);
-      v.visit(yfov, atom_yfov);
-      v.visit(aspect_ratio, atom_aspect_ratio);
+      OCTET_FIELD(xfov)
+      OCTET_FIELD(yfov)
+      OCTET_FIELD(aspect_ratio)
 
       // ortho camera
-      v.visit(xmag, atom_xmag);
-      v.visit(ymag, atom_ymag);
-    }
+      OCTET_FIELD(xmag)
+      OCTET_FIELD(ymag)
+    OCTET_FIELDS_END()
 
     // set the parameters as in the collada perspective element
     void set_perspective(float xfov, float yfov, float aspect_ratio, float n, float f)
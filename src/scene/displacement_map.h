@@ -28,9 +28,9 @@ namespace octet {
 
     }
 
-    void visit(visitor &v) {
-      mesh::visit(v);
-      v.visit(src, atom_src);
-    }
+    OCTET_FIELDS_BEGIN(displacement_map)
+      OCTET_FIELDS_BASE(mesh)
+      OCTET_FIELD(src)
+    OCTET_FIELDS_END()
   };
 }
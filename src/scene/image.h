@@ -55,155 +55,110 @@ namespace octet {
       COMPRESSED_RGBA_S3TC_DXT5_EXT = 0x83F3,
     };
 
+    // add the smaller levels to the end of bytes, down to 1x1.
     void make_mipmaps() {
       if (format != RGB && format != RGBA) return;
 
-      bytes.resize(bytes.size() * 4 / 3);
-
       unsigned num_comps = format == RGB ? 3 : 4;
-      uint8_t *src = &bytes[0];
-      uint8_t *dest = &bytes[width * height * num_comps];
-      unsigned w = width;
-      unsigned h = height;
-      unsigned stride = w * num_comps;
-      mip_levels = 0;
-      while (w > 1 && h > 1) {
-        for (unsigned y = 0; y < h/2; ++y) {
-          for (unsigned x = 0; x < w/2; ++x) {
-            // this is a rather dreadful box filter, it is simple to make, but introduces
-            // artifacts. We can do better than this.
-            for (unsigned i = 0; i != num_comps; ++i) {
-              *dest++ = ( src[0] + src[num_comps] + src[stride] + src[stride+num_comps] + 3 ) >> 2;
-              src++;
-            }
-            src += num_comps;
-          }
-          src += stride;
-        }
-        w >>= 1;
-        h >>= 1;
-        stride >>= 1;
-        mip_levels++;
-      }
-      assert(dest - &bytes[0] < (int)bytes.size());
-      //printf("%d %d\n", dest - &bytes[0], bytes.size());
+      bytes.resize(mip_builder::get_chain_size(width, height, num_comps));
+
+      mip_builder builder;
+      builder.set_srgb(srgb_mipmaps());
+      mip_levels = (uint8_t)builder.build(&bytes[0], width, height, num_comps);
     }
 
-    void dxt_encode() {
+    // compress the mip chain to DXT1, or DXT5 if there is any alpha.
+    void dxt_encode(unsigned quality) {
       if (format != RGB && format != RGBA) return;
 
       unsigned num_comps = format == RGB ? 3 : 4;
+      bool bc3 = num_comps == 4 && dxt_encoder::has_alpha(&bytes[0], width * height);
+
+      dxt_encoder enc;
+      enc.set_quality(quality);
       dynarray<uint8_t> result;
-      result.resize(bytes.size() / num_comps);
-      uint8_t *src = &bytes[0];
-      uint8_t *dest = &result[0];
-      unsigned w = width;
-      unsigned h = height;
-      unsigned stride = w * num_comps;
-      unsigned new_mip_levels = 0;
-      while (w > 4 && h > 4 && new_mip_levels < mip_levels) {
-        for (unsigned y = 0; y < h/4; ++y) {
-          app_utils::log("w=%d y=%d src=%08x\n", w, y, src - &bytes[0]);
-          for (unsigned x = 0; x < w/4; ++x) {
-            // ye olde covariance method http://en.wikipedia.org/wiki/Linear_discriminant_analysis
-            vec4 tot(0, 0, 0, 0);
-            vec4 colours[16];
-            for (unsigned j = 0; j != 4; ++j) {
-              for (unsigned i = 0; i != 4; ++i) {
-                //vec4 colour(src[0] * (1.0f/255), src[1] * (1.0f/255), src[2] * (1.0f/255), (num_comps == 4 ? src[3] * (1.0f/255) : 1.0f));
-                vec4 colour(src[0] * (1.0f/255), src[1] * (1.0f/255), src[2] * (1.0f/255), 1.0f);
-                colours[i+j*4] = colour;
-                tot += colour;
-                src += num_comps;
-              }
-              src += ( w - 4 ) * num_comps;
-            }
-            src -= ( w - 1 ) * 4 * num_comps;
-
-            // calculate the covariance matrix
-            vec4 mean = tot * 0.0625f;
-            mat4t covariance(0);
-            for (unsigned i = 0; i != 16; ++i) {
-              vec4 colour = colours[i] -= mean;
-              covariance += outer(colour, colour);
-            }
+      unsigned levels = enc.encode_mips(result, &bytes[0], bytes.size(), width, height, num_comps, bc3);
+      if (!levels) return;
 
-            // power method to find largest eigenvector (axis)
-            vec4 axis = covariance.trace();
-            for (unsigned i = 0; i != 4; ++i) {
-              axis = axis * covariance;
-            }
-            float len = axis.length();
-            if (abs(len) >= 0.001f) axis = axis / len;
-            if (y == 27) app_utils::log("%s %s %s\n", mean.toString(), axis.toString(), covariance.toString());
-
-            // our colours all have to live on the axis.
-            // in practice, we can ignore "odd man out" colours
-            // for better compression. But for now, do all the colours.
-            float pmin = dot(colours[0], axis);
-            float pmax = pmin;
-            float projs[16];
-            projs[0] = pmin;
-            for (unsigned i = 1; i != 16; ++i) {
-              float proj = dot(colours[i], axis);
-              projs[i] = proj;
-              pmin = pmin < proj ? pmin : proj;
-              pmax = pmax > proj ? pmax : proj;
-            }
-            vec4 cmin = mean + axis * pmin;
-            vec4 cmax = mean + axis * pmax;
-            if (y == 27) app_utils::log("%s -> %s\n", cmin.toString(), cmax.toString());
-            cmin = min(max(cmin, vec4(0, 0, 0, 0)), vec4(1, 1, 1, 1));
-            cmax = min(max(cmax, vec4(0, 0, 0, 0)), vec4(1, 1, 1, 1));
-
-            unsigned c0 =
-              ( (unsigned)(cmin.x() * 31.999f) << 11 ) |
-              ( (unsigned)(cmin.y() * 63.999f) << 5 ) |
-              ( (unsigned)(cmin.z() * 31.999f) << 0 )
-            ;
-            unsigned c1 =
-              ( (unsigned)(cmax.x() * 31.999f) << 11 ) |
-              ( (unsigned)(cmax.y() * 63.999f) << 5 ) |
-              ( (unsigned)(cmax.z() * 31.999f) << 0 )
-            ;
-
-            if (c0 < c1) {
-              unsigned t = c0; c0 = c1; c1 = t;
-              float p = pmin; pmin = pmax; pmax = p;
-            }
+      bytes.resize(result.size());
+      memcpy(&bytes[0], &result[0], result.size());
+      format = bc3 ? COMPRESSED_RGBA_S3TC_DXT5_EXT : COMPRESSED_RGB_S3TC_DXT1_EXT;
+      mip_levels = (uint8_t)levels;
+    }
 
-            float pscale = abs(pmax - pmin) > 0.001f ? 3.999f / (pmax - pmin) : 0;
-            uint8_t pal[16];
-            for (unsigned i = 0; i != 16; ++i) {
-              pal[i] = (unsigned)( ( projs[i] - pmin ) * pscale );
-            }
+    // true if the url names a pre-baked KTX file
+    bool is_ktx_url() const {
+      unsigned len = (unsigned)strlen(url.c_str());
+      return len >= 4 && !strcmp(url.c_str() + len - 4, ".ktx");
+    }
 
-            dest[0] = ( c0 >> 0 ) & 0xff;
-            dest[1] = ( c0 >> 8 ) & 0xff;
-            dest[2] = ( c1 >> 0 ) & 0xff;
-            dest[3] = ( c1 >> 8 ) & 0xff;
-            for (int i = 0; i != 4; ++i) {
-              dest[i+4] = pal[i*4+0] + pal[i*4+1] * 4 + pal[i*4+2] * 16 + pal[i*4+3] * 64;
-            }
-            dest += 8;
-          }
-          src += stride * 3;
-        }
-        w >>= 1;
-        h >>= 1;
-        stride >>= 1;
-        new_mip_levels++;
+    // send a KTX file to the GPU straight from the mapped file, without copying the pixels.
+    bool upload_ktx() {
+      mapped_file file;
+      ktx_decoder ktx;
+      if (!file.open(app_utils::get_path(url)) || !ktx.parse(file.data(), file.data() + file.size())) {
+        return false;
       }
-      assert(dest - &result[0] < (int)result.size());
-      bytes.resize((int)(dest - &result[0]));
-      memcpy(&bytes[0], &result[0], dest - &result[0]);
-      format = COMPRESSED_RGB_S3TC_DXT1_EXT;
-      mip_levels = new_mip_levels;
+      gl_texture = app_utils::make_texture(ktx);
+      format = (uint16_t)ktx.get_format();
+      width = (uint16_t)ktx.get_width();
+      height = (uint16_t)ktx.get_height();
+      mip_levels = (uint8_t)ktx.get_num_levels();
+      return true;
+    }
+
+    static unsigned &compression() {
+      static unsigned value = compress_none;
+      return value;
+    }
+
+    static bool &software_dxt() {
+      static bool value = false;
+      return value;
+    }
+
+    static bool &srgb_mipmaps() {
+      static bool value = false;
+      return value;
     }
 
   public:
     RESOURCE_META(image)
 
+    enum {
+      compress_none,
+      compress_fast,
+      compress_high_quality,
+    };
+
+    // compress textures to DXT as they load. The GPU must support S3TC.
+    static void set_compression(unsigned value) {
+      compression() = value;
+    }
+
+    static unsigned get_compression() {
+      return compression();
+    }
+
+    // decode DXT textures from DDS files on the cpu for GPUs without S3TC.
+    static void set_software_dxt(bool value) {
+      software_dxt() = value;
+    }
+
+    static bool get_software_dxt() {
+      return software_dxt();
+    }
+
+    // filter mip levels in linear light. Use this for colour textures but
+    // not for normal maps and other data.
+    static void set_srgb_mipmaps(bool value) {
+      srgb_mipmaps() = value;
+    }
+
+    static bool get_srgb_mipmaps() {
+      return srgb_mipmaps();
+    }
+
     // default constructor makes a blank image.
     image() {
       init("");
@@ -217,46 +172,136 @@ namespace octet {
     }
 
     // access attributes by name
-    void visit(visitor &v) {
-      v.visit(url, atom_url);
-      v.visit(bytes, atom_bytes);
-      v.visit(format, atom_format);
-      v.visit(width, atom_width);
-      v.visit(height, atom_height);
-      v.visit(mip_levels, atom_mip_levels);
-      v.visit(cube_faces, atom_cube_faces);
-    }
+    OCTET_FIELDS_BEGIN(image)
+      OCTET_FIELD(url)
+      OCTET_FIELD(bytes)
+      OCTET_FIELD(format)
+      OCTET_FIELD(width)
+      OCTET_FIELD(height)
+      OCTET_FIELD(mip_levels)
+      OCTET_FIELD(cube_faces)
+    OCTET_FIELDS_END()
 
     // load the image from a file
     void load() {
       dynarray<uint8_t> buffer;
       app_utils::get_url(buffer, url);
+      if (buffer.size() == 0) return;
+
+      // KTX files are ready to use, so they don't go in the cache.
+      if (ktx_decoder::is_ktx(&buffer[0], buffer.size())) {
+        ktx_decoder dec;
+        dec.get_image(bytes, format, width, height, &buffer[0], &buffer[0] + buffer.size());
+        mip_levels = (uint8_t)dec.get_num_levels();
+        if (mip_levels == 1) make_mipmaps();
+        return;
+      }
+
+      // use the decoded pixels from an earlier run if we have them.
+      image_cache &cache = image_cache::get();
+      bool is_dds = buffer.size() >= 4 && buffer[0] == 'D' && buffer[1] == 'D' && buffer[2] == 'S' && buffer[3] == ' ';
+      unsigned variant =
+        compression() == compress_fast ? image_cache::variant_compressed :
+        compression() == compress_high_quality ? image_cache::variant_compressed_hq :
+        image_cache::variant_mipmapped
+      ;
+      if (srgb_mipmaps()) variant |= image_cache::variant_srgb;
+      if (is_dds && software_dxt()) variant |= image_cache::variant_software_dxt;
+      uint64_t key = image_cache::get_key(url, variant);
+      uint64_t source_hash = image_cache::get_source_hash(&buffer[0], buffer.size());
+      mapped_file cached;
+      image_cache::entry e;
+      if (cache.find(cached, e, key, source_hash, buffer.size(), variant)) {
+        bytes.resize(e.size);
+        memcpy(&bytes[0], e.pixels, e.size);
+        format = e.format;
+        width = e.width;
+        height = e.height;
+        mip_levels = e.mip_levels;
+        cube_faces = e.cube_faces;
+        return;
+      }
+
       const unsigned char *src = &buffer[0];
       const unsigned char *src_max = src + buffer.size();
-      if (buffer.size() >= 6 && !memcmp(&buffer[0], "GIF89a", 6)) {
+      bool has_mips = false;
+      if (buffer.size() >= 6 && (!memcmp(&buffer[0], "GIF89a", 6) || !memcmp(&buffer[0], "GIF87a", 6))) {
         gif_decoder dec;
         dec.get_image(bytes, format, width, height, src, src_max);
       } else if (buffer.size() >= 6 && buffer[0] == 0xff && buffer[1] == 0xd8) {
         jpeg_decoder dec;
         dec.get_image(bytes, format, width, height, src, src_max);
-      } else if (buffer.size() >= 6 && buffer[0] == 0 && buffer[1] == 0 && buffer[2] == 2) {
+      } else if (tga_decoder::is_tga(&buffer[0], buffer.size())) {
         tga_decoder dec;
         dec.get_image(bytes, format, width, height, src, src_max);
-      } else if (buffer.size() >= 4 && buffer[0] == 'D' && buffer[1] == 'D' && buffer[2] == 'S' && buffer[3] == ' ') {
+      } else if (is_dds) {
         dds_decoder dec;
+        dec.set_decompress(software_dxt());
         dec.get_image(bytes, format, width, height, src, src_max);
+
+        // decoded files keep their mip levels if they go all the way down.
+        unsigned full_levels = mip_builder::get_num_levels(width, height);
+        if (format == RGBA && dec.get_num_levels() == full_levels && full_levels > 1) {
+          has_mips = true;
+          mip_levels = (uint8_t)full_levels;
+        } else if (format == RGBA) {
+          bytes.resize(width * height * 4);
+        } else {
+          // compressed files use the levels they have.
+          has_mips = true;
+          mip_levels = (uint8_t)dec.get_num_levels();
+        }
       } else {
         printf("warning: unknown texture format\n");
         return;
       }
 
-      make_mipmaps();
-      //dxt_encode();
+      if (!has_mips) make_mipmaps();
+      if (compression() != compress_none) {
+        dxt_encode(compression() == compress_high_quality ? dxt_encoder::quality_high : dxt_encoder::quality_fast);
+      }
+
+      if (bytes.size() && width && height) {
+        e.pixels = &bytes[0];
+        e.size = bytes.size();
+        e.format = format;
+        e.width = width;
+        e.height = height;
+        e.mip_levels = mip_levels;
+        e.cube_faces = cube_faces;
+        cache.store(key, source_hash, buffer.size(), variant, e);
+      }
+    }
+
+    // write the decoded (and maybe compressed) mip chain as a KTX file.
+    // This is how we convert GIF, JPEG, TGA and DDS files offline.
+    bool save_ktx(const char *path) {
+      if (bytes.size() == 0 || width == 0 || height == 0) {
+        load();
+      }
+      if (bytes.size() == 0) return false;
+
+      dynarray<uint8_t> ktx;
+      if (!ktx_encoder::encode(ktx, format, width, height, mip_levels ? mip_levels : 1, &bytes[0], bytes.size())) {
+        return false;
+      }
+
+      FILE *file = fopen(path, "wb");
+      if (!file) {
+        printf("warning: could not write %s\n", path);
+        return false;
+      }
+      bool ok = fwrite(&ktx[0], 1, ktx.size(), file) == ktx.size();
+      fclose(file);
+      return ok;
     }
 
     GLuint get_gl_texture() {
       if (!gl_texture) {
         if (bytes.size() == 0 || width == 0 || height == 0) {
+          if (is_ktx_url() && upload_ktx()) {
+            return gl_texture;
+          }
           load();
         }
 
@@ -265,8 +310,11 @@ namespace octet {
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, gl_texture);
 
-        // todo: handle compressed textures
+        // a chain that stops before 1x1 is incomplete, so we can't use mipmapping.
+        bool complete = true;
         if (format == GL_RGB || format == GL_RGBA) {
+          // our rows are not padded to four bytes
+          glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
           if (mip_levels == 1) {
             glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, (void*)&bytes[0]);
             // this may not work on very old systems, comment it out.
@@ -276,34 +324,35 @@ namespace octet {
             unsigned w = width;
             unsigned h = height;
             uint8_t *src = &bytes[0];
-            unsigned level = 0;
-            while (w != 0 && h != 0) {
-              glTexImage2D(GL_TEXTURE_2D, level++, format, w, h, 0, format, GL_UNSIGNED_BYTE, (void*)src);
+            for (unsigned level = 0; level != mip_levels; ++level) {
+              glTexImage2D(GL_TEXTURE_2D, level, format, w, h, 0, format, GL_UNSIGNED_BYTE, (void*)src);
               src += w * h * num_comps;
-              w >>= 1;
-              h >>= 1;
+              w = mip_builder::get_next_size(w);
+              h = mip_builder::get_next_size(h);
             }
           }
+          glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
         } else if (format == COMPRESSED_RGB_S3TC_DXT1_EXT || format == COMPRESSED_RGBA_S3TC_DXT1_EXT || format == COMPRESSED_RGBA_S3TC_DXT3_EXT || format == COMPRESSED_RGBA_S3TC_DXT5_EXT) {
           unsigned w = width;
           unsigned h = height;
           uint8_t *src = &bytes[0];
-          unsigned level = 0;
-          unsigned shift = ( format == COMPRESSED_RGB_S3TC_DXT1_EXT || format == COMPRESSED_RGBA_S3TC_DXT1_EXT ) ? 1 : 0;
-          while (w != 0 && h != 0) {
-            unsigned wmin = w < 4 ? 4 : w;
-            unsigned hmin = h < 4 ? 4 : h;
-            unsigned size = ( wmin * hmin ) >> shift;
-            glCompressedTexImage2D(GL_TEXTURE_2D, level++, format, w, h, 0, size, (void*)src);
-            //printf("%d\n", glGetError());
+          unsigned block_size = ( format == COMPRESSED_RGB_S3TC_DXT1_EXT || format == COMPRESSED_RGBA_S3TC_DXT1_EXT ) ? 8 : 16;
+          unsigned levels = mip_levels ? mip_levels : 1;
+          for (unsigned level = 0; level != levels; ++level) {
+            unsigned size = ( ( w + 3 ) / 4 ) * ( ( h + 3 ) / 4 ) * block_size;
+            if (src + size > &bytes[0] + bytes.size()) {
+              levels = level;
+              break;
+            }
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, format, w, h, 0, size, (void*)src);
             src += size;
-            w >>= 1;
-            h >>= 1;
+            w = mip_builder::get_next_size(w);
+            h = mip_builder::get_next_size(h);
           }
-          //printf("%d %d\n", src - image_, size);
+          complete = levels == mip_builder::get_num_levels(width, height);
         }
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, complete ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
       }
       return gl_texture;
@@ -6,86 +6,232 @@
 //
 // Index modifier. Reduce vertices to the minimum set
 //
+// Vertices with the same bytes are welded into one. Each vertex is hashed
+// eight bytes at a time with app_utils::hash64 and the vertices are split
+// into partitions by hash, so the partitions can be welded on separate
+// threads. The result is the same for any number of threads: vertices are
+// numbered in the order the indices first use them.
+//
+// With a weld epsilon, positions are snapped to a grid of that size before
+// comparing, so vertices that are almost in the same place are welded too.
+//
 
 namespace octet {
   class indexer : public mesh {
-    struct vertex {
-      const uint8_t *bytes;
-      unsigned size;
-
-      bool is_empty() const { return bytes == 0; }
+    enum {
+      // don't start threads for fewer vertices than this
+      min_thread_vertices = 32768,
 
-      bool operator ==(const vertex &rhs) const {
-        return size == rhs.size && memcmp(bytes, rhs.bytes, size) == 0;
-      }
-
-      unsigned get_hash() const {
-        unsigned hash = 0;
-        for (unsigned i = 0; i != size; ++i) {
-          hash = ( hash >> 3 ) ^ ( hash >> 5 ) ^ bytes[i];
-        }
-        return hash;
-      }
+      // partitions per thread, to even out the work
+      partitions_per_thread = 4,
     };
 
-    class vertex_cmp {
-    public:
-      static unsigned fuzz_hash(unsigned hash) { return hash ^ (hash >> 3) ^ (hash >> 5); }
-
-      static unsigned get_hash(const vertex &key) { return fuzz_hash(key.get_hash()); }
-
-      static bool is_empty(const vertex &key) { return key.is_empty(); }
+    // shared by the hash and weld jobs
+    struct weld_state {
+      const uint8_t *keys;
+      unsigned key_stride;
+      unsigned num_vertices;
+      unsigned num_chunks;
+      uint64_t *hashes;
+
+      // vertices sorted by partition
+      unsigned partition_shift;
+      const unsigned *partition_start;
+      const unsigned *partition_vertices;
+
+      // the first vertex with the same key
+      unsigned *first;
     };
 
     // source mesh. Provides underlying geometry.
     ref<mesh> src;
 
+    // positions closer than this are welded. 0 means exact matches only.
+    float weld_epsilon;
+
+    // 0 means one per cpu
+    unsigned num_threads;
+
+    static void hash_chunk(void *arg, unsigned chunk) {
+      weld_state &ws = *(weld_state*)arg;
+      unsigned begin = (unsigned)( (uint64_t)ws.num_vertices * chunk / ws.num_chunks );
+      unsigned end = (unsigned)( (uint64_t)ws.num_vertices * ( chunk + 1 ) / ws.num_chunks );
+      for (unsigned v = begin; v != end; ++v) {
+        ws.hashes[v] = app_utils::hash64(ws.keys + v * ws.key_stride, ws.key_stride);
+      }
+    }
+
+    // weld the vertices of one partition with an open addressed table of vertex numbers.
+    static void weld_partition(void *arg, unsigned partition) {
+      weld_state &ws = *(weld_state*)arg;
+      const unsigned *vertices = ws.partition_vertices + ws.partition_start[partition];
+      unsigned count = ws.partition_start[partition + 1] - ws.partition_start[partition];
+      if (count == 0) return;
+
+      unsigned table_size = 16;
+      while (table_size < count * 2) table_size *= 2;
+      unsigned mask = table_size - 1;
+      dynarray<unsigned> table(table_size);
+      memset(&table[0], 0xff, table_size * sizeof(table[0]));
+
+      for (unsigned i = 0; i != count; ++i) {
+        unsigned v = vertices[i];
+        uint64_t hash = ws.hashes[v];
+        const uint8_t *key = ws.keys + v * ws.key_stride;
+        for (unsigned slot = (unsigned)hash & mask; ; slot = ( slot + 1 ) & mask) {
+          unsigned e = table[slot];
+          if (e == ~0u) {
+            table[slot] = v;
+            ws.first[v] = v;
+            break;
+          } else if (ws.hashes[e] == hash && !memcmp(ws.keys + e * ws.key_stride, key, ws.key_stride)) {
+            ws.first[v] = e;
+            break;
+          }
+        }
+      }
+    }
+
   public:
     RESOURCE_META(indexer)
 
-    indexer(mesh *src=0) {
+    indexer(mesh *src=0, float weld_epsilon=0) {
       this->src = src;
+      this->weld_epsilon = weld_epsilon;
+      num_threads = 0;
       update();
     }
 
+    // 0 means one per cpu. call update() to weld again.
+    void set_num_threads(unsigned value) {
+      num_threads = value;
+    }
+
     void update() {
       if (!src) return;
 
       *(mesh*)this = *(mesh*)src;
 
-      if (get_index_type() != GL_UNSIGNED_INT) return;
+      unsigned index_type = get_index_type();
+      if (index_type != GL_UNSIGNED_INT && index_type != GL_UNSIGNED_SHORT) return;
 
-      hash_map<vertex, unsigned, vertex_cmp> vertex_to_index;
-
-      dynarray<uint8_t> dest_vertices;
-      dynarray<uint32_t> dest_indices;
-      dest_indices.reserve(get_num_indices());
+      unsigned num_indices = get_num_indices();
+      unsigned num_src_vertices = get_num_vertices();
+      unsigned stride = get_stride();
+      if (num_indices == 0 || num_src_vertices == 0 || stride == 0) return;
 
-      //const uint32_t *ip = (const uint32_t*)get_indices()->lock_read_only();
+      const void *ip = get_indices()->lock_read_only();
       const uint8_t *vp = (const uint8_t*)get_vertices()->lock_read_only();
-      unsigned stride = get_stride();
+
+      dynarray<uint32_t> src_indices(num_indices);
+      for (unsigned i = 0; i != num_indices; ++i) {
+        src_indices[i] = index_type == GL_UNSIGNED_INT ? ((const uint32_t*)ip)[i] : ((const uint16_t*)ip)[i];
+        if (src_indices[i] >= num_src_vertices) {
+          get_vertices()->unlock_read_only();
+          get_indices()->unlock_read_only();
+          OCTET_LOG_WARNING("indexer: index %d out of range\n", src_indices[i]);
+          return;
+        }
+      }
+      get_indices()->unlock_read_only();
+
+      // with an epsilon, compare copies of the vertices with positions on a grid.
+      dynarray<uint8_t> snapped;
+      const uint8_t *keys = vp;
+      unsigned pos_slot = get_slot(attribute_pos);
+      if (weld_epsilon > 0 && pos_slot != ~0u && get_kind(pos_slot) == GL_FLOAT) {
+        snapped.resize(num_src_vertices * stride);
+        memcpy(&snapped[0], vp, num_src_vertices * stride);
+        unsigned offset = get_offset(pos_slot);
+        unsigned size = get_size(pos_slot);
+        float scale = 1.0f / weld_epsilon;
+        for (unsigned v = 0; v != num_src_vertices; ++v) {
+          uint8_t *pos = &snapped[v * stride + offset];
+          for (unsigned j = 0; j != size; ++j) {
+            float x;
+            memcpy(&x, pos + j * 4, 4);
+            int32_t cell = (int32_t)floorf(x * scale + 0.5f);
+            memcpy(pos + j * 4, &cell, 4);
+          }
+        }
+        keys = &snapped[0];
+      }
+
+      unsigned threads = num_threads ? num_threads : thread::get_num_cpus();
+      if (num_src_vertices < min_thread_vertices) threads = 1;
+
+      dynarray<uint64_t> hashes(num_src_vertices);
+      dynarray<unsigned> first(num_src_vertices);
+
+      weld_state ws;
+      ws.keys = keys;
+      ws.key_stride = stride;
+      ws.num_vertices = num_src_vertices;
+      ws.num_chunks = threads * partitions_per_thread;
+      ws.hashes = &hashes[0];
+      ws.first = &first[0];
+      parallel_for::run(ws.num_chunks, hash_chunk, (void*)&ws, threads);
+
+      // sort the vertices by the top bits of their hashes. each partition keeps the vertex order.
+      unsigned num_partitions = 1, partition_bits = 0;
+      while (num_partitions < ws.num_chunks) {
+        num_partitions *= 2;
+        partition_bits++;
+      }
+      ws.partition_shift = 64 - partition_bits;
+      dynarray<unsigned> partition_start(num_partitions + 1);
+      dynarray<unsigned> partition_vertices(num_src_vertices);
+      memset(&partition_start[0], 0, ( num_partitions + 1 ) * sizeof(partition_start[0]));
+      for (unsigned v = 0; v != num_src_vertices; ++v) {
+        partition_start[partition_bits ? (unsigned)( hashes[v] >> ws.partition_shift ) + 1 : 1]++;
+      }
+      for (unsigned p = 0; p != num_partitions; ++p) {
+        partition_start[p + 1] += partition_start[p];
+      }
+      {
+        dynarray<unsigned> fill(num_partitions);
+        memcpy(&fill[0], &partition_start[0], num_partitions * sizeof(fill[0]));
+        for (unsigned v = 0; v != num_src_vertices; ++v) {
+          partition_vertices[fill[partition_bits ? (unsigned)( hashes[v] >> ws.partition_shift ) : 0]++] = v;
+        }
+      }
+      ws.partition_start = &partition_start[0];
+      ws.partition_vertices = &partition_vertices[0];
+      parallel_for::run(num_partitions, weld_partition, (void*)&ws, threads);
+
+      // number the welded vertices in the order the indices use them.
+      dynarray<unsigned> remap(num_src_vertices);
+      memset(&remap[0], 0xff, num_src_vertices * sizeof(remap[0]));
+      dynarray<uint8_t> dest_vertices;
+      dest_vertices.reserve(num_src_vertices * stride);
       unsigned num_vertices = 0;
-      for (unsigned i = 0; i != get_num_indices(); ++i) {
-        //uint32_t idx = ip[i];
-        vertex v = { vp + i * stride, stride };
-        unsigned &e = vertex_to_index[v];
-        if (e == 0) { // hash_map inits to zero
-          e = ++num_vertices;
+      for (unsigned i = 0; i != num_indices; ++i) {
+        unsigned v = first[src_indices[i]];
+        unsigned &r = remap[v];
+        if (r == ~0u) {
+          r = num_vertices++;
           unsigned old_size = dest_vertices.size();
           dest_vertices.resize(old_size + stride);
-          memcpy(&dest_vertices[old_size], vp + i * stride, stride);
+          memcpy(&dest_vertices[old_size], vp + v * stride, stride);
         }
-        dest_indices.push_back(e - 1);
+        src_indices[i] = r;
       }
       get_vertices()->unlock_read_only();
-      get_indices()->unlock_read_only();
-      //printf("%d/%d\n", get_num_vertices(), num_vertices);
+      //printf("%d/%d\n", num_src_vertices, num_vertices);
 
-      unsigned isize = dest_indices.size() * sizeof(dest_indices[0]);
+      unsigned isize = num_indices * kind_size(index_type);
       unsigned vsize = dest_vertices.size() * sizeof(dest_vertices[0]);
       gl_resource *indices = new gl_resource(GL_ELEMENT_ARRAY_BUFFER, isize);
       gl_resource *vertices = new gl_resource(GL_ARRAY_BUFFER, vsize);
-      indices->assign(&dest_indices[0], 0, isize);
+      if (index_type == GL_UNSIGNED_INT) {
+        indices->assign(&src_indices[0], 0, isize);
+      } else {
+        uint16_t *dip = (uint16_t*)indices->lock();
+        for (unsigned i = 0; i != num_indices; ++i) {
+          dip[i] = (uint16_t)src_indices[i];
+        }
+        indices->unlock();
+      }
       vertices->assign(&dest_vertices[0], 0, vsize);
 
       set_indices(indices);
@@ -93,9 +239,9 @@ namespace octet {
       set_num_vertices(num_vertices);
     }
 
-    void visit(visitor &v) {
-      mesh::visit(v);
-      v.visit(src, atom_src);
-    }
+    OCTET_FIELDS_BEGIN(indexer)
+      OCTET_FIELDS_BASE(mesh)
+      OCTET_FIELD(src)
+    OCTET_FIELDS_END()
   };
 }
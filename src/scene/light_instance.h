@@ -30,20 +30,20 @@ namespace octet {
       farVal = 1000.0f;
     }
 
-    void visit(visitor &v) {
-      v.visit(node, atom_node);
-
-      v.visit(kind, atom_kind);
-      v.visit(color, atom_color);
-      v.visit(constant_attenuation, atom_constant_attenuation);
-      v.visit(linear_attenuation, atom_linear_attenuation);
-      v.visit(quadratic_attenuation, atom_quadratic_attenuation);
-      v.visit(falloff_angle, atom_falloff_angle);
-      v.visit(falloff_exponent, atom_falloff_exponent);
-
-      v.visit(nearVal, atom_nearVal);
-      v.visit(farVal, atom_farVal);
-    }
+    OCTET_FIELDS_BEGIN(light_instance)
+      OCTET_FIELD(node)
+
+      OCTET_FIELD(kind)
+      OCTET_FIELD(color)
+      OCTET_FIELD(constant_attenuation)
+      OCTET_FIELD(linear_attenuation)
+      OCTET_FIELD(quadratic_attenuation)
+      OCTET_FIELD(falloff_angle)
+      OCTET_FIELD(falloff_exponent)
+
+      OCTET_FIELD(nearVal)
+      OCTET_FIELD(farVal)
+    OCTET_FIELDS_END()
 
     void set_node(scene_node *node) {
       this->node = node;
@@ -67,14 +67,14 @@ namespace octet {
       shininess = new param(vec4(30.0f/255, 0, 0, 0));
     }
 
-    void visit(visitor &v) {
-      v.visit(diffuse, atom_diffuse);
-      v.visit(ambient, atom_ambient);
-      v.visit(emission, atom_emission);
-      v.visit(specular, atom_specular);
-      v.visit(bump, atom_bump);
-      v.visit(shininess, atom_shininess);
-    }
+    OCTET_FIELDS_BEGIN(material)
+      OCTET_FIELD(diffuse)
+      OCTET_FIELD(ambient)
+      OCTET_FIELD(emission)
+      OCTET_FIELD(specular)
+      OCTET_FIELD(bump)
+      OCTET_FIELD(shininess)
+    OCTET_FIELDS_END()
 
     void init(param *diffuse, param *ambient, param *emission, param *specular, param *bump, param *shininess) {
       this->diffuse = diffuse;
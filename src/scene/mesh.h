@@ -31,6 +31,12 @@ namespace octet {
     // bounding box
     aabb mesh_aabb;
 
+    // how the shader turns quantized attributes back into model space (see quantizer)
+    //   pos = pos * decode[0].xyz + decode[1].xyz
+    //   uv = uv * decode[2].xy + decode[2].zw
+    //   decode[0].w != 0 if the normals are octahedral
+    vec4 attribute_decode[3];
+
   public:
     RESOURCE_META(mesh)
 
@@ -38,20 +44,21 @@ namespace octet {
       init(_skin);
     }
 
-    void visit(visitor &v) {
-      v.visit(vertices, atom_vertices);
-      v.visit(indices, atom_indices);
-      v.visit(format, atom_format);
-      v.visit(num_indices, atom_num_indices);
-      v.visit(num_vertices, atom_num_vertices);
-      v.visit(stride, atom_stride);
-      v.visit(mode, atom_mode);
-      v.visit(index_type, atom_index_type);
-      v.visit(normalized, atom_normalized);
-      v.visit(num_slots, atom_num_slots);
-      v.visit(mesh_skin, atom_mesh_skin);
-      v.visit(mesh_aabb, atom_mesh_aabb);
-    }
+    OCTET_FIELDS_BEGIN(mesh)
+      OCTET_FIELD(vertices)
+      OCTET_FIELD(indices)
+      OCTET_FIELD(format)
+      OCTET_FIELD(num_indices)
+      OCTET_FIELD(num_vertices)
+      OCTET_FIELD(stride)
+      OCTET_FIELD(mode)
+      OCTET_FIELD(index_type)
+      OCTET_FIELD(normalized)
+      OCTET_FIELD(num_slots)
+      OCTET_FIELD(mesh_skin)
+      OCTET_FIELD(mesh_aabb)
+      OCTET_FIELD(attribute_decode)
+    OCTET_FIELDS_END()
 
     ~mesh() {
     }
@@ -73,11 +80,17 @@ namespace octet {
       index_type = GL_UNSIGNED_SHORT;
       mode = GL_TRIANGLES;
 
+      attribute_decode[0] = vec4(1, 1, 1, 0);
+      attribute_decode[1] = vec4(0, 0, 0, 0);
+      attribute_decode[2] = vec4(1, 1, 0, 0);
+
       mesh_skin = _skin;
     }
 
     void clear_attributes() {
       num_slots = 0;
+      normalized = 0;
+      memset(format, 0, sizeof(format));
     }
 
     // eg. add_attribute(attribute_pos, 3, GL_FLOAT, 0)
@@ -133,6 +146,26 @@ namespace octet {
       return num_slots;
     }
 
+    // one bit for each slot
+    unsigned get_normalized() const {
+      return normalized;
+    }
+
+    // three vec4s for the shader. see attribute_decode above.
+    const vec4 *get_attribute_decode() const {
+      return attribute_decode;
+    }
+
+    void set_attribute_decode(unsigned index, const vec4 &value) {
+      attribute_decode[index] = value;
+    }
+
+    // meshes with levels of detail (see simplifier) return a simpler mesh if it is
+    // within a pixel error on the screen, given the pixels per unit. this mesh has no levels.
+    virtual mesh *get_lod(float, float) {
+      return this;
+    }
+
     // get the optional skin data
     skin *get_skin() const {
       return (skin*)mesh_skin;
@@ -188,27 +221,48 @@ namespace octet {
     }
 
     // get a vec4 value of an attribute (only when not in a vbo)
+    // quantized positions, normals and uvs are decoded as the shader would.
     vec4 get_value(unsigned slot, unsigned index) const {
-      if (get_kind(slot) == GL_FLOAT) {
-        const float *src = (float*)((uint8_t*)vertices->lock_read_only() + stride * index + get_offset(slot));
-        unsigned size = get_size(slot);
-        float x = src[0];
-        float y = size > 1 ? src[1] : 0;
-        float z = size > 2 ? src[2] : 0;
-        float w = size > 3 ? src[3] : 1;
-        vertices->unlock_read_only();
-        return vec4(x, y, z, w);
-	  } else if (get_kind(slot) == GL_UNSIGNED_BYTE) {
-        const uint8_t *src = (uint8_t*)((uint8_t*)vertices->lock_read_only() + stride * index + get_offset(slot));
-        unsigned size = get_size(slot);
-        float x = src[0]*(1.0f/255);
-        float y = size > 1 ? src[1]*(1.0f/255) : 0;
-        float z = size > 2 ? src[2]*(1.0f/255) : 0;
-        float w = size > 3 ? src[3]*(1.0f/255) : 1;
-        vertices->unlock_read_only();
-        return vec4(x, y, z, w);
+      unsigned kind = get_kind(slot);
+      unsigned size = get_size(slot);
+      bool norm = ( normalized >> slot & 1 ) != 0;
+      const uint8_t *src = (uint8_t*)vertices->lock_read_only() + stride * index + get_offset(slot);
+      float v[4] = { 0, 0, 0, 1 };
+      for (unsigned i = 0; i != size; ++i) {
+        switch (kind) {
+          case GL_FLOAT: memcpy(&v[i], src + i * 4, 4); break;
+          case GL_UNSIGNED_BYTE: v[i] = norm ? src[i] * (1.0f/255) : src[i]; break;
+          case GL_BYTE: v[i] = norm ? ((int8_t*)src)[i] * (1.0f/127) : ((int8_t*)src)[i]; break;
+          case GL_SHORT: v[i] = norm ? ((int16_t*)src)[i] * (1.0f/32767) : ((int16_t*)src)[i]; break;
+          case GL_UNSIGNED_SHORT: v[i] = norm ? ((uint16_t*)src)[i] * (1.0f/65535) : ((uint16_t*)src)[i]; break;
+          default: v[i] = 0; break;
+        }
+        if (norm && v[i] < -1) v[i] = -1;
       }
-      return vec4(0, 0, 0, 0);
+      vertices->unlock_read_only();
+
+      unsigned attr = get_attr(slot);
+      if (attr == attribute_pos) {
+        for (unsigned i = 0; i != 3; ++i) {
+          v[i] = v[i] * attribute_decode[0][i] + attribute_decode[1][i] * v[3];
+        }
+      } else if (attr == attribute_uv) {
+        v[0] = v[0] * attribute_decode[2][0] + attribute_decode[2][2];
+        v[1] = v[1] * attribute_decode[2][1] + attribute_decode[2][3];
+      } else if (attr == attribute_normal && attribute_decode[0][3] != 0) {
+        vec3 n = decode_octahedral(v[0], v[1]);
+        v[0] = n.x(); v[1] = n.y(); v[2] = n.z(); v[3] = 1;
+      }
+      return vec4(v[0], v[1], v[2], v[3]);
+    }
+
+    // unit vector from a point on the octahedron folded flat (see quantizer)
+    static vec3 decode_octahedral(float x, float y) {
+      float z = 1.0f - fabsf(x) - fabsf(y);
+      float t = z < 0 ? -z : 0;
+      x += x >= 0 ? -t : t;
+      y += y >= 0 ? -t : t;
+      return vec3(x, y, z).normalize();
     }
 
     void get_values(unsigned slot, uint8_t *dest, unsigned dest_stride) {
@@ -224,24 +278,28 @@ namespace octet {
     }
 
     // set a vec4 value of an attribute (only when not in a vbo)
+    // integer kinds are scaled as get_value reads them, rounded and clamped.
     void set_value(unsigned slot, unsigned index, vec4 value) {
-      if (get_kind(slot) == GL_FLOAT) {
-        float *src = (float*)((uint8_t*)vertices->lock() + stride * index + get_offset(slot));
-        unsigned size = get_size(slot);
-        src[0] = value[0];
-        if (size > 1) src[1] = value[1];
-        if (size > 2) src[2] = value[2];
-        if (size > 3) src[3] = value[3];
-        vertices->unlock();
-  	  } else if (get_kind(slot) == GL_UNSIGNED_BYTE) {
-        uint8_t *src = (uint8_t*)((uint8_t*)vertices->lock() + stride * index + get_offset(slot));
-        unsigned size = get_size(slot);
-        src[0] = (uint8_t)( value[0] * 255.0f );
-        if (size > 1) src[1] = (uint8_t)( value[1] * 255.0f );
-        if (size > 2) src[2] = (uint8_t)( value[2] * 255.0f );
-        if (size > 3) src[3] = (uint8_t)( value[3] * 255.0f );
-        vertices->unlock();
+      unsigned kind = get_kind(slot);
+      unsigned size = get_size(slot);
+      bool norm = ( normalized >> slot & 1 ) != 0;
+      uint8_t *dest = (uint8_t*)vertices->lock() + stride * index + get_offset(slot);
+      for (unsigned i = 0; i != size; ++i) {
+        float v = value[i];
+        switch (kind) {
+          case GL_FLOAT: memcpy(dest + i * 4, &v, 4); break;
+          case GL_UNSIGNED_BYTE: dest[i] = (uint8_t)to_integer(norm ? v * 255 : v, 0, 255); break;
+          case GL_BYTE: ((int8_t*)dest)[i] = (int8_t)to_integer(norm ? v * 127 : v, -128, 127); break;
+          case GL_SHORT: ((int16_t*)dest)[i] = (int16_t)to_integer(norm ? v * 32767 : v, -32768, 32767); break;
+          case GL_UNSIGNED_SHORT: ((uint16_t*)dest)[i] = (uint16_t)to_integer(norm ? v * 65535 : v, 0, 65535); break;
+        }
       }
+      vertices->unlock();
+    }
+
+    // nearest integer to v in [min, max]
+    static int to_integer(float v, int min, int max) {
+      return v <= min ? min : v >= max ? max : (int)floorf(v + 0.5f);
     }
 
     unsigned get_index(unsigned index) const {
@@ -585,7 +643,25 @@ namespace octet {
       indices = value;
     }
 
-    void get_edges(hash_map<uint64_t, unsigned> &edges) {
+    // find the edges and neighbours of the triangles. see mesh_edges.
+    void get_edges(mesh_edges &edges) const {
+      dynarray<uint32_t> idx(num_indices);
+      if (mode != GL_TRIANGLES || num_indices == 0 || ( index_type != GL_UNSIGNED_SHORT && index_type != GL_UNSIGNED_INT )) {
+        edges.build(0, 0, 0);
+        return;
+      }
+      const void *ip = indices->lock_read_only();
+      for (unsigned i = 0; i != num_indices; ++i) {
+        idx[i] = index_type == GL_UNSIGNED_INT ? ((const uint32_t*)ip)[i] : ((const uint16_t*)ip)[i];
+        if (idx[i] >= num_vertices) {
+          indices->unlock_read_only();
+          OCTET_LOG_WARNING("get_edges: index %d out of range\n", idx[i]);
+          edges.build(0, 0, 0);
+          return;
+        }
+      }
+      indices->unlock_read_only();
+      edges.build(&idx[0], num_indices, num_vertices);
     }
   };
 }
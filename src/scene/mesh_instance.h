@@ -33,12 +33,12 @@ namespace octet {
     }
 
     // metadata visitor. Used for serialisation and script interface.
-    void visit(visitor &v) {
-      v.visit(node, atom_node);
-      v.visit(msh, atom_msh);
-      v.visit(mat, atom_mat);
-      v.visit(skel, atom_skel);
-    }
+    OCTET_FIELDS_BEGIN(mesh_instance)
+      OCTET_FIELD(node)
+      OCTET_FIELD(msh)
+      OCTET_FIELD(mat)
+      OCTET_FIELD(skel)
+    OCTET_FIELDS_END()
 
     //////////////////////////////
     //
@@ -50,9 +50,9 @@ namespace octet {
       set_num_vertices(num_quads * 4);
     }
 
-    void visit(visitor &v) {
-      mesh::visit(v);
-      v.visit(font, atom_font);
-    }
+    OCTET_FIELDS_BEGIN(mesh_text)
+      OCTET_FIELDS_BASE(mesh)
+      OCTET_FIELD(font)
+    OCTET_FIELDS_END()
   };
 }
@@ -47,10 +47,10 @@ namespace octet {
     }
 
     // access attributes by name
-    void visit(visitor &v) {
-      v.visit(kind, atom_kind);
-      v.visit(img, atom_image);
-    }
+    OCTET_FIELDS_BEGIN(param)
+      OCTET_FIELD(kind)
+      OCTET_FIELD_SID(img, atom_image)
+    OCTET_FIELDS_END()
 
     // generate a texture for this parameter
     GLuint get_gl_texture() {
@@ -0,0 +1,298 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Quantizer modifier. Make the vertices and indices smaller.
+//
+// Float attributes are replaced with smaller ones:
+//
+//   positions:          3 x normalized short against the bounds of the mesh
+//   normals:            2 x normalized short (octahedral)
+//   tangents:           3 x normalized byte
+//   uvs:                2 x normalized unsigned short against the uv bounds
+//   weights and colors: normalized unsigned bytes
+//   bone indices:       unsigned bytes
+//
+// uint32 indices become uint16 when there are few enough vertices.
+//
+// The scales and offsets go in mesh::get_attribute_decode() and bump_shader
+// decodes them. Other shaders only work with meshes that are not quantized.
+//
+// If the source is a simplifier, its levels of detail are quantized too.
+//
+// example:
+//
+//   mi->set_mesh(new quantizer(mi->get_mesh()));
+//
+
+namespace octet {
+  class quantizer : public mesh {
+    // source mesh. Provides underlying geometry.
+    ref<mesh> src;
+
+    // quantized copies of the levels of a simplifier
+    dynarray<ref<mesh> > lods;
+
+    // vertex and index buffer sizes for the last update(), including the levels
+    unsigned bytes_before;
+    unsigned bytes_after;
+
+    // how a slot is written
+    enum {
+      write_copy,
+      write_pos,
+      write_octahedral,
+      write_byte,
+      write_uv,
+      write_unit_ubyte,
+      write_ubyte,
+    };
+
+    static float clamp(float x, float lo, float hi) {
+      return x < lo ? lo : x > hi ? hi : x;
+    }
+
+    static int16_t to_short(float x) {
+      return (int16_t)floorf(clamp(x, -1, 1) * 32767 + 0.5f);
+    }
+
+    static unsigned get_bytes(mesh &msh) {
+      return msh.get_num_vertices() * msh.get_stride() + msh.get_num_indices() * kind_size(msh.get_index_type());
+    }
+
+    // fold the unit sphere onto an octahedron and the octahedron flat onto a square.
+    static void encode_octahedral(int16_t *dest, const float *n) {
+      float sum = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+      float x = sum > 0 ? n[0] / sum : 0;
+      float y = sum > 0 ? n[1] / sum : 0;
+      if (n[2] < 0) {
+        float fx = ( 1.0f - fabsf(y) ) * ( x >= 0 ? 1.0f : -1.0f );
+        float fy = ( 1.0f - fabsf(x) ) * ( y >= 0 ? 1.0f : -1.0f );
+        x = fx;
+        y = fy;
+      }
+      dest[0] = to_short(x);
+      dest[1] = to_short(y);
+    }
+
+    // uint32 indices to uint16
+    static void shorten_indices(mesh &msh) {
+      unsigned num_indices = msh.get_num_indices();
+      gl_resource *indices = new gl_resource(GL_ELEMENT_ARRAY_BUFFER, num_indices * 2);
+      const uint32_t *sip = (const uint32_t*)msh.get_indices()->lock_read_only();
+      uint16_t *dip = (uint16_t*)indices->lock();
+      for (unsigned i = 0; i != num_indices; ++i) {
+        dip[i] = (uint16_t)sip[i];
+      }
+      indices->unlock();
+      msh.get_indices()->unlock_read_only();
+      msh.set_indices(indices);
+      msh.set_params(msh.get_stride(), num_indices, msh.get_num_vertices(), msh.get_mode(), GL_UNSIGNED_SHORT);
+    }
+
+    // replace the buffers of msh with quantized ones.
+    static void quantize(mesh &msh) {
+      unsigned num_vertices = msh.get_num_vertices();
+      unsigned num_indices = msh.get_num_indices();
+      unsigned stride = msh.get_stride();
+      unsigned num_slots = msh.get_num_slots();
+      unsigned index_type = msh.get_index_type();
+      if (num_vertices == 0 || stride == 0) return;
+
+      unsigned attrs[16], sizes[16], kinds[16], offsets[16], norms[16], writes[16];
+      if (num_slots > 16) return;
+
+      const uint8_t *vp = (const uint8_t*)msh.get_vertices()->lock_read_only();
+
+      // choose the new format for each slot
+      vec4 decode[3] = { msh.get_attribute_decode()[0], msh.get_attribute_decode()[1], msh.get_attribute_decode()[2] };
+      unsigned new_stride = 0;
+      for (unsigned slot = 0; slot != num_slots; ++slot) {
+        unsigned attr = attrs[slot] = msh.get_attr(slot);
+        unsigned size = sizes[slot] = msh.get_size(slot);
+        unsigned kind = kinds[slot] = msh.get_kind(slot);
+        unsigned offset = msh.get_offset(slot);
+        norms[slot] = ( msh.get_normalized() >> slot ) & 1;
+        writes[slot] = write_copy;
+
+        if (kind == GL_FLOAT) {
+          // the range of each component
+          float lo[4] = { 1e37f, 1e37f, 1e37f, 1e37f }, hi[4] = { -1e37f, -1e37f, -1e37f, -1e37f };
+          bool integral = true;
+          for (unsigned v = 0; v != num_vertices; ++v) {
+            const float *p = (const float*)(vp + v * stride + offset);
+            for (unsigned j = 0; j != size; ++j) {
+              lo[j] = p[j] < lo[j] ? p[j] : lo[j];
+              hi[j] = p[j] > hi[j] ? p[j] : hi[j];
+              integral = integral && p[j] == floorf(p[j]);
+            }
+          }
+          float min_lo = lo[0], max_hi = hi[0];
+          for (unsigned j = 1; j != size; ++j) {
+            min_lo = lo[j] < min_lo ? lo[j] : min_lo;
+            max_hi = hi[j] > max_hi ? hi[j] : max_hi;
+          }
+
+          if (attr == attribute_pos && size == 3) {
+            writes[slot] = write_pos;
+            for (unsigned j = 0; j != 3; ++j) {
+              decode[0][j] = ( hi[j] - lo[j] ) * 0.5f;
+              decode[1][j] = ( hi[j] + lo[j] ) * 0.5f;
+            }
+          } else if (attr == attribute_normal && size == 3) {
+            writes[slot] = write_octahedral;
+            decode[0][3] = 1;
+          } else if (( attr == attribute_tangent || attr == attribute_bitangent ) && min_lo >= -1 && max_hi <= 1) {
+            writes[slot] = write_byte;
+          } else if (attr == attribute_uv && size == 2) {
+            writes[slot] = write_uv;
+            decode[2] = vec4(hi[0] - lo[0], hi[1] - lo[1], lo[0], lo[1]);
+          } else if (( attr == attribute_blendweight || attr == attribute_color ) && min_lo >= 0 && max_hi <= 1) {
+            writes[slot] = write_unit_ubyte;
+          } else if (attr == attribute_blendindices && integral && min_lo >= 0 && max_hi <= 255) {
+            writes[slot] = write_ubyte;
+          }
+        }
+
+        switch (writes[slot]) {
+          case write_pos: kinds[slot] = GL_SHORT; norms[slot] = 1; break;
+          case write_octahedral: kinds[slot] = GL_SHORT; sizes[slot] = 2; norms[slot] = 1; break;
+          case write_byte: kinds[slot] = GL_BYTE; norms[slot] = 1; break;
+          case write_uv: kinds[slot] = GL_UNSIGNED_SHORT; norms[slot] = 1; break;
+          case write_unit_ubyte: kinds[slot] = GL_UNSIGNED_BYTE; norms[slot] = 1; break;
+          case write_ubyte: kinds[slot] = GL_UNSIGNED_BYTE; norms[slot] = 0; break;
+        }
+
+        // keep attributes four byte aligned
+        offsets[slot] = new_stride;
+        new_stride += ( kind_size(kinds[slot]) * sizes[slot] + 3 ) & ~3;
+      }
+
+      bool small_indices = index_type == GL_UNSIGNED_INT && num_vertices <= 0x10000;
+      if (new_stride >= stride) {
+        msh.get_vertices()->unlock_read_only();
+        if (small_indices) shorten_indices(msh);
+        return;
+      }
+
+      // write the vertices
+      unsigned vsize = num_vertices * new_stride;
+      gl_resource *vertices = new gl_resource(GL_ARRAY_BUFFER, vsize);
+      uint8_t *dvp = (uint8_t*)vertices->lock();
+      memset(dvp, 0, vsize);
+      for (unsigned slot = 0; slot != num_slots; ++slot) {
+        unsigned offset = msh.get_offset(slot);
+        unsigned size = msh.get_size(slot);
+        unsigned bytes = kind_size(msh.get_kind(slot)) * size;
+        for (unsigned v = 0; v != num_vertices; ++v) {
+          const uint8_t *s = vp + v * stride + offset;
+          const float *f = (const float*)s;
+          uint8_t *d = dvp + v * new_stride + offsets[slot];
+          switch (writes[slot]) {
+            case write_copy: {
+              memcpy(d, s, bytes);
+            } break;
+            case write_pos: {
+              for (unsigned j = 0; j != 3; ++j) {
+                float x = decode[0][j] > 0 ? ( f[j] - decode[1][j] ) / decode[0][j] : 0;
+                ((int16_t*)d)[j] = to_short(x);
+              }
+            } break;
+            case write_octahedral: {
+              encode_octahedral((int16_t*)d, f);
+            } break;
+            case write_byte: {
+              for (unsigned j = 0; j != size; ++j) {
+                ((int8_t*)d)[j] = (int8_t)floorf(clamp(f[j], -1, 1) * 127 + 0.5f);
+              }
+            } break;
+            case write_uv: {
+              for (unsigned j = 0; j != 2; ++j) {
+                float x = decode[2][j] > 0 ? ( f[j] - decode[2][j+2] ) / decode[2][j] : 0;
+                ((uint16_t*)d)[j] = (uint16_t)floorf(clamp(x, 0, 1) * 65535 + 0.5f);
+              }
+            } break;
+            case write_unit_ubyte: {
+              for (unsigned j = 0; j != size; ++j) {
+                d[j] = (uint8_t)floorf(clamp(f[j], 0, 1) * 255 + 0.5f);
+              }
+            } break;
+            case write_ubyte: {
+              for (unsigned j = 0; j != size; ++j) {
+                d[j] = (uint8_t)f[j];
+              }
+            } break;
+          }
+        }
+      }
+      vertices->unlock();
+      msh.get_vertices()->unlock_read_only();
+
+      msh.set_vertices(vertices);
+      msh.set_params(new_stride, num_indices, num_vertices, msh.get_mode(), index_type);
+      if (small_indices) shorten_indices(msh);
+      msh.clear_attributes();
+      for (unsigned slot = 0; slot != num_slots; ++slot) {
+        msh.add_attribute(attrs[slot], sizes[slot], kinds[slot], offsets[slot], norms[slot]);
+      }
+      for (unsigned i = 0; i != 3; ++i) {
+        msh.set_attribute_decode(i, decode[i]);
+      }
+    }
+
+  public:
+    RESOURCE_META(quantizer)
+
+    quantizer(mesh *src=0) {
+      this->src = src;
+      bytes_before = bytes_after = 0;
+      update();
+    }
+
+    void update() {
+      lods.reset();
+      bytes_before = bytes_after = 0;
+      if (!src) return;
+
+      *(mesh*)this = *(mesh*)src;
+      bytes_before = get_bytes(*this);
+      quantize(*this);
+      bytes_after = get_bytes(*this);
+
+      simplifier *simp = src->get_simplifier();
+      for (unsigned level = 1; simp && level < simp->get_num_lods(); ++level) {
+        mesh *lod = new mesh();
+        *lod = *simp->get_lod(level);
+        bytes_before += get_bytes(*lod);
+        quantize(*lod);
+        bytes_after += get_bytes(*lod);
+        lods.push_back(lod);
+      }
+
+      OCTET_LOG_INFO("quantizer: %d bytes -> %d bytes\n", bytes_before, bytes_after);
+    }
+
+    unsigned get_bytes_before() const {
+      return bytes_before;
+    }
+
+    unsigned get_bytes_after() const {
+      return bytes_after;
+    }
+
+    // use the source's choice of level
+    mesh *get_lod(float pixels_per_unit, float max_pixel_error) {
+      simplifier *simp = src ? src->get_simplifier() : 0;
+      unsigned level = simp ? simp->get_lod_level(pixels_per_unit, max_pixel_error) : 0;
+      return level == 0 || level > lods.size() ? (mesh*)this : (mesh*)lods[level - 1];
+    }
+
+    OCTET_FIELDS_BEGIN(quantizer)
+      OCTET_FIELDS_BASE(mesh)
+      OCTET_FIELD(src)
+      OCTET_FIELD(lods)
+    OCTET_FIELDS_END()
+  };
+}
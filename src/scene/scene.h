@@ -42,6 +42,22 @@ namespace octet {
 
     int frame_number;
 
+    // meshes with levels of detail use the simplest level that is this many pixels from the full mesh
+    float lod_pixel_error;
+
+    // how many pixels a unit of model space covers at the nearest point of a bounding box.
+    // very large if the box reaches the camera.
+    static float get_pixels_per_unit(const aabb &bb, const mat4t &modelToCamera, const mat4t &cameraToProjection, float viewport_height) {
+      float scale = max(max(modelToCamera.x().xyz().length(), modelToCamera.y().xyz().length()), modelToCamera.z().xyz().length());
+      float w = ( bb.get_center().xyz1() * modelToCamera * cameraToProjection ).w();
+      if (cameraToProjection[3][3] == 0) {
+        // perspective: w is the distance in front of the camera
+        w -= length(bb.get_half_extent()) * scale;
+      }
+      if (w <= 0) return 1e30f;
+      return 0.5f * viewport_height * cameraToProjection[1][1] * scale / w;
+    }
+
     void draw_aabb(const aabb &bb) {
       vec3 pos[8];
       for (int i = 0; i != 8; ++i) {
@@ -130,7 +146,7 @@ namespace octet {
           vec4 pos1 = pos.xyz1();
           vec4 world_pos = pos1 * modelToWorld;
           vec4 proj_pos = pos1 * modelToProjection;
-          app_utils::log("%5d i=%5d m=[%9.3f, %9.3f, %9.3f] w=[%9.3f, %9.3f, %9.3f] p=[%9.3f, %9.3f, %9.3f]\n",
+          OCTET_LOG_DEBUG("%5d i=%5d m=[%9.3f, %9.3f, %9.3f] w=[%9.3f, %9.3f, %9.3f] p=[%9.3f, %9.3f, %9.3f]\n",
             i, index,
             pos.x(), pos.y(), pos.z(),
             world_pos.x(), world_pos.y(), world_pos.z(),
@@ -183,6 +199,9 @@ namespace octet {
 
       draw_debug_data(object_shader, cam);
 
+      GLint viewport[4];
+      glGetIntegerv(GL_VIEWPORT, viewport);
+
       for (unsigned mesh_index = 0; mesh_index != mesh_instances.size(); ++mesh_index) {
         mesh_instance *mi = mesh_instances[mesh_index];
         mesh *msh = mi->get_mesh();
@@ -195,17 +214,23 @@ namespace octet {
         mat4t modelToProjection;
         cam.get_matrices(modelToProjection, modelToCamera, modelToWorld);
 
+        // pick a level of detail from the size on the screen
+        float pixels_per_unit = get_pixels_per_unit(msh->get_aabb(), modelToCamera, cameraToProjection, (float)viewport[3]);
+        msh = msh->get_lod(pixels_per_unit, lod_pixel_error);
+
         if (!skel || !skn) {
           // normal rendering for single matrix objects
           // build a projection matrix: model -> world -> camera_instance -> projection
           // the projection space is the cube -1 <= x/w, y/w, z/w <= 1
           mat->render(object_shader, modelToProjection, modelToCamera, light_uniforms, num_light_uniforms, num_lights);
+          object_shader.set_attribute_decode(msh->get_attribute_decode());
         } else {
           // multi-matrix rendering
           mat4t *transforms = skel->calc_transforms(modelToCamera, skn);
           int num_bones = skel->get_num_bones();
           assert(num_bones < 64);
           mat->render_skinned(skin_shader, cameraToProjection, transforms, num_bones, light_uniforms, num_light_uniforms, num_lights);
+          skin_shader.set_attribute_decode(msh->get_attribute_decode());
         }
         msh->enable_attributes();
         msh->draw();
@@ -222,6 +247,7 @@ namespace octet {
       num_light_uniforms = 0;
       num_lights = 0;
       render_aabbs = false;
+      lod_pixel_error = 1.0f;
       dump_vertices = false;
       render_debug_lines = false;
       debug_material = new material(vec4(1, 0, 0, 1));
@@ -231,13 +257,13 @@ namespace octet {
       debug_in_ptr = 0;
     }
 
-    void visit(visitor &v) {
-      scene_node::visit(v);
-      v.visit(mesh_instances, atom_mesh_instances);
-      v.visit(animation_instances, atom_animation_instances);
-      v.visit(camera_instances, atom_camera_instances);
-      v.visit(light_instances, atom_light_instances);
-    }
+    OCTET_FIELDS_BEGIN(scene)
+      OCTET_FIELDS_BASE(scene_node)
+      OCTET_FIELD(mesh_instances)
+      OCTET_FIELD(animation_instances)
+      OCTET_FIELD(camera_instances)
+      OCTET_FIELD(light_instances)
+    OCTET_FIELDS_END()
 
     static float max(float x, float y) {
       return x > y ? x : y;
@@ -331,6 +357,11 @@ namespace octet {
       render_aabbs = value;
     }
 
+    // 0 always draws the full meshes
+    void set_lod_pixel_error(float value) {
+      lod_pixel_error = value;
+    }
+
     // debugging aid to draw debug lines
     void set_render_debug_lines(bool value) {
       render_debug_lines = value;
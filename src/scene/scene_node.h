@@ -54,15 +54,12 @@ namespace octet {
     //
     // visitor pattern used for game saves/loads (serialisation)
     //
-    void visit(visitor &v) {
-      app_utils::log("visit scene_node\n");
-      v.visit(parent, atom_parent);
-      app_utils::log("visit scene_node children\n");
-      v.visit(children, atom_children);
-      app_utils::log("visit scene_node nodeToParent\n");
-      v.visit(nodeToParent, atom_nodeToParent);
-      v.visit(sid, atom_sid);
-    }
+    OCTET_FIELDS_BEGIN(scene_node)
+      OCTET_FIELD(parent)
+      OCTET_FIELD(children)
+      OCTET_FIELD(nodeToParent)
+      OCTET_FIELD(sid)
+    OCTET_FIELDS_END()
 
     void add_child(scene_node *new_node) {
       new_node->parent = this;
@@ -0,0 +1,795 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012, 2013
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Simplifier modifier. Build levels of detail for a mesh.
+//
+// The mesh itself is the full detail level. Each extra level has about half
+// the triangles of the one before. Edges are collapsed in order of quadric
+// error (Garland and Heckbert) plus a penalty for the change in normals, uvs
+// and skin weights across the edge.
+//
+// Collapses move one position onto a neighbouring one. Each vertex at the
+// old position is merged with the vertex at the new position that shares a
+// triangle on the collapsed edge, so normals, uvs and skin weights are never
+// blended and seams along the edge stay where they are. A vertex that no
+// such triangle reaches is merged with a vertex at the new position that has
+// the same attributes, or keeps its own attributes, so meshes with flat
+// normals (where no vertices can be shared) still simplify.
+// Open borders only collapse along the border.
+//
+// The error of a level is measured: the largest distance from a source
+// position to the level, or from a grid of points on a level triangle to the
+// source triangles collapsed into its corners.
+//
+// The scene picks a level for each mesh instance from the error of the level
+// in pixels. See scene::render_impl.
+//
+// example:
+//
+//   mi->set_mesh(new simplifier(new indexer(mi->get_mesh())));
+//
+// or, to simplify many meshes at once on worker threads:
+//
+//   simplifier *s = new simplifier(new indexer(msh), false);
+//   ...
+//   simplifier::update_all(list, count);
+//
+
+namespace octet {
+  class simplifier : public mesh {
+    enum {
+      max_levels = 8,
+
+      // don't make levels with fewer triangles than this
+      min_triangles = 32,
+
+      // most neighbours of one position that we look at
+      max_neighbours = 64,
+
+      max_attributes = 16,
+
+      // most vertices at one position that we merge in one collapse
+      max_merges = 16,
+
+      // points along each edge of a level triangle where we measure the error
+      sample_steps = 4,
+    };
+
+    // area weighted sum of plane equations
+    struct quadric {
+      double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+      double weight;
+
+      void clear() {
+        memset(this, 0, sizeof(*this));
+      }
+
+      void add_plane(double a, double b, double c, double d, double w) {
+        a00 += w*a*a; a01 += w*a*b; a02 += w*a*c; a03 += w*a*d;
+        a11 += w*b*b; a12 += w*b*c; a13 += w*b*d;
+        a22 += w*c*c; a23 += w*c*d;
+        a33 += w*d*d;
+        weight += w;
+      }
+
+      void add(const quadric &r) {
+        a00 += r.a00; a01 += r.a01; a02 += r.a02; a03 += r.a03;
+        a11 += r.a11; a12 += r.a12; a13 += r.a13;
+        a22 += r.a22; a23 += r.a23;
+        a33 += r.a33;
+        weight += r.weight;
+      }
+
+      // weighted sum of squared distances from the planes
+      double get_sum(const vec3 &p) const {
+        double x = p.x(), y = p.y(), z = p.z();
+        return
+          a00*x*x + 2*a01*x*y + 2*a02*x*z + 2*a03*x +
+          a11*y*y + 2*a12*y*z + 2*a13*y +
+          a22*z*z + 2*a23*z +
+          a33
+        ;
+      }
+    };
+
+    struct attribute_info {
+      unsigned offset;
+      unsigned size;
+      unsigned kind;
+      bool normalized;
+    };
+
+    struct candidate {
+      unsigned from;
+      unsigned to;
+      float cost;
+    };
+
+    // a finished level, before it gets buffers
+    struct level {
+      dynarray<uint8_t> vertices;
+      dynarray<uint32_t> indices;
+      unsigned num_vertices;
+      float error;
+    };
+
+    // source mesh. Provides underlying geometry.
+    ref<mesh> src;
+
+    // coarser levels and their errors in model units
+    dynarray<ref<mesh> > lods;
+    dynarray<float> lod_errors;
+
+    // an attribute difference of 1 costs as much as this fraction of the mesh size
+    float attribute_weight;
+
+    // copies of the source for build()
+    dynarray<uint8_t> src_vertices;
+    dynarray<uint32_t> src_indices;
+    dynarray<level*> pending;
+
+    // how different the attributes (other than position) of two vertices are
+    static float get_attribute_distance(const uint8_t *a, const uint8_t *b, const attribute_info *attrs, unsigned num_attrs) {
+      float dist = 0;
+      for (unsigned i = 0; i != num_attrs; ++i) {
+        const attribute_info &ai = attrs[i];
+        if (ai.kind == GL_FLOAT) {
+          for (unsigned j = 0; j != ai.size; ++j) {
+            float fa, fb;
+            memcpy(&fa, a + ai.offset + j * 4, 4);
+            memcpy(&fb, b + ai.offset + j * 4, 4);
+            dist += ( fa - fb ) * ( fa - fb );
+          }
+        } else if (ai.kind == GL_UNSIGNED_BYTE && ai.normalized) {
+          for (unsigned j = 0; j != ai.size; ++j) {
+            float d = ( a[ai.offset + j] - b[ai.offset + j] ) * ( 1.0f / 255 );
+            dist += d * d;
+          }
+        } else if (memcmp(a + ai.offset, b + ai.offset, ai.size * kind_size(ai.kind))) {
+          // eg. bone indices: any change is a big change
+          dist += 1;
+        }
+      }
+      return dist;
+    }
+
+    // sort candidates by cost. costs are positive, so the float bits sort like integers.
+    static void sort_candidates(dynarray<candidate> &cands) {
+      unsigned size = cands.size();
+      dynarray<candidate> tmp(size);
+      for (unsigned shift = 0; shift != 32; shift += 16) {
+        dynarray<unsigned> count(0x10001);
+        memset(&count[0], 0, count.size() * sizeof(count[0]));
+        for (unsigned i = 0; i != size; ++i) {
+          uint32_t bits;
+          memcpy(&bits, &cands[i].cost, 4);
+          count[( ( bits >> shift ) & 0xffff ) + 1]++;
+        }
+        for (unsigned i = 0; i != 0x10000; ++i) {
+          count[i + 1] += count[i];
+        }
+        for (unsigned i = 0; i != size; ++i) {
+          uint32_t bits;
+          memcpy(&bits, &cands[i].cost, 4);
+          tmp[count[( bits >> shift ) & 0xffff]++] = cands[i];
+        }
+        memcpy(&cands[0], &tmp[0], size * sizeof(candidate));
+      }
+    }
+
+    // attribute distances at most this are the same vertex
+    static float same_attributes() {
+      return 1e-8f;
+    }
+
+    // add a corner of a source triangle to the list for position g
+    static void add_source(dynarray<unsigned> &head, dynarray<unsigned> &tail, dynarray<unsigned> &next, unsigned g, unsigned corner) {
+      next[corner] = ~0u;
+      if (head[g] == ~0u) {
+        head[g] = corner;
+      } else {
+        next[tail[g]] = corner;
+      }
+      tail[g] = corner;
+    }
+
+    // distance from p to the closest point on triangle abc
+    static float get_triangle_distance(const vec3 &p, const vec3 &a, const vec3 &b, const vec3 &c) {
+      vec3 ab = b - a, ac = c - a, ap = p - a;
+      float d1 = dot(ab, ap), d2 = dot(ac, ap);
+      if (d1 <= 0 && d2 <= 0) return length(ap);
+      vec3 bp = p - b;
+      float d3 = dot(ab, bp), d4 = dot(ac, bp);
+      if (d3 >= 0 && d4 <= d3) return length(bp);
+      vec3 cp = p - c;
+      float d5 = dot(ab, cp), d6 = dot(ac, cp);
+      if (d6 >= 0 && d5 <= d6) return length(cp);
+      float vc = d1 * d4 - d3 * d2;
+      if (vc <= 0 && d1 >= 0 && d3 <= 0) return length(ap - ab * ( d1 / ( d1 - d3 ) ));
+      float vb = d5 * d2 - d1 * d6;
+      if (vb <= 0 && d2 >= 0 && d6 <= 0) return length(ap - ac * ( d2 / ( d2 - d6 ) ));
+      float va = d3 * d6 - d5 * d4;
+      if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) return length(bp - ( c - b ) * ( ( d4 - d3 ) / ( ( d4 - d3 ) + ( d5 - d6 ) ) ));
+      float denom = 1.0f / ( va + vb + vc );
+      return length(ap - ab * ( vb * denom ) - ac * ( vc * denom ));
+    }
+
+    static unsigned find_merge(const unsigned *from, unsigned num_merges, unsigned v) {
+      for (unsigned m = 0; m != num_merges; ++m) {
+        if (from[m] == v) return m;
+      }
+      return ~0u;
+    }
+
+    // v becomes to. false if there is no room or v is already going somewhere.
+    static bool add_merge(unsigned *from, unsigned *to, unsigned &num_merges, unsigned v, unsigned target) {
+      if (num_merges == max_merges || find_merge(from, num_merges, v) != ~0u) return false;
+      from[num_merges] = v;
+      to[num_merges] = target;
+      num_merges++;
+      return true;
+    }
+
+    // the live triangles around each position
+    static void get_triangles(dynarray<unsigned> &tri_start, dynarray<unsigned> &tri_list, const dynarray<uint32_t> &indices, const dynarray<unsigned> &group, const dynarray<uint8_t> &live, unsigned num_groups) {
+      unsigned num_triangles = live.size();
+      tri_start.resize(num_groups + 1);
+      memset(&tri_start[0], 0, ( num_groups + 1 ) * sizeof(tri_start[0]));
+      for (unsigned t = 0; t != num_triangles; ++t) {
+        if (!live[t]) continue;
+        for (unsigned j = 0; j != 3; ++j) tri_start[group[indices[t*3+j]] + 1]++;
+      }
+      for (unsigned g = 0; g != num_groups; ++g) tri_start[g + 1] += tri_start[g];
+      tri_list.resize(tri_start[num_groups]);
+      dynarray<unsigned> fill(num_groups);
+      memcpy(&fill[0], &tri_start[0], num_groups * sizeof(fill[0]));
+      for (unsigned t = 0; t != num_triangles; ++t) {
+        if (!live[t]) continue;
+        for (unsigned j = 0; j != 3; ++j) tri_list[fill[group[indices[t*3+j]]]++] = t;
+      }
+    }
+
+    // make the levels from src_vertices and src_indices. no GL calls, so this runs on worker threads.
+    void build() {
+      unsigned stride = get_stride();
+      unsigned num_vertices = get_num_vertices();
+      unsigned num_triangles = src_indices.size() / 3;
+      unsigned pos_slot = get_slot(attribute_pos);
+      if (num_triangles < min_triangles * 2 || pos_slot == ~0u || get_kind(pos_slot) != GL_FLOAT || get_size(pos_slot) != 3) {
+        return;
+      }
+      unsigned pos_offset = get_offset(pos_slot);
+      const uint8_t *vp = &src_vertices[0];
+
+      attribute_info attrs[max_attributes];
+      unsigned num_attrs = 0;
+      for (unsigned slot = 0; slot != get_num_slots() && num_attrs != max_attributes; ++slot) {
+        if (slot == pos_slot) continue;
+        attribute_info &ai = attrs[num_attrs++];
+        ai.offset = get_offset(slot);
+        ai.size = get_size(slot);
+        ai.kind = get_kind(slot);
+        ai.normalized = ( get_normalized() >> slot & 1 ) != 0;
+      }
+
+      // vertices in the same place share a position. collapses move positions, not vertices.
+      dynarray<unsigned> group(num_vertices);
+      dynarray<vec3> positions;
+      {
+        unsigned table_size = 16;
+        while (table_size < num_vertices * 2) table_size *= 2;
+        dynarray<unsigned> table(table_size);
+        memset(&table[0], 0xff, table_size * sizeof(table[0]));
+        for (unsigned v = 0; v != num_vertices; ++v) {
+          float p[3];
+          memcpy(p, vp + v * stride + pos_offset, sizeof(p));
+          p[0] += 0.0f; p[1] += 0.0f; p[2] += 0.0f; // -0 is 0
+          uint64_t hash = app_utils::hash64(p, sizeof(p));
+          for (unsigned slot = (unsigned)hash & ( table_size - 1 ); ; slot = ( slot + 1 ) & ( table_size - 1 )) {
+            unsigned g = table[slot];
+            if (g == ~0u) {
+              g = table[slot] = positions.size();
+              positions.push_back(vec3(p[0], p[1], p[2]));
+              group[v] = g;
+              break;
+            } else if (positions[g].x() == p[0] && positions[g].y() == p[1] && positions[g].z() == p[2]) {
+              group[v] = g;
+              break;
+            }
+          }
+        }
+      }
+      unsigned num_groups = positions.size();
+
+      dynarray<uint32_t> indices(num_triangles * 3);
+      memcpy(&indices[0], &src_indices[0], num_triangles * 3 * sizeof(indices[0]));
+
+      // plane quadrics for each position, and the size of the mesh.
+      dynarray<quadric> quadrics(num_groups);
+      memset(&quadrics[0], 0, num_groups * sizeof(quadric));
+
+      // the source triangles collapsed into each position and where each position has gone.
+      dynarray<unsigned> src_group(num_vertices);
+      memcpy(&src_group[0], &group[0], num_vertices * sizeof(src_group[0]));
+      dynarray<unsigned> src_head(num_groups);
+      dynarray<unsigned> src_tail(num_groups);
+      dynarray<unsigned> src_next(num_triangles * 3);
+      memset(&src_head[0], 0xff, num_groups * sizeof(src_head[0]));
+      memset(&src_tail[0], 0xff, num_groups * sizeof(src_tail[0]));
+      dynarray<unsigned> collapsed_to(num_groups);
+      for (unsigned g = 0; g != num_groups; ++g) collapsed_to[g] = g;
+      dynarray<uint8_t> live(num_triangles);
+      unsigned num_live = 0;
+      vec3 bb_min = positions[0], bb_max = positions[0];
+      for (unsigned g = 0; g != num_groups; ++g) {
+        bb_min = min(bb_min, positions[g]);
+        bb_max = max(bb_max, positions[g]);
+      }
+      float size = length(bb_max - bb_min);
+      for (unsigned t = 0; t != num_triangles; ++t) {
+        unsigned g0 = group[indices[t*3+0]], g1 = group[indices[t*3+1]], g2 = group[indices[t*3+2]];
+        live[t] = g0 != g1 && g1 != g2 && g2 != g0;
+        if (!live[t]) continue;
+        num_live++;
+        add_source(src_head, src_tail, src_next, g0, t * 3 + 0);
+        add_source(src_head, src_tail, src_next, g1, t * 3 + 1);
+        add_source(src_head, src_tail, src_next, g2, t * 3 + 2);
+        vec3 n = cross(positions[g1] - positions[g0], positions[g2] - positions[g0]);
+        float len = n.length();
+        if (len == 0) continue;
+        n = n * ( 1.0f / len );
+        double d = -dot(n, positions[g0]);
+        quadrics[g0].add_plane(n.x(), n.y(), n.z(), d, len * 0.5f);
+        quadrics[g1].add_plane(n.x(), n.y(), n.z(), d, len * 0.5f);
+        quadrics[g2].add_plane(n.x(), n.y(), n.z(), d, len * 0.5f);
+      }
+      float attr_scale = attribute_weight * size * attribute_weight * size;
+
+      // work space for each pass
+      dynarray<unsigned> tri_start;
+      dynarray<unsigned> tri_list;
+      dynarray<uint8_t> locked(num_groups);
+      dynarray<candidate> cands;
+
+      // keep borders in place with planes at right angles to the border faces
+      get_triangles(tri_start, tri_list, indices, group, live, num_groups);
+      for (unsigned t = 0; t != num_triangles; ++t) {
+        if (!live[t]) continue;
+        unsigned g[3] = { group[indices[t*3+0]], group[indices[t*3+1]], group[indices[t*3+2]] };
+        vec3 n = cross(positions[g[1]] - positions[g[0]], positions[g[2]] - positions[g[0]]);
+        for (unsigned j = 0; j != 3; ++j) {
+          unsigned a = g[j], b = g[(j+1)%3];
+          unsigned count = 0;
+          for (unsigned i = tri_start[a]; i != tri_start[a + 1]; ++i) {
+            const uint32_t *idx = &indices[tri_list[i] * 3];
+            count += group[idx[0]] == b || group[idx[1]] == b || group[idx[2]] == b;
+          }
+          if (count != 1) continue;
+          vec3 edge = positions[b] - positions[a];
+          vec3 bn = cross(edge, n);
+          float len = bn.length();
+          if (len == 0) continue;
+          bn = bn * ( 1.0f / len );
+          double d = -dot(bn, positions[a]);
+          double w = dot(edge, edge) * 10;
+          quadrics[a].add_plane(bn.x(), bn.y(), bn.z(), d, w);
+          quadrics[b].add_plane(bn.x(), bn.y(), bn.z(), d, w);
+        }
+      }
+
+      float max_error = 0;
+      unsigned prev_live = num_live;
+      unsigned target = num_live / 2;
+
+      while (pending.size() < max_levels) {
+        while (num_live > target) {
+          get_triangles(tri_start, tri_list, indices, group, live, num_groups);
+
+          // the best collapse for each position
+          cands.resize(0);
+          for (unsigned g0 = 0; g0 != num_groups; ++g0) {
+            unsigned nb_group[max_neighbours], nb_count[max_neighbours];
+            float nb_attr[max_neighbours];
+            unsigned num_nb = 0;
+            bool ok = tri_start[g0] != tri_start[g0 + 1];
+            for (unsigned i = tri_start[g0]; ok && i != tri_start[g0 + 1]; ++i) {
+              const uint32_t *idx = &indices[tri_list[i] * 3];
+              unsigned j = group[idx[0]] == g0 ? 0 : group[idx[1]] == g0 ? 1 : 2;
+              const uint8_t *a = vp + idx[j] * stride;
+              for (unsigned k = 1; ok && k != 3; ++k) {
+                unsigned b = idx[(j+k)%3];
+                unsigned gb = group[b];
+                float ad = get_attribute_distance(a, vp + b * stride, attrs, num_attrs);
+                unsigned n = 0;
+                while (n != num_nb && nb_group[n] != gb) ++n;
+                if (n == num_nb) {
+                  if (num_nb == max_neighbours) { ok = false; break; }
+                  nb_group[n] = gb;
+                  nb_count[n] = 0;
+                  nb_attr[n] = 0;
+                  num_nb++;
+                }
+                nb_count[n]++;
+                nb_attr[n] = nb_attr[n] > ad ? nb_attr[n] : ad;
+              }
+            }
+            if (!ok) continue;
+
+            // interior positions have no border edges, border positions have two. leave anything else alone.
+            unsigned num_border = 0;
+            for (unsigned n = 0; n != num_nb; ++n) {
+              if (nb_count[n] > 2) ok = false;
+              num_border += nb_count[n] == 1;
+            }
+            if (!ok || ( num_border != 0 && num_border != 2 )) continue;
+
+            candidate best = { g0, ~0u, 0 };
+            for (unsigned n = 0; n != num_nb; ++n) {
+              if (num_border && nb_count[n] != 1) continue;
+              unsigned g1 = nb_group[n];
+              const quadric &q0 = quadrics[g0], &q1 = quadrics[g1];
+              double sum = q0.get_sum(positions[g1]) + q1.get_sum(positions[g1]);
+              double weight = q0.weight + q1.weight;
+              float error = weight > 0 && sum > 0 ? (float)( sum / weight ) : 0.0f;
+              float cost = error + nb_attr[n] * attr_scale;
+              if (best.to == ~0u || cost < best.cost) {
+                best.to = g1;
+                best.cost = cost;
+              }
+            }
+            if (best.to != ~0u) cands.push_back(best);
+          }
+
+          sort_candidates(cands);
+
+          // do the cheapest collapses that don't touch each other
+          memset(&locked[0], 0, num_groups);
+          unsigned num_collapsed = 0;
+          for (unsigned c = 0; c != cands.size() && num_live > target; ++c) {
+            unsigned g0 = cands[c].from, g1 = cands[c].to;
+            if (locked[g0] || locked[g1]) continue;
+
+            // the positions next to both ends must be the far corners of the triangles on the edge,
+            // and no triangle may turn over.
+            unsigned edge_tris = 0, common = 0;
+            bool ok = true;
+            for (unsigned i = tri_start[g0]; ok && i != tri_start[g0 + 1]; ++i) {
+              unsigned t = tri_list[i];
+              const uint32_t *idx = &indices[t * 3];
+              unsigned g[3] = { group[idx[0]], group[idx[1]], group[idx[2]] };
+              if (g[0] == g1 || g[1] == g1 || g[2] == g1) {
+                edge_tris++;
+                continue;
+              }
+              vec3 p0 = positions[g[0]], p1 = positions[g[1]], p2 = positions[g[2]];
+              vec3 before = cross(p1 - p0, p2 - p0);
+              if (g[0] == g0) p0 = positions[g1]; else if (g[1] == g0) p1 = positions[g1]; else p2 = positions[g1];
+              vec3 after = cross(p1 - p0, p2 - p0);
+              ok = dot(before, after) > 0 || dot(before, before) == 0;
+            }
+            if (!ok) continue;
+
+            unsigned nb[max_neighbours];
+            unsigned num_nb = 0;
+            for (unsigned i = tri_start[g0]; ok && i != tri_start[g0 + 1]; ++i) {
+              const uint32_t *idx = &indices[tri_list[i] * 3];
+              for (unsigned j = 0; ok && j != 3; ++j) {
+                unsigned gn = group[idx[j]];
+                if (gn == g0 || gn == g1) continue;
+                unsigned n = 0;
+                while (n != num_nb && nb[n] != gn) ++n;
+                if (n != num_nb) continue;
+                if (num_nb == max_neighbours) { ok = false; break; }
+                nb[num_nb++] = gn;
+
+                // is gn next to g1 too?
+                bool found = false;
+                for (unsigned k = tri_start[g1]; !found && k != tri_start[g1 + 1]; ++k) {
+                  const uint32_t *idx1 = &indices[tri_list[k] * 3];
+                  found = group[idx1[0]] == gn || group[idx1[1]] == gn || group[idx1[2]] == gn;
+                }
+                common += found;
+              }
+            }
+            if (!ok || common > edge_tris) continue;
+
+            // collapse: the triangles on the edge go and the rest move to g1.
+            // vertices are shared between triangles, so decide which triangles go before moving any.
+            // a vertex at g0 on an edge triangle merges with the vertex at g1 on the same triangle.
+            unsigned merge_from[max_merges], merge_to[max_merges];
+            unsigned num_merges = 0;
+            for (unsigned i = tri_start[g0]; i != tri_start[g0 + 1]; ++i) {
+              unsigned t = tri_list[i];
+              const uint32_t *idx = &indices[t * 3];
+              unsigned g[3] = { group[idx[0]], group[idx[1]], group[idx[2]] };
+              for (unsigned j = 0; j != 3; ++j) locked[g[j]] = 1;
+              if (g[0] == g1 || g[1] == g1 || g[2] == g1) {
+                live[t] = 0;
+                num_live--;
+                unsigned v0 = idx[g[0] == g0 ? 0 : g[1] == g0 ? 1 : 2];
+                unsigned v1 = idx[g[0] == g1 ? 0 : g[1] == g1 ? 1 : 2];
+                add_merge(merge_from, merge_to, num_merges, v0, v1);
+              }
+            }
+
+            // other vertices at g0 merge with a vertex at g1 with the same attributes, or move on their own.
+            for (unsigned i = tri_start[g0]; i != tri_start[g0 + 1]; ++i) {
+              unsigned t = tri_list[i];
+              const uint32_t *idx = &indices[t * 3];
+              for (unsigned j = 0; live[t] && j != 3; ++j) {
+                unsigned v = idx[j];
+                if (group[v] != g0 || find_merge(merge_from, num_merges, v) != ~0u) continue;
+                unsigned same = ~0u;
+                for (unsigned k = tri_start[g1]; same == ~0u && k != tri_start[g1 + 1]; ++k) {
+                  const uint32_t *idx1 = &indices[tri_list[k] * 3];
+                  for (unsigned j1 = 0; j1 != 3; ++j1) {
+                    unsigned w = idx1[j1];
+                    if (group[w] == g1 && get_attribute_distance(vp + v * stride, vp + w * stride, attrs, num_attrs) <= same_attributes()) {
+                      same = w;
+                      break;
+                    }
+                  }
+                }
+                if (same == ~0u || !add_merge(merge_from, merge_to, num_merges, v, same)) {
+                  group[v] = g1;
+                }
+              }
+            }
+
+            for (unsigned i = tri_start[g0]; i != tri_start[g0 + 1]; ++i) {
+              unsigned t = tri_list[i];
+              uint32_t *idx = &indices[t * 3];
+              for (unsigned j = 0; live[t] && j != 3; ++j) {
+                unsigned m = find_merge(merge_from, num_merges, idx[j]);
+                if (m != ~0u) idx[j] = merge_to[m];
+              }
+            }
+            for (unsigned m = 0; m != num_merges; ++m) {
+              group[merge_from[m]] = g1;
+            }
+
+            if (src_head[g0] != ~0u) {
+              if (src_head[g1] == ~0u) {
+                src_head[g1] = src_head[g0];
+              } else {
+                src_next[src_tail[g1]] = src_head[g0];
+              }
+              src_tail[g1] = src_tail[g0];
+              src_head[g0] = src_tail[g0] = ~0u;
+            }
+            collapsed_to[g0] = g1;
+
+            quadrics[g1].add(quadrics[g0]);
+            locked[g0] = locked[g1] = 1;
+            num_collapsed++;
+          }
+
+          if (num_collapsed == 0) break;
+        }
+
+        // stop if we could not get much further.
+        if (num_live > prev_live - prev_live / 10) break;
+
+        // measure the distance between the level and the source both ways.
+        get_triangles(tri_start, tri_list, indices, group, live, num_groups);
+        for (unsigned g = 0; g != num_groups; ++g) {
+          unsigned to = g;
+          while (collapsed_to[to] != to) to = collapsed_to[to];
+          collapsed_to[g] = to;
+          float best = 1e30f;
+          for (unsigned i = tri_start[to]; i != tri_start[to + 1] && best > max_error; ++i) {
+            const uint32_t *idx = &indices[tri_list[i] * 3];
+            float dist = get_triangle_distance(positions[g], positions[group[idx[0]]], positions[group[idx[1]]], positions[group[idx[2]]]);
+            best = dist < best ? dist : best;
+          }
+          if (tri_start[to] != tri_start[to + 1] && best > max_error) max_error = best;
+        }
+        for (unsigned t = 0; t != num_triangles; ++t) {
+          if (!live[t]) continue;
+          unsigned g[3] = { group[indices[t*3+0]], group[indices[t*3+1]], group[indices[t*3+2]] };
+          const vec3 &a = positions[g[0]], &b = positions[g[1]], &c = positions[g[2]];
+          // a grid of points over the triangle, skipping the corners
+          for (unsigned i = 0; i <= sample_steps; ++i) {
+            for (unsigned j = 0; i + j <= sample_steps; ++j) {
+              if (i + j == 0 || i == sample_steps || j == sample_steps) continue;
+              vec3 sample = a + ( b - a ) * ( (float)i / sample_steps ) + ( c - a ) * ( (float)j / sample_steps );
+              float best = 1e30f;
+              for (unsigned k = 0; k != 3 && best > max_error; ++k) {
+                for (unsigned e = src_head[g[k]]; e != ~0u && best > max_error; e = src_next[e]) {
+                  const uint32_t *idx = &src_indices[e / 3 * 3];
+                  float dist = get_triangle_distance(sample, positions[src_group[idx[0]]], positions[src_group[idx[1]]], positions[src_group[idx[2]]]);
+                  best = dist < best ? dist : best;
+                }
+              }
+              if (best > max_error) max_error = best;
+            }
+          }
+        }
+
+        level *lv = new level();
+        dynarray<unsigned> remap(num_vertices);
+        memset(&remap[0], 0xff, num_vertices * sizeof(remap[0]));
+        lv->num_vertices = 0;
+        lv->error = max_error;
+        for (unsigned t = 0; t != num_triangles; ++t) {
+          if (!live[t]) continue;
+          for (unsigned j = 0; j != 3; ++j) {
+            unsigned v = indices[t*3+j];
+            unsigned &r = remap[v];
+            if (r == ~0u) {
+              r = lv->num_vertices++;
+              unsigned old_size = lv->vertices.size();
+              lv->vertices.resize(old_size + stride);
+              memcpy(&lv->vertices[old_size], vp + v * stride, stride);
+              const vec3 &p = positions[group[v]];
+              float xyz[3] = { p.x(), p.y(), p.z() };
+              memcpy(&lv->vertices[old_size + pos_offset], xyz, sizeof(xyz));
+            }
+            lv->indices.push_back(r);
+          }
+        }
+        pending.push_back(lv);
+
+        prev_live = num_live;
+        target = num_live / 2;
+        if (target < min_triangles) break;
+      }
+    }
+
+    // copy the source so that build() does not need to touch any buffers.
+    void prepare() {
+      for (unsigned i = 0; i != pending.size(); ++i) delete pending[i];
+      pending.reset();
+      src_vertices.reset();
+      src_indices.reset();
+      lods.reset();
+      lod_errors.reset();
+
+      if (!src) return;
+
+      *(mesh*)this = *(mesh*)src;
+
+      unsigned index_type = get_index_type();
+      if (get_mode() != GL_TRIANGLES || ( index_type != GL_UNSIGNED_INT && index_type != GL_UNSIGNED_SHORT )) return;
+
+      unsigned num_indices = get_num_indices() - get_num_indices() % 3;
+      unsigned vsize = get_num_vertices() * get_stride();
+      if (num_indices == 0 || vsize == 0) return;
+
+      src_vertices.resize(vsize);
+      memcpy(&src_vertices[0], get_vertices()->lock_read_only(), vsize);
+      get_vertices()->unlock_read_only();
+
+      src_indices.resize(num_indices);
+      const void *ip = get_indices()->lock_read_only();
+      for (unsigned i = 0; i != num_indices; ++i) {
+        src_indices[i] = index_type == GL_UNSIGNED_INT ? ((const uint32_t*)ip)[i] : ((const uint16_t*)ip)[i];
+        if (src_indices[i] >= get_num_vertices()) {
+          OCTET_LOG_WARNING("simplifier: index %d out of range\n", src_indices[i]);
+          src_indices.reset();
+          break;
+        }
+      }
+      get_indices()->unlock_read_only();
+    }
+
+    // make meshes from the levels. this makes buffers, so it must be on the GL thread.
+    void finish() {
+      unsigned index_type = get_index_type();
+      unsigned num_triangles = src_indices.size() / 3;
+      float size = length(get_aabb().get_half_extent()) * 2;
+      for (unsigned i = 0; i != pending.size(); ++i) {
+        level *lv = pending[i];
+        unsigned vsize = lv->vertices.size();
+        unsigned isize = lv->indices.size() * kind_size(index_type);
+
+        gl_resource *vertices = new gl_resource(GL_ARRAY_BUFFER, vsize);
+        vertices->assign(&lv->vertices[0], 0, vsize);
+
+        gl_resource *indices = new gl_resource(GL_ELEMENT_ARRAY_BUFFER, isize);
+        if (index_type == GL_UNSIGNED_INT) {
+          indices->assign(&lv->indices[0], 0, isize);
+        } else {
+          uint16_t *dip = (uint16_t*)indices->lock();
+          for (unsigned j = 0; j != lv->indices.size(); ++j) {
+            dip[j] = (uint16_t)lv->indices[j];
+          }
+          indices->unlock();
+        }
+
+        mesh *msh = new mesh();
+        *msh = *(mesh*)this;
+        msh->set_vertices(vertices);
+        msh->set_indices(indices);
+        msh->set_num_vertices(lv->num_vertices);
+        msh->set_num_indices(lv->indices.size());
+
+        lods.push_back(new cache_optimizer(msh));
+        lod_errors.push_back(lv->error);
+
+        OCTET_LOG_INFO(
+          "simplifier: level %d: %d of %d triangles, %d vertices, error %g (%.3f%% of size)\n",
+          i + 1, lv->indices.size() / 3, num_triangles, lv->num_vertices, lv->error, size > 0 ? lv->error * 100 / size : 0.0f
+        );
+        delete lv;
+      }
+      pending.reset();
+      src_vertices.reset();
+      src_indices.reset();
+    }
+
+    static void build_thunk(void *arg, unsigned index) {
+      simplifier **meshes = (simplifier**)arg;
+      meshes[index]->build();
+    }
+
+  public:
+    RESOURCE_META(simplifier)
+
+    // if update_now is false, call update() or update_all() later.
+    simplifier(mesh *src=0, bool update_now=true) {
+      this->src = src;
+      attribute_weight = 0.01f;
+      if (update_now) update();
+    }
+
+    ~simplifier() {
+      for (unsigned i = 0; i != pending.size(); ++i) delete pending[i];
+    }
+
+    void update() {
+      prepare();
+      build();
+      finish();
+    }
+
+    // build the levels of many meshes, one mesh per thread. num_threads = 0 means one per cpu.
+    static void update_all(simplifier **meshes, unsigned count, unsigned num_threads=0) {
+      for (unsigned i = 0; i != count; ++i) meshes[i]->prepare();
+      parallel_for::run(count, build_thunk, (void*)meshes, num_threads);
+      for (unsigned i = 0; i != count; ++i) meshes[i]->finish();
+    }
+
+    void set_attribute_weight(float value) {
+      attribute_weight = value;
+    }
+
+    // level 0 is this mesh
+    unsigned get_num_lods() const {
+      return lods.size() + 1;
+    }
+
+    mesh *get_lod(unsigned level) {
+      return level == 0 ? (mesh*)this : (mesh*)lods[level - 1];
+    }
+
+    // the largest distance (in model units) between a level and the full mesh, measured
+    // at the source positions and at a grid of points on each level triangle.
+    float get_lod_error(unsigned level) const {
+      return level == 0 ? 0.0f : lod_errors[level - 1];
+    }
+
+    // the coarsest level whose error is less than max_pixel_error on the screen.
+    unsigned get_lod_level(float pixels_per_unit, float max_pixel_error) const {
+      unsigned level = 0;
+      while (level != lods.size() && lod_errors[level] * pixels_per_unit <= max_pixel_error) {
+        level++;
+      }
+      return level;
+    }
+
+    mesh *get_lod(float pixels_per_unit, float max_pixel_error) {
+      return get_lod(get_lod_level(pixels_per_unit, max_pixel_error));
+    }
+
+    OCTET_FIELDS_BEGIN(simplifier)
+      OCTET_FIELDS_BASE(mesh)
+      OCTET_FIELD(src)
+      OCTET_FIELD(lods)
+      OCTET_FIELD(lod_errors)
+    OCTET_FIELDS_END()
+  };
+}
@@ -26,22 +26,22 @@ namespace octet {
     skeleton() {
     }
 
-    void visit(visitor &v) {
-      v.visit(nodeToParents, atom_nodeToParents);
-      v.visit(joints, atom_joints);
-      v.visit(nodes, atom_nodes);
-      v.visit(parents, atom_parents);
-      v.visit(boneToNode, atom_boneToNode);
-      v.visit(result, atom_result);  /// uniforms to shader
-      v.visit(indices, atom_indices);   /// map skeleton to skin indices
-    }
+    OCTET_FIELDS_BEGIN(skeleton)
+      OCTET_FIELD(nodeToParents)
+      OCTET_FIELD(joints)
+      OCTET_FIELD(nodes)
+      OCTET_FIELD(parents)
+      OCTET_FIELD(boneToNode)
+      OCTET_FIELD(result)  /// uniforms to shader
+      OCTET_FIELD(indices)   /// map skeleton to skin indices
+    OCTET_FIELDS_END()
 
     void add_bone(scene_node *node, int parent) {
       nodes.push_back(node);
       nodeToParents.push_back(node->get_nodeToParent());
       joints.push_back(node->get_sid());
       parents.push_back(parent);
-      app_utils::log("skeleton: add_bone %d [%s]\n", node->get_sid(), node->access_nodeToParent().toString());
+      OCTET_LOG_DEBUG("skeleton: add_bone %d [%s]\n", node->get_sid(), node->access_nodeToParent().toString());
     }
 
     int get_num_bones() const { return nodeToParents.size(); }
@@ -75,7 +75,7 @@ namespace octet {
         } else {
           boneToNode[i] = nodeToParents[i] * boneToNode[parent];
         }
-        //app_utils::log("%d %s p=%d\n", i, result[i].toString(), parent);
+        //OCTET_LOG_DEBUG("%d %s p=%d\n", i, result[i].toString(), parent);
       }
 
       unsigned num_joints = skn->get_num_joints();
@@ -97,7 +97,7 @@ namespace octet {
         } else {
           result[i] = worldToCamera;
         }
-        //if (first_frame) app_utils::log("%d %d [%s]\n", i, index, result[i].toString());
+        //if (first_frame) OCTET_LOG_DEBUG("%d %d [%s]\n", i, index, result[i].toString());
       }
 
       return &result[0];
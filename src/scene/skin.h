@@ -28,16 +28,16 @@ namespace octet {
       this->modelToBind = modelToBind;
     }
 
-    void visit(visitor &v) {
-      v.visit(modelToBind, atom_modelToBind);
-      v.visit(bindToModel, atom_bindToModel);
-      v.visit(joints, atom_joints);
-    }
+    OCTET_FIELDS_BEGIN(skin)
+      OCTET_FIELD(modelToBind)
+      OCTET_FIELD(bindToModel)
+      OCTET_FIELD(joints)
+    OCTET_FIELDS_END()
 
     void add_joint(const mat4t &bindToModel, atom_t sid) {
       this->bindToModel.push_back(bindToModel);
       joints.push_back(sid);
-      app_utils::log("skin: add_joint %d\n", sid);
+      OCTET_LOG_DEBUG("skin: add_joint %d\n", sid);
     }
 
     int find_joint(atom_t sid) {
@@ -4,238 +4,426 @@
 //
 // Modular Framework for OpenGLES2 rendering on multiple platforms.
 //
-// Mesh smooth modifier. Work in progress.
+// Mesh smooth modifier. Subdivide curved parts of a mesh.
+//
+// An edge is split when the normals at its ends are further apart than
+// max_angle (and, if a view is set, when it is long enough on the screen).
+// The new vertex goes on a cubic curve that follows both normals. Triangles
+// with split edges are cut into two, three or four.
+//
+// The mesh is split one level at a time. Each level finds the edges with
+// mesh_edges, so each edge gets one midpoint that both of its triangles use,
+// then splits the edges and the triangles in parallel.
+//
+// The curves use a normal for each position (the average of the normals of
+// the vertices there), not the normals of the vertices. Whether an edge is
+// split and where its midpoint goes then only depend on the positions, so
+// there are no cracks at uv seams or hard edges and the result is the same
+// for any number of threads.
+//
+// needs an all float vertex format with positions and normals.
 //
 
 namespace octet {
   class smooth : public mesh {
+    enum {
+      // most levels of subdivision
+      default_max_depth = 3,
+
+      // jobs per thread, to even out the work
+      chunks_per_thread = 4,
+
+      // don't start threads for fewer edges than this
+      min_thread_edges = 8192,
+    };
+
     // source mesh. Provides underlying geometry.
     ref<mesh> src;
 
     // view dependent parameters
     vec3 view_pos;
-    vec3 view_dir;
-
-    // working params
-    unsigned num_dest_vertices;
-
-    dynarray<uint32_t> dest_indices;
-    hash_map<uint64_t, unsigned> edges;
-    dynarray<uint8_t> dest_vertices;
-    unsigned pos_offset;
-    unsigned normal_offset;
-    unsigned uv_offset;
-    int depth;
-
-    bool split_edge(uint8_t *dest, const uint8_t *src0, const uint8_t *src1, unsigned stride) {
-      const vec3 &pos0 = (const vec3&)src0[pos_offset];
-      const vec3 &pos1 = (const vec3&)src1[pos_offset];
-      const vec3 &n0 = (const vec3&)src0[normal_offset];
-      const vec3 &n1 = (const vec3&)src1[normal_offset];
-      //const vec3 &uv0 = (const vec3&)src0[uv_offset];
-      //const vec3 &uv1 = (const vec3&)src1[uv_offset];
-
-      if (is_smooth(n0, n1, depth)) {
-        return false;
-      }
-
-      // Catmul-Rom spline
-      vec3 diff = pos1 - pos0;
-      vec3 t0 = cross(cross(n0, diff), n0); // bezier tangent * 3
-      vec3 t1 = cross(cross(n1, diff), n1); // bezier tangent * 3
+    float pixels_per_unit;
+    float min_pixels;
+
+    // curvature limits
+    float max_angle;
+    unsigned max_depth;
+
+    // 0 means one per cpu
+    unsigned num_threads;
+
+    // the same for all the vertices in the same place
+    struct curve_point {
+      vec3 normal;
+      uint32_t depth;
+    };
+
+    // working state for one level
+    struct level_state {
+      smooth *self;
+      unsigned num_floats;
+      unsigned pos_index;
+      unsigned normal_index;
+      unsigned num_chunks;
+
+      const mesh_edges *edges;
+      float *vertices;
+      curve_point *curve;
+
+      // new vertex for each edge, or ~0
+      uint32_t *edge_vertex;
+
+      const uint32_t *src_indices;
+      unsigned num_triangles;
+      const uint32_t *tri_start;
+      uint32_t *dest_indices;
+    };
+
+    // sub triangles for each combination of split edges.
+    // corners 0, 1 and 2 are the triangle, 3 is on edge 0-1, 4 on 1-2 and 5 on 2-0
+    static const uint8_t *get_pattern(unsigned mask) {
+      static const uint8_t patterns[8][13] = {
+        { 1, 0,1,2 },
+        { 2, 3,1,2, 3,2,0 },
+        { 2, 4,0,1, 4,2,0 },
+        { 3, 3,1,4, 3,4,0, 4,2,0 },
+        { 2, 5,0,1, 5,1,2 },
+        { 3, 5,0,3, 5,3,2, 3,1,2 },
+        { 3, 4,2,5, 5,0,4, 4,0,1 },
+        { 4, 1,4,3, 3,4,5, 3,5,0, 4,2,5 },
+      };
+      return patterns[mask];
+    }
 
-      for (unsigned i = 0; i < stride/sizeof(float); ++i) {
-        ((float*)dest)[i] = (((float*)src0)[i] + ((float*)src1)[i]) * 0.5f;
+    // decide which edges to split
+    static void choose_edges(void *arg, unsigned chunk) {
+      level_state &ls = *(level_state*)arg;
+      unsigned num_edges = ls.edges->get_num_edges();
+      unsigned begin = (unsigned)( (uint64_t)num_edges * chunk / ls.num_chunks );
+      unsigned end = (unsigned)( (uint64_t)num_edges * ( chunk + 1 ) / ls.num_chunks );
+      for (unsigned e = begin; e != end; ++e) {
+        unsigned a = ls.edges->get_vertex(e, 0);
+        unsigned b = ls.edges->get_vertex(e, 1);
+        const curve_point &ca = ls.curve[a], &cb = ls.curve[b];
+        unsigned depth = ( ca.depth > cb.depth ? ca.depth : cb.depth ) + 1;
+        const float *va = ls.vertices + a * ls.num_floats;
+        const float *vb = ls.vertices + b * ls.num_floats;
+        bool split = depth <= ls.self->max_depth && !ls.self->is_smooth(
+          (const vec3&)va[ls.pos_index], ca.normal, (const vec3&)vb[ls.pos_index], cb.normal, depth
+        );
+        ls.edge_vertex[e] = split ? 0 : ~0u;
       }
-
-      vec3 &pos = (vec3&)dest[pos_offset];
-      vec3 &normal = (vec3&)dest[normal_offset];
-
-      pos = (pos0 + pos1) * 0.5f + (t0 - t1) * 0.125; // (3/8)/3 = 1/8
-      normal = normalize(normal);
-
-      return true;
     }
 
-    unsigned add_edge(int i0, int i1) {
-      if (i0 > i1) { swap(i0, i1); }
+    // make the new vertices
+    static void split_edges(void *arg, unsigned chunk) {
+      level_state &ls = *(level_state*)arg;
+      unsigned num_edges = ls.edges->get_num_edges();
+      unsigned begin = (unsigned)( (uint64_t)num_edges * chunk / ls.num_chunks );
+      unsigned end = (unsigned)( (uint64_t)num_edges * ( chunk + 1 ) / ls.num_chunks );
+      for (unsigned e = begin; e != end; ++e) {
+        unsigned v = ls.edge_vertex[e];
+        if (v == ~0u) continue;
+        unsigned a = ls.edges->get_vertex(e, 0);
+        unsigned b = ls.edges->get_vertex(e, 1);
+        if (is_before(ls.vertices + b * ls.num_floats, ls.curve[b], ls.vertices + a * ls.num_floats, ls.curve[a], ls.pos_index)) {
+          unsigned tmp = a; a = b; b = tmp;
+        }
+        split_edge(ls.vertices + v * ls.num_floats, ls.curve[v], ls.vertices + a * ls.num_floats, ls.curve[a], ls.vertices + b * ls.num_floats, ls.curve[b], ls);
+      }
+    }
 
-      unsigned &e = edges[((uint64_t)i1 << 32) | i0];
+    // cut the triangles
+    static void split_triangles(void *arg, unsigned chunk) {
+      level_state &ls = *(level_state*)arg;
+      unsigned begin = (unsigned)( (uint64_t)ls.num_triangles * chunk / ls.num_chunks );
+      unsigned end = (unsigned)( (uint64_t)ls.num_triangles * ( chunk + 1 ) / ls.num_chunks );
+      for (unsigned t = begin; t != end; ++t) {
+        uint32_t corners[6];
+        unsigned mask = 0;
+        for (unsigned j = 0; j != 3; ++j) {
+          corners[j] = ls.src_indices[t * 3 + j];
+          unsigned e = ls.edges->get_edge(t, j);
+          corners[j + 3] = e == ~0u ? ~0u : ls.edge_vertex[e];
+          mask |= corners[j + 3] != ~0u ? 1 << j : 0;
+        }
+        const uint8_t *pattern = get_pattern(mask);
+        uint32_t *dest = ls.dest_indices + ls.tri_start[t] * 3;
+        for (unsigned i = 0; i != pattern[0] * 3; ++i) {
+          dest[i] = corners[pattern[i + 1]];
+        }
+      }
+    }
 
-      if (e == ~0) return 0;
+    // an order for the ends of an edge that does not depend on their indices, so that
+    // copies of an edge (on either side of a uv seam, say) get exactly the same midpoint.
+    static bool is_before(const float *a, const curve_point &ca, const float *b, const curve_point &cb, unsigned pos_index) {
+      for (unsigned i = 0; i != 3; ++i) {
+        if (a[pos_index + i] != b[pos_index + i]) return a[pos_index + i] < b[pos_index + i];
+      }
+      for (unsigned i = 0; i != 3; ++i) {
+        if (ca.normal[i] != cb.normal[i]) return ca.normal[i] < cb.normal[i];
+      }
+      return false;
+    }
 
-      if (e != 0) return e;
+    // the middle of an edge on a cubic curve that meets both curve normals at right angles.
+    // the other attributes are averaged.
+    static void split_edge(float *dest, curve_point &cdest, const float *src0, const curve_point &c0, const float *src1, const curve_point &c1, const level_state &ls) {
+      const vec3 &pos0 = (const vec3&)src0[ls.pos_index];
+      const vec3 &pos1 = (const vec3&)src1[ls.pos_index];
+      const vec3 &n0 = c0.normal;
+      const vec3 &n1 = c1.normal;
 
-      unsigned stride = get_stride();
+      // Catmul-Rom spline
+      vec3 diff = pos1 - pos0;
+      vec3 t0 = cross(cross(n0, diff), n0); // bezier tangent * 3
+      vec3 t1 = cross(cross(n1, diff), n1); // bezier tangent * 3
 
-      dest_vertices.resize((num_dest_vertices + 1) * stride);
+      for (unsigned i = 0; i != ls.num_floats; ++i) {
+        dest[i] = ( src0[i] + src1[i] ) * 0.5f;
+      }
 
-      app_utils::log("%*se%d %d %d\n", depth*2, "", num_dest_vertices, i0, i1);
-      bool split = split_edge(
-        &dest_vertices[num_dest_vertices * stride],
-        &dest_vertices[i0 * stride],
-        &dest_vertices[i1 * stride],
-        stride
-      );
+      vec3 pos = ( pos0 + pos1 ) * 0.5f + ( t0 - t1 ) * 0.125f; // (3/8)/3 = 1/8
+      vec3 normal = normalize((const vec3&)dest[ls.normal_index]);
+      memcpy(dest + ls.pos_index, &pos, sizeof(float) * 3);
+      memcpy(dest + ls.normal_index, &normal, sizeof(float) * 3);
 
-      if (split) {
-        e = num_dest_vertices++;
-        return e;
-      } else {
-        // unable to split. Don't test again.
-        e = ~0;
-        return 0;
-      }
+      cdest.normal = normalize(n0 + n1);
+      cdest.depth = ( c0.depth > c1.depth ? c0.depth : c1.depth ) + 1;
     }
 
-    void add_triangle(unsigned i0, unsigned i1, unsigned i2) {
-      unsigned i3 = add_edge(i0, i1);
-      unsigned i4 = add_edge(i1, i2);
-      unsigned i5 = add_edge(i2, i0);
-
-      depth++;
-
-      app_utils::log("%*sat: %d %d %d %d %d %d\n", depth*2, "", i0, i1, i2, i3, i4, i5);
-
-      switch( (i3 != 0) + (i4 != 0)*2 + (i5 != 0)*4 ) {
-        case 0: {
-          unsigned disize = dest_indices.size();
-          dest_indices.resize(disize+3);
-          dest_indices[disize+0] = i0;
-          dest_indices[disize+1] = i1;
-          dest_indices[disize+2] = i2;
-        } break;
-        case 1: {
-          //    1
-          //   3 
-          //  0   2
-          add_triangle(i3, i1, i2);
-          add_triangle(i3, i2, i0);
-        } break;
-        case 2: {
-          //    1
-          //     4 
-          //  0   2
-          add_triangle(i4, i0, i1);
-          add_triangle(i4, i2, i0);
-        } break;
-        case 3: {
-          //    1
-          //   3 4
-          //  0   2
-          add_triangle(i3, i1, i4);
-          add_triangle(i3, i4, i0);
-          add_triangle(i4, i2, i0);
-        } break;
-        case 4: {
-          //    1
-          //      
-          //  0 5 2
-          add_triangle(i5, i0, i1);
-          add_triangle(i5, i1, i2);
-        } break;
-        case 5: {
-          //    1
-          //   3  
-          //  0 5 2
-          add_triangle(i5, i0, i3);
-          add_triangle(i5, i3, i2);
-          add_triangle(i3, i1, i2);
-        } break;
-        case 6: {
-          //    1
-          //     4
-          //  0 5 2
-          add_triangle(i4, i2, i5);
-          add_triangle(i5, i0, i4);
-          add_triangle(i4, i0, i1);
-        } break;
-        case 7: {
-          //    1
-          //   3 4
-          //  0 5 2
-          add_triangle(i1, i4, i3);
-          add_triangle(i3, i4, i5);
-          add_triangle(i3, i5, i0);
-          add_triangle(i4, i2, i5);
-        } break;
-      }
-      depth--;
-    }
-          
   public:
     RESOURCE_META(smooth)
 
-    smooth(mesh *src=0) {
+    smooth(mesh *src=0, float max_angle=0.3f, unsigned max_depth=default_max_depth) {
       this->src = src;
+      this->max_angle = max_angle;
+      this->max_depth = max_depth;
       view_pos = vec3(0, 0, 0);
+      pixels_per_unit = 0;
+      min_pixels = 0;
+      num_threads = 0;
       update();
     }
 
+    // don't split edges shorter than min_pixels when seen from view_pos.
+    // pixels_per_unit is the size on the screen of one unit at a distance of one. call update() afterwards.
+    void set_view(const vec3 &view_pos, float pixels_per_unit, float min_pixels) {
+      this->view_pos = view_pos;
+      this->pixels_per_unit = pixels_per_unit;
+      this->min_pixels = min_pixels;
+    }
+
+    // 0 means one per cpu. call update() to subdivide again.
+    void set_num_threads(unsigned value) {
+      num_threads = value;
+    }
+
     void update() {
       if (!src) return;
       if (src->get_mode() != GL_TRIANGLES) return;
-      if (src->get_index_type() != GL_UNSIGNED_INT) return;
 
       *(mesh*)this = *(mesh*)src;
 
+      unsigned index_type = get_index_type();
       unsigned pos_slot = get_slot(attribute_pos);
       unsigned normal_slot = get_slot(attribute_normal);
-      unsigned uv_slot = get_slot(attribute_uv);
+      unsigned stride = get_stride();
 
-      // needs pos, normal and uv map
-      if (pos_slot == ~0 || normal_slot == ~0 || uv_slot == ~0) {
+      // needs float positions and normals
+      if (pos_slot == ~0u || normal_slot == ~0u || get_size(pos_slot) < 3 || get_size(normal_slot) < 3 || stride % 4 != 0) {
         return;
       }
+      for (unsigned slot = 0; slot != get_num_slots(); ++slot) {
+        if (get_kind(slot) != GL_FLOAT) return;
+      }
+      if (index_type != GL_UNSIGNED_SHORT && index_type != GL_UNSIGNED_INT) return;
 
-      pos_offset = get_offset(pos_slot);
-      normal_offset = get_offset(normal_slot);
-      uv_offset = get_offset(uv_slot);
+      unsigned num_src_vertices = get_num_vertices();
+      unsigned num_src_indices = get_num_indices() - get_num_indices() % 3;
+      if (num_src_vertices == 0 || num_src_indices == 0) return;
 
-      dest_indices.reserve(get_num_indices() * 4);
-      dest_vertices.reserve(get_num_vertices() * get_stride() * 4);
-      dest_vertices.resize(get_num_vertices() * get_stride());
+      level_state ls;
+      ls.self = this;
+      ls.num_floats = stride / 4;
+      ls.pos_index = get_offset(pos_slot) / 4;
+      ls.normal_index = get_offset(normal_slot) / 4;
 
-      // copy vertices for existing triangles
-      const void *sp = src->get_vertices()->lock_read_only();
-      memcpy(&dest_vertices[0], sp, get_num_vertices() * get_stride());
+      dynarray<float> vertices(num_src_vertices * ls.num_floats);
+      memcpy(&vertices[0], src->get_vertices()->lock_read_only(), num_src_vertices * stride);
       src->get_vertices()->unlock_read_only();
-      num_dest_vertices = get_num_vertices();
 
+      dynarray<uint32_t> indices(num_src_indices);
       const void *sip = src->get_indices()->lock_read_only();
-      depth = 0;
-      for (unsigned i = 0; i+2 < get_num_indices(); i += 3) {
-        uint32_t *tp = ((uint32_t*)sip) + i;
-        add_triangle(tp[0], tp[1], tp[2]);
+      for (unsigned i = 0; i != num_src_indices; ++i) {
+        indices[i] = index_type == GL_UNSIGNED_INT ? ((const uint32_t*)sip)[i] : ((const uint16_t*)sip)[i];
+        if (indices[i] >= num_src_vertices) {
+          src->get_indices()->unlock_read_only();
+          OCTET_LOG_WARNING("smooth: index %d out of range\n", indices[i]);
+          return;
+        }
       }
       src->get_indices()->unlock_read_only();
 
-      unsigned isize = dest_indices.size() * sizeof(dest_indices[0]);
-      unsigned vsize = dest_vertices.size() * sizeof(dest_vertices[0]);
-      gl_resource *indices = new gl_resource(GL_ELEMENT_ARRAY_BUFFER, isize);
-      gl_resource *vertices = new gl_resource(GL_ARRAY_BUFFER, vsize);
-      indices->assign(&dest_indices[0], 0, isize);
-      vertices->assign(&dest_vertices[0], 0, vsize);
+      // add up the normals in each place
+      dynarray<curve_point> curve(num_src_vertices);
+      {
+        unsigned table_size = 16;
+        while (table_size < num_src_vertices * 2) table_size *= 2;
+        dynarray<unsigned> table(table_size);
+        memset(&table[0], 0xff, table_size * sizeof(table[0]));
+        dynarray<unsigned> first(num_src_vertices);
+        dynarray<vec3> sums(num_src_vertices);
+        for (unsigned v = 0; v != num_src_vertices; ++v) {
+          const float *pos = &vertices[v * ls.num_floats + ls.pos_index];
+          float key[3] = { pos[0] + 0.0f, pos[1] + 0.0f, pos[2] + 0.0f }; // -0 is 0
+          unsigned slot = (unsigned)app_utils::hash64(key, sizeof(key)) & ( table_size - 1 );
+          for (; ; slot = ( slot + 1 ) & ( table_size - 1 )) {
+            unsigned f = table[slot];
+            if (f == ~0u) {
+              table[slot] = first[v] = v;
+              sums[v] = vec3(0, 0, 0);
+              break;
+            }
+            const float *fpos = &vertices[f * ls.num_floats + ls.pos_index];
+            if (fpos[0] == key[0] && fpos[1] == key[1] && fpos[2] == key[2]) {
+              first[v] = f;
+              break;
+            }
+          }
+          const vec3 &n = (const vec3&)vertices[v * ls.num_floats + ls.normal_index];
+          float len = length(n);
+          if (len > 0) sums[first[v]] += n * ( 1.0f / len );
+        }
+        for (unsigned v = 0; v != num_src_vertices; ++v) {
+          const vec3 &n = sums[first[v]];
+          float len = length(n);
+          curve[v].normal = len > 0 ? n * ( 1.0f / len ) : n;
+          curve[v].depth = 0;
+        }
+      }
 
-      set_indices(indices);
-      set_vertices(vertices);
-      set_num_vertices(num_dest_vertices);
-      set_num_indices(dest_indices.size());
+      mesh_edges edges;
+      dynarray<uint32_t> edge_vertex;
+      dynarray<uint32_t> tri_start;
+      dynarray<uint32_t> new_indices;
+      unsigned num_levels = 0;
+
+      for (unsigned level = 0; level != max_depth; ++level) {
+        unsigned num_vertices = curve.size();
+        unsigned num_triangles = indices.size() / 3;
+        edges.build(&indices[0], indices.size(), num_vertices);
+        unsigned num_edges = edges.get_num_edges();
+        if (num_edges == 0) break;
+
+        unsigned threads = num_threads ? num_threads : thread::get_num_cpus();
+        if (num_edges < min_thread_edges) threads = 1;
+
+        edge_vertex.resize(num_edges);
+        ls.num_chunks = threads * chunks_per_thread;
+        ls.edges = &edges;
+        ls.edge_vertex = &edge_vertex[0];
+        ls.vertices = &vertices[0];
+        ls.curve = &curve[0];
+        parallel_for::run(ls.num_chunks, choose_edges, (void*)&ls, threads);
+
+        // number the new vertices in edge order
+        unsigned new_vertices = num_vertices;
+        for (unsigned e = 0; e != num_edges; ++e) {
+          if (edge_vertex[e] != ~0u) edge_vertex[e] = new_vertices++;
+        }
+        if (new_vertices == num_vertices) break;
+
+        vertices.resize(new_vertices * ls.num_floats);
+        curve.resize(new_vertices);
+        ls.vertices = &vertices[0];
+        ls.curve = &curve[0];
+        parallel_for::run(ls.num_chunks, split_edges, (void*)&ls, threads);
+
+        // where each triangle's pieces go
+        tri_start.resize(num_triangles + 1);
+        unsigned total = 0;
+        for (unsigned t = 0; t != num_triangles; ++t) {
+          tri_start[t] = total;
+          unsigned mask = 0;
+          for (unsigned j = 0; j != 3; ++j) {
+            unsigned e = edges.get_edge(t, j);
+            mask |= e != ~0u && edge_vertex[e] != ~0u ? 1 << j : 0;
+          }
+          total += get_pattern(mask)[0];
+        }
+        tri_start[num_triangles] = total;
+
+        new_indices.resize(total * 3);
+        ls.src_indices = &indices[0];
+        ls.num_triangles = num_triangles;
+        ls.tri_start = &tri_start[0];
+        ls.dest_indices = &new_indices[0];
+        parallel_for::run(ls.num_chunks, split_triangles, (void*)&ls, threads);
+
+        indices.resize(total * 3);
+        memcpy(&indices[0], &new_indices[0], total * 3 * sizeof(indices[0]));
+        num_levels++;
+      }
 
-      dump(app_utils::log("dump"));
-    }
+      unsigned num_vertices = curve.size();
+      unsigned num_indices = indices.size();
+      if (num_vertices > 0x10000) index_type = GL_UNSIGNED_INT;
 
-    void visit(visitor &v) {
-      mesh::visit(v);
-      v.visit(src, atom_src);
-      v.visit(view_pos, atom_view_pos);
+      unsigned isize = num_indices * kind_size(index_type);
+      unsigned vsize = num_vertices * stride;
+      gl_resource *new_ib = new gl_resource(GL_ELEMENT_ARRAY_BUFFER, isize);
+      gl_resource *new_vb = new gl_resource(GL_ARRAY_BUFFER, vsize);
+      if (index_type == GL_UNSIGNED_INT) {
+        new_ib->assign(&indices[0], 0, isize);
+      } else {
+        uint16_t *dip = (uint16_t*)new_ib->lock();
+        for (unsigned i = 0; i != num_indices; ++i) {
+          dip[i] = (uint16_t)indices[i];
+        }
+        new_ib->unlock();
+      }
+      new_vb->assign(&vertices[0], 0, vsize);
+
+      set_indices(new_ib);
+      set_vertices(new_vb);
+      set_params(stride, num_indices, num_vertices, GL_TRIANGLES, index_type);
+
+      OCTET_LOG_INFO(
+        "smooth: %d levels, %d -> %d triangles, %d -> %d vertices\n",
+        num_levels, num_src_indices / 3, num_indices / 3, num_src_vertices, num_vertices
+      );
     }
 
-    virtual bool is_smooth(const vec3 &n0, const vec3 &n1, int depth) {
-      return true;
+    OCTET_FIELDS_BEGIN(smooth)
+      OCTET_FIELDS_BASE(mesh)
+      OCTET_FIELD(src)
+      OCTET_FIELD(view_pos)
+      OCTET_FIELD(pixels_per_unit)
+      OCTET_FIELD(min_pixels)
+      OCTET_FIELD(max_angle)
+      OCTET_FIELD(max_depth)
+    OCTET_FIELDS_END()
+
+    // return false to split the edge between two vertices. the last argument is the level of the new vertex.
+    // this is called on worker threads.
+    virtual bool is_smooth(const vec3 &pos0, const vec3 &n0, const vec3 &pos1, const vec3 &n1, unsigned) const {
       float dotp = dot(n0, n1);
-      app_utils::log("%*s  dotp=%f\n", depth*2, "", dotp);
-      return (dotp >= 0.9f) || depth >= 4;
+      float len0 = length(n0), len1 = length(n1);
+      if (len0 == 0 || len1 == 0 || dotp >= cosf(max_angle) * len0 * len1) {
+        return true;
+      }
+
+      // too small to see
+      if (pixels_per_unit > 0) {
+        vec3 mid = ( pos0 + pos1 ) * 0.5f;
+        float dist = length(mid - view_pos);
+        if (length(pos1 - pos0) * pixels_per_unit < min_pixels * dist) {
+          return true;
+        }
+      }
+      return false;
     }
   };
 }
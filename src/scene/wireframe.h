@@ -27,43 +27,40 @@ namespace octet {
 
       set_mode(GL_LINES);
 
-      // re-index the triangles to make lines
+      // one line for each edge, even if two triangles share it.
+      mesh_edges edges;
+      src->get_edges(edges);
+
       unsigned index_type = src->get_index_type();
-      unsigned num_indices = src->get_num_indices();
-      unsigned isize = kind_size(index_type) * num_indices * 2;
+      unsigned num_edges = edges.get_num_edges();
+      unsigned isize = kind_size(index_type) * num_edges * 2;
 
       gl_resource *indices = new gl_resource(GL_ELEMENT_ARRAY_BUFFER, isize);
       void *dp = indices->lock();
-      void *sp = src->get_indices()->lock();
       if (index_type == GL_UNSIGNED_SHORT) {
-        uint16_t *s = (uint16_t*)sp;
         uint16_t *d = (uint16_t*)dp;
-        for (unsigned i = 0; i < num_indices; i += 3) {
-          d[0] = s[0]; d[1] = s[1];
-          d[2] = s[1]; d[3] = s[2];
-          d[4] = s[2]; d[5] = s[0];
-          d += 6; s += 3;
+        for (unsigned e = 0; e != num_edges; ++e) {
+          d[0] = (uint16_t)edges.get_vertex(e, 0);
+          d[1] = (uint16_t)edges.get_vertex(e, 1);
+          d += 2;
         }
       } else { // assume GL_UNSIGNED_INT
-        uint32_t *s = (uint32_t*)sp;
         uint32_t *d = (uint32_t*)dp;
-        for (unsigned i = 0; i < num_indices; i += 3) {
-          d[0] = s[0]; d[1] = s[1];
-          d[2] = s[1]; d[3] = s[2];
-          d[4] = s[2]; d[5] = s[0];
-          d += 6; s += 3;
+        for (unsigned e = 0; e != num_edges; ++e) {
+          d[0] = edges.get_vertex(e, 0);
+          d[1] = edges.get_vertex(e, 1);
+          d += 2;
         }
       }
 
       indices->unlock();
-      src->get_indices()->unlock();
-      set_num_indices(num_indices*2);
+      set_num_indices(num_edges*2);
       set_indices( indices );
     }
 
-    void visit(visitor &v) {
-      mesh::visit(v);
-      v.visit(src, atom_src);
-    }
+    OCTET_FIELDS_BEGIN(wireframe)
+      OCTET_FIELDS_BASE(mesh)
+      OCTET_FIELD(src)
+    OCTET_FIELDS_END()
   };
 }
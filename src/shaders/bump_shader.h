@@ -16,6 +16,7 @@ namespace octet {
     GLuint light_uniforms_index;    // lighting parameters for fragment shader
     GLuint num_lights_index;        // how many lights?
     GLuint samplers_index;          // index for texture samplers
+    GLuint attribute_decode_index;  // scales and offsets for quantized vertices
 
     void init_uniforms(const char *vertex_shader, const char *fragment_shader) {
       // use the common shader code to compile and link the shaders
@@ -29,6 +30,13 @@ namespace octet {
       light_uniforms_index = glGetUniformLocation(program(), "light_uniforms");
       num_lights_index = glGetUniformLocation(program(), "num_lights");
       samplers_index = glGetUniformLocation(program(), "samplers");
+      attribute_decode_index = glGetUniformLocation(program(), "attribute_decode");
+    }
+
+    // no quantization
+    void set_default_attribute_decode() {
+      static const float decode[] = { 1, 1, 1, 0,  0, 0, 0, 0,  1, 1, 0, 0 };
+      glUniform4fv(attribute_decode_index, 3, decode);
     }
 
   public:
@@ -52,13 +60,24 @@ namespace octet {
       
         uniform mat4 modelToProjection;
         uniform mat4 modelToCamera;
+        uniform vec4 attribute_decode[3];
+
+        // octahedral normals have two components
+        vec3 decode_normal(vec3 n) {
+          if (attribute_decode[0].w == 0.0) return n;
+          vec3 v = vec3(n.xy, 1.0 - abs(n.x) - abs(n.y));
+          float t = clamp(-v.z, 0.0, 1.0);
+          v.x += v.x >= 0.0 ? -t : t;
+          v.y += v.y >= 0.0 ? -t : t;
+          return normalize(v);
+        }
       
         void main() {
-          uv_ = uv;
-          normal_ = (modelToCamera * vec4(normal,0)).xyz;
+          uv_ = uv * attribute_decode[2].xy + attribute_decode[2].zw;
+          normal_ = (modelToCamera * vec4(decode_normal(normal),0)).xyz;
           tangent_ = (modelToCamera * vec4(tangent,0)).xyz;
           bitangent_ = (modelToCamera * vec4(bitangent,0)).xyz;
-          gl_Position = modelToProjection * pos;
+          gl_Position = modelToProjection * vec4(pos.xyz * attribute_decode[0].xyz + attribute_decode[1].xyz * pos.w, pos.w);
         }
       );
 
@@ -83,9 +102,19 @@ namespace octet {
       
         uniform mat4 cameraToProjection;
         uniform mat4 modelToCamera[96];
+        uniform vec4 attribute_decode[3];
+
+        vec3 decode_normal(vec3 n) {
+          if (attribute_decode[0].w == 0.0) return n;
+          vec3 v = vec3(n.xy, 1.0 - abs(n.x) - abs(n.y));
+          float t = clamp(-v.z, 0.0, 1.0);
+          v.x += v.x >= 0.0 ? -t : t;
+          v.y += v.y >= 0.0 ? -t : t;
+          return normalize(v);
+        }
       
         void main() {
-          uv_ = uv;
+          uv_ = uv * attribute_decode[2].xy + attribute_decode[2].zw;
           ivec4 index = ivec4(blendindices);
           mat4 m2c0 = modelToCamera[index.x];
           mat4 m2c1 = modelToCamera[index.y];
@@ -93,10 +122,11 @@ namespace octet {
           mat4 m2c3 = modelToCamera[index.w];
           float blend0 = 1.0 - blendweight.x - blendweight.y - blendweight.z;
           mat4 blendedModelToCamera = m2c0 * blend0 + m2c1 * blendweight.x + m2c2 * blendweight.y + m2c3 * blendweight.z;
-          normal_ = normalize((blendedModelToCamera * vec4(normal,0)).xyz);
+          normal_ = normalize((blendedModelToCamera * vec4(decode_normal(normal),0)).xyz);
           tangent_ = normalize((blendedModelToCamera * vec4(tangent,0)).xyz);
           bitangent_ = normalize((blendedModelToCamera * vec4(bitangent,0)).xyz);
-          gl_Position = cameraToProjection * (blendedModelToCamera * pos);
+          vec4 model_pos = vec4(pos.xyz * attribute_decode[0].xyz + attribute_decode[1].xyz * pos.w, pos.w);
+          gl_Position = cameraToProjection * (blendedModelToCamera * model_pos);
         }
       );
 
@@ -177,6 +207,8 @@ namespace octet {
       // we use textures 0-3 for material properties.
       static const GLint samplers[] = { 0, 1, 2, 3, 4, 5 };
       glUniform1iv(samplers_index, 6, samplers);
+
+      set_default_attribute_decode();
     }
 
     void render_skinned(const mat4t &cameraToProjection, const mat4t *modelToCamera, int num_matrices, const vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
@@ -193,6 +225,14 @@ namespace octet {
       // we use textures 0-3 for material properties.
       static const GLint samplers[] = { 0, 1, 2, 3, 4 };
       glUniform1iv(samplers_index, 5, samplers);
+
+      set_default_attribute_decode();
+    }
+
+    // call after render() or render_skinned() to draw a mesh with quantized vertices.
+    // decode is three vec4s, see mesh::get_attribute_decode()
+    void set_attribute_decode(const vec4 *decode) {
+      glUniform4fv(attribute_decode_index, 3, (const float*)decode);
     }
   };
 }